@@ -0,0 +1,75 @@
+/**
+ * @file HeightQueryBenchmarks.cpp
+ * @author Ollie Nicholls
+ * @brief Benchmarks for batches of bilinear height queries, reporting queries
+ * per second
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "HeightQuery.h"
+#include "TestHeightmaps.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    constexpr int k_heightmapSize = 2048;
+
+    Heightmap &heightmap()
+    {
+      static std::unique_ptr<Heightmap> h;
+      if (!h)
+      {
+        h = std::make_unique<Heightmap>(static_cast<ngl::Real>(k_heightmapSize), static_cast<ngl::Real>(k_heightmapSize),
+                                       hills(k_heightmapSize, k_heightmapSize, k_benchmarkHills));
+      }
+      return *h;
+    }
+
+    /**
+     * @brief Query heights at random positions all over the heightmap
+     *
+     * @param _state Arg 0 is the number of positions and arg 1 whether to
+     * work out normals too
+     */
+    void BM_heightQuery(benchmark::State &_state)
+    {
+      size_t count = static_cast<size_t>(_state.range(0));
+      bool normals = _state.range(1) != 0;
+      HeightQuery query(&heightmap());
+
+      std::mt19937 random(1);
+      std::uniform_real_distribution<ngl::Real> coord(0.0f, static_cast<ngl::Real>(k_heightmapSize));
+      std::vector<ngl::Vec2> positions(count);
+      for (auto &p : positions)
+      {
+        p = ngl::Vec2(coord(random), coord(random));
+      }
+      std::vector<ngl::Real> heights(count);
+      std::vector<ngl::Vec3> normalsOut(normals ? count : 0);
+
+      for (auto _ : _state)
+      {
+        query.heights(positions.data(), count, heights.data(), normals ? normalsOut.data() : nullptr);
+        benchmark::DoNotOptimize(heights.data());
+        benchmark::ClobberMemory();
+      }
+
+      _state.SetItemsProcessed(static_cast<int64_t>(_state.iterations()) * static_cast<int64_t>(count));
+    }
+  } // end namespace
+
+  BENCHMARK(BM_heightQuery)
+      ->ArgNames({"count", "normals"})
+      ->ArgsProduct({{1000, 100000, 10000000}, {0, 1}})
+      ->Unit(benchmark::kMicrosecond)
+      ->UseRealTime();
+} // end namespace geoclipmap
@@ -0,0 +1,299 @@
+/**
+ * @file HeightmapBenchmarks.cpp
+ * @author Ollie Nicholls
+ * @brief Benchmarks for filling clipmap level textures from a heightmap in
+ * each memory layout and storage, reporting texels per second and (on Linux) cache and
+ * TLB misses per texel, and for finding the range of heights in a square with
+ * and without the min/max pyramid
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "Heightmap.h"
+#include "TestHeightmaps.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // Big enough that a heightmap doesn't fit in any cache (48MB of colour data)
+    constexpr int k_heightmapSize = 2048;
+    // The width of a clipmap level texture (D with K = 8)
+    constexpr int k_levelSize = 256;
+
+    enum class PerfEvent
+    {
+      // Last level cache misses
+      CacheMisses,
+      // Data TLB read misses
+      TlbMisses
+    };
+
+    /**
+     * @brief A hardware counter read with perf_event_open. Counts nothing if
+     * the counter isn't available (not Linux, or not allowed to profile).
+     *
+     */
+    class PerfCounter
+    {
+    public:
+      explicit PerfCounter(PerfEvent _event) noexcept
+      {
+#ifdef __linux__
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        if (_event == PerfEvent::CacheMisses)
+        {
+          attr.type = PERF_TYPE_HARDWARE;
+          attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        }
+        else
+        {
+          attr.type = PERF_TYPE_HW_CACHE;
+          attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        }
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        m_fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+      }
+
+      ~PerfCounter() noexcept
+      {
+#ifdef __linux__
+        if (m_fd >= 0)
+        {
+          close(m_fd);
+        }
+#endif
+      }
+
+      bool available() const noexcept
+      {
+        return m_fd >= 0;
+      }
+
+      void start() noexcept
+      {
+#ifdef __linux__
+        if (available())
+        {
+          ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+          ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+      }
+
+      uint64_t stop() noexcept
+      {
+        uint64_t count = 0;
+#ifdef __linux__
+        if (available())
+        {
+          ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+          if (read(m_fd, &count, sizeof(count)) != sizeof(count))
+          {
+            count = 0;
+          }
+        }
+#endif
+        return count;
+      }
+
+    private:
+      int m_fd = -1;
+    };
+
+    Heightmap &heightmap(HeightmapLayout _layout, bool _quantised)
+    {
+      // Build the heightmap once per layout and storage, it takes a while
+      static std::vector<std::unique_ptr<Heightmap>> heightmaps(6);
+      auto &h = heightmaps[static_cast<int>(_layout) * 2 + _quantised];
+      if (!h)
+      {
+        h = std::make_unique<Heightmap>(static_cast<ngl::Real>(k_heightmapSize), static_cast<ngl::Real>(k_heightmapSize),
+                                       hills(k_heightmapSize, k_heightmapSize, k_benchmarkHills));
+        h->setLayout(_layout);
+        if (_quantised)
+        {
+          h->quantise();
+        }
+      }
+      return *h;
+    }
+
+    /**
+     * @brief Fill a level texture, moving the window each iteration like a
+     * camera flying diagonally
+     *
+     * @param _state Arg 0 is the layout, arg 1 the level's scale and arg 2 
+     * whether the heights are quantised
+     * @param _byRow Whether to read a row at a time rather than the whole
+     * window at once (as ClipmapLevel::updateTexture does)
+     */
+    void fillLevel(benchmark::State &_state, bool _byRow)
+    {
+      auto layout = static_cast<HeightmapLayout>(_state.range(0));
+      int scale = static_cast<int>(_state.range(1));
+      Heightmap &h = heightmap(layout, _state.range(2) != 0);
+
+      std::vector<ngl::Real> texture(static_cast<size_t>(k_levelSize) * k_levelSize);
+      PerfCounter cacheMisses(PerfEvent::CacheMisses);
+      PerfCounter tlbMisses(PerfEvent::TlbMisses);
+
+      // Keep the window on the heightmap wherever it moves to
+      int range = std::max(1, k_heightmapSize - k_levelSize * scale);
+      int offset = 0;
+      uint64_t cacheMissCount = 0;
+      uint64_t tlbMissCount = 0;
+      for (auto _ : _state)
+      {
+        offset = (offset + 37) % range;
+
+        cacheMisses.start();
+        tlbMisses.start();
+        if (_byRow)
+        {
+          for (int y = 0; y < k_levelSize; y++)
+          {
+            h.readRow(offset, offset + y * scale, scale, k_levelSize, &texture[static_cast<size_t>(y) * k_levelSize]);
+          }
+        }
+        else
+        {
+          h.readWindow(offset, offset, scale, k_levelSize, k_levelSize, texture.data());
+        }
+        cacheMissCount += cacheMisses.stop();
+        tlbMissCount += tlbMisses.stop();
+
+        benchmark::DoNotOptimize(texture.data());
+        benchmark::ClobberMemory();
+      }
+
+      int64_t texels = static_cast<int64_t>(_state.iterations()) * k_levelSize * k_levelSize;
+      _state.SetItemsProcessed(texels);
+      if (cacheMisses.available())
+      {
+        _state.counters["cache_misses/texel"] = static_cast<double>(cacheMissCount) / texels;
+      }
+      if (tlbMisses.available())
+      {
+        _state.counters["dtlb_misses/texel"] = static_cast<double>(tlbMissCount) / texels;
+      }
+    }
+
+    void BM_fillLevel(benchmark::State &_state)
+    {
+      fillLevel(_state, false);
+    }
+
+    void BM_fillLevelByRow(benchmark::State &_state)
+    {
+      fillLevel(_state, true);
+    }
+
+    enum class RangeMethod
+    {
+      // Heightmap::heightBounds, from the pyramid's blocks alone
+      Bounds,
+      // Heightmap::exactHeightRange, reading the samples along the edges
+      Exact,
+      // Reading every sample
+      Scan
+    };
+
+    /**
+     * @brief Find the range of heights in a square, moving it each iteration
+     *
+     * @param _state Arg 0 is the width of the square
+     * @param _method How to find it
+     */
+    void heightRange(benchmark::State &_state, RangeMethod _method)
+    {
+      int size = static_cast<int>(_state.range(0));
+      Heightmap &h = heightmap(HeightmapLayout::RowMajor, false);
+
+      std::vector<ngl::Real> samples(static_cast<size_t>(size) * size);
+      int range = std::max(1, k_heightmapSize - size);
+      int offset = 0;
+      for (auto _ : _state)
+      {
+        // Odd steps so the square is rarely aligned to the pyramid's blocks
+        offset = (offset + 37) % range;
+        HeightRange heights;
+        if (_method == RangeMethod::Bounds)
+        {
+          heights = h.heightBounds(offset, offset, offset + size - 1, offset + size - 1);
+        }
+        else if (_method == RangeMethod::Exact)
+        {
+          heights = h.exactHeightRange(offset, offset, offset + size - 1, offset + size - 1);
+        }
+        else
+        {
+          h.readWindow(offset, offset, 1, size, size, samples.data());
+          auto minMax = std::minmax_element(samples.begin(), samples.end());
+          heights = HeightRange{*minMax.first, *minMax.second};
+        }
+        benchmark::DoNotOptimize(heights);
+      }
+
+      _state.SetItemsProcessed(static_cast<int64_t>(_state.iterations()) * size * size);
+    }
+
+    void BM_heightBounds(benchmark::State &_state)
+    {
+      heightRange(_state, RangeMethod::Bounds);
+    }
+
+    void BM_heightRange(benchmark::State &_state)
+    {
+      heightRange(_state, RangeMethod::Exact);
+    }
+
+    void BM_heightRangeScan(benchmark::State &_state)
+    {
+      heightRange(_state, RangeMethod::Scan);
+    }
+
+    void layoutsAndScales(benchmark::internal::Benchmark *_benchmark)
+    {
+      _benchmark->ArgNames({"layout", "scale", "quantised"});
+      for (int quantised : {0, 1})
+      {
+        for (auto layout : {HeightmapLayout::RowMajor, HeightmapLayout::Tiled, HeightmapLayout::Morton})
+        {
+          for (int scale : {1, 2, 4, 8})
+          {
+            _benchmark->Args({static_cast<int64_t>(layout), scale, quantised});
+          }
+        }
+      }
+    }
+  } // end namespace
+
+  BENCHMARK(BM_fillLevel)->Apply(layoutsAndScales);
+  BENCHMARK(BM_fillLevelByRow)->Apply(layoutsAndScales);
+  BENCHMARK(BM_heightBounds)->ArgName("size")->RangeMultiplier(4)->Range(16, 1024);
+  BENCHMARK(BM_heightRange)->ArgName("size")->RangeMultiplier(4)->Range(16, 1024);
+  BENCHMARK(BM_heightRangeScan)->ArgName("size")->RangeMultiplier(4)->Range(16, 1024);
+} // end namespace geoclipmap
+
+BENCHMARK_MAIN();
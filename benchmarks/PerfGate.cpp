@@ -0,0 +1,395 @@
+/**
+ * @file PerfGate.cpp
+ * @author Ollie Nicholls
+ * @brief Fixed workloads for the clipmap core, timed against a calibration
+ * loop and compared with the baseline committed in perf_baseline.txt, so ctest
+ * fails when a change makes one of them much slower
+ *
+ * Each workload's time is divided by the calibration loop's, timed alongside
+ * it, so the ratio says how the code performs rather than how fast the
+ * machine running it is. The fastest of several runs of each is used as
+ * anything else on the machine only ever makes a run slower.
+ *
+ * Usage: PerfGate <workload|all> [--baseline=<file>] [--tolerance=F]
+ *                 [--repeats=N] [--update]
+ *
+ * The workloads are levelRefill, terrainMoves, footprintBuild and
+ * heightQueries. A workload fails if its ratio is more than (1 + F) times the
+ * baseline's (F is 0.5 by default). --update measures the workloads and
+ * writes their ratios to the baseline file instead of checking them.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ClipmapLevel.h"
+#include "Footprint.h"
+#include "HeightQuery.h"
+#include "Manager.h"
+#include "Terrain.h"
+#include "TestHeightmaps.h"
+
+namespace
+{
+  using namespace geoclipmap;
+
+  // The synthetic heightmap every workload reads, the same hills as the benchmarks use
+  constexpr int k_heightmapSize = 1024;
+  // Somewhere for results to go so the compiler can't throw the work away
+  volatile double g_sink = 0.0;
+
+  Heightmap &heightmap()
+  {
+    static std::unique_ptr<Heightmap> h;
+    if (!h)
+    {
+      h = std::make_unique<Heightmap>(static_cast<ngl::Real>(k_heightmapSize), static_cast<ngl::Real>(k_heightmapSize),
+                                     hills(k_heightmapSize, k_heightmapSize, k_benchmarkHills));
+    }
+    return *h;
+  }
+
+  /**
+   * @brief Set K, L and R for a workload and put them back afterwards
+   *
+   */
+  class ManagerSettings
+  {
+  public:
+    ManagerSettings(int _k, int _l, int _r) noexcept : m_manager{Manager::getInstance()},
+                                                       m_k{m_manager->K()},
+                                                       m_l{m_manager->L()},
+                                                       m_r{m_manager->R()}
+    {
+      m_manager->setK(static_cast<unsigned char>(_k));
+      m_manager->setL(static_cast<unsigned char>(_l));
+      m_manager->setR(static_cast<unsigned char>(_r));
+    }
+
+    ~ManagerSettings() noexcept
+    {
+      m_manager->setK(m_k);
+      m_manager->setL(m_l);
+      m_manager->setR(m_r);
+    }
+
+  private:
+    Manager *m_manager;
+    unsigned char m_k;
+    unsigned char m_l;
+    unsigned char m_r;
+  };
+
+  /**
+   * @brief A mix of integer, floating point and memory work that doesn't
+   * touch the engine, to measure how fast the machine is
+   *
+   */
+  void calibrate()
+  {
+    static std::vector<float> buffer(1 << 20);
+    uint32_t random = 12345;
+    for (float &value : buffer)
+    {
+      random = random * 1664525u + 1013904223u;
+      value = static_cast<float>(random >> 8) / 16777216.0f;
+    }
+    double sum = 0.0;
+    for (int pass = 0; pass < 8; pass++)
+    {
+      // Strided so it isn't just streaming through the cache
+      size_t stride = 1 + static_cast<size_t>(pass) * 257;
+      size_t index = 0;
+      for (size_t i = 0; i < buffer.size(); i++)
+      {
+        index = (index + stride) & (buffer.size() - 1);
+        buffer[index] = buffer[index] * 0.999f + std::sqrt(buffer[i] + 1.0f);
+        sum += buffer[index];
+      }
+    }
+    g_sink = sum;
+  }
+
+  /**
+   * @brief Fill the textures of a fine and a coarse level as they move
+   * diagonally, as every level does when the terrain moves a long way
+   *
+   */
+  void levelRefill()
+  {
+    ManagerSettings settings(8, 8, 4);
+    ClipmapLevel fine(7, &heightmap(), nullptr);
+    ClipmapLevel coarse(4, &heightmap(), nullptr);
+    for (int i = 0; i < 16; i++)
+    {
+      fine.setPosition(ngl::Vec2(), 37 * i, 23 * i, TrimLocation::All);
+      fine.updateTexture();
+      coarse.setPosition(ngl::Vec2(), 3 * i, 5 * i, TrimLocation::All);
+      coarse.updateTexture();
+    }
+    g_sink = fine.heights()[0] + coarse.heights()[0];
+  }
+
+  /**
+   * @brief Move a terrain one sample at a time, drift it diagonally then jump
+   * it about, with the camera low enough for R + 1 levels to be active
+   *
+   */
+  void terrainMoves()
+  {
+    ManagerSettings settings(7, 8, 4);
+    Terrain terrain(&heightmap());
+    terrain.moveTo(k_heightmapSize / 2, k_heightmapSize / 2);
+    terrain.setActiveLevels(0.0f);
+    for (int i = 0; i < 64; i++)
+    {
+      terrain.move(1.0f, 0.0f);
+    }
+    for (int i = 0; i < 64; i++)
+    {
+      terrain.move(-0.75f, 0.5f);
+    }
+    uint32_t random = 54321;
+    for (int i = 0; i < 16; i++)
+    {
+      random = random * 1664525u + 1013904223u;
+      terrain.moveTo(static_cast<int64_t>(random >> 8) % k_heightmapSize, static_cast<int64_t>(random >> 4) % k_heightmapSize);
+    }
+    g_sink = static_cast<double>(terrain.positionX());
+  }
+
+  /**
+   * @brief Generate every type of footprint a terrain uses for each K
+   *
+   */
+  void footprintBuild()
+  {
+    size_t triangles = 0;
+    for (int round = 0; round < 32; round++)
+    {
+      for (int k = 5; k <= 9; k++)
+      {
+        ManagerSettings settings(k, 8, 4);
+        size_t M = Manager::getInstance()->M();
+        Footprint block(M, M);
+        Footprint fixupHorizontal(M, 3);
+        Footprint fixupVertical(3, M);
+        Footprint trimHorizontal((2 * M) + 1, 2);
+        Footprint trimVertical(2, (2 * M) + 1);
+        Footprint ring((4 * M) - 1);
+        triangles += block.triangleCount() + ring.triangleCount();
+      }
+    }
+    g_sink = static_cast<double>(triangles);
+  }
+
+  /**
+   * @brief Query the height and normal at positions all over the heightmap
+   *
+   */
+  void heightQueries()
+  {
+    static std::vector<ngl::Vec2> positions;
+    if (positions.empty())
+    {
+      positions.resize(1 << 18);
+      uint32_t random = 99991;
+      for (auto &position : positions)
+      {
+        random = random * 1664525u + 1013904223u;
+        ngl::Real x = static_cast<ngl::Real>(random >> 8) / 16777216.0f;
+        random = random * 1664525u + 1013904223u;
+        ngl::Real y = static_cast<ngl::Real>(random >> 8) / 16777216.0f;
+        position = ngl::Vec2(x * (k_heightmapSize - 1), y * (k_heightmapSize - 1));
+      }
+    }
+    std::vector<ngl::Real> heights(positions.size());
+    std::vector<ngl::Vec3> normals(positions.size());
+    HeightQuery query(&heightmap());
+    query.heights(positions.data(), positions.size(), heights.data(), normals.data());
+    g_sink = heights[0] + normals[0].m_y;
+  }
+
+  struct Workload
+  {
+    const char *name;
+    void (*run)();
+  };
+
+  const Workload k_workloads[] = {{"levelRefill", levelRefill},
+                                  {"terrainMoves", terrainMoves},
+                                  {"footprintBuild", footprintBuild},
+                                  {"heightQueries", heightQueries}};
+
+  /**
+   * @brief Time a function
+   *
+   * @return double The time it took in seconds
+   */
+  double timeOf(void (*_function)())
+  {
+    auto start = std::chrono::steady_clock::now();
+    _function();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  /**
+   * @brief Get a workload's time as a multiple of the calibration loop's,
+   * taking the fastest of each over several runs that alternate between the
+   * two so both see the machine in the same state
+   *
+   */
+  double measure(const Workload &_workload, int _repeats)
+  {
+    // Once each first so the heightmap is built and the caches are warm
+    calibrate();
+    _workload.run();
+    double calibration = 1e30;
+    double workload = 1e30;
+    for (int i = 0; i < _repeats; i++)
+    {
+      calibration = std::min(calibration, timeOf(calibrate));
+      workload = std::min(workload, timeOf(_workload.run));
+    }
+    return workload / calibration;
+  }
+
+  /**
+   * @brief Read the baseline, one "<workload> <ratio>" per line with # for
+   * comments
+   *
+   */
+  std::map<std::string, double> readBaseline(const std::string &_path)
+  {
+    std::map<std::string, double> baseline;
+    std::ifstream file(_path);
+    std::string line;
+    while (std::getline(file, line))
+    {
+      if (line.empty() || line[0] == '#')
+      {
+        continue;
+      }
+      std::istringstream fields(line);
+      std::string name;
+      double ratio = 0.0;
+      if (fields >> name >> ratio)
+      {
+        baseline[name] = ratio;
+      }
+    }
+    return baseline;
+  }
+
+  bool writeBaseline(const std::string &_path, const std::map<std::string, double> &_baseline)
+  {
+    std::ofstream file(_path, std::ios::trunc);
+    file << "# Each workload's time as a multiple of the calibration loop's, from a release build.\n"
+         << "# Regenerate with: PerfGate all --update --baseline=<this file>\n";
+    for (const auto &entry : _baseline)
+    {
+      char ratio[32];
+      std::snprintf(ratio, sizeof(ratio), "%.4f", entry.second);
+      file << entry.first << ' ' << ratio << '\n';
+    }
+    return static_cast<bool>(file);
+  }
+} // end namespace
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    std::fprintf(stderr, "Usage: PerfGate <workload|all> [--baseline=<file>] [--tolerance=F] [--repeats=N] [--update]\n");
+    return EXIT_FAILURE;
+  }
+
+  std::string which = argv[1];
+  std::string baselinePath = "benchmarks/perf_baseline.txt";
+  double tolerance = 0.5;
+  int repeats = 5;
+  bool update = false;
+  for (int i = 2; i < argc; i++)
+  {
+    std::string option(argv[i]);
+    if (option.compare(0, 11, "--baseline=") == 0)
+    {
+      baselinePath = option.substr(11);
+    }
+    else if (option.compare(0, 12, "--tolerance=") == 0)
+    {
+      tolerance = std::max(std::atof(option.c_str() + 12), 0.0);
+    }
+    else if (option.compare(0, 10, "--repeats=") == 0)
+    {
+      repeats = std::max(std::atoi(option.c_str() + 10), 1);
+    }
+    else if (option == "--update")
+    {
+      update = true;
+    }
+    else
+    {
+      std::fprintf(stderr, "Unknown option %s\n", option.c_str());
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::vector<const Workload *> workloads;
+  for (const Workload &workload : k_workloads)
+  {
+    if (which == "all" || which == workload.name)
+    {
+      workloads.push_back(&workload);
+    }
+  }
+  if (workloads.empty())
+  {
+    std::fprintf(stderr, "Unknown workload %s\n", which.c_str());
+    return EXIT_FAILURE;
+  }
+
+  std::map<std::string, double> baseline = readBaseline(baselinePath);
+  bool passed = true;
+  for (const Workload *workload : workloads)
+  {
+    double ratio = measure(*workload, repeats);
+    if (update)
+    {
+      std::printf("%s: %.4f x calibration\n", workload->name, ratio);
+      baseline[workload->name] = ratio;
+      continue;
+    }
+
+    auto expected = baseline.find(workload->name);
+    if (expected == baseline.end() || expected->second <= 0.0)
+    {
+      std::printf("%s: %.4f x calibration, no baseline in %s (add one with --update)\n", workload->name, ratio, baselinePath.c_str());
+      passed = false;
+      continue;
+    }
+    double change = ratio / expected->second - 1.0;
+    bool slower = change > tolerance;
+    std::printf("%s: %.4f x calibration, baseline %.4f (%+.1f%%, at most %+.1f%% allowed)%s\n",
+                workload->name, ratio, expected->second, change * 100.0, tolerance * 100.0, slower ? " - TOO SLOW" : "");
+    passed = passed && !slower;
+  }
+
+  if (update && !writeBaseline(baselinePath, baseline))
+  {
+    std::fprintf(stderr, "Couldn't write %s\n", baselinePath.c_str());
+    return EXIT_FAILURE;
+  }
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file RayCasterBenchmarks.cpp
+ * @author Ollie Nicholls
+ * @brief Benchmarks for casting single rays and batches of rays at a
+ * heightmap, reporting rays per second
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <cmath>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "RayCaster.h"
+#include "TestHeightmaps.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    Heightmap &heightmap(int _size)
+    {
+      // Build each size once, the large ones take a while
+      static std::map<int, std::unique_ptr<Heightmap>> heightmaps;
+      auto &h = heightmaps[_size];
+      if (!h)
+      {
+        h = std::make_unique<Heightmap>(static_cast<ngl::Real>(_size), static_cast<ngl::Real>(_size),
+                                       hills(_size, _size, {1.0f, 0.5f, 0.01f, 0.013f, 0.05f, 0.3f, 0.2f}));
+        h->quantise();
+      }
+      return *h;
+    }
+
+    /**
+     * @brief Rays from just above the middle of the heightmap looking out in
+     * every direction
+     *
+     * @param _size The width of the heightmap
+     * @param _count The number of rays
+     * @param _slope How steeply the rays look down (height per sample)
+     */
+    void makeRays(int _size, size_t _count, ngl::Real _slope, std::vector<ngl::Vec3> &o_origins, std::vector<ngl::Vec3> &o_directions)
+    {
+      std::mt19937 random(1);
+      std::uniform_real_distribution<ngl::Real> angle(0.0f, 6.2831853f);
+      std::uniform_real_distribution<ngl::Real> offset(-0.25f, 0.25f);
+      for (size_t i = 0; i < _count; i++)
+      {
+        ngl::Real a = angle(random);
+        o_origins.push_back(ngl::Vec3(_size * (0.5f + offset(random)), _size * (0.5f + offset(random)), 2.0f));
+        o_directions.push_back(ngl::Vec3(std::cos(a), std::sin(a), -_slope));
+      }
+    }
+
+    /**
+     * @brief Cast one ray at a time, the latency of picking
+     *
+     * @param _state Arg 0 is the width of the heightmap and arg 1 the slope of
+     * the rays in thousandths
+     */
+    void BM_rayCast(benchmark::State &_state)
+    {
+      int size = static_cast<int>(_state.range(0));
+      RayCaster caster(&heightmap(size));
+      std::vector<ngl::Vec3> origins;
+      std::vector<ngl::Vec3> directions;
+      makeRays(size, 1024, static_cast<ngl::Real>(_state.range(1)) / 1000.0f, origins, directions);
+
+      size_t i = 0;
+      size_t hits = 0;
+      for (auto _ : _state)
+      {
+        RayHit hit = caster.cast(origins[i], directions[i]);
+        hits += hit.hit;
+        benchmark::DoNotOptimize(hit);
+        i = (i + 1) % origins.size();
+      }
+
+      _state.SetItemsProcessed(static_cast<int64_t>(_state.iterations()));
+      _state.counters["hit_rate"] = static_cast<double>(hits) / static_cast<double>(_state.iterations());
+    }
+
+    /**
+     * @brief Cast a batch of rays
+     *
+     * @param _state Arg 0 is the width of the heightmap and arg 1 the number
+     * of rays
+     */
+    void BM_rayCastBatch(benchmark::State &_state)
+    {
+      int size = static_cast<int>(_state.range(0));
+      size_t count = static_cast<size_t>(_state.range(1));
+      RayCaster caster(&heightmap(size));
+      std::vector<ngl::Vec3> origins;
+      std::vector<ngl::Vec3> directions;
+      makeRays(size, count, 0.01f, origins, directions);
+      std::vector<RayHit> hits(count);
+
+      for (auto _ : _state)
+      {
+        caster.castBatch(origins.data(), directions.data(), count, hits.data());
+        benchmark::DoNotOptimize(hits.data());
+      }
+
+      _state.SetItemsProcessed(static_cast<int64_t>(_state.iterations()) * static_cast<int64_t>(count));
+    }
+  } // end namespace
+
+  // Steep rays are like picking from above, shallow ones like looking at the horizon and have to cross far more blocks
+  BENCHMARK(BM_rayCast)->ArgNames({"size", "slope"})->ArgsProduct({{1024, 4096}, {1, 10, 500}});
+  BENCHMARK(BM_rayCastBatch)->ArgNames({"size", "rays"})->Args({4096, 10000})->UseRealTime();
+} // end namespace geoclipmap
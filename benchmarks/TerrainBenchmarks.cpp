@@ -0,0 +1,319 @@
+/**
+ * @file TerrainBenchmarks.cpp
+ * @author Ollie Nicholls
+ * @brief Benchmarks for the clipmap core without a window or GL context:
+ * moving a terrain (sweeping K, L and R, the heightmap and how the camera
+ * moves), filling a single level's texture and generating the footprints.
+ * Moves report texels per second and the median and 99th percentile time of
+ * a move.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <OpenImageIO/imageio.h>
+
+#include "Footprint.h"
+#include "Manager.h"
+#include "Terrain.h"
+#include "TestHeightmaps.h"
+
+#ifndef GEOCLIPMAP_TEST_IMAGES
+#define GEOCLIPMAP_TEST_IMAGES "img/tests"
+#endif
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // The same size as the other benchmarks' heightmaps
+    constexpr int k_syntheticSize = 2048;
+    // The heightmaps in img/tests, after the synthetic one (heightmap 0)
+    const char *const k_images[] = {"ben_nevis.png", "cheddar.png", "grand_canyon.png", "poole_harbour.png"};
+    constexpr int k_heightmaps = 1 + sizeof(k_images) / sizeof(k_images[0]);
+    // How far steps and drifts go before turning back
+    constexpr int k_turnAfter = 256;
+
+    enum class Movement
+    {
+      // One sample across each move, like holding an arrow key
+      Step,
+      // A fraction of a sample diagonally each move, like the camera gliding
+      Drift,
+      // Somewhere else on the heightmap each move, so every level is read afresh
+      Teleport
+    };
+
+    /**
+     * @brief Get a heightmap, built or loaded once
+     *
+     * @param _index 0 for a synthetic heightmap or 1 onwards for the images
+     * in img/tests
+     * @return Heightmap* The heightmap, or nullptr if the image couldn't be
+     * loaded
+     */
+    Heightmap *heightmap(int _index)
+    {
+      static std::vector<std::unique_ptr<Heightmap>> heightmaps(k_heightmaps);
+      auto &h = heightmaps[_index];
+      if (h)
+      {
+        return h.get();
+      }
+
+      if (_index == 0)
+      {
+        h = std::make_unique<Heightmap>(static_cast<ngl::Real>(k_syntheticSize), static_cast<ngl::Real>(k_syntheticSize),
+                                       hills(k_syntheticSize, k_syntheticSize, k_benchmarkHills));
+        return h.get();
+      }
+
+      // Colours are read the same way the demo reads them with Qt, top row first
+      std::string path = std::string(GEOCLIPMAP_TEST_IMAGES) + "/" + k_images[_index - 1];
+      auto input = OIIO::ImageInput::open(path);
+      if (!input)
+      {
+        return nullptr;
+      }
+      const OIIO::ImageSpec &spec = input->spec();
+      int channels = spec.nchannels;
+      std::vector<float> pixels(static_cast<size_t>(spec.width) * spec.height * channels);
+      bool read = input->read_image(0, 0, 0, channels, OIIO::TypeDesc::FLOAT, pixels.data());
+      input->close();
+      if (!read)
+      {
+        return nullptr;
+      }
+
+      std::vector<ngl::Vec3> data(static_cast<size_t>(spec.width) * spec.height);
+      for (size_t i = 0; i < data.size(); i++)
+      {
+        const float *pixel = &pixels[i * channels];
+        data[i] = channels >= 3 ? ngl::Vec3(pixel[0], pixel[1], pixel[2]) : ngl::Vec3(pixel[0]);
+      }
+      h = std::make_unique<Heightmap>(static_cast<ngl::Real>(spec.width), static_cast<ngl::Real>(spec.height), data);
+      return h.get();
+    }
+
+    /**
+     * @brief Set K, L and R for a benchmark and put them back afterwards, as
+     * the Manager is shared by every benchmark
+     *
+     */
+    class ManagerSettings
+    {
+    public:
+      ManagerSettings(int _k, int _l, int _r) noexcept : m_manager{Manager::getInstance()},
+                                                         m_k{m_manager->K()},
+                                                         m_l{m_manager->L()},
+                                                         m_r{m_manager->R()}
+      {
+        m_manager->setK(static_cast<unsigned char>(_k));
+        m_manager->setL(static_cast<unsigned char>(_l));
+        m_manager->setR(static_cast<unsigned char>(_r));
+      }
+
+      ~ManagerSettings() noexcept
+      {
+        m_manager->setK(m_k);
+        m_manager->setL(m_l);
+        m_manager->setR(m_r);
+      }
+
+    private:
+      Manager *m_manager;
+      unsigned char m_k;
+      unsigned char m_l;
+      unsigned char m_r;
+    };
+
+    /**
+     * @brief Get the _percentile (0-1) of some times in microseconds
+     *
+     */
+    double percentile(std::vector<double> &_times, double _percentile)
+    {
+      if (_times.empty())
+      {
+        return 0.0;
+      }
+      size_t n = std::min(_times.size() - 1, static_cast<size_t>(_percentile * _times.size()));
+      std::nth_element(_times.begin(), _times.begin() + n, _times.end());
+      return _times[n];
+    }
+
+    /**
+     * @brief Move a terrain each iteration, with the camera low enough for
+     * R + 1 levels to be active
+     *
+     * @param _state Args are K, L, R, the heightmap (see heightmap) and the
+     * movement
+     */
+    void BM_terrainMove(benchmark::State &_state)
+    {
+      ManagerSettings settings(static_cast<int>(_state.range(0)), static_cast<int>(_state.range(1)), static_cast<int>(_state.range(2)));
+      Heightmap *h = heightmap(static_cast<int>(_state.range(3)));
+      if (!h)
+      {
+        _state.SkipWithError("Couldn't load the heightmap from img/tests");
+        return;
+      }
+      auto movement = static_cast<Movement>(_state.range(4));
+
+      int64_t width = static_cast<int64_t>(h->width());
+      int64_t depth = static_cast<int64_t>(h->depth());
+      Terrain terrain(h);
+      terrain.moveTo(width / 2, depth / 2);
+      terrain.setActiveLevels(0.0f);
+      unsigned char finest, coarsest;
+      terrain.levelsForHeight(0.0f, finest, coarsest);
+      size_t D = Manager::getInstance()->D();
+      int64_t texelsPerMove = static_cast<int64_t>(D * D) * (finest - coarsest + 1);
+
+      std::vector<double> latencies;
+      uint32_t random = 12345;
+      int64_t moves = 0;
+      for (auto _ : _state)
+      {
+        // Turn back every so often so steps and drifts stay over the heightmap
+        ngl::Real direction = (moves / k_turnAfter) % 2 == 0 ? 1.0f : -1.0f;
+        auto start = std::chrono::steady_clock::now();
+        switch (movement)
+        {
+        case Movement::Step:
+          terrain.move(direction, 0.0f);
+          break;
+        case Movement::Drift:
+          terrain.move(0.75f * direction, 0.5f * direction);
+          break;
+        case Movement::Teleport:
+          random = random * 1664525u + 1013904223u;
+          terrain.moveTo(static_cast<int64_t>(random >> 8) % width, static_cast<int64_t>(random >> 4) % depth);
+          break;
+        }
+        latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        moves++;
+        benchmark::ClobberMemory();
+      }
+
+      _state.SetItemsProcessed(moves * texelsPerMove);
+      _state.counters["levels"] = finest - coarsest + 1;
+      _state.counters["p50_us"] = percentile(latencies, 0.5);
+      _state.counters["p99_us"] = percentile(latencies, 0.99);
+    }
+
+    /**
+     * @brief Fill one level's texture each iteration, moving it diagonally
+     *
+     * @param _state Args are K, the level's scale and the heightmap
+     */
+    void BM_updateTexture(benchmark::State &_state)
+    {
+      int scale = static_cast<int>(_state.range(1));
+      ManagerSettings settings(static_cast<int>(_state.range(0)), 8, 4);
+      Heightmap *h = heightmap(static_cast<int>(_state.range(2)));
+      if (!h)
+      {
+        _state.SkipWithError("Couldn't load the heightmap from img/tests");
+        return;
+      }
+
+      // The finest level (L - 1) has a scale of 1 and each coarser one twice the last
+      int index = 7;
+      while ((1 << (7 - index)) < scale && index > 0)
+      {
+        index--;
+      }
+      ClipmapLevel level(index, h, nullptr);
+      size_t D = Manager::getInstance()->D();
+      int64_t range = std::max<int64_t>(1, static_cast<int64_t>(h->width()) / scale - static_cast<int64_t>(D));
+      int64_t origin = 0;
+      for (auto _ : _state)
+      {
+        origin = (origin + 37) % range;
+        level.setPosition(ngl::Vec2(), origin, origin, TrimLocation::All);
+        level.updateTexture();
+        benchmark::DoNotOptimize(level.heights().data());
+      }
+      _state.SetItemsProcessed(static_cast<int64_t>(_state.iterations()) * static_cast<int64_t>(D * D));
+    }
+
+    /**
+     * @brief Generate every type of footprint a terrain uses, as Terrain does
+     *
+     * @param _state Arg 0 is K
+     */
+    void BM_generateFootprints(benchmark::State &_state)
+    {
+      ManagerSettings settings(static_cast<int>(_state.range(0)), Manager::getInstance()->L(), Manager::getInstance()->R());
+      size_t M = Manager::getInstance()->M();
+      for (auto _ : _state)
+      {
+        Footprint block(M, M);
+        Footprint fixupHorizontal(M, 3);
+        Footprint fixupVertical(3, M);
+        Footprint trimHorizontal((2 * M) + 1, 2);
+        Footprint trimVertical(2, (2 * M) + 1);
+        Footprint ring((4 * M) - 1);
+        benchmark::DoNotOptimize(&ring);
+      }
+    }
+
+    void terrainSweep(benchmark::internal::Benchmark *_benchmark)
+    {
+      _benchmark->ArgNames({"K", "L", "R", "heightmap", "movement"});
+      auto step = static_cast<int64_t>(Movement::Step);
+      // Each of K, L and R on its own from the demo's defaults (8, 8, 4)
+      for (int k : {5, 6, 7, 8})
+      {
+        _benchmark->Args({k, 8, 4, 0, step});
+      }
+      for (int l : {4, 6, 10})
+      {
+        _benchmark->Args({8, l, 4, 0, step});
+      }
+      for (int r : {1, 2, 7})
+      {
+        _benchmark->Args({8, 8, r, 0, step});
+      }
+      // Then every heightmap with every movement
+      for (int heightmap = 0; heightmap < k_heightmaps; heightmap++)
+      {
+        for (auto movement : {Movement::Step, Movement::Drift, Movement::Teleport})
+        {
+          if (heightmap != 0 || movement != Movement::Step)
+          {
+            _benchmark->Args({8, 8, 4, heightmap, static_cast<int64_t>(movement)});
+          }
+        }
+      }
+    }
+
+    void levelSweep(benchmark::internal::Benchmark *_benchmark)
+    {
+      _benchmark->ArgNames({"K", "scale", "heightmap"});
+      for (int k : {6, 8})
+      {
+        for (int scale : {1, 4, 16, 64})
+        {
+          for (int heightmap : {0, 1})
+          {
+            _benchmark->Args({k, scale, heightmap});
+          }
+        }
+      }
+    }
+  } // end namespace
+
+  BENCHMARK(BM_terrainMove)->Apply(terrainSweep)->Unit(benchmark::kMicrosecond);
+  BENCHMARK(BM_updateTexture)->Apply(levelSweep)->Unit(benchmark::kMicrosecond);
+  BENCHMARK(BM_generateFootprints)->ArgName("K")->DenseRange(5, 9)->Unit(benchmark::kMicrosecond);
+} // end namespace geoclipmap
@@ -0,0 +1,133 @@
+/**
+ * @file TileReaderBenchmarks.cpp
+ * @author Ollie Nicholls
+ * @brief Benchmarks for reading batches of random tiles from a large file
+ * with each backend, with and without O_DIRECT
+ *
+ * The file is 2GB by default (set GEOCLIPMAP_TILE_FILE_GB to change it) so
+ * that, with O_DIRECT at least, reads go to the disk rather than the page
+ * cache. It is written to the temp directory the first time it's needed and
+ * removed at exit.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "TileReader.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // Compressed 64x64 tiles are mostly a few KB
+    constexpr size_t k_minTileSize = 1024;
+    constexpr size_t k_maxTileSize = 6144;
+
+    /**
+     * @brief The large file the tiles are read from
+     *
+     */
+    struct TileFile
+    {
+      std::string path;
+      uint64_t size = 0;
+
+      TileFile()
+      {
+        const char *gigabytes = std::getenv("GEOCLIPMAP_TILE_FILE_GB");
+        size = static_cast<uint64_t>((gigabytes ? std::max(std::atof(gigabytes), 0.01) : 2.0) * static_cast<double>(1ull << 30));
+        path = (std::filesystem::temp_directory_path() / "geoclipmap_tile_reader_benchmark.bin").string();
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        std::vector<char> chunk(1 << 20);
+        std::mt19937 random(3);
+        for (uint64_t written = 0; written < size; written += chunk.size())
+        {
+          for (auto &byte : chunk)
+          {
+            byte = static_cast<char>(random());
+          }
+          file.write(chunk.data(), static_cast<std::streamsize>(std::min<uint64_t>(chunk.size(), size - written)));
+        }
+      }
+
+      ~TileFile()
+      {
+        std::error_code error;
+        std::filesystem::remove(path, error);
+      }
+    };
+
+    const TileFile &tileFile()
+    {
+      static TileFile file;
+      return file;
+    }
+
+    /**
+     * @brief Read batches of random tiles from across the file
+     *
+     * @param _state Arg 0 is the backend (0 pread, 1 io_uring), arg 1 whether
+     * to use O_DIRECT and arg 2 the number of tiles per batch
+     */
+    void BM_readTiles(benchmark::State &_state)
+    {
+      const TileFile &file = tileFile();
+      auto backend = _state.range(0) == 0 ? TileReaderBackend::Pread : TileReaderBackend::IoUring;
+      auto reader = TileReader::open(file.path, backend, _state.range(1) != 0);
+      if (!reader || reader->backend() != backend || reader->directIO() != (_state.range(1) != 0))
+      {
+        _state.SkipWithError("backend or O_DIRECT not supported here");
+        return;
+      }
+
+      size_t batchSize = static_cast<size_t>(_state.range(2));
+      std::mt19937_64 random(11);
+      std::vector<TileRead> reads(batchSize);
+      // How long after the batch started each tile arrived, which is how long a decode waiting on it would stall
+      std::vector<double> latencies;
+      std::vector<double> arrived(batchSize);
+
+      for (auto _ : _state)
+      {
+        _state.PauseTiming();
+        for (auto &read : reads)
+        {
+          read.size = k_minTileSize + random() % (k_maxTileSize - k_minTileSize);
+          read.offset = random() % (file.size - read.size);
+        }
+        _state.ResumeTiming();
+
+        auto start = std::chrono::steady_clock::now();
+        reader->readBatch(reads, [&](size_t _i, const uint8_t *_data, size_t) {
+          arrived[_i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+          benchmark::DoNotOptimize(_data);
+        });
+
+        _state.PauseTiming();
+        latencies.insert(latencies.end(), arrived.begin(), arrived.end());
+        _state.ResumeTiming();
+      }
+
+      std::sort(latencies.begin(), latencies.end());
+      auto percentile = [&](double _p) {
+        return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, static_cast<size_t>(_p * latencies.size()))];
+      };
+      _state.SetItemsProcessed(static_cast<int64_t>(_state.iterations() * batchSize));
+      _state.counters["p50_us"] = percentile(0.5) * 1e6;
+      _state.counters["p99_us"] = percentile(0.99) * 1e6;
+    }
+  } // end namespace
+
+  BENCHMARK(BM_readTiles)->ArgNames({"uring", "direct", "batch"})->ArgsProduct({{0, 1}, {0, 1}, {64, 512}})->Unit(benchmark::kMillisecond)->UseRealTime();
+} // end namespace geoclipmap
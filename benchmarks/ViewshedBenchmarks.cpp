@@ -0,0 +1,63 @@
+/**
+ * @file ViewshedBenchmarks.cpp
+ * @author Ollie Nicholls
+ * @brief Benchmarks for finding everything that can be seen from an observer
+ * at different heightmap sizes and observer heights
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <cmath>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "TestHeightmaps.h"
+#include "Viewshed.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    Heightmap &heightmap(int _size)
+    {
+      // Build each size once, the large ones take a while
+      static std::map<int, std::unique_ptr<Heightmap>> heightmaps;
+      auto &h = heightmaps[_size];
+      if (!h)
+      {
+        h = std::make_unique<Heightmap>(static_cast<ngl::Real>(_size), static_cast<ngl::Real>(_size),
+                                       hills(_size, _size, {1.0f, 0.5f, 0.01f, 0.013f, 0.05f, 0.3f, 0.2f}));
+        h->quantise();
+      }
+      return *h;
+    }
+
+    /**
+     * @brief Find the whole viewshed from an observer in the middle of the
+     * heightmap
+     *
+     * @param _state Arg 0 is the width of the heightmap and arg 1 the height of
+     * the observer's eye above the ground in thousandths
+     */
+    void BM_viewshed(benchmark::State &_state)
+    {
+      int size = static_cast<int>(_state.range(0));
+      Viewshed viewshed(&heightmap(size));
+      ngl::Real observerHeight = static_cast<ngl::Real>(_state.range(1)) / 1000.0f;
+
+      for (auto _ : _state)
+      {
+        viewshed.compute(size / 2, size / 2, observerHeight);
+        benchmark::ClobberMemory();
+      }
+
+      _state.SetItemsProcessed(static_cast<int64_t>(_state.iterations()) * size * size);
+      _state.counters["visible"] = static_cast<double>(viewshed.visibleCount()) / (static_cast<double>(size) * size);
+    }
+  } // end namespace
+
+  BENCHMARK(BM_viewshed)->ArgNames({"size", "eye"})->ArgsProduct({{1024, 4096}, {10, 200}})->Unit(benchmark::kMillisecond)->UseRealTime();
+} // end namespace geoclipmap
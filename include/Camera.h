@@ -15,6 +15,22 @@
 
 namespace geoclipmap
 {
+  /**
+   * @brief Everything that places a camera, e.g. to record it and put it back
+   * exactly (its up vector and speeds never change)
+   *
+   */
+  struct CameraState
+  {
+    // The location of the camera
+    ngl::Vec3 eye;
+    // The location of what the camera is looking at
+    ngl::Vec3 look;
+    // The yaw and pitch the camera has orbited by
+    ngl::Real yaw = 0.0f;
+    ngl::Real pitch = 0.0f;
+  };
+
   class Camera
   {
   public:
@@ -70,6 +86,18 @@ namespace geoclipmap
      * @return ngl::Vec2 The x, y position of the camera
      */
     ngl::Vec2 position() noexcept;
+    /**
+     * @brief Get where the camera is and how it has been rotated
+     * 
+     * @return CameraState 
+     */
+    CameraState state() const noexcept;
+    /**
+     * @brief Put the camera back to a state it was in before
+     * 
+     * @param _state The state, from state
+     */
+    void setState(const CameraState &_state) noexcept;
 
   private:
     /**
@@ -114,6 +142,7 @@ namespace geoclipmap
     FRIEND_TEST(CameraTest, pedestal_camera);
     FRIEND_TEST(CameraTest, orbit_camera);
     FRIEND_TEST(CameraTest, dolly_camera);
+    FRIEND_TEST(CameraTest, camera_state);
 #endif
   };
 } // end namespace geoclipmap
@@ -0,0 +1,120 @@
+/**
+ * @file CameraPath.h
+ * @author Ollie Nicholls
+ * @brief A recording of how the demo was viewed, one frame at a time: where
+ * the camera was, where the terrain had been moved to, whether it was
+ * following the camera and the clipmap settings. Playing it back shows exactly the same frames without anyone at
+ * the keyboard, so runs can be timed against each other.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef CAMERA_PATH_H_
+#define CAMERA_PATH_H_
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Camera.h"
+
+namespace geoclipmap
+{
+  /**
+   * @brief Everything that decides what a frame of the demo shows
+   *
+   */
+  struct CameraPathFrame
+  {
+    // Where the camera was
+    CameraState camera;
+    // Where the terrain had been moved to (see Terrain::moveTo)
+    int64_t terrainX = 0;
+    int64_t terrainY = 0;
+    // Whether the terrain was centred under the camera (see NGLScene::setFollowCamera)
+    bool followCamera = false;
+    // The clipmap settings (see Manager)
+    unsigned char K = 0;
+    unsigned char L = 0;
+    unsigned char R = 0;
+  };
+
+  class CameraPath
+  {
+  public:
+    /**
+     * @brief Read a path written by CameraPathWriter
+     *
+     * @param _path The file
+     * @return std::unique_ptr<CameraPath> The path, or nullptr if the file
+     * couldn't be read, isn't a camera path or has no frames
+     */
+    static std::unique_ptr<CameraPath> open(const std::string &_path) noexcept;
+    /**
+     * @brief Get the number of frames recorded
+     *
+     * @return size_t
+     */
+    size_t frameCount() const noexcept;
+    /**
+     * @brief Get a frame
+     *
+     * @param _frame The frame, wrapping around after the last so a short
+     * path can be played for as long as needed
+     * @return const CameraPathFrame&
+     */
+    const CameraPathFrame &frame(size_t _frame) const noexcept;
+
+  private:
+    // The recorded frames in order
+    std::vector<CameraPathFrame> m_frames;
+
+    /**
+     * @brief Construct a new CameraPath object (see open)
+     *
+     */
+    CameraPath() noexcept = default;
+  };
+
+  class CameraPathWriter
+  {
+  public:
+    /**
+     * @brief Start recording a path
+     *
+     * @param _path The file to write (replaced if it exists)
+     * @return std::unique_ptr<CameraPathWriter> The writer, or nullptr if the
+     * file couldn't be created
+     */
+    static std::unique_ptr<CameraPathWriter> create(const std::string &_path) noexcept;
+    /**
+     * @brief Add the next frame. Each frame is flushed as it is written, so
+     * the recording is whole however the demo is closed.
+     *
+     * @param _frame The frame
+     * @return true If it was written
+     */
+    bool addFrame(const CameraPathFrame &_frame) noexcept;
+    /**
+     * @brief Get the number of frames written
+     *
+     * @return size_t
+     */
+    size_t framesWritten() const noexcept;
+
+  private:
+    // The file being written
+    std::ofstream m_file;
+    // The number of frames written
+    size_t m_framesWritten = 0;
+
+    /**
+     * @brief Construct a new CameraPathWriter object (see create)
+     *
+     */
+    CameraPathWriter() noexcept = default;
+  };
+} // end namespace geoclipmap
+#endif // !CAMERA_PATH_H_
@@ -9,10 +9,14 @@
 #ifndef CLIPMAP_LEVEL_H_
 #define CLIPMAP_LEVEL_H_
 
+#include <cstdint>
+#include <functional>
+
 #include <ngl/Vec2.h>
 #include <ngl/Vec3.h>
 
 #include "Heightmap.h"
+#include "MemoryTracker.h"
 
 namespace geoclipmap
 {
@@ -25,6 +29,22 @@ namespace geoclipmap
     BottomLeft,
     BottomRight
   };
+  // Reads a row of overlay values (e.g. a visibility mask) to show on the terrain, with the same arguments as
+  // Heightmap::readRow
+  using OverlayReader = std::function<void(int64_t _x, int64_t _y, int _stride, int _count, ngl::Real *_out)>;
+  // The frame a texel was regenerated on is kept modulo this, the most a float counts to exactly
+  constexpr size_t k_regeneratedFrameWrap = size_t{1} << 24;
+  // The part of a level's texture to upload to its buffer, texels [begin, end)
+  struct TextureUpload
+  {
+    size_t begin = 0;
+    size_t end = 0;
+    // Whether the buffer has to be (re)allocated at the texture's size, in which case it is all uploaded
+    bool allocate = false;
+
+    size_t bytes() const noexcept { return (end - begin) * sizeof(ngl::Vec3); }
+  };
+
   class ClipmapLevel
   {
 
@@ -41,20 +61,77 @@ namespace geoclipmap
                  Heightmap *_heightmap,
                  ClipmapLevel *_parent,
                  TrimLocation _trimLocation = TrimLocation::TopRight) noexcept;
+    /**
+     * @brief Destroy the ClipmapLevel object, deleting the texture and its
+     * buffer (so a GL context must be current if they were created)
+     * 
+     */
+    ~ClipmapLevel() noexcept;
     /**
      * @brief Set the position of the clipmap and get the height data
      * 
-     * @param _position 
+     * @param _worldPosition The position of the clipmap relative to the
+     * camera in units of this level's samples
+     * @param _originX The X coord of the first sample of this level's texture
+     * in units of this level's samples (heightmap X / scale)
+     * @param _originY The Y coord of the first sample of this level's texture
+     * in units of this level's samples (heightmap Y / scale)
+     * @param _trimLocation Where the trims are on this clipmap
+     * @param _subTexelOffset How far the camera is past the origin's sample,
+     * [0, 1) in units of this level's samples, which the shader moves the
+     * level back by so it slides smoothly between samples
      */
     void setPosition(ngl::Vec2 _worldPosition,
-                     ngl::Vec2 _heightmapPosition,
-                     TrimLocation _trimLocation) noexcept;
+                     int64_t _originX,
+                     int64_t _originY,
+                     TrimLocation _trimLocation,
+                     ngl::Vec2 _subTexelOffset = ngl::Vec2()) noexcept;
+    /**
+     * @brief Resize the texture and work out the scale again after K or L
+     * have changed in the Manager, keeping the buffer to be resized the
+     * next time it is bound. The texture is stale until it is updated.
+     * 
+     */
+    void reconfigure() noexcept;
     /**
      * @brief Update the texture for this clipmap. Usually called after new 
      * position has been set
      * 
      */
     void updateTexture() noexcept;
+    /**
+     * @brief Get whether the texture needs updating, i.e. it has never been
+     * filled, the origin has moved or the overlay has changed since it was
+     * last updated, or it was marked stale
+     * 
+     * @return true If updateTexture should be called before the level is drawn
+     */
+    bool stale() const noexcept;
+    /**
+     * @brief Mark the texture as needing updating, e.g. after heights it
+     * covers have changed while it wasn't being refreshed
+     * 
+     */
+    void markStale() noexcept;
+    /**
+     * @brief Re-read the part of the texture covering the heightmap samples in
+     * [_x0, _x1] x [_y0, _y1] after they have changed, so only that part is
+     * uploaded again the next time the texture is bound
+     * 
+     * @param _x0 The left of the region
+     * @param _y0 The top of the region
+     * @param _x1 The right of the region (inclusive)
+     * @param _y1 The bottom of the region (inclusive)
+     * @return true If the texture covers any of the region
+     */
+    bool refreshRegion(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) noexcept;
+    /**
+     * @brief Set the overlay read into the texture's third channel the next
+     * time it is updated
+     * 
+     * @param _overlay The overlay, or an empty reader for none (all 0)
+     */
+    void setOverlay(OverlayReader _overlay) noexcept;
     /**
      * @brief Get the scale of this clipmap
      * 
@@ -62,11 +139,41 @@ namespace geoclipmap
      */
     int scale() const noexcept;
     /**
-     * @brief Get the position of this clipmap
+     * @brief Get the position of this clipmap relative to the camera, small
+     * enough to be precise as a float wherever the camera is in the world
      * 
      * @return const ngl::Vec2& The position of the clipmap
      */
     const ngl::Vec2 &position() const noexcept;
+    /**
+     * @brief Get how far the camera is past the origin's sample, [0, 1) in
+     * units of this level's samples, to be taken off the position when drawn
+     * 
+     * @return const ngl::Vec2& 
+     */
+    const ngl::Vec2 &subTexelOffset() const noexcept;
+    /**
+     * @brief Get the X coord of the first sample of this level's texture in
+     * units of this level's samples
+     * 
+     * @return int64_t 
+     */
+    int64_t originX() const noexcept;
+    /**
+     * @brief Get the Y coord of the first sample of this level's texture in
+     * units of this level's samples
+     * 
+     * @return int64_t 
+     */
+    int64_t originY() const noexcept;
+    /**
+     * @brief Get the heights read from the heightmap for this level's texture,
+     * D x D row-major starting at the origin (only current while the level is
+     * active)
+     * 
+     * @return const std::vector<ngl::Real>& 
+     */
+    const std::vector<ngl::Real> &heights() const noexcept;
     /**
      * @brief Get this clipmap's trim location
      * 
@@ -74,10 +181,21 @@ namespace geoclipmap
      */
     TrimLocation trimLocation() const noexcept;
     /**
-     * @brief Bind the height data texture
+     * @brief Bind the height data texture, uploading whatever has changed
+     * since it was last bound
+     * 
+     * @return size_t The number of bytes uploaded
+     */
+    size_t bindTextures() noexcept;
+    /**
+     * @brief Take what has to be uploaded the next time the texture is bound,
+     * i.e. everything if the buffer has to be (re)allocated, else the texels
+     * changed since the last upload, and count it as uploaded. Doesn't touch
+     * GL, bindTextures does the upload.
      * 
+     * @return TextureUpload The texels to upload, empty if nothing changed
      */
-    void bindTextures() noexcept;
+    TextureUpload pendingUpload() noexcept;
     /**
      * @brief Unbind the texture
      * 
@@ -100,37 +218,74 @@ namespace geoclipmap
     int m_scale;
     // The heightmap
     Heightmap *m_heightmap;
-    // The texture for the ClipmapLevel - used for height data
-    std::vector<ngl::Vec2> m_texture;
+    // The texture for the ClipmapLevel - used for height data, when each texel was regenerated and the overlay
+    std::vector<ngl::Vec3> m_texture;
+    // The heights read from the heightmap for the texture
+    std::vector<ngl::Real> m_heights;
+    // The overlay shown on this level's part of the terrain
+    OverlayReader m_overlay;
+    // A row of the overlay read for the texture
+    std::vector<ngl::Real> m_overlayRow;
     // The texture buffer
     GLuint m_tbo;
     // The texture
     GLuint m_tboTex;
     // Whether the texture had been allocated or not
     bool m_allocated = false;
+    // The number of texels the buffer was last allocated with
+    size_t m_bufferTexels = 0;
+    // The texels changed since the texture was last uploaded, [m_dirtyBegin, m_dirtyEnd)
+    size_t m_dirtyBegin = 0;
+    size_t m_dirtyEnd = 0;
     // The parent ClipmapLevel (coarser detail) used for blending
     ClipmapLevel *m_parent;
-    // The position of this ClipmapLevel
+    // The position of this ClipmapLevel relative to the camera
     ngl::Vec2 m_worldPosition;
-    // The position of this ClipmapLevel on the heightmap
-    ngl::Vec2 m_heightmapPosition;
+    // How far the camera is past the origin's sample in units of this level's samples
+    ngl::Vec2 m_subTexelOffset;
+    // The position of this ClipmapLevel on the heightmap in units of this level's samples
+    int64_t m_originX = 0;
+    int64_t m_originY = 0;
     // Where the trims are on this ClipmapLevel
     TrimLocation m_trimLocation;
+    // Whether the texture needs updating before it's drawn
+    bool m_stale = true;
+    // The memory held by the texture, the heights and the texture buffer
+    MemoryAccount m_memory{MemorySubsystem::ClipmapLevels};
 
     /**
-     * @brief Generate a pixel at location based on parent texture and heightmap
+     * @brief Generate part of a row of the texture based on parent texture and
+     * the heights read from the heightmap
+     * 
+     * @param _row The row of the texture, its pixels are vectors where r = fine pixel, g = the frame (Metrics::frameCount
+     * modulo k_regeneratedFrameWrap) it was regenerated on, b = overlay
+     * @param _first The first pixel of the row to generate
+     * @param _count The number of pixels to generate
+     */
+    void generateRow(int _row, int _first, int _count) noexcept;
+    /**
+     * @brief Mark texels as needing to be uploaded again
+     * 
+     * @param _begin The first texel
+     * @param _end One past the last texel
+     */
+    void markDirty(size_t _begin, size_t _end) noexcept;
+    /**
+     * @brief Report the memory held by this level to the memory tracker
      * 
-     * @param _x The x location of the pixel
-     * @param _y The y location of the pixel
-     * @return ngl::Vec2 A vector where r = fine pixel, g = coarse pixel
      */
-    ngl::Vec2 generatePixelAt(int _x, int _y) noexcept;
+    void accountMemory() noexcept;
 
 #ifdef TERRAIN_TESTING
 #include <gtest/gtest.h>
     FRIEND_TEST(ClipmapTest, ctor);
     FRIEND_TEST(ClipmapTest, ctor_specify_trimlocation);
     FRIEND_TEST(ClipmapTest, setPosition);
+    FRIEND_TEST(ClipmapTest, overlay);
+    FRIEND_TEST(ClipmapTest, refresh_region);
+    FRIEND_TEST(ClipmapTest, memory);
+    FRIEND_TEST(ClipmapTest, regenerated_frame);
+    FRIEND_TEST(ClipmapTest, stale);
 #endif
   };
 
@@ -0,0 +1,421 @@
+/**
+ * @file CompressedHeightmap.h
+ * @author Ollie Nicholls
+ * @brief Stores heights as a compressed multi-resolution pyramid, based on the
+ * compression used in "Geometry Clipmaps: Terrain Rendering Using Nested
+ * Regular Grids" by Losasso and Hoppe
+ *
+ * Level 0 is the full resolution heightmap and each coarser level keeps every
+ * other sample of the level below. The coarsest level is stored directly and
+ * every finer level only stores the samples the coarser level doesn't have, as
+ * residuals against the coarser level upsampled. The residuals are quantised
+ * and adaptively Rice coded in square tiles that can be decoded independently of their
+ * neighbours (they only need the one coarser tile above them).
+ *
+ * The encoded tiles can also be baked into a file (a header, an index of
+ * where every tile is, then the tiles) and dropped from memory, after which
+ * the tiles a region needs are read back in one batch with a TileReader just
+ * before they are decoded. As the file describes itself, a heightmap can be
+ * opened straight from one through any TileReader, e.g. from a tile server.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef COMPRESSED_HEIGHTMAP_H_
+#define COMPRESSED_HEIGHTMAP_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ngl/Types.h>
+
+#include "MemoryTracker.h"
+#include "TileReader.h"
+
+namespace geoclipmap
+{
+  /**
+   * @brief The size and speed of a CompressedHeightmap
+   *
+   */
+  struct CompressionStats
+  {
+    // The number of bytes the heights took before compression (one float each)
+    size_t rawBytes = 0;
+    // The number of bytes of encoded tiles
+    size_t compressedBytes = 0;
+    // The largest error between a decoded height and the original
+    ngl::Real maxError = 0.0f;
+    // The number of tiles that have been decoded
+    size_t tilesDecoded = 0;
+    // The number of samples that have been decoded
+    size_t samplesDecoded = 0;
+    // The time spent decoding in seconds (wall clock, so parallel decodes count once)
+    double decodeSeconds = 0.0;
+    // The number of tiles reads of regions have needed
+    size_t tilesRequested = 0;
+    // The number of those tiles that were already decoded
+    size_t tileHits = 0;
+    // The number of tiles decoded ahead of time by warmRegion
+    size_t tilesPrefetched = 0;
+    // The number of encoded bytes read to decode them
+    size_t bytesPrefetched = 0;
+    // The number of encoded tiles read from the tile file
+    size_t tilesRead = 0;
+    // The number of bytes of those tiles
+    size_t bytesRead = 0;
+    // The number of tiles that couldn't be read (and were estimated from the level above until read again)
+    size_t readErrors = 0;
+    // The time spent waiting for tiles to be read in seconds
+    double readSeconds = 0.0;
+
+    /**
+     * @brief Get the compression ratio (raw / compressed)
+     *
+     * @return double
+     */
+    double ratio() const noexcept;
+    /**
+     * @brief Get the decompression throughput in samples per second
+     *
+     * @return double
+     */
+    double samplesPerSecond() const noexcept;
+    /**
+     * @brief Get the fraction of the tiles needed by reads of regions that
+     * were already decoded
+     *
+     * @return double
+     */
+    double hitRate() const noexcept;
+    /**
+     * @brief Get the number of tiles read from the tile file per second
+     *
+     * @return double
+     */
+    double tilesReadPerSecond() const noexcept;
+  };
+
+  class CompressedHeightmap
+  {
+  public:
+    /**
+     * @brief Construct a new CompressedHeightmap object by encoding the heights
+     *
+     * @param _width The width of the heightmap
+     * @param _depth The depth of the heightmap
+     * @param _heights The heights of the heightmap (row-major)
+     * @param _tolerance The largest error allowed between an original and a
+     * decoded height
+     * @param _tileSize The width of each tile (a power of 2)
+     * @param _cacheTiles The number of decoded tiles to keep in memory
+     */
+    CompressedHeightmap(int _width,
+                        int _depth,
+                        const std::vector<ngl::Real> &_heights,
+                        ngl::Real _tolerance,
+                        int _tileSize = 64,
+                        size_t _cacheTiles = 2048) noexcept;
+    /**
+     * @brief Open a heightmap baked by bake() (or streamTiles()), reading its
+     * tiles through _reader as they are needed
+     *
+     * @param _reader Reads the baked file
+     * @param _cacheTiles The number of decoded tiles to keep in memory
+     * @return std::unique_ptr<CompressedHeightmap> The heightmap, or nullptr
+     * if the file couldn't be read or isn't a baked heightmap
+     */
+    static std::unique_ptr<CompressedHeightmap> open(std::unique_ptr<TileReader> _reader, size_t _cacheTiles = 2048) noexcept;
+    /**
+     * @brief Get the height at _x, _y. Decodes the tile holding it if it isn't
+     * already decoded.
+     *
+     * @param _x X coord of the heightmap (must be in range)
+     * @param _y Y coord of the heightmap (must be in range)
+     * @return ngl::Real
+     */
+    ngl::Real sample(int64_t _x, int64_t _y) noexcept;
+    /**
+     * @brief Read a window of _countX by _countY samples _stride apart
+     * starting at _x, _y, giving the same heights as sample. The window is
+     * walked a block at a time, each block lying within a single tile of
+     * every level it reads, so each of those tiles is looked up (and marked
+     * as used) once per block rather than once per sample.
+     *
+     * @param _x X coord of the first sample (the window must be in range)
+     * @param _y Y coord of the first sample
+     * @param _stride The distance between the samples
+     * @param _countX The number of samples across the window
+     * @param _countY The number of samples down the window
+     * @param _pitch The distance between rows of _out
+     * @param _out Where to write the heights, row-major
+     */
+    void readWindow(int64_t _x, int64_t _y, int _stride, int _countX, int _countY, size_t _pitch, ngl::Real *_out) noexcept;
+    /**
+     * @brief Decode, in parallel, every tile needed to read the samples at
+     * multiples of _stride within [_x0, _x1] x [_y0, _y1]. Tiles are decoded
+     * from the pyramid level matching _stride so coarse reads never touch the
+     * full resolution tiles.
+     *
+     * @param _x0 The left of the region
+     * @param _y0 The top of the region
+     * @param _x1 The right of the region (inclusive)
+     * @param _y1 The bottom of the region (inclusive)
+     * @param _stride The distance between the samples that will be read
+     */
+    void decodeRegion(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, int _stride) noexcept;
+    /**
+     * @brief Decode ahead of time some of the tiles that decodeRegion would
+     * need for the region, coarsest first, so later reads don't have to wait
+     * for them. Tiles already decoded are marked as used so they stay in the
+     * cache.
+     *
+     * @param _x0 The left of the region
+     * @param _y0 The top of the region
+     * @param _x1 The right of the region (inclusive)
+     * @param _y1 The bottom of the region (inclusive)
+     * @param _stride The distance between the samples that will be read
+     * @param _maxTiles The most tiles to decode
+     * @return size_t The number of tiles decoded
+     */
+    size_t warmRegion(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, int _stride, size_t _maxTiles) noexcept;
+    /**
+     * @brief Write the heightmap to a baked file that open() can read, with
+     * the tiles packed after a header and an index of where they are
+     *
+     * @param _path The file to write (replaced if it exists)
+     * @return true If it was written, false if it couldn't be or the tiles
+     * are already streamed from a file
+     */
+    bool bake(const std::string &_path) noexcept;
+    /**
+     * @brief Bake the heightmap to a file and release the encoded tiles from
+     * memory,
+     * reading them back from the file whenever they need decoding again
+     *
+     * @param _path The file to write the tiles to (replaced if it exists)
+     * @param _backend How to read the tiles back
+     * @param _directIO Whether to read the tiles back with O_DIRECT
+     * @return true If the tiles are now streamed from the file. If not (the
+     * file couldn't be written or read, or the tiles are already streamed)
+     * they are kept where they were.
+     */
+    bool streamTiles(const std::string &_path, TileReaderBackend _backend, bool _directIO) noexcept;
+    /**
+     * @brief Get the reader the tiles are streamed with, or nullptr if they
+     * are kept in memory
+     *
+     * @return const TileReader*
+     */
+    const TileReader *tileReader() const noexcept;
+    /**
+     * @brief Get the width of the heightmap in samples
+     *
+     * @return int
+     */
+    int width() const noexcept;
+    /**
+     * @brief Get the depth of the heightmap in samples
+     *
+     * @return int
+     */
+    int depth() const noexcept;
+    /**
+     * @brief Get the width of each tile
+     *
+     * @return int
+     */
+    int tileSize() const noexcept;
+    /**
+     * @brief Get the number of levels in the pyramid
+     *
+     * @return int
+     */
+    int levels() const noexcept;
+    /**
+     * @brief Get the compression and decompression statistics
+     *
+     * @return const CompressionStats&
+     */
+    const CompressionStats &stats() const noexcept;
+
+  private:
+    struct EncodedTile
+    {
+      // The Rice coded residuals, empty when streamed and not being decoded
+      std::vector<uint8_t> bits;
+      // Where the residuals are in the tile file and how many bytes they take
+      uint64_t offset = 0;
+      size_t size = 0;
+    };
+
+    struct Level
+    {
+      // The width and depth of this level in samples
+      int width = 0;
+      int depth = 0;
+      // The number of tiles across and down this level
+      int tilesX = 0;
+      int tilesY = 0;
+      // The encoded tiles (row-major)
+      std::vector<EncodedTile> tiles;
+      // The decoded tiles, empty when not resident
+      std::vector<std::shared_ptr<const std::vector<ngl::Real>>> decoded;
+      // When each tile was last used, so tiles about to be used aren't evicted
+      std::vector<uint64_t> lastUsed;
+      // Whether each decoded tile (or one it was decoded from) couldn't be read, so only holds an estimate and is
+      // read again the next time a region it is in is decoded
+      std::vector<uint8_t> failed;
+      // Where each decoded tile is in the cache's use order
+      std::vector<std::list<std::pair<int, size_t>>::iterator> cacheEntry;
+    };
+
+    // The width of each tile
+    int m_tileSize;
+    // The quantisation step (twice the tolerance)
+    ngl::Real m_step;
+    // The pyramid, finest level first
+    std::vector<Level> m_levels;
+    // The number of decoded tiles to keep in memory
+    size_t m_cacheTiles;
+    // The number of decoded tiles currently in memory
+    size_t m_residentTiles = 0;
+    // Counter used to stamp tiles when they are used
+    uint64_t m_useCounter = 0;
+    // The decoded tiles (level and index), least recently used first
+    std::list<std::pair<int, size_t>> m_cacheOrder;
+    // The compression and decompression statistics
+    CompressionStats m_stats;
+    // Reads the encoded tiles back from the tile file when they are streamed
+    std::unique_ptr<TileReader> m_reader;
+    // The memory held by the encoded tiles kept in memory, counted as the heightmap's
+    MemoryAccount m_encodedMemory{MemorySubsystem::Heightmap};
+    // The memory held by the decoded tiles
+    MemoryAccount m_cacheMemory{MemorySubsystem::TileCache};
+
+    /**
+     * @brief Construct an empty CompressedHeightmap for open() to fill in
+     *
+     * @param _tileSize The width of each tile
+     * @param _step The quantisation step
+     * @param _cacheTiles The number of decoded tiles to keep in memory
+     */
+    CompressedHeightmap(int _tileSize, ngl::Real _step, size_t _cacheTiles) noexcept;
+    /**
+     * @brief Set up the (empty) levels of the pyramid for a heightmap
+     *
+     * @param _width The width of the heightmap
+     * @param _depth The depth of the heightmap
+     */
+    void buildLevels(int _width, int _depth) noexcept;
+    /**
+     * @brief Decode the tiles needed to read a region (see decodeRegion),
+     * either because they are about to be read or ahead of time
+     *
+     * @param _x0 The left of the region
+     * @param _y0 The top of the region
+     * @param _x1 The right of the region (inclusive)
+     * @param _y1 The bottom of the region (inclusive)
+     * @param _stride The distance between the samples that will be read
+     * @param _prefetch Whether the tiles are being decoded ahead of time
+     * @param _maxTiles The most tiles to decode
+     * @return size_t The number of tiles decoded
+     */
+    size_t decode(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, int _stride, bool _prefetch, size_t _maxTiles) noexcept;
+    /**
+     * @brief Read the encoded residuals of the given tiles back from the tile
+     * file in one batch, if the tiles are streamed, marking the tiles that
+     * couldn't be read as failed
+     *
+     * @param _tiles The level and index of each tile
+     */
+    void loadTiles(const std::vector<std::pair<int, size_t>> &_tiles) noexcept;
+    /**
+     * @brief Encode every tile of every level
+     *
+     * @param _heights The full resolution heights
+     */
+    void encode(const std::vector<ngl::Real> &_heights) noexcept;
+    /**
+     * @brief Predict the sample at _x, _y of _level from the level above it
+     *
+     * @param _coarse The (reconstructed) level above, row-major
+     * @param _coarseWidth The width of the level above
+     * @param _x X coord in _level
+     * @param _y Y coord in _level
+     * @param _maxX The largest X coord of the level above that may be used
+     * @param _maxY The largest Y coord of the level above that may be used
+     * @return ngl::Real
+     */
+    static ngl::Real predict(const ngl::Real *_coarse,
+                             int _coarseWidth,
+                             int _x,
+                             int _y,
+                             int _maxX,
+                             int _maxY) noexcept;
+    /**
+     * @brief Decode a single tile. The tile above it must already be decoded.
+     *
+     * @param _level The level of the tile
+     * @param _tx The tile's X index
+     * @param _ty The tile's Y index
+     */
+    void decodeTile(int _level, int _tx, int _ty) noexcept;
+    /**
+     * @brief Make sure the tile and all the tiles above it are decoded and
+     * return it
+     *
+     * @param _level The level of the tile
+     * @param _tx The tile's X index
+     * @param _ty The tile's Y index
+     * @return const std::vector<ngl::Real>& The decoded tile
+     */
+    const std::vector<ngl::Real> &residentTile(int _level, int _tx, int _ty) noexcept;
+    /**
+     * @brief Drop a decoded tile from the cache
+     *
+     * @param _level The level of the tile
+     * @param _index The tile's index in its level
+     */
+    void release(int _level, size_t _index) noexcept;
+    /**
+     * @brief Stamp a tile as used now, moving it to the back of the cache's
+     * use order if it is decoded
+     *
+     * @param _level The level of the tile
+     * @param _index The tile's index in its level
+     */
+    void touch(int _level, size_t _index) noexcept;
+    /**
+     * @brief Add a tile that has just been decoded to the back of the
+     * cache's use order
+     *
+     * @param _level The level of the tile
+     * @param _index The tile's index in its level
+     */
+    void addResident(int _level, size_t _index) noexcept;
+    /**
+     * @brief Evict the least recently used tiles until there is room for
+     * _incoming more
+     *
+     * @param _incoming The number of tiles about to be decoded
+     */
+    void evict(size_t _incoming) noexcept;
+
+#ifdef TERRAIN_TESTING
+#include <gtest/gtest.h>
+    FRIEND_TEST(CompressedHeightmapTest, pyramid_levels);
+    FRIEND_TEST(CompressedHeightmapTest, decode_region);
+    FRIEND_TEST(CompressedHeightmapTest, read_window);
+    FRIEND_TEST(CompressedHeightmapTest, eviction);
+    FRIEND_TEST(CompressedHeightmapTest, warm_region);
+    FRIEND_TEST(CompressedHeightmapTest, stream_tiles);
+    FRIEND_TEST(CompressedHeightmapTest, open_baked);
+    FRIEND_TEST(CompressedHeightmapTest, failed_reads);
+#endif
+  };
+} // end namespace geoclipmap
+#endif // !COMPRESSED_HEIGHTMAP_H_
@@ -13,6 +13,7 @@
 #include <ngl/Vec3.h>
 
 #include "FootprintVAO.h"
+#include "MemoryTracker.h"
 
 namespace geoclipmap
 {
@@ -52,6 +53,13 @@ namespace geoclipmap
      * 
      */
     void draw() noexcept;
+    /**
+     * @brief Get the number of triangles each draw submits, including the
+     * degenerate ones joining the strips
+     * 
+     * @return size_t
+     */
+    size_t triangleCount() const noexcept;
 
   private:
     // The width of the Footprint
@@ -66,12 +74,16 @@ namespace geoclipmap
     size_t m_vertexCount;
     // The number of indices
     size_t m_indexCount;
+    // The number of triangles in the strips
+    size_t m_triangleCount;
     // Whether the VAO has been bound
     bool m_vaoBound = false;
     // Whether the footprint vertex data has been bound
     bool m_dataBound = false;
     // A pointer to this footprints VAO
     std::unique_ptr<FootprintVAO> m_vao;
+    // The memory held by the vertices and indices and their buffers
+    MemoryAccount m_memory{MemorySubsystem::Footprints};
 
     /**
      * @brief Calculate the 2D vertices for the Footprint
@@ -95,11 +107,17 @@ namespace geoclipmap
      * @brief Calculate the indices for a degenerate triangle ring Footprint
      */
     void calculateIndicesDegenerate() noexcept;
+    /**
+     * @brief Count the triangles in the strips of indices
+     */
+    void countTriangles() noexcept;
 
 #ifdef TERRAIN_TESTING
 #include <gtest/gtest.h>
     FRIEND_TEST(FootprintTest, ctor_width_depth);
     FRIEND_TEST(FootprintTest, ctor_degenerate);
+    FRIEND_TEST(FootprintTest, triangle_count);
+    FRIEND_TEST(FootprintTest, memory);
 #endif
   };
 
@@ -105,6 +105,8 @@ namespace geoclipmap
   private:
     // The buffer ID for the VAO
     GLuint m_buffer = 0;
+    // The buffer ID for the indices
+    GLuint m_indexBuffer = 0;
   };
 
 } // end namespace geoclipmap
@@ -0,0 +1,100 @@
+/**
+ * @file FrameStats.h
+ * @author Ollie Nicholls
+ * @brief The cost of each frame the demo draws, e.g. while playing back a
+ * camera path, so that runs can be compared by their percentiles rather than
+ * by how smooth they looked
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef FRAME_STATS_H_
+#define FRAME_STATS_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace geoclipmap
+{
+  /**
+   * @brief What one frame cost
+   *
+   */
+  struct FrameTiming
+  {
+    // The time since the last frame started, in milliseconds
+    double frameMs = 0.0;
+    // The time spent on the CPU drawing the frame, in milliseconds
+    double cpuMs = 0.0;
+    // The time the GPU spent on the frame's commands, in milliseconds (negative if it isn't known)
+    double gpuMs = -1.0;
+    // The bytes of texture data uploaded for the frame
+    size_t uploadBytes = 0;
+    // The number of draw calls made
+    size_t draws = 0;
+  };
+
+  // Which of a frame's times to take the percentiles of
+  enum class FrameTime
+  {
+    Frame,
+    Cpu,
+    Gpu
+  };
+
+  class FrameStats
+  {
+  public:
+    /**
+     * @brief Add the next frame
+     *
+     * @param _timing What the frame cost, the GPU time being set later if
+     * it isn't known yet
+     * @return size_t The frame's index
+     */
+    size_t add(const FrameTiming &_timing) noexcept;
+    /**
+     * @brief Set the GPU time of a frame once its timer has been read back
+     *
+     * @param _frame The frame's index (from add)
+     * @param _gpuMs The time in milliseconds
+     */
+    void setGpuTime(size_t _frame, double _gpuMs) noexcept;
+    /**
+     * @brief Get the number of frames added
+     *
+     * @return size_t
+     */
+    size_t frameCount() const noexcept;
+    /**
+     * @brief Get a frame
+     *
+     * @param _frame The frame's index
+     * @return const FrameTiming&
+     */
+    const FrameTiming &frame(size_t _frame) const noexcept;
+    /**
+     * @brief Get a percentile of one of the frames' times, leaving out frames
+     * whose GPU time isn't known
+     *
+     * @param _time Which time
+     * @param _percentile The percentile (0-1)
+     * @return double The time in milliseconds, or 0 if there are no frames
+     */
+    double percentile(FrameTime _time, double _percentile) const noexcept;
+    /**
+     * @brief Write every frame to a CSV file with a header row, one frame per
+     * row
+     *
+     * @param _path The file to write (replaced if it exists)
+     * @return true If it was written
+     */
+    bool writeCsv(const std::string &_path) const noexcept;
+
+  private:
+    // Every frame added in order
+    std::vector<FrameTiming> m_frames;
+  };
+} // end namespace geoclipmap
+#endif // !FRAME_STATS_H_
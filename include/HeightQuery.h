@@ -0,0 +1,109 @@
+/**
+ * @file HeightQuery.h
+ * @author Ollie Nicholls
+ * @brief Answers batches of height queries, e.g. placing every vehicle and
+ * agent of a simulation on the terrain each tick
+ *
+ * Positions are in heightmap samples (the same units as Terrain::moveTo) and
+ * heights are bilinearly interpolated between the four samples around each
+ * position. Samples are read from the finest clipmap level's heights when the
+ * terrain's finest level is at full resolution and holds them, otherwise from
+ * the heightmap.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef HEIGHT_QUERY_H_
+#define HEIGHT_QUERY_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include <ngl/Vec2.h>
+#include <ngl/Vec3.h>
+
+#include "Heightmap.h"
+#include "Terrain.h"
+
+namespace geoclipmap
+{
+  class HeightQuery
+  {
+  public:
+    /**
+     * @brief Construct a new HeightQuery object
+     *
+     * @param _heightmap The heightmap to read samples from
+     * @param _terrain The terrain whose finest level to read samples from
+     * first, or nullptr to always use the heightmap. Queries must not run while
+     * the terrain is moving.
+     */
+    HeightQuery(Heightmap *_heightmap, Terrain *_terrain = nullptr) noexcept;
+    /**
+     * @brief Get the bilinearly interpolated height at each position. Large
+     * batches are split across the shared ThreadPool (except for compressed
+     * heightmaps, whose tile cache is only safe to use from one thread).
+     *
+     * @param _positions The positions in heightmap samples
+     * @param _count The number of positions
+     * @param o_heights Set to the height at each position (_count values),
+     * samples outside the heightmap are 0 as with Heightmap::value
+     * @param o_normals If not nullptr, set to the unit normal of the
+     * interpolated surface at each position (_count values) as (x, y, height)
+     * with heights unscaled
+     */
+    void heights(const ngl::Vec2 *_positions, size_t _count, ngl::Real *o_heights, ngl::Vec3 *o_normals = nullptr) noexcept;
+    /**
+     * @brief Get how many positions have been answered entirely from the
+     * terrain's finest level rather than the heightmap
+     *
+     * @return size_t
+     */
+    size_t residentQueries() const noexcept;
+
+  private:
+    /**
+     * @brief The heights of the terrain's finest level, if it can be used
+     *
+     */
+    struct ResidentLevel
+    {
+      // The level's heights (size x size, row-major), nullptr if not usable
+      const ngl::Real *heights = nullptr;
+      // The heightmap sample of the first height
+      int64_t originX = 0;
+      int64_t originY = 0;
+      // The width of the level
+      int64_t size = 0;
+    };
+
+    // The heightmap to read samples from
+    Heightmap *m_heightmap;
+    // The terrain whose finest level to read samples from first
+    Terrain *m_terrain;
+    // The number of positions answered from the terrain's finest level
+    std::atomic<size_t> m_residentQueries{0};
+
+    /**
+     * @brief Get the terrain's finest level if it is at full resolution
+     *
+     * @return ResidentLevel
+     */
+    ResidentLevel residentLevel() const noexcept;
+    /**
+     * @brief Answer a batch of positions on the calling thread
+     *
+     * @param _positions The positions in heightmap samples
+     * @param _count The number of positions
+     * @param o_heights Set to the height at each position
+     * @param o_normals If not nullptr, set to the normal at each position
+     * @param _level The terrain's finest level
+     */
+    void heightsBatch(const ngl::Vec2 *_positions,
+                      size_t _count,
+                      ngl::Real *o_heights,
+                      ngl::Vec3 *o_normals,
+                      const ResidentLevel &_level) noexcept;
+  };
+} // end namespace geoclipmap
+#endif // !HEIGHT_QUERY_H_
@@ -9,10 +9,74 @@
 #ifndef HEIGHTMAP_H_
 #define HEIGHTMAP_H_
 
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <ngl/Vec3.h>
 
+#include "CompressedHeightmap.h"
+#include "MemoryTracker.h"
+#include "MinMaxPyramid.h"
+
 namespace geoclipmap
 {
+  class HeightmapMosaic;
+
+  enum class HeightmapStorage
+  {
+    Colour,
+    Compressed,
+    Quantised,
+    // Read straight from row-major heights owned by something else, e.g. a HeightmapFeed
+    External,
+    // Read from the finest of several heightmaps layered over each other (see HeightmapMosaic)
+    Mosaic
+  };
+
+  enum class HeightmapLayout
+  {
+    // One row after another
+    RowMajor,
+    // Square tiles one after another, each tile row-major
+    Tiled,
+    // Square tiles one after another, each tile in Z-order (Morton order)
+    Morton
+  };
+
+  /**
+   * @brief The size and error of a quantised heightmap
+   *
+   */
+  struct QuantisationStats
+  {
+    // The number of bytes the heightmap took before quantising
+    size_t rawBytes = 0;
+    // The number of bytes of the quantised samples and the tiles' scales and offsets
+    size_t quantisedBytes = 0;
+    // The largest error between a quantised height and the original
+    ngl::Real maxError = 0.0f;
+    // The root mean square error of every quantised height
+    ngl::Real rmsError = 0.0f;
+  };
+
+  /**
+   * @brief A rectangle of a heightmap that has changed
+   *
+   */
+  struct DirtyRect
+  {
+    // The left of the rectangle
+    int64_t x0 = 0;
+    // The top of the rectangle
+    int64_t y0 = 0;
+    // The right of the rectangle (inclusive)
+    int64_t x1 = 0;
+    // The bottom of the rectangle (inclusive)
+    int64_t y1 = 0;
+  };
+
   class Heightmap
   {
   public:
@@ -26,6 +90,39 @@ namespace geoclipmap
     Heightmap(ngl::Real _width,
               ngl::Real _depth,
               std::vector<ngl::Vec3> _data) noexcept;
+    /**
+     * @brief Construct a new compressed Heightmap object from a compressed
+     * pyramid, e.g. one opened from a baked file or a tile server. Building
+     * the min/max pyramid reads every tile once, a band of tiles at a time.
+     * 
+     * @param _compressed The compressed heights
+     */
+    explicit Heightmap(std::unique_ptr<CompressedHeightmap> _compressed) noexcept;
+    /**
+     * @brief Construct a new Heightmap object that reads its heights straight
+     * from memory owned by something else (e.g. a HeightmapFeed) without
+     * copying them. The heights can change at any time, after which
+     * heightsChanged must be called for the region that changed.
+     * 
+     * @param _width The width of the heightmap
+     * @param _depth The depth of the heightmap
+     * @param _heights The heights (row-major), which must outlive the
+     * heightmap
+     */
+    Heightmap(int64_t _width, int64_t _depth, const ngl::Real *_heights) noexcept;
+    /**
+     * @brief Construct a new Heightmap object that reads its heights from a
+     * mosaic of heightmaps, each sample from the finest one covering it.
+     * Building the min/max pyramid reads every sample of the mosaic once.
+     * 
+     * @param _mosaic The mosaic
+     */
+    explicit Heightmap(std::unique_ptr<HeightmapMosaic> _mosaic) noexcept;
+    /**
+     * @brief Destroy the Heightmap object
+     * 
+     */
+    ~Heightmap();
     /**
      * @brief Get the width of the heightmap
      * 
@@ -45,7 +142,7 @@ namespace geoclipmap
      * @param _y Y coord of the heightmap
      * @return ngl::Real 
      */
-    ngl::Real value(int _x, int _y) noexcept;
+    ngl::Real value(int64_t _x, int64_t _y) noexcept;
     /**
      * @brief Get the colour at _x, _y in the heightmap
      * 
@@ -53,23 +150,318 @@ namespace geoclipmap
      * @param _y Y coord of the heightmap
      * @return ngl::Vec3 
      */
-    ngl::Vec3 colour(int _x, int _y) noexcept;
+    ngl::Vec3 colour(int64_t _x, int64_t _y) noexcept;
+    /**
+     * @brief Read _count heights along row _y starting at _x and stepping
+     * _stride samples each time. Samples out of range of the heightmap are 0.
+     * This is much faster than calling value() for each sample as the address
+     * of each sample is found incrementally.
+     * 
+     * @param _x X coord of the first sample
+     * @param _y Y coord of the row
+     * @param _stride The distance between each sample (> 0)
+     * @param _count The number of samples to read
+     * @param _out Where to write the heights (_count values)
+     */
+    void readRow(int64_t _x, int64_t _y, int _stride, int _count, ngl::Real *_out) noexcept;
+    /**
+     * @brief Read a window of _countX by _countY heights starting at _x, _y
+     * and stepping _stride samples each time in both directions, e.g. the
+     * window read by a clipmap level. Samples out of range of the heightmap 
+     * are 0. Tiled layouts are read a tile at a time.
+     * 
+     * @param _x X coord of the first sample
+     * @param _y Y coord of the first sample
+     * @param _stride The distance between each sample (> 0)
+     * @param _countX The number of samples across the window
+     * @param _countY The number of samples down the window
+     * @param _out Where to write the heights (_countX * _countY values, row-major)
+     */
+    void readWindow(int64_t _x, int64_t _y, int _stride, int _countX, int _countY, ngl::Real *_out) noexcept;
+    /**
+     * @brief Change the order the colour data is stored in memory. Tiled 
+     * layouts keep the square windows read by each clipmap level in fewer 
+     * cache lines and pages than row-major.
+     * 
+     * @param _layout The new layout
+     */
+    void setLayout(HeightmapLayout _layout) noexcept;
+    /**
+     * @brief Get the order the colour data is stored in memory
+     * 
+     * @return HeightmapLayout 
+     */
+    HeightmapLayout layout() noexcept;
     /**
      * @brief Return the highest point in the heightmap
      * 
      * @return ngl::Real 
      */
     ngl::Real highestPoint() noexcept;
+    /**
+     * @brief Replace the colour data with a compressed pyramid of the heights.
+     * After this colour() returns a grey colour whose value() is the height.
+     * 
+     * @param _tolerance The largest error allowed in any height
+     * @param _tileSize The width of the compressed tiles (a power of 2)
+     */
+    void compress(ngl::Real _tolerance, int _tileSize = 64) noexcept;
+    /**
+     * @brief Replace the colour data with a 16 bit sample per height. Each
+     * 32x32 tile has its own scale and offset so the 65536 levels only cover
+     * the heights in that tile. After this colour() returns a grey colour 
+     * whose value() is the height.
+     * 
+     */
+    void quantise() noexcept;
+    /**
+     * @brief Get the quantisation size and error, or nullptr if not quantised
+     * 
+     * @return const QuantisationStats* 
+     */
+    const QuantisationStats *quantisationStats() noexcept;
+    /**
+     * @brief Get how the heightmap data is stored
+     * 
+     * @return HeightmapStorage 
+     */
+    HeightmapStorage storage() noexcept;
+    /**
+     * @brief Get the compression statistics, or nullptr if not compressed
+     * 
+     * @return const CompressionStats* 
+     */
+    const CompressionStats *compressionStats() noexcept;
+    /**
+     * @brief Get ready to read the samples at multiples of _stride within 
+     * [_x0, _x1] x [_y0, _y1]. For compressed heightmaps this decodes all the 
+     * tiles needed in parallel, and for mosaics it does the same for each
+     * compressed source, otherwise it does nothing.
+     * 
+     * @param _x0 The left of the region
+     * @param _y0 The top of the region
+     * @param _x1 The right of the region (inclusive)
+     * @param _y1 The bottom of the region (inclusive)
+     * @param _stride The distance between the samples that will be read
+     */
+    void prefetch(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, int _stride) noexcept;
+    /**
+     * @brief Get some of a region ready ahead of time, before it is needed.
+     * For compressed heightmaps (or mosaics of them) this decodes up to
+     * _maxTiles of the tiles prefetch would need, otherwise it does nothing.
+     * 
+     * @param _x0 The left of the region
+     * @param _y0 The top of the region
+     * @param _x1 The right of the region (inclusive)
+     * @param _y1 The bottom of the region (inclusive)
+     * @param _stride The distance between the samples that will be read
+     * @param _maxTiles The most tiles to decode
+     * @return size_t The number of tiles decoded
+     */
+    size_t warm(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, int _stride, size_t _maxTiles) noexcept;
+    /**
+     * @brief Write a compressed heightmap's encoded tiles to a file and read
+     * them back from it as they are needed instead of keeping them in memory
+     * (see CompressedHeightmap::streamTiles)
+     * 
+     * @param _path The file to write the tiles to
+     * @param _backend How to read the tiles back
+     * @param _directIO Whether to read the tiles back with O_DIRECT
+     * @return true If the tiles are now streamed, false if they couldn't be
+     * or the heightmap isn't compressed
+     */
+    bool streamTiles(const std::string &_path, TileReaderBackend _backend, bool _directIO) noexcept;
+    /**
+     * @brief Get the reader compressed tiles are streamed with, or nullptr if
+     * they aren't streamed
+     * 
+     * @return const TileReader* 
+     */
+    const TileReader *tileReader() noexcept;
+    /**
+     * @brief Get whether the heightmap can be read from several threads at
+     * once, which it can't when compressed tiles are decoded into a shared
+     * cache as they are read
+     * 
+     * @return true If reads can run at the same time
+     */
+    bool concurrentReads() noexcept;
+    /**
+     * @brief Get bounds on the heights in [_x0, _x1] x [_y0, _y1] (clamped to
+     * the heightmap) in O(log n) from the min/max pyramid without reading any
+     * samples, e.g. for culling, picking or keeping the camera above the
+     * ground. They hold every height in the rectangle but may be wider than
+     * its exact range (see MinMaxPyramid::bounds).
+     *
+     * @param _x0 The left of the rectangle
+     * @param _y0 The top of the rectangle
+     * @param _x1 The right of the rectangle (inclusive)
+     * @param _y1 The bottom of the rectangle (inclusive)
+     * @return HeightRange The bounds, or 0, 0 if the rectangle is outside the
+     * heightmap
+     */
+    HeightRange heightBounds(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) const noexcept;
+    /**
+     * @brief Get the exact lowest and highest heights in [_x0, _x1] x [_y0,
+     * _y1] (clamped to the heightmap) from the min/max pyramid. Slower than
+     * heightBounds, the samples along the rectangle's edges are read so a W x
+     * H rectangle costs O(W + H) sample reads. For compressed heightmaps the
+     * range may be off by up to the compression tolerance.
+     *
+     * @param _x0 The left of the rectangle
+     * @param _y0 The top of the rectangle
+     * @param _x1 The right of the rectangle (inclusive)
+     * @param _y1 The bottom of the rectangle (inclusive)
+     * @return HeightRange The range, or 0, 0 if the rectangle is outside the
+     * heightmap
+     */
+    HeightRange exactHeightRange(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) noexcept;
+    /**
+     * @brief Get the min/max pyramid of the heights, e.g. to skip over whole
+     * blocks of the heightmap
+     *
+     * @return const MinMaxPyramid&
+     */
+    const MinMaxPyramid &heightRanges() noexcept;
+    /**
+     * @brief Set the height at _x, _y (see setValues)
+     *
+     * @param _x X coord of the heightmap
+     * @param _y Y coord of the heightmap
+     * @param _height The new height
+     */
+    void setValue(int64_t _x, int64_t _y, ngl::Real _height) noexcept;
+    /**
+     * @brief Set a window of _countX by _countY heights starting at _x, _y.
+     * Colours are replaced with the grey whose value() is the height, so
+     * they can't hold a height below 0 and negative heights are set to 0.
+     * Quantised tiles are re-quantised if a height is outside their range,
+     * including below 0. Samples out of range are skipped and compressed,
+     * external and mosaic heightmaps can't be changed. Only the blocks of
+     * the min/max pyramid holding the changed samples are updated.
+     *
+     * @param _x X coord of the first sample
+     * @param _y Y coord of the first sample
+     * @param _countX The number of samples across the window
+     * @param _countY The number of samples down the window
+     * @param _heights The new heights (_countX * _countY values, row-major)
+     * @param _changed If not null, set to the samples whose heights may have
+     * changed, which is more than the window when a quantised tile was
+     * re-quantised (every height in the tile shifts)
+     * @return true If any samples were set
+     */
+    bool setValues(int64_t _x, int64_t _y, int _countX, int _countY, const ngl::Real *_heights, DirtyRect *_changed = nullptr) noexcept;
+    /**
+     * @brief Tell the heightmap that the external heights in [_x0, _x1] x
+     * [_y0, _y1] have changed, updating the blocks of the min/max pyramid
+     * holding them
+     *
+     * @param _x0 The left of the region
+     * @param _y0 The top of the region
+     * @param _x1 The right of the region (inclusive)
+     * @param _y1 The bottom of the region (inclusive)
+     */
+    void heightsChanged(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) noexcept;
 
   private:
+    struct QuantisedTile
+    {
+      // The height of a quantised sample of 0
+      ngl::Real offset;
+      // The height between each quantised level
+      ngl::Real scale;
+    };
+
     // The width of the heightmap (x axis)
-    ngl::Real m_width;
+    int64_t m_width;
     // The depth of the heightmap (y axis)
-    ngl::Real m_depth;
+    int64_t m_depth;
+    // How the heightmap data is stored
+    HeightmapStorage m_storage = HeightmapStorage::Colour;
     // The heightmap data
     std::vector<ngl::Vec3> m_data;
+    // The quantised heights in the same layout as m_data would be, only set when the storage is quantised
+    std::vector<uint16_t> m_quantised;
+    // The scale and offset of each 32x32 tile of m_quantised (row-major)
+    std::vector<QuantisedTile> m_quantisedTiles;
+    // The size and error of the quantised heights
+    std::unique_ptr<QuantisationStats> m_quantisationStats;
+    // The order of m_data in memory
+    HeightmapLayout m_layout = HeightmapLayout::RowMajor;
+    // The number of tiles across the heightmap for the tiled layouts
+    int64_t m_tilesX;
     // The highest point in the clipmap
     ngl::Real m_highestPoint;
+    // The compressed heights, only set when the storage is compressed
+    std::unique_ptr<CompressedHeightmap> m_compressed;
+    // The heights owned by something else (row-major), only set when the storage is external
+    const ngl::Real *m_external = nullptr;
+    // The heightmaps layered over each other, only set when the storage is mosaic
+    std::unique_ptr<HeightmapMosaic> m_mosaic;
+    // The lowest and highest heights of blocks of the heightmap
+    std::unique_ptr<MinMaxPyramid> m_heightRanges;
+    // The memory held by the samples and the min/max pyramid (compressed heights have their own)
+    MemoryAccount m_memory{MemorySubsystem::Heightmap};
+
+    /**
+     * @brief Get a reader for the min/max pyramid to read rows of heights with
+     *
+     * @return MinMaxPyramid::SampleReader
+     */
+    MinMaxPyramid::SampleReader sampleReader() noexcept;
+    /**
+     * @brief Report the memory held by the samples and the min/max pyramid to
+     * the memory tracker
+     *
+     */
+    void accountMemory() noexcept;
+    /**
+     * @brief Store _height in quantised tile _tx, _ty at _x, _y (in the
+     * tile), re-quantising the whole tile with a wider range if it doesn't fit
+     *
+     * @param _tx The tile's X index
+     * @param _ty The tile's Y index
+     * @param _x X coord of the heightmap
+     * @param _y Y coord of the heightmap
+     * @param _height The new height
+     * @return true If the tile was re-quantised
+     */
+    bool setQuantised(int64_t _tx, int64_t _ty, int64_t _x, int64_t _y, ngl::Real _height) noexcept;
+    /**
+     * @brief Get the index of _x, _y in m_data when stored in _layout (must be
+     * in range)
+     * 
+     * @param _x X coord of the heightmap
+     * @param _y Y coord of the heightmap
+     * @param _layout The layout of m_data
+     * @return size_t 
+     */
+    size_t index(int64_t _x, int64_t _y, HeightmapLayout _layout) const noexcept;
+    /**
+     * @brief Read a window of samples (see readWindow) in the order that suits
+     * the layout, using _sample to get the height of each sample
+     * 
+     * @tparam Sample Callable as ngl::Real(size_t index, size_t tile) where
+     * index is the sample's index in the layout and tile is the row-major 
+     * index of the 32x32 tile it is in
+     */
+    template <typename Sample>
+    void readWindowWith(int64_t _x,
+                        int64_t _y,
+                        int _stride,
+                        int _countX,
+                        int _countY,
+                        ngl::Real *_out,
+                        const Sample &_sample) const noexcept;
+
+#ifdef TERRAIN_TESTING
+#include <gtest/gtest.h>
+    FRIEND_TEST(HeightmapTest, layouts);
+    FRIEND_TEST(HeightmapTest, quantise);
+    FRIEND_TEST(HeightmapTest, large_index);
+    FRIEND_TEST(HeightmapTest, set_values);
+    FRIEND_TEST(HeightmapTest, external);
+#endif
   };
 } // end namespace geoclipmap
 #endif // !HEIGHTMAP_H_
\ No newline at end of file
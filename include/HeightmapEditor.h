@@ -0,0 +1,212 @@
+/**
+ * @file HeightmapEditor.h
+ * @author Ollie Nicholls
+ * @brief Brush edits to a heightmap at runtime (e.g. craters, excavation or
+ * flattening the ground for a road)
+ *
+ * Every edit reads the samples under the brush, works out their new heights
+ * and writes them back with Heightmap::setValues, so only the blocks of the
+ * min/max pyramid holding them are updated. The texels of the terrain's
+ * active levels that cover them are then read again with
+ * Terrain::refreshRegion, so an edit costs time in proportion to the area it
+ * covers rather than the size of the heightmap.
+ *
+ * Heightmaps stored as colours can't hold heights below 0, so an edit that
+ * goes lower (e.g. a deep crater on low ground) bottoms out at 0 there.
+ * Quantised heightmaps keep negative heights.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef HEIGHTMAP_EDITOR_H_
+#define HEIGHTMAP_EDITOR_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <ngl/Types.h>
+
+#include "Heightmap.h"
+#include "Terrain.h"
+
+namespace geoclipmap
+{
+  /**
+   * @brief The samples a brush covers, and how strongly it affects each
+   *
+   */
+  struct BrushArea
+  {
+    // The left of the area's bounds
+    int64_t x0 = 0;
+    // The top of the area's bounds
+    int64_t y0 = 0;
+    // The right of the area's bounds (inclusive)
+    int64_t x1 = -1;
+    // The bottom of the area's bounds (inclusive)
+    int64_t y1 = -1;
+    // The centre of a circular brush in samples
+    ngl::Real centreX = 0.0f;
+    ngl::Real centreY = 0.0f;
+    // The radius of a circular brush in samples, 0 for a rectangle
+    ngl::Real radius = 0.0f;
+    // The fraction of the radius over which a circular brush fades out
+    ngl::Real falloff = 0.0f;
+
+    /**
+     * @brief Make a brush covering every sample in [_x0, _x1] x [_y0, _y1]
+     * at full strength
+     *
+     * @param _x0 The left of the rectangle
+     * @param _y0 The top of the rectangle
+     * @param _x1 The right of the rectangle (inclusive)
+     * @param _y1 The bottom of the rectangle (inclusive)
+     * @return BrushArea
+     */
+    static BrushArea rectangle(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) noexcept;
+    /**
+     * @brief Make a brush covering the samples within _radius of _x, _y
+     *
+     * @param _x The x coord of the centre in samples
+     * @param _y The y coord of the centre in samples
+     * @param _radius The radius in samples
+     * @param _falloff The fraction of the radius (from the edge inwards) over
+     * which the brush fades smoothly from full strength to nothing, 0 for a
+     * hard edge
+     * @return BrushArea
+     */
+    static BrushArea circle(ngl::Real _x, ngl::Real _y, ngl::Real _radius, ngl::Real _falloff = 0.5f) noexcept;
+    /**
+     * @brief Get how strongly the brush affects the sample at _x, _y
+     *
+     * @param _x X coord of the sample
+     * @param _y Y coord of the sample
+     * @return ngl::Real From 0 (not at all) to 1 (fully)
+     */
+    ngl::Real weight(int64_t _x, int64_t _y) const noexcept;
+  };
+
+  class HeightmapEditor
+  {
+  public:
+    /**
+     * @brief Construct a new HeightmapEditor object
+     *
+     * @param _heightmap The heightmap to edit, which must be stored as colours
+     * or quantised (compressed, external and mosaic heightmaps can't be edited)
+     * @param _terrain The terrain to refresh after each edit, or nullptr
+     */
+    HeightmapEditor(Heightmap *_heightmap, Terrain *_terrain = nullptr) noexcept;
+    /**
+     * @brief Set the terrain to refresh after each edit, e.g. after it has
+     * been regenerated
+     *
+     * @param _terrain The terrain, or nullptr
+     */
+    void setTerrain(Terrain *_terrain) noexcept;
+    /**
+     * @brief Move the heights under the brush towards _height
+     *
+     * @param _area The brush
+     * @param _height The height to set
+     * @param _strength How far to move them, from 0 (not at all) to 1 (all
+     * the way where the brush is at full strength)
+     * @return true If any samples were edited
+     */
+    bool set(const BrushArea &_area, ngl::Real _height, ngl::Real _strength = 1.0f) noexcept;
+    /**
+     * @brief Raise (or with a negative amount, lower) the heights under the
+     * brush. On a heightmap stored as colours heights stop at 0, quantised
+     * ones can go below it (see Heightmap::setValues).
+     *
+     * @param _area The brush
+     * @param _amount The height to add where the brush is at full strength
+     * @return true If any samples were edited
+     */
+    bool add(const BrushArea &_area, ngl::Real _amount) noexcept;
+    /**
+     * @brief Blend the heights under the brush with the average of the 3x3
+     * samples around them
+     *
+     * @param _area The brush
+     * @param _strength How far to blend them, from 0 (not at all) to 1 (all
+     * the way where the brush is at full strength)
+     * @return true If any samples were edited
+     */
+    bool smooth(const BrushArea &_area, ngl::Real _strength = 1.0f) noexcept;
+    /**
+     * @brief Move the heights under the brush towards their average,
+     * weighted by the brush
+     *
+     * @param _area The brush
+     * @param _strength How far to move them, from 0 (not at all) to 1 (all
+     * the way where the brush is at full strength)
+     * @return true If any samples were edited
+     */
+    bool flatten(const BrushArea &_area, ngl::Real _strength = 1.0f) noexcept;
+    /**
+     * @brief Get the number of samples written by all edits so far
+     *
+     * @return size_t
+     */
+    size_t samplesEdited() const noexcept;
+
+  private:
+    // The heightmap to edit
+    Heightmap *m_heightmap;
+    // The terrain to refresh after each edit
+    Terrain *m_terrain;
+    // The heights read from under the brush (with a border for smoothing)
+    std::vector<ngl::Real> m_before;
+    // The first sample of m_before
+    int64_t m_beforeX = 0;
+    int64_t m_beforeY = 0;
+    // The size of m_before
+    int64_t m_beforeWidth = 0;
+    int64_t m_beforeDepth = 0;
+    // The samples being edited, the brush's bounds clamped to the heightmap
+    int64_t m_editX0 = 0;
+    int64_t m_editY0 = 0;
+    int64_t m_editX1 = -1;
+    int64_t m_editY1 = -1;
+    // The new heights of the samples being edited
+    std::vector<ngl::Real> m_after;
+    // The number of samples written so far
+    size_t m_samplesEdited = 0;
+
+    /**
+     * @brief Read the heights under the brush into m_before, ready for
+     * writeBrush
+     *
+     * @param _area The brush
+     * @param _border The number of samples around the brush to read as well
+     * @return true If the brush covers any samples that can be edited
+     */
+    bool readBrush(const BrushArea &_area, int _border) noexcept;
+    /**
+     * @brief Write the new heights of the samples under the brush, then
+     * refresh the terrain where they are
+     *
+     * @param _area The brush
+     * @param _edit Called as _edit(x, y, weight) for each sample the brush
+     * affects, returning its new height
+     */
+    template <typename Edit>
+    void writeBrush(const BrushArea &_area, Edit &&_edit) noexcept;
+    /**
+     * @brief Get the height of a sample as read by readBrush, clamped to the
+     * samples that were read (so the heightmap's edge is repeated)
+     *
+     * @param _x X coord of the sample
+     * @param _y Y coord of the sample
+     * @return ngl::Real
+     */
+    ngl::Real before(int64_t _x, int64_t _y) const noexcept;
+
+#ifdef TERRAIN_TESTING
+#include <gtest/gtest.h>
+    FRIEND_TEST(HeightmapEditorTest, reads_only_brush);
+#endif
+  };
+} // end namespace geoclipmap
+#endif // !HEIGHTMAP_EDITOR_H_
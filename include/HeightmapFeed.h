@@ -0,0 +1,159 @@
+/**
+ * @file HeightmapFeed.h
+ * @author Ollie Nicholls
+ * @brief Heights shared live with another process (e.g. an erosion or flood
+ * simulation) through POSIX shared memory
+ *
+ * The shared memory region holds a header, a ring of the rectangles changed
+ * by each update and then the heights themselves, row-major. The writer
+ * changes heights in place and then publishes the rectangle it changed with
+ * the next sequence number. The reader maps the same heights read-only and
+ * reads them straight from there (see Heightmap's external storage), so
+ * nothing is copied between the simulation and the clipmap textures. Polling
+ * returns the rectangles published since the last poll, or the whole
+ * heightmap if the reader fell so far behind that the ring wrapped. Heights
+ * being written while they're read can be seen half updated, until the
+ * rectangle they're in is published and read again.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef HEIGHTMAP_FEED_H_
+#define HEIGHTMAP_FEED_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ngl/Types.h>
+
+#include "Heightmap.h"
+
+namespace geoclipmap
+{
+  class HeightmapFeed
+  {
+  public:
+    /**
+     * @brief Map a feed created by a HeightmapFeedWriter
+     *
+     * @param _name The name of the shared memory region, e.g. "/erosion"
+     * @return std::unique_ptr<HeightmapFeed> The feed, or nullptr if there is
+     * no such region or it isn't a heightmap feed
+     */
+    static std::unique_ptr<HeightmapFeed> open(const std::string &_name) noexcept;
+    /**
+     * @brief Destroy the HeightmapFeed object, unmapping the region
+     *
+     */
+    ~HeightmapFeed();
+    /**
+     * @brief Get the width of the heightmap
+     *
+     * @return int64_t
+     */
+    int64_t width() const noexcept;
+    /**
+     * @brief Get the depth of the heightmap
+     *
+     * @return int64_t
+     */
+    int64_t depth() const noexcept;
+    /**
+     * @brief Get the heights in the shared memory (row-major), valid for as
+     * long as the feed
+     *
+     * @return const ngl::Real*
+     */
+    const ngl::Real *heights() const noexcept;
+    /**
+     * @brief Get the rectangles changed since the last poll, oldest first
+     *
+     * @param o_rects Set to the changed rectangles, or the whole heightmap if
+     * more were published than the ring holds
+     * @return true If anything changed
+     */
+    bool poll(std::vector<DirtyRect> &o_rects) noexcept;
+    /**
+     * @brief Get the sequence number of the last update read by poll
+     *
+     * @return uint64_t
+     */
+    uint64_t sequence() const noexcept;
+
+  private:
+    // The mapped region
+    void *m_region;
+    // The size of the mapped region in bytes
+    size_t m_size;
+    // The number of updates read by poll so far
+    uint64_t m_sequence = 0;
+
+    /**
+     * @brief Construct a new HeightmapFeed object (see open)
+     *
+     */
+    HeightmapFeed(void *_region, size_t _size) noexcept;
+  };
+
+  class HeightmapFeedWriter
+  {
+  public:
+    /**
+     * @brief Create a feed for a HeightmapFeed to read, e.g. to drive one
+     * from a simulation or a test. The heights start at 0.
+     *
+     * @param _name The name of the shared memory region, e.g. "/erosion"
+     * (replaced if it exists)
+     * @param _width The width of the heightmap
+     * @param _depth The depth of the heightmap
+     * @param _ringSize The most updates a reader can fall behind by before
+     * it has to reread the whole heightmap
+     * @return std::unique_ptr<HeightmapFeedWriter> The writer, or nullptr if
+     * the region couldn't be created
+     */
+    static std::unique_ptr<HeightmapFeedWriter> create(const std::string &_name,
+                                                       int64_t _width,
+                                                       int64_t _depth,
+                                                       uint32_t _ringSize = 256) noexcept;
+    /**
+     * @brief Destroy the HeightmapFeedWriter object, removing the region.
+     * Readers that already have it mapped keep it until they close.
+     *
+     */
+    ~HeightmapFeedWriter();
+    /**
+     * @brief Get the heights in the shared memory (row-major) to write to
+     *
+     * @return ngl::Real*
+     */
+    ngl::Real *heights() noexcept;
+    /**
+     * @brief Tell readers that the heights in [_x0, _x1] x [_y0, _y1] have
+     * changed (clamped to the heightmap)
+     *
+     * @param _x0 The left of the rectangle
+     * @param _y0 The top of the rectangle
+     * @param _x1 The right of the rectangle (inclusive)
+     * @param _y1 The bottom of the rectangle (inclusive)
+     * @return uint64_t The sequence number of the update
+     */
+    uint64_t publish(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) noexcept;
+
+  private:
+    // The name of the region, removed when the writer is destroyed
+    std::string m_name;
+    // The mapped region
+    void *m_region;
+    // The size of the mapped region in bytes
+    size_t m_size;
+
+    /**
+     * @brief Construct a new HeightmapFeedWriter object (see create)
+     *
+     */
+    HeightmapFeedWriter(const std::string &_name, void *_region, size_t _size) noexcept;
+  };
+} // end namespace geoclipmap
+#endif // !HEIGHTMAP_FEED_H_
@@ -0,0 +1,248 @@
+/**
+ * @file HeightmapMosaic.h
+ * @author Ollie Nicholls
+ * @brief Heightmaps of differing resolution layered over each other, e.g.
+ * high resolution surveys of a few areas over a low resolution global base
+ *
+ * The mosaic's samples are on a grid as fine as its finest inset. Each source
+ * covers a rectangle of that grid with one of its samples every spacing
+ * samples of the mosaic, and heights between its samples are interpolated.
+ * Reading a sample takes it from the finest source covering it, fading into
+ * the sources beneath it over the feather at the inset's edges so there is
+ * no step where the resolution changes. Only the sources are held in memory,
+ * so a mosaic costs as much as the data it was made from rather than its
+ * extent at the finest resolution.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef HEIGHTMAP_MOSAIC_H_
+#define HEIGHTMAP_MOSAIC_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ngl/Types.h>
+
+#include "Heightmap.h"
+
+namespace geoclipmap
+{
+  /**
+   * @brief A source of a mosaic as given in a mosaic file (see readLayers)
+   *
+   */
+  struct MosaicLayer
+  {
+    // The source's image
+    std::string image;
+    // Where the source's first sample is in the mosaic (always 0, 0 for the base)
+    int64_t x = 0;
+    int64_t y = 0;
+    // The number of mosaic samples between the source's samples
+    int spacing = 1;
+    // The width of the fade into the sources beneath at the source's edges, in mosaic samples
+    int64_t feather = 16;
+  };
+
+  class HeightmapMosaic
+  {
+  public:
+    /**
+     * @brief Construct a new HeightmapMosaic object covering all of _base
+     *
+     * @param _base The heightmap beneath every inset
+     * @param _spacing The number of mosaic samples between the base's samples
+     * (a power of 2), so the finest inset can have a spacing of 1
+     */
+    HeightmapMosaic(std::unique_ptr<Heightmap> _base, int _spacing) noexcept;
+    /**
+     * @brief Read the sources of a mosaic from a text file. The first line is
+     * "base <image> <spacing>" and each line after it
+     * "inset <image> <x> <y> <spacing> [feather]". Images are relative to the
+     * file and lines starting with # are ignored.
+     *
+     * @param _path The mosaic file
+     * @param o_layers Set to the sources, the base first
+     * @return true If the file was read, false if it couldn't be or a line
+     * isn't understood
+     */
+    static bool readLayers(const std::string &_path, std::vector<MosaicLayer> &o_layers) noexcept;
+    /**
+     * @brief Add an inset over the sources already in the mosaic. Finer
+     * insets are read before coarser ones wherever they overlap, whichever
+     * order they were added in, then later insets before earlier ones.
+     *
+     * @param _inset The inset's heights
+     * @param _x Where the inset's first sample is in the mosaic (a multiple
+     * of _spacing)
+     * @param _y Where the inset's first sample is in the mosaic (a multiple
+     * of _spacing)
+     * @param _spacing The number of mosaic samples between the inset's
+     * samples (a power of 2 no more than the base's)
+     * @param _feather The width of the fade into the sources beneath at the
+     * inset's edges, in mosaic samples (0 for a hard edge)
+     * @return true If it was added, false if it isn't within the base or
+     * isn't on the mosaic's grid
+     */
+    bool addInset(std::unique_ptr<Heightmap> _inset, int64_t _x, int64_t _y, int _spacing, int64_t _feather = 16) noexcept;
+    /**
+     * @brief Get the width of the mosaic in its finest samples
+     *
+     * @return int64_t
+     */
+    int64_t width() const noexcept;
+    /**
+     * @brief Get the depth of the mosaic in its finest samples
+     *
+     * @return int64_t
+     */
+    int64_t depth() const noexcept;
+    /**
+     * @brief Get the number of sources including the base
+     *
+     * @return size_t
+     */
+    size_t sourceCount() const noexcept;
+    /**
+     * @brief Get the number of samples held by all of the sources, against
+     * the width * depth the mosaic covers
+     *
+     * @return size_t
+     */
+    size_t storedSamples() const noexcept;
+    /**
+     * @brief Get the height at _x, _y
+     *
+     * @param _x X coord of the mosaic
+     * @param _y Y coord of the mosaic
+     * @return ngl::Real The height, or 0 outside of the mosaic
+     */
+    ngl::Real sample(int64_t _x, int64_t _y) noexcept;
+    /**
+     * @brief Read _count heights along a row, starting at _x, _y and
+     * stepping _stride each time. Each source is read a row at a time, and
+     * only where a finer source hasn't already given the whole height.
+     *
+     * @param _x X coord of the first sample
+     * @param _y Y coord of the row
+     * @param _stride The distance between samples (> 0)
+     * @param _count The number of samples
+     * @param _out The heights, 0 outside of the mosaic
+     */
+    void readRow(int64_t _x, int64_t _y, int _stride, int _count, ngl::Real *_out) noexcept;
+    /**
+     * @brief Get ready to read the samples at multiples of _stride within
+     * [_x0, _x1] x [_y0, _y1] (see Heightmap::prefetch), for each source
+     * under the region at the stride it will be read at
+     *
+     * @param _x0 The left of the region
+     * @param _y0 The top of the region
+     * @param _x1 The right of the region (inclusive)
+     * @param _y1 The bottom of the region (inclusive)
+     * @param _stride The distance between the samples that will be read
+     */
+    void prefetch(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, int _stride) noexcept;
+    /**
+     * @brief Get some of a region ready ahead of time (see Heightmap::warm)
+     *
+     * @param _x0 The left of the region
+     * @param _y0 The top of the region
+     * @param _x1 The right of the region (inclusive)
+     * @param _y1 The bottom of the region (inclusive)
+     * @param _stride The distance between the samples that will be read
+     * @param _maxTiles The most tiles to decode across every source
+     * @return size_t The number of tiles decoded
+     */
+    size_t warm(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, int _stride, size_t _maxTiles) noexcept;
+    /**
+     * @brief Get whether the mosaic can be read from several threads at
+     * once, which it can't if any of its sources are compressed
+     *
+     * @return true If reads can run at the same time
+     */
+    bool concurrentReads() noexcept;
+
+  private:
+    /**
+     * @brief A heightmap in the mosaic and where it is
+     *
+     */
+    struct Source
+    {
+      std::unique_ptr<Heightmap> heights;
+      // The source's size in its own samples
+      int64_t width;
+      int64_t depth;
+      // The rectangle the source covers in the mosaic (inclusive)
+      int64_t x0;
+      int64_t y0;
+      int64_t x1;
+      int64_t y1;
+      // The number of mosaic samples between the source's samples
+      int spacing;
+      // The width of the fade at the source's edges
+      int64_t feather;
+    };
+
+    // The sources in the order they are read, finest first and the base last
+    std::vector<Source> m_sources;
+    // The size of the mosaic
+    int64_t m_width;
+    int64_t m_depth;
+
+    /**
+     * @brief Read the interpolated heights of a source at samples [_first,
+     * _last) of a row (see readRow)
+     *
+     * @param _source The source, which must cover every sample
+     * @param _x X coord of sample 0 of the row
+     * @param _y Y coord of the row
+     * @param _stride The distance between samples
+     * @param _first The first sample to read
+     * @param _last One past the last sample to read
+     * @param _out The heights, indexed by sample
+     */
+    void readSource(Source &_source, int64_t _x, int64_t _y, int _stride, int _first, int _last, ngl::Real *_out) noexcept;
+    /**
+     * @brief Find the samples of a source under a region of the mosaic and
+     * the stride to read them at
+     *
+     * @param _source The source
+     * @param _x0 The left of the region
+     * @param _y0 The top of the region
+     * @param _x1 The right of the region (inclusive)
+     * @param _y1 The bottom of the region (inclusive)
+     * @param _stride The distance between the samples of the mosaic
+     * @param o_region Set to the source's samples under the region
+     * @param o_stride Set to the distance between the source's samples
+     * @return true If the source is under the region
+     */
+    bool sourceRegion(const Source &_source,
+                      int64_t _x0,
+                      int64_t _y0,
+                      int64_t _x1,
+                      int64_t _y1,
+                      int _stride,
+                      DirtyRect &o_region,
+                      int &o_stride) const noexcept;
+    /**
+     * @brief Get how much of a source's height is used at _x, _y, fading
+     * from 1 inside its feather to 0 at its edge
+     *
+     * @param _source The source, which must cover _x, _y
+     * @param _x X coord of the mosaic
+     * @param _y Y coord of the mosaic
+     * @return ngl::Real
+     */
+    ngl::Real weight(const Source &_source, int64_t _x, int64_t _y) const noexcept;
+
+#ifdef TERRAIN_TESTING
+#include <gtest/gtest.h>
+    FRIEND_TEST(HeightmapMosaicTest, finest_first);
+#endif
+  };
+} // end namespace geoclipmap
+#endif // !HEIGHTMAP_MOSAIC_H_
@@ -0,0 +1,276 @@
+/**
+ * @file HeightmapSequence.h
+ * @author Ollie Nicholls
+ * @brief Heightmaps that change over time (e.g. tides or moving dunes),
+ * stored as a keyframe and then the tiles that changed in each step
+ *
+ * Heights are quantised to a fixed step. The first frame holds every tile of
+ * the heightmap and each later frame only the tiles whose quantised heights
+ * changed, as the change to each height. The changes along each row of a
+ * tile are Rice coded as the difference to the change before them (see
+ * RiceCoder.h), so smooth changes cost a few bits per sample and unchanged
+ * runs next to nothing. The writer works out each frame's changes from the
+ * heights the reader will have, so quantisation errors never add up over a
+ * long sequence.
+ *
+ * Playback keeps the current frame's heights in memory for a Heightmap with
+ * external storage to read in place. The frames after the current one are
+ * decoded ahead of time on the shared ThreadPool, so stepping only has to add
+ * the decoded changes to the tiles they belong to.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef HEIGHTMAP_SEQUENCE_H_
+#define HEIGHTMAP_SEQUENCE_H_
+
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ngl/Types.h>
+
+#include "Heightmap.h"
+
+namespace geoclipmap
+{
+  class HeightmapSequence
+  {
+  public:
+    /**
+     * @brief Open a sequence written by a HeightmapSequenceWriter, reading it
+     * into memory and decoding its first frame
+     *
+     * @param _path The sequence file
+     * @param _lookahead How many frames to decode ahead of the current one
+     * @return std::unique_ptr<HeightmapSequence> The sequence, or nullptr if
+     * it couldn't be read or isn't a heightmap sequence
+     */
+    static std::unique_ptr<HeightmapSequence> open(const std::string &_path, size_t _lookahead = 4) noexcept;
+    /**
+     * @brief Destroy the HeightmapSequence object, waiting for any frames
+     * still being decoded
+     *
+     */
+    ~HeightmapSequence();
+    /**
+     * @brief Get the width of the heightmap
+     *
+     * @return int64_t
+     */
+    int64_t width() const noexcept;
+    /**
+     * @brief Get the depth of the heightmap
+     *
+     * @return int64_t
+     */
+    int64_t depth() const noexcept;
+    /**
+     * @brief Get the number of frames in the sequence
+     *
+     * @return int
+     */
+    int frameCount() const noexcept;
+    /**
+     * @brief Get the number of frames a second the sequence was written to
+     * be played at
+     *
+     * @return ngl::Real
+     */
+    ngl::Real frameRate() const noexcept;
+    /**
+     * @brief Get the current frame
+     *
+     * @return int
+     */
+    int frame() const noexcept;
+    /**
+     * @brief Get the current frame's heights (row-major), valid for as long
+     * as the sequence
+     *
+     * @return const ngl::Real*
+     */
+    const ngl::Real *heights() const noexcept;
+    /**
+     * @brief Move on to the next frame, going back to the first after the
+     * last. Waits if the next frame hasn't been decoded yet.
+     *
+     * @param o_rects Set to the tiles that changed, or the whole heightmap
+     * when going back to the first frame
+     * @return true If any heights changed
+     */
+    bool step(std::vector<DirtyRect> &o_rects) noexcept;
+    /**
+     * @brief Get the number of times step had to wait for a frame to be
+     * decoded
+     *
+     * @return size_t
+     */
+    size_t stalls() const noexcept;
+
+  private:
+    /**
+     * @brief The decoded changes of one frame
+     *
+     */
+    struct DecodedFrame
+    {
+      // The tiles that changed
+      std::vector<uint32_t> tiles;
+      // The change to each height of those tiles in quantisation steps, one tile after another and each row-major
+      std::vector<int32_t> changes;
+    };
+
+    /**
+     * @brief A frame being decoded ahead of time
+     *
+     */
+    struct PendingFrame
+    {
+      int frame;
+      std::shared_ptr<DecodedFrame> decoded;
+      std::future<void> done;
+    };
+
+    // The whole sequence file
+    std::vector<uint8_t> m_data;
+    // Where each frame starts in m_data and how many bytes it has
+    std::vector<std::pair<uint64_t, uint64_t>> m_frames;
+    // The size of the heightmap
+    int64_t m_width = 0;
+    int64_t m_depth = 0;
+    // The width of the tiles
+    int m_tileSize = 0;
+    // The number of tiles across the heightmap
+    int64_t m_tilesX = 0;
+    // The height of one quantisation step
+    ngl::Real m_step = 0.0f;
+    // The frames a second to play at
+    ngl::Real m_frameRate = 0.0f;
+    // The current frame's heights
+    std::vector<ngl::Real> m_heights;
+    // The current frame
+    int m_frame = 0;
+    // How many frames to decode ahead
+    size_t m_lookahead;
+    // The frames after the current one being decoded, in order
+    std::deque<PendingFrame> m_pending;
+    // The number of times step had to wait
+    size_t m_stalls = 0;
+
+    /**
+     * @brief Construct a new HeightmapSequence object (see open)
+     *
+     */
+    HeightmapSequence(size_t _lookahead) noexcept;
+    /**
+     * @brief Decode a frame's changes
+     *
+     * @param _frame The frame
+     * @param o_decoded Set to its changes, left empty if the frame is corrupt
+     */
+    void decodeFrame(int _frame, DecodedFrame &o_decoded) const noexcept;
+    /**
+     * @brief Add a frame's changes to the current heights
+     *
+     * @param _decoded The changes
+     * @param o_rects The tiles changed are appended to this
+     */
+    void applyFrame(const DecodedFrame &_decoded, std::vector<DirtyRect> &o_rects) noexcept;
+    /**
+     * @brief Queue frames to be decoded until there are m_lookahead pending
+     *
+     */
+    void queueFrames() noexcept;
+
+#ifdef TERRAIN_TESTING
+#include <gtest/gtest.h>
+    FRIEND_TEST(HeightmapSequenceTest, changed_tiles);
+#endif
+  };
+
+  class HeightmapSequenceWriter
+  {
+  public:
+    /**
+     * @brief Start writing a sequence
+     *
+     * @param _path The file to write (replaced if it exists)
+     * @param _width The width of the heightmap
+     * @param _depth The depth of the heightmap
+     * @param _step The height of one quantisation step, so every height is
+     * within half of it of the original
+     * @param _frameRate The frames a second the sequence should be played at
+     * @param _tileSize The width of the tiles that changes are stored for
+     * @return std::unique_ptr<HeightmapSequenceWriter> The writer, or nullptr
+     * if the file couldn't be created
+     */
+    static std::unique_ptr<HeightmapSequenceWriter> create(const std::string &_path,
+                                                           int64_t _width,
+                                                           int64_t _depth,
+                                                           ngl::Real _step = 1.0f / 1024.0f,
+                                                           ngl::Real _frameRate = 10.0f,
+                                                           int _tileSize = 64) noexcept;
+    /**
+     * @brief Destroy the HeightmapSequenceWriter object, finishing the file
+     * if finish hasn't been called
+     *
+     */
+    ~HeightmapSequenceWriter();
+    /**
+     * @brief Add the next frame, storing the tiles that changed since the
+     * last one (or every tile for the first)
+     *
+     * @param _heights The frame's heights (width * depth values, row-major)
+     * @return true If it was written
+     */
+    bool addFrame(const ngl::Real *_heights) noexcept;
+    /**
+     * @brief Write the index of frames and close the file
+     *
+     * @return true If the whole file was written
+     */
+    bool finish() noexcept;
+    /**
+     * @brief Get the number of tiles stored so far, including the first
+     * frame's
+     *
+     * @return size_t
+     */
+    size_t tilesWritten() const noexcept;
+
+  private:
+    // The file being written
+    std::ofstream m_file;
+    // The size of the heightmap
+    int64_t m_width;
+    int64_t m_depth;
+    // The height of one quantisation step
+    ngl::Real m_step;
+    // The frames a second to play at
+    ngl::Real m_frameRate;
+    // The width of the tiles
+    int m_tileSize;
+    // The quantised heights the reader will have after the last frame
+    std::vector<int32_t> m_current;
+    // Where each frame starts in the file and how many bytes it has
+    std::vector<std::pair<uint64_t, uint64_t>> m_frames;
+    // Where the next frame starts
+    uint64_t m_offset = 0;
+    // The number of tiles stored so far
+    size_t m_tilesWritten = 0;
+    // Whether finish has been called
+    bool m_finished = false;
+
+    /**
+     * @brief Construct a new HeightmapSequenceWriter object (see create)
+     *
+     */
+    HeightmapSequenceWriter(int64_t _width, int64_t _depth, ngl::Real _step, ngl::Real _frameRate, int _tileSize) noexcept;
+  };
+} // end namespace geoclipmap
+#endif // !HEIGHTMAP_SEQUENCE_H_
@@ -0,0 +1,205 @@
+/**
+ * @file HttpTileReader.h
+ * @author Ollie Nicholls
+ * @brief Reads tiles of a baked heightmap from a tile server over HTTP, with
+ * a pool of persistent connections and a cache of tiles on disk
+ *
+ * Every tile is a Range request for its bytes of the baked file. A batch is
+ * spread over a pool of keep-alive connections, each of which pipelines a few
+ * requests at a time, so many tiles are in flight at once without a new
+ * connection per tile. Tiles that arrive are written to a cache directory, so
+ * a restart only has to fetch what it hasn't seen before. The cache is keyed
+ * by the server's ETag for the file and cleared when that changes, and if the
+ * server can't be reached the cache is used on its own. Only plain http://
+ * URLs and responses with a Content-Length are supported.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef HTTP_TILE_READER_H_
+#define HTTP_TILE_READER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ThreadPool.h"
+#include "TileReader.h"
+
+namespace geoclipmap
+{
+  /**
+   * @brief How an HttpTileReader's tiles were found
+   *
+   */
+  struct HttpStats
+  {
+    // The number of requests sent to the server
+    size_t requests = 0;
+    // The number of tiles found in the disk cache
+    size_t cacheHits = 0;
+    // The number of bytes of tiles fetched from the server
+    size_t bytesFetched = 0;
+    // The number of connections opened (including reconnects)
+    size_t connections = 0;
+    // The number of tiles that couldn't be found anywhere
+    size_t failures = 0;
+  };
+
+  class HttpTileReader : public TileReader
+  {
+  public:
+    /**
+     * @brief Connect to a tile server
+     *
+     * @param _url The baked file on the server, e.g.
+     * http://tiles.example.com:8080/alps.tiles
+     * @param _cacheDirectory Where to keep fetched tiles between runs, empty
+     * to not keep them
+     * @param _connections The number of connections to keep open
+     * @param _pipelineDepth The most requests to send down a connection
+     * before reading the responses
+     * @return std::unique_ptr<HttpTileReader> The reader, or nullptr if the
+     * URL isn't valid, or the server can't be reached and there is nothing
+     * in the cache
+     */
+    static std::unique_ptr<HttpTileReader> open(const std::string &_url,
+                                                const std::string &_cacheDirectory = "",
+                                                size_t _connections = 8,
+                                                size_t _pipelineDepth = 4) noexcept;
+    /**
+     * @brief Destroy the HttpTileReader object, closing its connections
+     *
+     */
+    ~HttpTileReader() override;
+    /**
+     * @brief Read a batch of tiles, from the disk cache where possible and
+     * the server otherwise. Callbacks for fetched tiles run on the
+     * connections' threads.
+     *
+     * @param _reads The tiles to read
+     * @param _callback Called for every read as it completes
+     */
+    void readBatch(const std::vector<TileRead> &_reads, const TileReadCallback &_callback) noexcept override;
+    /**
+     * @brief Get how tiles are read (always Http)
+     *
+     * @return TileReaderBackend
+     */
+    TileReaderBackend backend() const noexcept override;
+    /**
+     * @brief Get whether the file was opened with O_DIRECT (never)
+     *
+     * @return false
+     */
+    bool directIO() const noexcept override;
+    /**
+     * @brief Get whether the server couldn't be reached, so tiles only come
+     * from the disk cache
+     *
+     * @return true If offline
+     */
+    bool offline() const noexcept;
+    /**
+     * @brief Get how the tiles read so far were found
+     *
+     * @return HttpStats
+     */
+    HttpStats stats() const noexcept;
+
+  private:
+    struct Connection
+    {
+      // The socket, -1 when not connected
+      int socket = -1;
+      // Bytes received but not yet parsed, as pipelined responses run together
+      std::string buffer;
+    };
+
+    // Where the server is and the path of the baked file on it
+    std::string m_host;
+    std::string m_port;
+    std::string m_path;
+    // Where fetched tiles are kept, empty for no cache
+    std::string m_cacheDirectory;
+    // The pool of connections, each used by one thread at a time
+    std::vector<Connection> m_connections;
+    // The most requests in flight on one connection
+    size_t m_pipelineDepth;
+    // The threads that drive the connections
+    ThreadPool m_pool;
+    // Set if the server couldn't be reached when opening
+    bool m_offline = false;
+    // Counters for stats(), updated from the connections' threads
+    std::atomic<size_t> m_requests{0};
+    std::atomic<size_t> m_cacheHits{0};
+    std::atomic<size_t> m_bytesFetched{0};
+    std::atomic<size_t> m_connectionsOpened{0};
+    std::atomic<size_t> m_failures{0};
+
+    /**
+     * @brief Construct a new HttpTileReader object (see open)
+     *
+     */
+    HttpTileReader(const std::string &_host,
+                   const std::string &_port,
+                   const std::string &_path,
+                   const std::string &_cacheDirectory,
+                   size_t _connections,
+                   size_t _pipelineDepth) noexcept;
+    /**
+     * @brief Make sure a connection is connected
+     *
+     * @param io_connection The connection
+     * @return true If it is
+     */
+    bool connect(Connection &io_connection) noexcept;
+    /**
+     * @brief Close a connection, e.g. after an error or when the server asks
+     *
+     * @param io_connection The connection
+     */
+    void disconnect(Connection &io_connection) noexcept;
+    /**
+     * @brief Read the next response from a connection
+     *
+     * @param io_connection The connection
+     * @param o_status Set to the response's status code
+     * @param o_headers Set to the response's headers (names in lower case)
+     * @param o_body Set to the body
+     * @param _head Whether the request was a HEAD, whose response has no body
+     * @return true If a whole response was read
+     */
+    bool readResponse(Connection &io_connection, int &o_status, std::string &o_headers, std::string &o_body, bool _head) noexcept;
+    /**
+     * @brief Fetch some tiles down one connection, pipelining the requests
+     * and trying once more on a new connection if it breaks
+     *
+     * @param io_connection The connection
+     * @param _reads The batch being read
+     * @param _indices The reads in the batch to fetch
+     * @param _callback Called for every read
+     */
+    void fetch(Connection &io_connection,
+               const std::vector<TileRead> &_reads,
+               const std::vector<size_t> &_indices,
+               const TileReadCallback &_callback) noexcept;
+    /**
+     * @brief Ask the server for the baked file's ETag and clear the cache if
+     * it's changed since the tiles in it were fetched
+     *
+     * @return true If the server answered
+     */
+    bool validateCache() noexcept;
+    /**
+     * @brief Get the file a tile is cached in
+     *
+     * @param _read The tile
+     * @return std::string
+     */
+    std::string cachePath(const TileRead &_read) const;
+  };
+} // end namespace geoclipmap
+#endif // !HTTP_TILE_READER_H_
@@ -10,6 +10,10 @@
 #ifndef MANAGER_H_
 #define MANAGER_H_
 
+#include <string>
+
+#include "Heightmap.h"
+
 namespace geoclipmap
 {
   class Manager
@@ -46,6 +50,60 @@ namespace geoclipmap
      * @param _r The new R value
      */
     void setR(unsigned char _r);
+    /**
+     * @brief Set how heightmaps should be stored once loaded
+     * 
+     * @param _storage The new storage
+     */
+    void setStorage(HeightmapStorage _storage);
+    /**
+     * @brief Set the memory layout heightmaps should use once loaded
+     * 
+     * @param _layout The new layout
+     */
+    void setLayout(HeightmapLayout _layout);
+    /**
+     * @brief Set the file compressed tiles are streamed from, empty to keep
+     * them in memory
+     * 
+     * @param _tileFile The new tile file
+     */
+    void setTileFile(const std::string &_tileFile);
+    /**
+     * @brief Set how streamed tiles are read
+     * 
+     * @param _backend The new backend
+     */
+    void setTileReader(TileReaderBackend _backend);
+    /**
+     * @brief Set whether streamed tiles are read with O_DIRECT
+     * 
+     * @param _directIO Whether to bypass the page cache
+     */
+    void setDirectIO(bool _directIO);
+    /**
+     * @brief Set where tiles fetched from a tile server are kept between
+     * runs, empty to not keep them
+     * 
+     * @param _tileCache The new cache directory
+     */
+    void setTileCache(const std::string &_tileCache);
+    /**
+     * @brief Set whether terrains fill their coarsest level first and refine
+     * the finer ones over the following frames after starting up or jumping
+     * a long way, rather than filling every level at once
+     * 
+     * @param _progressive Whether to refine progressively
+     */
+    void setProgressive(bool _progressive);
+    /**
+     * @brief Set how many texels terrains may fill each frame, the finer
+     * levels over it being left for the following frames (the coarsest
+     * active level is always filled)
+     * 
+     * @param _texels The new budget, 0 for no limit
+     */
+    void setUpdateBudget(size_t _texels);
 
     /**
      * @brief Get the K value (level of detail)
@@ -79,6 +137,45 @@ namespace geoclipmap
      * @brief Get the R value (The number of levels to show)
      */
     unsigned char R();
+    /**
+     * @brief Get how heightmaps should be stored once loaded
+     */
+    HeightmapStorage storage();
+    /**
+     * @brief Get the memory layout heightmaps should use once loaded
+     */
+    HeightmapLayout layout();
+    /**
+     * @brief Get the file compressed tiles are streamed from (empty if none)
+     */
+    const std::string &tileFile();
+    /**
+     * @brief Get how streamed tiles are read
+     */
+    TileReaderBackend tileReader();
+    /**
+     * @brief Get whether streamed tiles are read with O_DIRECT
+     */
+    bool directIO();
+    /**
+     * @brief Get where tiles fetched from a tile server are kept (empty if
+     * nowhere)
+     */
+    const std::string &tileCache();
+    /**
+     * @brief Get whether terrains refine progressively after starting up or
+     * jumping a long way
+     */
+    bool progressive();
+    /**
+     * @brief Get how many texels terrains may fill each frame (0 for no
+     * limit)
+     */
+    size_t updateBudget();
+    /**
+     * @brief Get how much heights are scaled by when drawn
+     */
+    ngl::Real heightScale();
 
   private:
     Manager(){};
@@ -113,6 +210,24 @@ namespace geoclipmap
     unsigned char m_RMin = 1;
     // The maximum value of R, any higher and the program can crash
     unsigned char m_RMax = 8;
+    // How heightmaps are stored once loaded
+    HeightmapStorage m_storage = HeightmapStorage::Colour;
+    // The memory layout of heightmaps once loaded
+    HeightmapLayout m_layout = HeightmapLayout::RowMajor;
+    // How much heights are scaled by when drawn (heightmap heights are 0-3)
+    ngl::Real m_heightScale = 50.0f;
+    // The file compressed tiles are streamed from, empty to keep them in memory
+    std::string m_tileFile;
+    // How streamed tiles are read
+    TileReaderBackend m_tileReader = TileReaderBackend::IoUring;
+    // Whether streamed tiles are read with O_DIRECT
+    bool m_directIO = false;
+    // Where tiles fetched from a tile server are kept, empty to not keep them
+    std::string m_tileCache;
+    // Whether terrains refine progressively after starting up or jumping a long way
+    bool m_progressive = false;
+    // How many texels terrains may fill each frame, 0 for no limit
+    size_t m_updateBudget = 0;
   };
 
 } // end namespace geoclipmap
@@ -0,0 +1,158 @@
+/**
+ * @file MemoryTracker.h
+ * @author Ollie Nicholls
+ * @brief Keeps a running total of the CPU and GPU memory held by each part
+ * of the engine, reported by the objects that own it
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef MEMORY_TRACKER_H_
+#define MEMORY_TRACKER_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace geoclipmap
+{
+  // The parts of the engine memory is counted against
+  enum class MemorySubsystem
+  {
+    // The heightmap's samples (colours, quantised or compressed) and its min/max pyramid
+    Heightmap,
+    // The decoded tiles of a compressed heightmap
+    TileCache,
+    // The clipmap levels' textures, their heights and their texture buffers
+    ClipmapLevels,
+    // The footprints' vertices and indices and their VBOs
+    Footprints
+  };
+  constexpr size_t k_memorySubsystems = 4;
+
+  /**
+   * @brief The memory held by a subsystem
+   *
+   */
+  struct MemoryUsage
+  {
+    int64_t cpuBytes = 0;
+    int64_t gpuBytes = 0;
+  };
+
+  class MemoryTracker
+  {
+  public:
+    /**
+     * @brief Get the tracker if it exists or create it if it doesn't
+     *
+     * @return MemoryTracker* The tracker shared by the whole engine
+     */
+    static MemoryTracker *getInstance();
+    /**
+     * @brief Get the name of a subsystem, as used in the metrics log
+     *
+     * @param _subsystem The subsystem
+     * @return const char* e.g. "clipmap_levels"
+     */
+    static const char *name(MemorySubsystem _subsystem) noexcept;
+    /**
+     * @brief Add to (or take away from) the memory held by a subsystem, from
+     * any thread
+     *
+     * @param _subsystem The subsystem
+     * @param _cpuBytes The change in CPU bytes
+     * @param _gpuBytes The change in GPU bytes
+     */
+    void add(MemorySubsystem _subsystem, int64_t _cpuBytes, int64_t _gpuBytes) noexcept;
+    /**
+     * @brief Get the memory held by a subsystem
+     *
+     * @param _subsystem The subsystem
+     * @return MemoryUsage
+     */
+    MemoryUsage usage(MemorySubsystem _subsystem) const noexcept;
+    /**
+     * @brief Get the memory held by every subsystem together
+     *
+     * @return MemoryUsage
+     */
+    MemoryUsage total() const noexcept;
+
+  private:
+    // The only tracker
+    static MemoryTracker *m_instance;
+    // The bytes held by each subsystem, indexed by MemorySubsystem
+    std::array<std::atomic<int64_t>, k_memorySubsystems> m_cpuBytes{};
+    std::array<std::atomic<int64_t>, k_memorySubsystems> m_gpuBytes{};
+
+    /**
+     * @brief Construct a new MemoryTracker object (see getInstance)
+     *
+     */
+    MemoryTracker() noexcept = default;
+  };
+
+  class MemoryAccount
+  {
+  public:
+    /**
+     * @brief Construct an empty account of the memory held by an object
+     *
+     * @param _subsystem The subsystem the memory counts against
+     */
+    explicit MemoryAccount(MemorySubsystem _subsystem) noexcept;
+    /**
+     * @brief Construct an account holding the same memory as another, for an
+     * object that is copied with everything it holds
+     *
+     * @param _other The account to copy
+     */
+    MemoryAccount(const MemoryAccount &_other) noexcept;
+    /**
+     * @brief Hold the same memory as another account
+     *
+     * @param _other The account to copy
+     * @return MemoryAccount&
+     */
+    MemoryAccount &operator=(const MemoryAccount &_other) noexcept;
+    /**
+     * @brief Destroy the account, giving back everything it holds
+     *
+     */
+    ~MemoryAccount() noexcept;
+    /**
+     * @brief Set the CPU bytes held, adding the change to the tracker
+     *
+     * @param _bytes The bytes now held
+     */
+    void setCpu(size_t _bytes) noexcept;
+    /**
+     * @brief Set the GPU bytes held, adding the change to the tracker
+     *
+     * @param _bytes The bytes now held
+     */
+    void setGpu(size_t _bytes) noexcept;
+    /**
+     * @brief Get the CPU bytes held
+     *
+     * @return size_t
+     */
+    size_t cpuBytes() const noexcept;
+    /**
+     * @brief Get the GPU bytes held
+     *
+     * @return size_t
+     */
+    size_t gpuBytes() const noexcept;
+
+  private:
+    // The subsystem the memory counts against
+    MemorySubsystem m_subsystem;
+    // The bytes held
+    size_t m_cpuBytes = 0;
+    size_t m_gpuBytes = 0;
+  };
+} // end namespace geoclipmap
+#endif // !MEMORY_TRACKER_H_
@@ -0,0 +1,214 @@
+/**
+ * @file Metrics.h
+ * @author Ollie Nicholls
+ * @brief Counters the engine adds to as it works (texels regenerated, bytes
+ * uploaded, draws...), gathered up each frame for the on screen summary and
+ * written to a log every so often so long runs can be graphed afterwards
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace geoclipmap
+{
+  // Counts added up over each frame
+  enum class Counter
+  {
+    // Texels of the clipmap levels' textures read from the heightmap again
+    TexelsRegenerated,
+    // Bytes of texture data uploaded to the GPU
+    BytesUploaded,
+    // Footprints drawn
+    DrawCalls,
+    // Triangles in the footprints drawn
+    Triangles,
+    // Blocks of the clipmap levels not drawn as their level is inactive (the camera is too high for it to be seen).
+    // There is no frustum culling, so these are the only blocks left out.
+    InactiveLevelBlocks
+  };
+  constexpr size_t k_counters = 5;
+
+  // Values sampled once a frame
+  enum class Gauge
+  {
+    // The most tasks waiting for the thread pool at once
+    WorkerQueueDepth,
+    // The fraction of the decoded tile cache's lookups that hit (0-1)
+    TileCacheHitRate
+  };
+  constexpr size_t k_gauges = 2;
+
+  // Texels are counted for each of up to this many levels (the most L can be)
+  constexpr size_t k_metricsLevels = 12;
+
+  /**
+   * @brief Every counter and gauge for a frame, or added up over several
+   *
+   */
+  struct MetricsFrame
+  {
+    // The time the frame took in milliseconds
+    double frameMs = 0.0;
+    // Indexed by Counter
+    std::array<uint64_t, k_counters> counters{};
+    // The texels regenerated for each level
+    std::array<uint64_t, k_metricsLevels> levelTexels{};
+    // The bytes of texture data uploaded for each level
+    std::array<uint64_t, k_metricsLevels> levelBytes{};
+    // Indexed by Gauge
+    std::array<double, k_gauges> gauges{};
+
+    uint64_t counter(Counter _counter) const noexcept
+    {
+      return counters[static_cast<size_t>(_counter)];
+    }
+
+    double gauge(Gauge _gauge) const noexcept
+    {
+      return gauges[static_cast<size_t>(_gauge)];
+    }
+  };
+
+  class Metrics
+  {
+  public:
+    /**
+     * @brief Get the metrics if they exist or create them if they don't
+     *
+     * @return Metrics* The metrics shared by the whole engine
+     */
+    static Metrics *getInstance();
+    /**
+     * @brief Add to a counter for the current frame, from any thread
+     *
+     * @param _counter The counter
+     * @param _amount The amount to add
+     */
+    void add(Counter _counter, uint64_t _amount) noexcept;
+    /**
+     * @brief Count texels regenerated for a level, both for the level and in
+     * Counter::TexelsRegenerated
+     *
+     * @param _level The level (levels past k_metricsLevels only count
+     * towards the total)
+     * @param _texels The number of texels
+     */
+    void addTexels(int _level, uint64_t _texels) noexcept;
+    /**
+     * @brief Count bytes of texture data uploaded for a level, both for the
+     * level and in Counter::BytesUploaded
+     *
+     * @param _level The level (levels past k_metricsLevels only count
+     * towards the total)
+     * @param _bytes The number of bytes
+     */
+    void addUpload(int _level, uint64_t _bytes) noexcept;
+    /**
+     * @brief Set a gauge for the current frame
+     *
+     * @param _gauge The gauge
+     * @param _value The value
+     */
+    void set(Gauge _gauge, double _value) noexcept;
+    /**
+     * @brief Finish the current frame, keeping what it counted as the last
+     * frame and starting every counter again from 0. Writes a row to the log
+     * once its interval has passed since the last one.
+     *
+     * @param _frameMs The time the frame took in milliseconds
+     */
+    void frameFinished(double _frameMs) noexcept;
+    /**
+     * @brief Get what the last finished frame counted
+     *
+     * @return const MetricsFrame&
+     */
+    const MetricsFrame &lastFrame() const noexcept;
+    /**
+     * @brief Get the number of frames finished
+     *
+     * @return size_t
+     */
+    size_t frameCount() const noexcept;
+    /**
+     * @brief Get a percentile of the recent frames' times
+     *
+     * @param _percentile The percentile (0-1)
+     * @return double The time in milliseconds, or 0 before any frames
+     */
+    double frameTimePercentile(double _percentile) const noexcept;
+    /**
+     * @brief Start writing a row every so often to a log. The log is JSON
+     * lines if the file ends in .json, otherwise CSV with a header row.
+     *
+     * @param _path The file to write (replaced if it exists)
+     * @param _intervalSeconds The time between rows (0 for a row every
+     * frame)
+     * @return true If the file was created
+     */
+    bool openLog(const std::string &_path, double _intervalSeconds) noexcept;
+    /**
+     * @brief Stop writing the log, writing out any frames not yet in a row
+     *
+     */
+    void closeLog() noexcept;
+
+  private:
+    // The only metrics
+    static Metrics *m_instance;
+    // The current frame's counters, indexed by Counter
+    std::array<std::atomic<uint64_t>, k_counters> m_counters{};
+    // The current frame's texels for each level
+    std::array<std::atomic<uint64_t>, k_metricsLevels> m_levelTexels{};
+    // The current frame's bytes uploaded for each level
+    std::array<std::atomic<uint64_t>, k_metricsLevels> m_levelBytes{};
+    // The current frame's gauges, indexed by Gauge
+    std::array<std::atomic<double>, k_gauges> m_gauges{};
+    // What the last finished frame counted
+    MetricsFrame m_lastFrame;
+    // The number of frames finished
+    size_t m_frames = 0;
+    // The times of the recent frames, oldest overwritten first
+    std::vector<double> m_frameTimes;
+    // The log being written
+    std::ofstream m_log;
+    // Whether the log is JSON lines rather than CSV
+    bool m_logJson = false;
+    // The time between the log's rows
+    std::chrono::steady_clock::duration m_logInterval{};
+    // When the log was opened and when its last row was written
+    std::chrono::steady_clock::time_point m_logOpened;
+    std::chrono::steady_clock::time_point m_logRowStart;
+    // The frames since the last row, added up
+    MetricsFrame m_logTotals;
+    // The times of the frames since the last row
+    std::vector<double> m_logFrameTimes;
+
+    /**
+     * @brief Construct a new Metrics object (see getInstance)
+     *
+     */
+    Metrics() noexcept = default;
+    /**
+     * @brief Write the frames since the last row as a row of the log
+     *
+     */
+    void writeLogRow() noexcept;
+
+#ifdef TERRAIN_TESTING
+#include <gtest/gtest.h>
+    FRIEND_TEST(MetricsTest, frames);
+#endif
+  };
+} // end namespace geoclipmap
+#endif // !METRICS_H_
@@ -0,0 +1,322 @@
+/**
+ * @file MinMaxPyramid.h
+ * @author Ollie Nicholls
+ * @brief A pyramid of the lowest and highest heights of ever larger square
+ * blocks of a heightmap, used to find the range of heights in any rectangle
+ * without reading every sample in it
+ *
+ * Level 0 holds the range of each 8x8 block of samples and every level above
+ * holds the range of each 2x2 block of the level below, up to a single block
+ * covering the whole heightmap. bounds() answers a rectangle in O(log n) from
+ * the at most 2x2 blocks of the finest level that cover it, which may be
+ * wider than the rectangle's exact range. exactRange() descends from the top,
+ * using whole blocks that are inside the rectangle and only reading the
+ * samples of the level 0 blocks its edges cut through, so a W x H rectangle
+ * reads O(W + H) samples (fewer when blocks can't widen the range found so
+ * far, none when its edges lie on block boundaries).
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef MIN_MAX_PYRAMID_H_
+#define MIN_MAX_PYRAMID_H_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include <ngl/Types.h>
+
+namespace geoclipmap
+{
+  /**
+   * @brief The lowest and highest height in an area
+   *
+   */
+  struct HeightRange
+  {
+    // The lowest height
+    ngl::Real min = 0.0f;
+    // The highest height
+    ngl::Real max = 0.0f;
+  };
+
+  class MinMaxPyramid
+  {
+  public:
+    /**
+     * @brief Reads _count heights along row _y starting at _x into _out (all
+     * within the heightmap)
+     *
+     */
+    using SampleReader = std::function<void(int64_t _x, int64_t _y, int _count, ngl::Real *_out)>;
+
+    /**
+     * @brief Construct a new MinMaxPyramid object by reading every sample
+     *
+     * @param _width The width of the heightmap
+     * @param _depth The depth of the heightmap
+     * @param _reader Used to read the heightmap's samples
+     */
+    MinMaxPyramid(int64_t _width, int64_t _depth, const SampleReader &_reader) noexcept;
+    /**
+     * @brief Get bounds on the heights in [_x0, _x1] x [_y0, _y1] (clamped to
+     * the heightmap) in O(log n) without reading any samples, from the at
+     * most 2x2 blocks of the finest level that cover the rectangle. The
+     * bounds hold every height in the rectangle but may be wider than its
+     * exact range, the blocks reaching up to twice its size past it.
+     *
+     * @param _x0 The left of the rectangle
+     * @param _y0 The top of the rectangle
+     * @param _x1 The right of the rectangle (inclusive)
+     * @param _y1 The bottom of the rectangle (inclusive)
+     * @return HeightRange The bounds, or 0, 0 if the rectangle is outside the
+     * heightmap
+     */
+    HeightRange bounds(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) const noexcept;
+    /**
+     * @brief Get the exact range of heights in [_x0, _x1] x [_y0, _y1]
+     * (clamped to the heightmap). Slower than bounds: the samples of the
+     * blocks the rectangle's edges cut through are read, O(W + H) of them for
+     * a W x H rectangle.
+     *
+     * @param _x0 The left of the rectangle
+     * @param _y0 The top of the rectangle
+     * @param _x1 The right of the rectangle (inclusive)
+     * @param _y1 The bottom of the rectangle (inclusive)
+     * @param _reader Called as _reader(x, y, count, out) to read count
+     * samples along row y from x into out, like a SampleReader
+     * @return HeightRange The range, or 0, 0 if the rectangle is outside the
+     * heightmap
+     */
+    template <typename Reader>
+    HeightRange exactRange(int64_t _x0,
+                           int64_t _y0,
+                           int64_t _x1,
+                           int64_t _y1,
+                           const Reader &_reader) const noexcept;
+    /**
+     * @brief Get the range of heights over the whole heightmap
+     *
+     * @return HeightRange
+     */
+    HeightRange total() const noexcept;
+    /**
+     * @brief Re-read the samples in [_x0, _x1] x [_y0, _y1] after they have
+     * changed and update only the blocks that contain them
+     *
+     * @param _x0 The left of the changed samples
+     * @param _y0 The top of the changed samples
+     * @param _x1 The right of the changed samples (inclusive)
+     * @param _y1 The bottom of the changed samples (inclusive)
+     * @param _reader Used to read the heightmap's samples
+     */
+    void update(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, const SampleReader &_reader) noexcept;
+    /**
+     * @brief Get the number of levels in the pyramid
+     *
+     * @return int
+     */
+    int levels() const noexcept;
+    /**
+     * @brief Get the number of blocks across _level
+     *
+     * @param _level The level
+     * @return int64_t
+     */
+    int64_t levelWidth(int _level) const noexcept;
+    /**
+     * @brief Get the number of blocks down _level
+     *
+     * @param _level The level
+     * @return int64_t
+     */
+    int64_t levelDepth(int _level) const noexcept;
+    /**
+     * @brief Get the log2 of the width in samples of the blocks of _level
+     *
+     * @param _level The level
+     * @return int
+     */
+    int blockShift(int _level) const noexcept;
+    /**
+     * @brief Get the range of heights over the bilinear cells whose top left
+     * sample is in block _bx, _by of _level, i.e. the block and the samples
+     * one past its right and bottom edges. Those samples are taken from the
+     * neighbouring blocks' ranges so this may be a little wider than the
+     * exact range.
+     *
+     * @param _level The level of the block
+     * @param _bx The block's X index
+     * @param _by The block's Y index
+     * @return HeightRange
+     */
+    HeightRange cellRange(int _level, int64_t _bx, int64_t _by) const noexcept;
+    /**
+     * @brief Get the bytes taken up by the ranges of every level
+     *
+     * @return size_t
+     */
+    size_t memoryBytes() const noexcept;
+
+  private:
+    // Level 0 blocks are 8x8 samples, small enough that reading the samples of
+    // a block cut by a rectangle's edge is cheap but big enough that the
+    // whole pyramid takes under a fifth of a byte per sample
+    static constexpr int k_blockShift = 3;
+    static constexpr int k_blockSize = 1 << k_blockShift;
+    // A range that any height will widen
+    static constexpr HeightRange k_emptyRange{std::numeric_limits<ngl::Real>::max(), std::numeric_limits<ngl::Real>::lowest()};
+
+    struct Level
+    {
+      // The number of blocks across and down this level
+      int64_t width = 0;
+      int64_t depth = 0;
+      // The range of each block (row-major)
+      std::vector<HeightRange> ranges;
+    };
+
+    // The width of the heightmap
+    int64_t m_width;
+    // The depth of the heightmap
+    int64_t m_depth;
+    // The pyramid, level 0 (8x8 sample blocks) first
+    std::vector<Level> m_levels;
+
+    /**
+     * @brief Recompute the level 0 blocks covering [_x0, _x1] x [_y0, _y1] from
+     * the samples, then the blocks above them
+     *
+     */
+    void rebuild(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, const SampleReader &_reader) noexcept;
+    /**
+     * @brief Clamp a rectangle to the heightmap
+     *
+     * @return true If any of it is within the heightmap
+     */
+    bool clamp(int64_t &_x0, int64_t &_y0, int64_t &_x1, int64_t &_y1) const noexcept;
+    /**
+     * @brief Widen _range to hold _other
+     *
+     */
+    static void merge(HeightRange &_range, const HeightRange &_other) noexcept;
+    /**
+     * @brief Add the range of the part of block _bx, _by of _level inside the
+     * rectangle to _range
+     *
+     * @param _level The level of the block
+     * @param _bx The block's X index
+     * @param _by The block's Y index
+     * @param _x0 The left of the rectangle (within the heightmap)
+     * @param _y0 The top of the rectangle (within the heightmap)
+     * @param _x1 The right of the rectangle (inclusive, within the heightmap)
+     * @param _y1 The bottom of the rectangle (inclusive, within the heightmap)
+     * @param _reader Used to read the heightmap's samples
+     * @param _range The range found so far
+     */
+    template <typename Reader>
+    void query(int _level,
+               int64_t _bx,
+               int64_t _by,
+               int64_t _x0,
+               int64_t _y0,
+               int64_t _x1,
+               int64_t _y1,
+               const Reader &_reader,
+               HeightRange &_range) const noexcept;
+
+#ifdef TERRAIN_TESTING
+#include <gtest/gtest.h>
+    FRIEND_TEST(MinMaxPyramidTest, levels);
+#endif
+  };
+
+  template <typename Reader>
+  HeightRange MinMaxPyramid::exactRange(int64_t _x0,
+                                        int64_t _y0,
+                                        int64_t _x1,
+                                        int64_t _y1,
+                                        const Reader &_reader) const noexcept
+  {
+    if (!clamp(_x0, _y0, _x1, _y1))
+    {
+      return HeightRange();
+    }
+
+    HeightRange range = k_emptyRange;
+    query(static_cast<int>(m_levels.size()) - 1, 0, 0, _x0, _y0, _x1, _y1, _reader, range);
+    return range;
+  }
+
+  template <typename Reader>
+  void MinMaxPyramid::query(int _level,
+                            int64_t _bx,
+                            int64_t _by,
+                            int64_t _x0,
+                            int64_t _y0,
+                            int64_t _x1,
+                            int64_t _y1,
+                            const Reader &_reader,
+                            HeightRange &_range) const noexcept
+  {
+    const Level &level = m_levels[static_cast<size_t>(_level)];
+    if (_bx >= level.width || _by >= level.depth)
+    {
+      return;
+    }
+
+    int shift = k_blockShift + _level;
+    int64_t left = _bx << shift;
+    int64_t top = _by << shift;
+    int64_t right = std::min(m_width, (_bx + 1) << shift) - 1;
+    int64_t bottom = std::min(m_depth, (_by + 1) << shift) - 1;
+    if (right < _x0 || left > _x1 || bottom < _y0 || top > _y1)
+    {
+      return;
+    }
+
+    // Nothing in this block can widen what has been found already
+    const HeightRange &range = level.ranges[static_cast<size_t>(_by * level.width + _bx)];
+    if (range.min >= _range.min && range.max <= _range.max)
+    {
+      return;
+    }
+
+    if (left >= _x0 && right <= _x1 && top >= _y0 && bottom <= _y1)
+    {
+      merge(_range, range);
+      return;
+    }
+
+    if (_level == 0)
+    {
+      // A block cut by the rectangle's edge, read the samples inside it
+      std::array<ngl::Real, k_blockSize> samples;
+      int64_t x0 = std::max(left, _x0);
+      int count = static_cast<int>(std::min(right, _x1) - x0 + 1);
+      for (int64_t y = std::max(top, _y0); y <= std::min(bottom, _y1); y++)
+      {
+        _reader(x0, y, count, samples.data());
+        for (int i = 0; i < count; i++)
+        {
+          _range.min = std::min(_range.min, samples[static_cast<size_t>(i)]);
+          _range.max = std::max(_range.max, samples[static_cast<size_t>(i)]);
+        }
+      }
+      return;
+    }
+
+    for (int64_t cy = _by * 2; cy < _by * 2 + 2; cy++)
+    {
+      for (int64_t cx = _bx * 2; cx < _bx * 2 + 2; cx++)
+      {
+        query(_level - 1, cx, cy, _x0, _y0, _x1, _y1, _reader, _range);
+      }
+    }
+  }
+} // end namespace geoclipmap
+#endif // !MIN_MAX_PYRAMID_H_
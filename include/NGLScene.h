@@ -10,6 +10,8 @@
 #ifndef NGLSCENE_H_
 #define NGLSCENE_H_
 
+#include <array>
+#include <chrono>
 #include <memory>
 
 #include <ngl/Mat4.h>
@@ -22,12 +24,27 @@
 #include <QSet>
 
 #include "Camera.h"
+#include "CameraPath.h"
 #include "ClipmapLevel.h"
 #include "Footprint.h"
+#include "FrameStats.h"
 #include "Heightmap.h"
+#include "HeightmapEditor.h"
+#include "HeightmapFeed.h"
+#include "HeightmapMosaic.h"
+#include "HeightmapSequence.h"
 #include "Manager.h"
+#include "MemoryTracker.h"
+#include "Metrics.h"
+#include "QualityGovernor.h"
+#include "RayCaster.h"
 #include "Terrain.h"
+#include "ThreadPool.h"
+#include "TilePrefetcher.h"
+#include "Trace.h"
+#include "UpdateCostBuffer.h"
 #include "ViewAxis.h"
+#include "Viewshed.h"
 #include "WindowParams.h"
 
 namespace geoclipmap
@@ -65,6 +82,45 @@ namespace geoclipmap
      * @param _h The new height
      */
     void resizeGL(int _w, int _h) override;
+    /**
+     * @brief Record the camera, the terrain's position and the clipmap
+     * settings of every frame drawn from now on
+     * 
+     * @param _path The camera path file to write
+     * @return true If the file was created
+     */
+    bool recordPath(const std::string &_path);
+    /**
+     * @brief Draw the frames of a recorded camera path one after another as
+     * fast as possible instead of following the mouse and keyboard, then
+     * print the percentiles of what the frames cost and quit
+     * 
+     * @param _path The camera path file to play
+     * @param _frames The number of frames to draw, playing the path again
+     * from the start if it is shorter (0 to play it once)
+     * @param _statsPath A CSV file to write every frame's costs to, or empty
+     * for none
+     * @return true If the path was read
+     */
+    bool replayPath(const std::string &_path, size_t _frames, const std::string &_statsPath);
+    /**
+     * @brief Centre the terrain under the camera every frame, so the
+     * clipmap follows the camera as it flies rather than only moving with
+     * the arrow keys
+     * 
+     * @param _follow Whether to follow the camera
+     */
+    void setFollowCamera(bool _follow) noexcept;
+    /**
+     * @brief Turn the terrain's quality down or up as it's drawn to hold a
+     * frame time (see QualityGovernor)
+     * 
+     * @param _targetMs The frame time to hold, in milliseconds
+     * @param _logPath A CSV file to write every change made to, or empty
+     * for none (they are printed either way)
+     * @return true If the log was created
+     */
+    bool setGovernor(double _targetMs, const std::string &_logPath);
 
   private:
     /**
@@ -85,6 +141,22 @@ namespace geoclipmap
      * @param _event the QMouseEvent used to query data about the mouse buttons
      */
     void mousePressEvent(QMouseEvent *_event) override;
+    /**
+     * @brief A Qt Event that is called whenever a mouse button is double
+     * clicked, used to pick the point on the terrain under the mouse
+     * 
+     * @param _event the QMouseEvent used to query data about the mouse buttons
+     */
+    void mouseDoubleClickEvent(QMouseEvent *_event) override;
+    /**
+     * @brief Cast a ray from the camera through a point on the window and find
+     * where it hits the heightmap
+     * 
+     * @param _x The X coord in the window (logical pixels)
+     * @param _y The Y coord in the window (logical pixels)
+     * @return RayHit Where the ray hit, in heightmap space
+     */
+    RayHit pick(int _x, int _y);
     /**
      * @brief Loads the heightmap file into a terrain and sets up other terrain
      * related computations
@@ -92,10 +164,80 @@ namespace geoclipmap
      */
     void generateTerrain();
     /**
-     * @brief Regenerates the terrain using any new settings in the Manager
+     * @brief Load an image into a heightmap whose heights are the brightness
+     * of its pixels
+     * 
+     * @param _name The image file
+     * @return std::unique_ptr<Heightmap> 
+     */
+    std::unique_ptr<Heightmap> loadImage(const std::string &_name);
+    /**
+     * @brief Change the terrain in place to match any new settings in the
+     * Manager (see Terrain::reconfigure)
+     * 
+     */
+    void reconfigureTerrain();
+    /**
+     * @brief Show what can be seen from the picked point (or the middle of the
+     * terrain if nothing has been picked) as an overlay, or hide it if it is
+     * already showing
+     * 
+     */
+    void toggleViewshed();
+    /**
+     * @brief Put the camera, terrain (including whether it follows the
+     * camera) and clipmap settings back to how they were for a frame of a
+     * camera path
+     * 
+     * @param _frame The frame
+     */
+    void applyPathFrame(const CameraPathFrame &_frame);
+    /**
+     * @brief Read back the GPU times of the replayed frames whose timers
+     * have finished
+     * 
+     * @param _wait Whether to wait for the timers still running rather than
+     * leaving them for later
+     */
+    void readGpuTimers(bool _wait);
+    /**
+     * @brief Print the percentiles of the replayed frames' costs, write them
+     * out if asked to and quit
+     * 
+     */
+    void finishReplay();
+    /**
+     * @brief Collect the GPU's zones of a trace being captured, writing the
+     * trace out once its last frame has been drawn
+     * 
+     */
+    void traceFrameFinished();
+    /**
+     * @brief Add what the engine counted outside of its own classes to the
+     * metrics and finish the frame's counters
+     * 
+     * @param _frameMs The time the frame took in milliseconds
+     */
+    void metricsFrameFinished(double _frameMs);
+    /**
+     * @brief Note the time to the first frame and to full detail of the
+     * terrain's latest fill, and keep drawing while it is still refining
+     * 
+     */
+    void fillFrameFinished();
+    /**
+     * @brief Give the governor, if there is one, what the frame cost and
+     * reconfigure the terrain if it changed K
+     * 
+     * @param _updateMs The time spent updating the terrain in milliseconds
+     */
+    void governorFrameFinished(double _updateMs);
+    /**
+     * @brief Get a brush around the picked point for editing the terrain
      * 
+     * @return BrushArea The brush, covering nothing if no point is picked
      */
-    void regenerateTerrain();
+    BrushArea pickedBrush() const;
     /**
      * @brief Draw the help text to the screen
      * 
@@ -110,12 +252,75 @@ namespace geoclipmap
     std::string m_imageName;
     // The heightmap that the image is loaded into
     Heightmap *m_heightmap;
+    // The live feed the heightmap reads from, if it is shm://
+    std::unique_ptr<HeightmapFeed> m_feed;
+    // The regions changed by the feed or sequence since the last frame
+    std::vector<DirtyRect> m_feedRects;
+    // The sequence the heightmap reads from, if it is a .gcseq file
+    std::unique_ptr<HeightmapSequence> m_sequence;
+    // Whether the sequence is playing
+    bool m_playingSequence = false;
+    // Times the sequence's playback since it last started
+    QElapsedTimer m_sequenceClock;
+    // The number of sequence steps applied since the clock started
+    int64_t m_sequenceSteps = 0;
     // The generated terrain
-    Terrain *m_terrain;
-    // The location of the terrain in X
-    ngl::Real m_terrainX = 0;
-    // The location of the terrain in Y
-    ngl::Real m_terrainY = 0;
+    std::unique_ptr<Terrain> m_terrain;
+    // Decodes the tiles the terrain is heading towards before they are needed
+    std::unique_ptr<TilePrefetcher> m_prefetcher;
+    // Casts rays at the heightmap for picking
+    std::unique_ptr<RayCaster> m_rayCaster;
+    // The last point picked on the terrain
+    RayHit m_picked;
+    // What can be seen from the observer
+    std::unique_ptr<Viewshed> m_viewshed;
+    // Edits the heightmap around the picked point
+    std::unique_ptr<HeightmapEditor> m_editor;
+    // Whether the viewshed is shown on the terrain
+    bool m_showViewshed = false;
+    // When the terrain's latest fill started, once a frame of it has been drawn
+    std::chrono::steady_clock::time_point m_fillShown;
+    // The time in milliseconds from the latest fill starting to its first frame and to every level being drawn (-1
+    // until then)
+    double m_timeToFirstFrame = -1.0;
+    double m_timeToFullDetail = -1.0;
+    // Whether the terrain is coloured by what it cost to update rather than by height
+    bool m_showUpdateCosts = false;
+    // Each level's update costs for the shader, only created once they are first shown
+    std::unique_ptr<UpdateCostBuffer> m_updateCosts;
+    // The location of the terrain in X (the sample under the world's origin when following the camera)
+    int64_t m_terrainX = 0;
+    // The location of the terrain in Y (the sample under the world's origin when following the camera)
+    int64_t m_terrainY = 0;
+    // Records every frame drawn, if recording
+    std::unique_ptr<CameraPathWriter> m_pathWriter;
+    // The camera path being replayed, if replaying
+    std::unique_ptr<CameraPath> m_replay;
+    // The path file being replayed
+    std::string m_replayName;
+    // The number of frames to replay
+    size_t m_replayFrames = 0;
+    // The next frame of the replay
+    size_t m_replayFrame = 0;
+    // Where to write the replayed frames' costs
+    std::string m_statsPath;
+    // What each replayed frame cost
+    FrameStats m_frameStats;
+    // When the last replayed frame started
+    std::chrono::steady_clock::time_point m_lastFrameStart;
+    // GPU timers for the last few frames replayed or governed, read back once they finish so the CPU never waits on
+    // the GPU
+    std::array<GLuint, 4> m_gpuTimers{};
+    // The frame each timer is timing, or SIZE_MAX if it isn't timing one
+    std::array<size_t, 4> m_gpuTimerFrames;
+    // The frames timed on the GPU
+    size_t m_timedFrames = 0;
+    // The GPU time of the latest frame read back, in milliseconds (negative until one is)
+    double m_lastGpuMs = -1.0;
+    // Turns the terrain's quality down or up to hold a frame time, if asked to
+    std::unique_ptr<QualityGovernor> m_governor;
+    // Times the texture uploads and draws on the GPU while a trace is being captured
+    std::unique_ptr<GpuTrace> m_gpuTrace;
     // The view axis that shows orientation of the world
     ViewAxis *m_viewAxis;
     // Camera object for viewing the scene
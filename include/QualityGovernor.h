@@ -0,0 +1,173 @@
+/**
+ * @file QualityGovernor.h
+ * @author Ollie Nicholls
+ * @brief Watches what frames cost on the CPU and the GPU and turns the
+ * terrain's quality (K, R and the update budget) down or up to hold a target
+ * frame time, logging every change it makes
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef QUALITY_GOVERNOR_H_
+#define QUALITY_GOVERNOR_H_
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+
+namespace geoclipmap
+{
+  // The settings the governor changes
+  enum class GovernorSetting
+  {
+    // The levels the terrain may fill each frame (Manager::updateBudget), 0 for no limit
+    UpdateBudget,
+    // The number of active levels below the finest (Manager::R)
+    R,
+    // The size of every level (Manager::K)
+    K
+  };
+
+  /**
+   * @brief A change the governor made and what it was measuring when it did
+   *
+   */
+  struct GovernorDecision
+  {
+    // The frames the governor had seen
+    size_t frame = 0;
+    // The mean time spent updating the terrain on the CPU over the frames decided on, in milliseconds
+    double cpuUpdateMs = 0.0;
+    // The mean time the GPU spent on those frames, in milliseconds (negative if it isn't known)
+    double gpuMs = -1.0;
+    // The setting changed
+    GovernorSetting setting = GovernorSetting::UpdateBudget;
+    // The setting's value before and after
+    int from = 0;
+    int to = 0;
+    // Why it was changed
+    const char *reason = "";
+  };
+
+  class QualityGovernor
+  {
+  public:
+    /**
+     * @brief Construct a new QualityGovernor object, starting from the
+     * Manager's settings
+     *
+     * @param _targetMs The frame time to hold, in milliseconds
+     */
+    explicit QualityGovernor(double _targetMs) noexcept;
+    /**
+     * @brief Destroy the QualityGovernor object, closing its log
+     *
+     */
+    ~QualityGovernor() noexcept;
+    QualityGovernor(const QualityGovernor &) = delete;
+    QualityGovernor &operator=(const QualityGovernor &) = delete;
+    /**
+     * @brief Write every decision to a CSV file from now on
+     *
+     * @param _path The file to write, replacing it if it exists
+     * @return true If the file was created
+     */
+    bool openLog(const std::string &_path) noexcept;
+    /**
+     * @brief Add what a frame cost, changing a setting in the Manager if the
+     * frames since the last change have been over the target (or well under
+     * it for long enough). The terrain has to be reconfigured after K has
+     * changed (see Terrain::reconfigure).
+     *
+     * @param _cpuUpdateMs The time spent updating the terrain on the CPU
+     * (moving it, filling levels), in milliseconds
+     * @param _gpuMs The time the GPU spent on a recent frame, in
+     * milliseconds, or negative if it isn't known
+     * @param o_decision Set to the change made, if any
+     * @return true If a setting was changed
+     */
+    bool frameFinished(double _cpuUpdateMs, double _gpuMs, GovernorDecision &o_decision) noexcept;
+    /**
+     * @brief Get the frame time being held
+     *
+     * @return double The target in milliseconds
+     */
+    double targetMs() const noexcept;
+    /**
+     * @brief Get the levels the terrain may fill each frame
+     *
+     * @return int The number of levels, 0 for no limit
+     */
+    int budgetLevels() const noexcept;
+    /**
+     * @brief Get the name of a setting as it is logged
+     *
+     */
+    static const char *name(GovernorSetting _setting) noexcept;
+
+  private:
+    // The frame time to hold
+    double m_targetMs;
+    // The frames seen
+    size_t m_frames = 0;
+    // The frames still to be ignored after a change, while the terrain fills afresh
+    size_t m_settling = 0;
+    // The frames measured since the last decision could be made, and what they added up to
+    size_t m_windowFrames = 0;
+    double m_cpuSum = 0.0;
+    double m_gpuSum = 0.0;
+    size_t m_gpuFrames = 0;
+    // The windows in a row that have been well under the target
+    size_t m_headroom = 0;
+    // The windows in a row well under the target needed to turn the quality up, doubled each time turning it up
+    // puts the frames over the target straight away
+    size_t m_raiseAfter;
+    // Whether the last change turned the quality up
+    bool m_raised = false;
+    // The levels the terrain may fill each frame, 0 for no limit
+    int m_budgetLevels = 0;
+    // Every decision, if logging
+    std::ofstream m_log;
+
+    /**
+     * @brief Turn the quality down, cutting whichever of the GPU's and the
+     * CPU's work is furthest over its target
+     *
+     * @param _gpuBound Whether the GPU is furthest over
+     * @param o_decision Set to the change made
+     * @return true If a setting could be turned down
+     */
+    bool lower(bool _gpuBound, GovernorDecision &o_decision) noexcept;
+    /**
+     * @brief Turn the quality up, the update budget first as it's the
+     * cheapest to get back
+     *
+     * @param o_decision Set to the change made
+     * @return true If a setting could be turned up
+     */
+    bool raise(GovernorDecision &o_decision) noexcept;
+    /**
+     * @brief Change a setting in the Manager
+     *
+     * @param _setting The setting
+     * @param _to The value to change it to
+     * @param _reason Why it is changed
+     * @param o_decision Set to the change made
+     * @return true If the setting changed (the Manager keeps K and R within
+     * their limits)
+     */
+    bool change(GovernorSetting _setting, int _to, const char *_reason, GovernorDecision &o_decision) noexcept;
+    /**
+     * @brief Set the Manager's update budget from the budget in levels,
+     * which depends on K
+     *
+     */
+    void applyBudget() noexcept;
+
+#ifdef TERRAIN_TESTING
+#include <gtest/gtest.h>
+    FRIEND_TEST(QualityGovernorTest, hysteresis);
+#endif
+  };
+} // end namespace geoclipmap
+#endif // !QUALITY_GOVERNOR_H_
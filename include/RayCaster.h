@@ -0,0 +1,135 @@
+/**
+ * @file RayCaster.h
+ * @author Ollie Nicholls
+ * @brief Finds where rays hit a heightmap, e.g. for picking, placing markers
+ * and line of sight checks
+ *
+ * Rays are in heightmap space: x and y in samples and z in (unscaled) heights.
+ * The surface between each 2x2 group of samples is their bilinear
+ * interpolation, the same surface HeightQuery gives heights on. The
+ * heightmap's min/max pyramid is walked front to back along the ray, skipping
+ * every block the ray passes over the top of, so only the cells near the
+ * surface are ever tested.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef RAY_CASTER_H_
+#define RAY_CASTER_H_
+
+#include <cstdint>
+#include <limits>
+
+#include <ngl/Vec3.h>
+
+#include "Heightmap.h"
+
+namespace geoclipmap
+{
+  /**
+   * @brief Where a ray hit the heightmap
+   *
+   */
+  struct RayHit
+  {
+    // Whether the ray hit the heightmap at all (nothing else is set if not)
+    bool hit = false;
+    // The position of the hit in heightmap space
+    ngl::Vec3 position;
+    // The distance along the ray to the hit
+    ngl::Real distance = 0.0f;
+    // The sample nearest the hit
+    int64_t sampleX = 0;
+    int64_t sampleY = 0;
+  };
+
+  class RayCaster
+  {
+  public:
+    /**
+     * @brief Construct a new RayCaster object
+     *
+     * @param _heightmap The heightmap to cast rays at
+     */
+    explicit RayCaster(Heightmap *_heightmap) noexcept;
+    /**
+     * @brief Find the first place a ray hits the heightmap. Only the
+     * heightmap itself can be hit, not the 0 heights around it.
+     *
+     * @param _origin The start of the ray in heightmap space
+     * @param _direction The direction of the ray (any non-zero length)
+     * @param _maxDistance How far along the ray to look
+     * @return RayHit
+     */
+    RayHit cast(const ngl::Vec3 &_origin,
+                const ngl::Vec3 &_direction,
+                ngl::Real _maxDistance = std::numeric_limits<ngl::Real>::max()) noexcept;
+    /**
+     * @brief Cast many rays, split across the shared ThreadPool (except for
+     * compressed heightmaps, whose tile cache is only safe to use from one
+     * thread)
+     *
+     * @param _origins The start of each ray
+     * @param _directions The direction of each ray
+     * @param _count The number of rays
+     * @param o_hits Set to where each ray hit (_count values)
+     * @param _maxDistance How far along each ray to look
+     */
+    void castBatch(const ngl::Vec3 *_origins,
+                   const ngl::Vec3 *_directions,
+                   size_t _count,
+                   RayHit *o_hits,
+                   ngl::Real _maxDistance = std::numeric_limits<ngl::Real>::max()) noexcept;
+
+  private:
+    // The heightmap to cast rays at
+    Heightmap *m_heightmap;
+
+    /**
+     * @brief Find where a ray first meets the bilinear surface of cell _cx, _cy
+     * (the samples _cx, _cy to _cx + 1, _cy + 1) between _tEnter and _tExit
+     *
+     * @param _origin The start of the ray
+     * @param _direction The direction of the ray
+     * @param _cx The cell's X coord
+     * @param _cy The cell's Y coord
+     * @param _tEnter Where the ray enters the cell (in multiples of _direction)
+     * @param _tExit Where the ray leaves the cell
+     * @param o_t Set to where the ray hit the surface
+     * @return true If the ray hit the surface in the cell
+     */
+    bool intersectCell(const ngl::Vec3 &_origin,
+                       const ngl::Vec3 &_direction,
+                       int64_t _cx,
+                       int64_t _cy,
+                       double _tEnter,
+                       double _tExit,
+                       double &o_t) noexcept;
+    /**
+     * @brief Walk the cells of level 0 block _bx, _by in the order the ray
+     * passes through them, between _tEnter and _tExit
+     *
+     * @param _origin The start of the ray
+     * @param _direction The direction of the ray
+     * @param _bx The block's X index
+     * @param _by The block's Y index
+     * @param _tEnter Where the ray enters the block
+     * @param _tExit Where the ray leaves the block
+     * @param o_t Set to where the ray hit the surface
+     * @return true If the ray hit the surface in the block
+     */
+    bool marchBlock(const ngl::Vec3 &_origin,
+                    const ngl::Vec3 &_direction,
+                    int64_t _bx,
+                    int64_t _by,
+                    double _tEnter,
+                    double _tExit,
+                    double &o_t) noexcept;
+
+#ifdef TERRAIN_TESTING
+#include <gtest/gtest.h>
+    FRIEND_TEST(RayCasterTest, matches_every_cell);
+#endif
+  };
+} // end namespace geoclipmap
+#endif // !RAY_CASTER_H_
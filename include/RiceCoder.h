@@ -0,0 +1,213 @@
+/**
+ * @file RiceCoder.h
+ * @author Ollie Nicholls
+ * @brief The adaptive Rice coding used for the residuals of compressed
+ * heightmap tiles and the deltas of heightmap sequences
+ *
+ * Residuals are zigzagged to unsigned values and Rice coded, with the Rice
+ * parameter following the average size of recent values. Runs of 16 zero
+ * residuals cost a single bit. The bit reader and writer are defined here so
+ * decoding stays inlined into the loops that use it.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef RICE_CODER_H_
+#define RICE_CODER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace geoclipmap
+{
+  // Residuals whose unary part would be longer than this are escaped and written out in full
+  constexpr uint32_t k_escapeLength = 32;
+
+  /**
+   * @brief Writes bits least significant first into a byte vector
+   *
+   */
+  class BitWriter
+  {
+  public:
+    explicit BitWriter(std::vector<uint8_t> &_out) : m_out{_out} {}
+
+    void write(uint64_t _value, uint32_t _count)
+    {
+      m_buffer |= (_value & ((1ull << _count) - 1)) << m_count;
+      m_count += _count;
+      while (m_count >= 8)
+      {
+        m_out.push_back(static_cast<uint8_t>(m_buffer));
+        m_buffer >>= 8;
+        m_count -= 8;
+      }
+    }
+
+    void flush()
+    {
+      if (m_count > 0)
+      {
+        m_out.push_back(static_cast<uint8_t>(m_buffer));
+      }
+      m_buffer = 0;
+      m_count = 0;
+    }
+
+  private:
+    std::vector<uint8_t> &m_out;
+    uint64_t m_buffer = 0;
+    uint32_t m_count = 0;
+  };
+
+  /**
+   * @brief Reads bits written by BitWriter
+   *
+   */
+  class BitReader
+  {
+  public:
+    BitReader(const uint8_t *_data, size_t _size) : m_data{_data}, m_end{_data + _size} {}
+
+    uint32_t read(uint32_t _count)
+    {
+      refill();
+      uint32_t value = static_cast<uint32_t>(m_buffer & ((1ull << _count) - 1));
+      m_buffer >>= _count;
+      m_count -= _count;
+      return value;
+    }
+
+    uint32_t readUnary()
+    {
+      uint32_t ones = 0;
+      while (ones < k_escapeLength)
+      {
+        refill();
+        if ((m_buffer & 1) == 0)
+        {
+          // Consume the terminating zero
+          m_buffer >>= 1;
+          m_count--;
+          break;
+        }
+        m_buffer >>= 1;
+        m_count--;
+        ones++;
+      }
+      return ones;
+    }
+
+  private:
+    void refill()
+    {
+      // Reading past the end yields zeros which is fine as the tile knows how many values it holds
+      while (m_count <= 56)
+      {
+        uint64_t byte = m_data < m_end ? *m_data++ : 0;
+        m_buffer |= byte << m_count;
+        m_count += 8;
+      }
+    }
+
+    const uint8_t *m_data;
+    const uint8_t *m_end;
+    uint64_t m_buffer = 0;
+    uint32_t m_count = 0;
+  };
+
+  inline uint32_t zigzag(int32_t _value)
+  {
+    return (static_cast<uint32_t>(_value) << 1) ^ static_cast<uint32_t>(_value >> 31);
+  }
+
+  inline int32_t unzigzag(uint32_t _value)
+  {
+    return static_cast<int32_t>(_value >> 1) ^ -static_cast<int32_t>(_value & 1);
+  }
+
+  // Residuals are coded in groups with a flag saying whether the group is all zero, so flat ground costs
+  // a fraction of a bit per sample
+  constexpr size_t k_groupSize = 16;
+
+  /**
+   * @brief Tracks the average size of recently coded values to choose the Rice parameter for the next one,
+   * similar to the adaptive coding in JPEG-LS. Encoder and decoder update it identically.
+   *
+   */
+  struct RiceState
+  {
+    uint32_t total = 4;
+    uint32_t count = 1;
+
+    uint32_t k() const
+    {
+      uint32_t k = 0;
+      while ((count << k) < total && k < 24)
+      {
+        k++;
+      }
+      return k;
+    }
+
+    void update(uint32_t _value)
+    {
+      total += _value;
+      count++;
+      if (count == 32)
+      {
+        total >>= 1;
+        count >>= 1;
+      }
+    }
+  };
+
+  /**
+   * @brief Adaptively Rice code a run of residuals (e.g. the residuals of a
+   * tile), appending the bits to _out
+   *
+   * @param _residuals The residuals
+   * @param o_out The coded bits are appended to this
+   */
+  void riceEncode(const std::vector<int32_t> &_residuals, std::vector<uint8_t> &o_out);
+
+  /**
+   * @brief Decodes residuals written by riceEncode one at a time
+   *
+   */
+  class RiceDecoder
+  {
+  public:
+    RiceDecoder(const std::vector<uint8_t> &_bits) : m_reader{_bits.data(), _bits.size()} {}
+    RiceDecoder(const uint8_t *_data, size_t _size) : m_reader{_data, _size} {}
+
+    int32_t next()
+    {
+      if (m_remaining == 0)
+      {
+        m_remaining = k_groupSize;
+        m_zeroGroup = m_reader.read(1) == 0;
+      }
+      m_remaining--;
+
+      if (m_zeroGroup)
+      {
+        return 0;
+      }
+
+      uint32_t k = m_state.k();
+      uint32_t quotient = m_reader.readUnary();
+      uint32_t value = quotient == k_escapeLength ? m_reader.read(32) : (quotient << k) | m_reader.read(k);
+      m_state.update(value);
+      return unzigzag(value);
+    }
+
+  private:
+    BitReader m_reader;
+    RiceState m_state;
+    size_t m_remaining = 0;
+    bool m_zeroGroup = false;
+  };
+} // end namespace geoclipmap
+#endif // !RICE_CODER_H_
@@ -9,6 +9,9 @@
 #ifndef TERRAIN_H_
 #define TERRAIN_H_
 
+#include <chrono>
+#include <cstdint>
+
 #include <ngl/Vec2.h>
 #include <ngl/Vec3.h>
 
@@ -28,6 +31,15 @@ namespace geoclipmap
      * @param _heightmap The height map to initialise the Terrain object with
      */
     Terrain(Heightmap *_heightmap) noexcept;
+    /**
+     * @brief Destroy the Terrain object along with its clipmap levels,
+     * footprints and locations (so a GL context must be current if they
+     * have been drawn)
+     * 
+     */
+    ~Terrain() noexcept;
+    Terrain(const Terrain &) = delete;
+    Terrain &operator=(const Terrain &) = delete;
     /**
      * @brief Return a vector of all the clipmaps that have been generated
      * 
@@ -53,6 +65,22 @@ namespace geoclipmap
      * 
      */
     void initialize() noexcept;
+    /**
+     * @brief Change the terrain to match the Manager after K, L or R have
+     * changed, keeping the levels, their buffers and the overlay. Footprints
+     * are only rebuilt if K changed and levels are only added or removed if
+     * L changed, then every level is filled afresh as on startup. R only
+     * needs the active levels to be set again.
+     * 
+     * @return true If K or L had changed
+     */
+    bool reconfigure() noexcept;
+    /**
+     * @brief Start a new frame's update budget (see Manager::updateBudget),
+     * to be called once a frame before the terrain is moved
+     * 
+     */
+    void beginFrame() noexcept;
     /**
      * @brief Move the terrain in X and Y and then recompute the terrain at that
      * position
@@ -61,12 +89,50 @@ namespace geoclipmap
      * @param _y The amount to move in Y
      */
     void move(float _x, float _y) noexcept;
+    /**
+     * @brief Move the terrain so it is centred on heightmap sample _x, _y and 
+     * then recompute the terrain at that position. Only the levels whose
+     * origins change have their textures filled again.
+     * 
+     * @param _x The sample to centre on in X
+     * @param _y The sample to centre on in Y
+     * @param _fraction How far past the sample to centre on, whole samples
+     * are carried over to _x, _y
+     */
+    void moveTo(int64_t _x, int64_t _y, ngl::Vec2 _fraction = ngl::Vec2()) noexcept;
+    /**
+     * @brief Get the whole heightmap sample the terrain is centred on in X
+     * 
+     * @return int64_t 
+     */
+    int64_t positionX() const noexcept;
+    /**
+     * @brief Get the whole heightmap sample the terrain is centred on in Y
+     * 
+     * @return int64_t 
+     */
+    int64_t positionY() const noexcept;
+    /**
+     * @brief Get how far past the whole sample the terrain is centred, [0, 1)
+     * 
+     * @return const ngl::Vec2& 
+     */
+    const ngl::Vec2 &positionFraction() const noexcept;
     /**
      * @brief Set the number of active LoD levels using the height of the camera
      * 
      * @param _camHeight The height of the camera
      */
     void setActiveLevels(ngl::Real _camHeight);
+    /**
+     * @brief Work out which LoD levels would be active with the camera at a
+     * height (without changing them)
+     * 
+     * @param _camHeight The height of the camera
+     * @param o_finest Set to the finest active level
+     * @param o_coarsest Set to the coarsest active level
+     */
+    void levelsForHeight(ngl::Real _camHeight, unsigned char &o_finest, unsigned char &o_coarsest) const noexcept;
     /**
      * @brief Get the active coarsest LoD level
      * 
@@ -85,6 +151,56 @@ namespace geoclipmap
     {
       return m_activeFinest;
     }
+    /**
+     * @brief Get the finest level whose texture has been filled for where
+     * the terrain is, every active level from the coarsest up to it being
+     * ready to draw. Only short of the active finest level while refining
+     * progressively (see Manager::progressive).
+     * 
+     * @return unsigned char the finest ready level
+     */
+    unsigned char readyFinest() const noexcept;
+    /**
+     * @brief Fill the next finer active level that isn't ready yet, to be
+     * called once a frame while refining progressively
+     * 
+     * @return true If a level was filled
+     */
+    bool refine() noexcept;
+    /**
+     * @brief Get whether any active level is still waiting to be filled
+     * 
+     * @return true If refine has more to do
+     */
+    bool refining() const noexcept;
+    /**
+     * @brief Get when every level last had to be filled afresh, i.e. when
+     * the terrain was created or last jumped further than half its finest
+     * active level
+     * 
+     * @return std::chrono::steady_clock::time_point 
+     */
+    std::chrono::steady_clock::time_point fillStarted() const noexcept;
+    /**
+     * @brief Show an overlay (e.g. a viewshed) on every clipmap level,
+     * refreshing the active levels' textures straight away
+     * 
+     * @param _overlay The overlay, or an empty reader to remove it
+     */
+    void setOverlay(OverlayReader _overlay) noexcept;
+    /**
+     * @brief Re-read the parts of the active levels' textures covering the
+     * heightmap samples in [_x0, _x1] x [_y0, _y1] after they have changed
+     * (e.g. from a HeightmapFeed), so only those parts are uploaded again.
+     * Inactive levels are read in full when they become active anyway.
+     * 
+     * @param _x0 The left of the region
+     * @param _y0 The top of the region
+     * @param _x1 The right of the region (inclusive)
+     * @param _y1 The bottom of the region (inclusive)
+     * @return int The number of levels whose textures covered the region
+     */
+    int refreshRegion(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) noexcept;
 
   private:
     // The heightmap to get height data from 
@@ -95,10 +211,15 @@ namespace geoclipmap
     std::vector<Footprint *> m_footprints;
     // The list of all the locations
     std::vector<FootprintLocation *> m_locations;
-    // The position of the terrain
-    ngl::Vec2 m_position;
+    // The position of the terrain, split into whole samples and the fraction of a sample [0, 1) so it stays exact
+    // however far from the origin it moves
+    int64_t m_positionX = 0;
+    int64_t m_positionY = 0;
+    ngl::Vec2 m_positionFraction;
     // The previous position of the terrain
-    ngl::Vec2 m_prevPosition;
+    int64_t m_prevPositionX = 0;
+    int64_t m_prevPositionY = 0;
+    ngl::Vec2 m_prevPositionFraction;
     // The active coarsest LoD level
     unsigned char m_activeCoarsest;
     // The active finest LoD level
@@ -107,6 +228,18 @@ namespace geoclipmap
     unsigned char m_prevActiveCoarsest;
     // The previous active finest LoD level
     unsigned char m_prevActiveFinest;
+    // The finest level filled for where the terrain is, from the active coarsest up
+    unsigned char m_readyFinest = 0;
+    // Whether the levels have been filled at all yet
+    bool m_filled = false;
+    // When every level last had to be filled afresh
+    std::chrono::steady_clock::time_point m_fillStarted;
+    // The D the footprints and levels were made for
+    size_t m_D = 0;
+    // The texels filled so far this frame
+    size_t m_frameTexels = 0;
+    // The overlay shown on every level, kept for levels added by reconfigure
+    OverlayReader m_overlay;
 
     /**
      * @brief Generate the set of footprints
@@ -129,10 +262,28 @@ namespace geoclipmap
      * 
      */
     void updatePosition() noexcept;
+    /**
+     * @brief Get whether another level can be filled this frame without
+     * going over the update budget
+     * 
+     */
+    bool withinBudget() const noexcept;
+    /**
+     * @brief Fill a level's texture, counting it against this frame's budget
+     * 
+     * @param _level The level to fill
+     */
+    void fill(ClipmapLevel *_level) noexcept;
 
 #ifdef TERRAIN_TESTING
 #include <gtest/gtest.h>
     FRIEND_TEST(TerrainTest, ctor);
+    FRIEND_TEST(TerrainTest, far_from_origin);
+    FRIEND_TEST(TerrainTest, refresh_region);
+    FRIEND_TEST(TerrainTest, progressive);
+    FRIEND_TEST(TerrainTest, sub_texel_moves);
+    FRIEND_TEST(TerrainTest, reconfigure);
+    FRIEND_TEST(TerrainTest, update_budget);
 #endif
   };
 
@@ -0,0 +1,102 @@
+/**
+ * @file ThreadPool.h
+ * @author Ollie Nicholls
+ * @brief A small pool of worker threads shared by the parts of the geoclipmap
+ * that can split their work up (e.g. decompressing heightmap tiles)
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace geoclipmap
+{
+  class ThreadPool
+  {
+  public:
+    // This class shouldn't be copyable
+    ThreadPool(ThreadPool & /*other*/) = delete;
+    // This class shouldn't be copy assignable
+    void operator=(const ThreadPool & /*other*/) = delete;
+
+    /**
+     * @brief Get the shared pool if it exists or create one (with one thread
+     * per hardware core) if it doesn't
+     *
+     * @return ThreadPool* a reference to the shared pool
+     */
+    static ThreadPool *getInstance();
+    /**
+     * @brief Construct a new ThreadPool object with its own worker threads
+     *
+     * @param _threads The number of worker threads (at least 1)
+     */
+    explicit ThreadPool(size_t _threads) noexcept;
+    /**
+     * @brief Destroy the ThreadPool object, finishing any queued tasks first
+     *
+     */
+    ~ThreadPool() noexcept;
+    /**
+     * @brief Queue a task to be run on one of the worker threads
+     *
+     * @param _task The task to run
+     * @return std::future<void> Becomes ready when the task has finished
+     */
+    std::future<void> submit(std::function<void()> _task);
+    /**
+     * @brief Run _task for every index in [0, _count) across the workers and
+     * the calling thread, returning once every index has been processed. The
+     * calling thread takes work too so this is safe to call from a worker.
+     *
+     * @param _count The number of indices
+     * @param _task The task to run for each index
+     */
+    void parallelFor(size_t _count, const std::function<void(size_t)> &_task);
+    /**
+     * @brief Get the number of worker threads
+     *
+     * @return size_t
+     */
+    size_t threadCount() const noexcept;
+    /**
+     * @brief Get the most tasks that have been waiting in the queue at once
+     * since this was last called, and start counting again
+     *
+     * @return size_t
+     */
+    size_t takePeakQueueDepth() noexcept;
+
+  private:
+    static ThreadPool *m_instance;
+
+    // The worker threads
+    std::vector<std::thread> m_workers;
+    // The tasks waiting to be run
+    std::deque<std::packaged_task<void()>> m_tasks;
+    // Guards m_tasks, m_stopping and m_peakQueueDepth
+    std::mutex m_mutex;
+    // Signalled when a task is queued or the pool is stopping
+    std::condition_variable m_wake;
+    // Whether the pool is being destroyed
+    bool m_stopping = false;
+    // The most tasks queued at once since takePeakQueueDepth was last called
+    size_t m_peakQueueDepth = 0;
+
+    /**
+     * @brief The loop each worker thread runs, taking tasks off the queue
+     *
+     */
+    void workerLoop() noexcept;
+  };
+} // end namespace geoclipmap
+#endif // !THREAD_POOL_H_
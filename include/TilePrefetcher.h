@@ -0,0 +1,95 @@
+/**
+ * @file TilePrefetcher.h
+ * @author Ollie Nicholls
+ * @brief Predicts where the terrain's levels will need tiles from recent
+ * movement and decodes them before they are needed
+ *
+ * Compressed heightmaps decode tiles into a bounded LRU cache as the clipmap
+ * levels read them, so the first frame in new territory has to wait for its
+ * tiles. The prefetcher follows the terrain's position and the camera's height
+ * frame by frame, extrapolates them over the next few frames and warms the
+ * tiles each active level's window would need there, a limited number of
+ * tiles per frame so prefetching never becomes a stall of its own.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef TILE_PREFETCHER_H_
+#define TILE_PREFETCHER_H_
+
+#include <cstdint>
+#include <deque>
+
+#include <ngl/Types.h>
+
+#include "Heightmap.h"
+#include "Terrain.h"
+
+namespace geoclipmap
+{
+  /**
+   * @brief How often frames had to wait for tiles (the hit rate and bytes
+   * prefetched are in the heightmap's CompressionStats)
+   *
+   */
+  struct PrefetchStats
+  {
+    // The number of frames followed
+    size_t frames = 0;
+    // The number of those frames that had to decode tiles before drawing
+    size_t stalledFrames = 0;
+  };
+
+  class TilePrefetcher
+  {
+  public:
+    /**
+     * @brief Construct a new TilePrefetcher object
+     *
+     * @param _terrain The terrain whose movement to follow
+     * @param _heightmap The terrain's heightmap
+     * @param _frames How many frames ahead to predict
+     * @param _tilesPerFrame The most tiles to decode ahead of time each frame
+     */
+    TilePrefetcher(Terrain *_terrain, Heightmap *_heightmap, int _frames = 8, size_t _tilesPerFrame = 32) noexcept;
+    /**
+     * @brief Follow the terrain and camera on to the next frame and warm the
+     * tiles they are heading towards. Call once a frame after the terrain has
+     * been moved and drawn.
+     *
+     * @param _cameraHeight The height of the camera this frame
+     */
+    void update(ngl::Real _cameraHeight) noexcept;
+    /**
+     * @brief Get the stall statistics
+     *
+     * @return const PrefetchStats&
+     */
+    const PrefetchStats &stats() const noexcept;
+
+  private:
+    // Where the terrain and camera were on a frame
+    struct Sample
+    {
+      int64_t x;
+      int64_t y;
+      ngl::Real height;
+    };
+
+    // The terrain whose movement to follow
+    Terrain *m_terrain;
+    // The terrain's heightmap
+    Heightmap *m_heightmap;
+    // How many frames ahead to predict
+    int m_frames;
+    // The most tiles to decode ahead of time each frame
+    size_t m_tilesPerFrame;
+    // Where the terrain and camera were over the last few frames, oldest first
+    std::deque<Sample> m_history;
+    // The number of tiles reads have had to wait for up to the last frame
+    size_t m_misses = 0;
+    // The stall statistics
+    PrefetchStats m_stats;
+  };
+} // end namespace geoclipmap
+#endif // !TILE_PREFETCHER_H_
@@ -0,0 +1,106 @@
+/**
+ * @file TileReader.h
+ * @author Ollie Nicholls
+ * @brief Reads batches of tiles from a file on disk, either with io_uring or
+ * with a pool of threads calling pread
+ *
+ * A batch is handed over all at once so the disk sees many reads in flight
+ * rather than one at a time. With io_uring a single thread queues up to 64
+ * reads at a time and takes their completions as they arrive, with no thread
+ * per read. Older kernels (and other unix platforms) fall back to a pool of
+ * threads that each pread one tile at a time. Every read is rounded out to
+ * 4096 byte boundaries into aligned buffers so the file can also be opened
+ * with O_DIRECT, skipping the page cache when the tiles are only read once.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef TILE_READER_H_
+#define TILE_READER_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace geoclipmap
+{
+  /**
+   * @brief How tiles are read
+   *
+   */
+  enum class TileReaderBackend
+  {
+    // A pool of threads each calling pread
+    Pread,
+    // Batches queued with io_uring (Linux 5.1+), falling back to Pread
+    IoUring,
+    // Range requests to a tile server over a pool of connections (see HttpTileReader)
+    Http
+  };
+
+  /**
+   * @brief Where a tile is in the file
+   *
+   */
+  struct TileRead
+  {
+    // The byte offset of the tile in the file
+    uint64_t offset = 0;
+    // The size of the tile in bytes
+    size_t size = 0;
+  };
+
+  /**
+   * @brief Called once for every read in a batch as it completes, with the
+   * index of the read in the batch and its bytes (nullptr if the read failed).
+   * The bytes are only valid during the call. With the Pread backend it may be
+   * called from several threads at once, for different reads.
+   *
+   */
+  using TileReadCallback = std::function<void(size_t _index, const uint8_t *_data, size_t _size)>;
+
+  class TileReader
+  {
+  public:
+    // Reads are aligned to and rounded out to this many bytes, as O_DIRECT needs
+    static constexpr size_t k_alignment = 4096;
+
+    virtual ~TileReader() = default;
+    /**
+     * @brief Open a file to read tiles from
+     *
+     * @param _path The file to read, or its URL for Http
+     * @param _backend How to read it. IoUring falls back to Pread if the
+     * kernel doesn't support it. Http reads with the default connections and
+     * no disk cache (see HttpTileReader::open for more control).
+     * @param _directIO Whether to bypass the page cache with O_DIRECT, ignored
+     * if the file system doesn't support it
+     * @return std::unique_ptr<TileReader> The reader, or nullptr if the file
+     * couldn't be opened or the platform has no pread
+     */
+    static std::unique_ptr<TileReader> open(const std::string &_path, TileReaderBackend _backend, bool _directIO) noexcept;
+    /**
+     * @brief Read a batch of tiles, returning once every read has completed
+     * and its callback has returned
+     *
+     * @param _reads The tiles to read
+     * @param _callback Called for every read as it completes
+     */
+    virtual void readBatch(const std::vector<TileRead> &_reads, const TileReadCallback &_callback) noexcept = 0;
+    /**
+     * @brief Get how tiles are actually being read (after any fallback)
+     *
+     * @return TileReaderBackend
+     */
+    virtual TileReaderBackend backend() const noexcept = 0;
+    /**
+     * @brief Get whether the file was opened with O_DIRECT
+     *
+     * @return true If reads bypass the page cache
+     */
+    virtual bool directIO() const noexcept = 0;
+  };
+} // end namespace geoclipmap
+#endif // !TILE_READER_H_
@@ -0,0 +1,270 @@
+/**
+ * @file Trace.h
+ * @author Ollie Nicholls
+ * @brief Scoped CPU timers and GL timer queries that show where a frame's
+ * time goes, captured for a few frames at a time and written as a Chrome
+ * trace (viewable in Perfetto or chrome://tracing)
+ *
+ * A zone only reads the clock while a capture is running, so zones can be
+ * left in the hottest code: outside of a capture each one costs a single
+ * relaxed load. Building with GEOCLIPMAP_NO_TRACE removes them altogether.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <ngl/Types.h>
+
+namespace geoclipmap
+{
+  class Tracer
+  {
+  public:
+    /**
+     * @brief Get the tracer if it exists or create one if it doesn't
+     *
+     * @return Tracer* The tracer shared by every zone
+     */
+    static Tracer *getInstance();
+    /**
+     * @brief Get whether a capture is running, i.e. whether zones are being
+     * recorded
+     *
+     * @return true If zones should be recorded
+     */
+    static bool capturing() noexcept
+    {
+      return s_capturing.load(std::memory_order_relaxed);
+    }
+    /**
+     * @brief Get the time zones are measured with
+     *
+     * @return int64_t The time in nanoseconds since an arbitrary point
+     */
+    static int64_t now() noexcept;
+    /**
+     * @brief Start capturing, throwing away anything recorded before
+     *
+     * @param _frames The number of frames to capture (see frameFinished)
+     */
+    void start(size_t _frames) noexcept;
+    /**
+     * @brief Mark the end of a frame, stopping the capture once it has
+     * captured all its frames
+     *
+     * @return true If this was the capture's last frame, so it can be written
+     */
+    bool frameFinished() noexcept;
+    /**
+     * @brief Get a number that changes each time a capture starts
+     *
+     * @return uint32_t
+     */
+    uint32_t captureId() const noexcept;
+    /**
+     * @brief Record a zone timed on the CPU, on the calling thread's track
+     *
+     * @param _name The zone's name, which must outlive the capture (e.g. a
+     * string literal)
+     * @param _start When the zone started (see now)
+     * @param _end When the zone ended (see now)
+     * @param _level The clipmap level the zone is for, or -1 for none
+     */
+    void addZone(const char *_name, int64_t _start, int64_t _end, int _level = -1) noexcept;
+    /**
+     * @brief Record a zone timed on the GPU, on the GPU's track
+     *
+     * @param _name The zone's name, which must outlive the capture
+     * @param _start When the zone started, in the same time as now
+     * @param _end When the zone ended, in the same time as now
+     * @param _level The clipmap level the zone is for, or -1 for none
+     */
+    void addGpuZone(const char *_name, int64_t _start, int64_t _end, int _level = -1) noexcept;
+    /**
+     * @brief Get the number of zones recorded by the last capture
+     *
+     * @return size_t
+     */
+    size_t zoneCount() const noexcept;
+    /**
+     * @brief Write the last capture's zones as a Chrome trace-event JSON
+     * file, with times relative to when the capture started
+     *
+     * @param _path The file to write (replaced if it exists)
+     * @return true If it was written
+     */
+    bool write(const std::string &_path) const noexcept;
+
+  private:
+    /**
+     * @brief A zone as it is recorded
+     *
+     */
+    struct Zone
+    {
+      const char *name;
+      int64_t start;
+      int64_t end;
+      // The track the zone is on, 0 being the GPU's and each thread having its own after that
+      uint32_t track;
+      int level;
+    };
+
+    // The only tracer
+    static Tracer *m_instance;
+    // Whether zones are being recorded
+    static std::atomic<bool> s_capturing;
+    // Guards everything below, as zones can end on any thread
+    mutable std::mutex m_mutex;
+    // The zones recorded by the last capture
+    std::vector<Zone> m_zones;
+    // When the capture started
+    int64_t m_origin = 0;
+    // The frames still to capture
+    size_t m_framesLeft = 0;
+    // Changes each time a capture starts
+    std::atomic<uint32_t> m_captureId{0};
+
+    /**
+     * @brief Construct a new Tracer object (see getInstance)
+     *
+     */
+    Tracer() noexcept = default;
+
+#ifdef TERRAIN_TESTING
+#include <gtest/gtest.h>
+    FRIEND_TEST(TraceTest, zones);
+#endif
+  };
+
+  class TraceZone
+  {
+  public:
+    /**
+     * @brief Start timing a zone if a capture is running, ending it when
+     * this goes out of scope
+     *
+     * @param _name The zone's name, which must outlive the capture (e.g. a
+     * string literal)
+     * @param _level The clipmap level the zone is for, or -1 for none
+     */
+    explicit TraceZone(const char *_name, int _level = -1) noexcept : m_name{Tracer::capturing() ? _name : nullptr},
+                                                                      m_level{_level}
+    {
+      if (m_name)
+      {
+        m_start = Tracer::now();
+      }
+    }
+    /**
+     * @brief End the zone
+     *
+     */
+    ~TraceZone() noexcept
+    {
+      if (m_name)
+      {
+        Tracer::getInstance()->addZone(m_name, m_start, Tracer::now(), m_level);
+      }
+    }
+    TraceZone(const TraceZone &) = delete;
+    TraceZone &operator=(const TraceZone &) = delete;
+
+  private:
+    // The zone's name, or nullptr if it isn't being timed
+    const char *m_name;
+    // The clipmap level the zone is for
+    int m_level;
+    // When the zone started
+    int64_t m_start = 0;
+  };
+
+  class GpuTrace
+  {
+  public:
+    /**
+     * @brief Destroy the GpuTrace object, deleting its queries (so a GL
+     * context must be current)
+     *
+     */
+    ~GpuTrace();
+    /**
+     * @brief Start timing a zone on the GPU if a capture is running. Zones
+     * can't overlap, so each must end before the next begins.
+     *
+     * @param _name The zone's name, which must outlive the capture
+     * @param _level The clipmap level the zone is for, or -1 for none
+     */
+    void begin(const char *_name, int _level = -1) noexcept;
+    /**
+     * @brief End the zone begun last, if one is being timed
+     *
+     */
+    void end() noexcept;
+    /**
+     * @brief Pass the zones the GPU has finished to the tracer, leaving the
+     * rest for later so the CPU never waits for the GPU
+     *
+     * @param _wait Whether to wait for every zone, e.g. at the end of a
+     * capture
+     */
+    void collect(bool _wait) noexcept;
+    /**
+     * @brief Get the number of zones the GPU hasn't finished yet
+     *
+     * @return size_t
+     */
+    size_t pending() const noexcept;
+
+  private:
+    /**
+     * @brief A zone between two timestamp queries
+     *
+     */
+    struct Pending
+    {
+      const char *name;
+      int level;
+      GLuint start;
+      GLuint end;
+    };
+
+    // Queries finished with, to be used again
+    std::vector<GLuint> m_free;
+    // Zones in the order they were timed
+    std::deque<Pending> m_pending;
+    // The zone being timed, if its name isn't nullptr
+    Pending m_open{nullptr, -1, 0, 0};
+    // The capture the GPU's clock was last lined up with the CPU's for
+    uint32_t m_captureId = 0;
+    // Added to the GPU's timestamps to give the CPU's time
+    int64_t m_offset = 0;
+
+    /**
+     * @brief Get a query to put a timestamp in
+     *
+     * @return GLuint
+     */
+    GLuint query() noexcept;
+  };
+} // end namespace geoclipmap
+
+#ifndef GEOCLIPMAP_NO_TRACE
+#define GEOCLIPMAP_TRACE_CONCAT_(_a, _b) _a##_b
+#define GEOCLIPMAP_TRACE_CONCAT(_a, _b) GEOCLIPMAP_TRACE_CONCAT_(_a, _b)
+// Times the rest of the enclosing scope as a zone, e.g. GEOCLIPMAP_TRACE_ZONE("updateTexture", level)
+#define GEOCLIPMAP_TRACE_ZONE(...) ::geoclipmap::TraceZone GEOCLIPMAP_TRACE_CONCAT(traceZone, __LINE__)(__VA_ARGS__)
+#else
+#define GEOCLIPMAP_TRACE_ZONE(...)
+#endif
+
+#endif // !TRACE_H_
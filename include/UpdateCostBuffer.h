@@ -0,0 +1,67 @@
+/**
+ * @file UpdateCostBuffer.h
+ * @author Ollie Nicholls
+ * @brief A small uniform buffer holding what each clipmap level cost to
+ * update over the last frame, read by the terrain shader's update cost view
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef UPDATE_COST_BUFFER_H_
+#define UPDATE_COST_BUFFER_H_
+
+#include <array>
+
+#include <ngl/Types.h>
+#include <ngl/Vec4.h>
+
+#include "Metrics.h"
+
+namespace geoclipmap
+{
+  // The uniform block binding the shader's UpdateCosts block is read from
+  constexpr GLuint k_updateCostBinding = 1;
+
+  class UpdateCostBuffer
+  {
+  public:
+    /**
+     * @brief Destroy the UpdateCostBuffer object, deleting its buffer (so a
+     * GL context must be current if it was created)
+     *
+     */
+    ~UpdateCostBuffer();
+    /**
+     * @brief Set each level's costs from a frame's metrics and upload them,
+     * leaving the buffer bound to k_updateCostBinding
+     *
+     * @param _frame The frame, usually the last one finished
+     * @param _levelTexels The texels in a level's texture (D x D), which a
+     * level's costs are given as fractions of
+     */
+    void update(const MetricsFrame &_frame, size_t _levelTexels) noexcept;
+    /**
+     * @brief Work out each level's costs from a frame's metrics, as update
+     * uploads them: x = texels regenerated, y = bytes uploaded, z = texels
+     * as a fraction of the texture's, w = bytes as a fraction of the texture's
+     *
+     * @param _frame The frame
+     * @param _levelTexels The texels in a level's texture (D x D)
+     * @return std::array<ngl::Vec4, k_metricsLevels> The costs
+     */
+    static std::array<ngl::Vec4, k_metricsLevels> computeCosts(const MetricsFrame &_frame, size_t _levelTexels) noexcept;
+    /**
+     * @brief Get each level's costs as last uploaded, see computeCosts
+     *
+     * @return const std::array<ngl::Vec4, k_metricsLevels>&
+     */
+    const std::array<ngl::Vec4, k_metricsLevels> &costs() const noexcept;
+
+  private:
+    // Each level's costs, laid out as the shader's std140 vec4 array
+    std::array<ngl::Vec4, k_metricsLevels> m_costs{};
+    // The uniform buffer, or 0 until the first update
+    GLuint m_buffer = 0;
+  };
+} // end namespace geoclipmap
+#endif // !UPDATE_COST_BUFFER_H_
@@ -0,0 +1,130 @@
+/**
+ * @file Viewshed.h
+ * @author Ollie Nicholls
+ * @brief Finds which parts of a heightmap can be seen from an observer, and
+ * whether there is a clear line of sight between any two points
+ *
+ * The viewshed is swept outwards from the observer a ring at a time in each of
+ * the 8 octants around it. Each sample keeps the steepest slope from the
+ * observer to anything in front of it (its horizon), found by interpolating
+ * the horizons of the two samples in the previous ring that the line back to
+ * the observer passes between, so every sample is only visited once rather
+ * than marching a ray to each. The octants don't depend on each other so they
+ * are swept in parallel, and as each sample is only ever written by one octant
+ * the result doesn't depend on how many threads there are.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef VIEWSHED_H_
+#define VIEWSHED_H_
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <ngl/Vec3.h>
+
+#include "Heightmap.h"
+#include "RayCaster.h"
+
+namespace geoclipmap
+{
+  class Viewshed
+  {
+  public:
+    /**
+     * @brief Construct a new Viewshed object
+     *
+     * @param _heightmap The heightmap to find visibility over
+     */
+    explicit Viewshed(Heightmap *_heightmap) noexcept;
+    /**
+     * @brief Find every sample that can be seen from an observer standing on
+     * the heightmap, replacing the last viewshed found
+     *
+     * @param _x The X coord of the observer's sample
+     * @param _y The Y coord of the observer's sample
+     * @param _observerHeight How far above the ground the observer's eye is
+     * (in heights)
+     * @param _targetHeight How far above the ground a sample's target must be
+     * seen (0 for the ground itself)
+     * @param _radius How far from the observer to look (in samples)
+     */
+    void compute(int64_t _x,
+                 int64_t _y,
+                 ngl::Real _observerHeight,
+                 ngl::Real _targetHeight = 0.0f,
+                 int64_t _radius = std::numeric_limits<int64_t>::max()) noexcept;
+    /**
+     * @brief Get whether a sample could be seen in the last viewshed found
+     * (samples outside its radius or the heightmap can't be)
+     *
+     * @param _x The X coord of the sample
+     * @param _y The Y coord of the sample
+     * @return true If the sample is visible
+     */
+    bool visible(int64_t _x, int64_t _y) const noexcept;
+    /**
+     * @brief Read a row of the visibility mask as 1 (visible) or 0, in the same
+     * form as Heightmap::readRow so it can be read into a clipmap level
+     *
+     * @param _x X coord of the first sample
+     * @param _y Y coord of the row
+     * @param _stride The distance between each sample (> 0)
+     * @param _count The number of samples to read
+     * @param _out Where to write the values (_count values)
+     */
+    void readRow(int64_t _x, int64_t _y, int _stride, int _count, ngl::Real *_out) const noexcept;
+    /**
+     * @brief Get the number of samples visible in the last viewshed found
+     *
+     * @return size_t
+     */
+    size_t visibleCount() const noexcept;
+    /**
+     * @brief Find whether anything on the heightmap is in the way of the
+     * straight line between two points
+     *
+     * @param _from The first point in heightmap space (x and y in samples and
+     * z in heights)
+     * @param _to The second point in heightmap space
+     * @return true If the line between them is clear
+     */
+    bool lineOfSight(const ngl::Vec3 &_from, const ngl::Vec3 &_to) noexcept;
+
+  private:
+    // The heightmap to find visibility over
+    Heightmap *m_heightmap;
+    // Casts the rays for lines of sight
+    RayCaster m_rayCaster;
+    // The rectangle of samples the last viewshed covers
+    int64_t m_x0 = 0;
+    int64_t m_y0 = 0;
+    int64_t m_width = 0;
+    int64_t m_depth = 0;
+    // 1 for each visible sample in the rectangle, row-major
+    std::vector<uint8_t> m_mask;
+
+    /**
+     * @brief Sweep one octant around the observer, writing the visibility of
+     * the samples it owns (samples on the octant's edges are owned by one
+     * octant only)
+     *
+     * @param _octant The octant (bit 0 set for y as the major axis, bit 1 for
+     * a negative major axis and bit 2 for a negative minor axis)
+     * @param _x The X coord of the observer
+     * @param _y The Y coord of the observer
+     * @param _eye The height of the observer's eye
+     * @param _targetHeight How far above the ground a target must be seen
+     * @param _radius How far from the observer to look
+     */
+    void sweepOctant(int _octant, int64_t _x, int64_t _y, ngl::Real _eye, ngl::Real _targetHeight, int64_t _radius) noexcept;
+
+#ifdef TERRAIN_TESTING
+#include <gtest/gtest.h>
+    FRIEND_TEST(ViewshedTest, deterministic);
+#endif
+  };
+} // end namespace geoclipmap
+#endif // !VIEWSHED_H_
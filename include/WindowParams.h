@@ -33,5 +33,9 @@ struct WinParams
   float m_far = 5000.0f;
   // The movement speed of the terrain
   float m_moveSpeed = 10.0f;
+  // Whether the terrain is centred under the camera rather than only moved by the arrow keys
+  bool followCamera = false;
+  // The number of frames captured to a trace file by 't'
+  int m_traceFrames = 60;
 };
 #endif // !WINDOW_PARAMS_H_
@@ -1,11 +1,42 @@
 #version 410 core
 
 in vec3 vertColour;
+// The frames since the texel was regenerated
+in float regeneratedAge;
+// The costs of the level being drawn (see the vertex shader)
+flat in vec4 levelCost;
 out vec4 outColour;
 
 uniform vec3 camPos;
+// 0 to colour by height, 1 for the update cost view
+uniform int debugMode;
+// The level being drawn and the number of levels, only set for the update cost view
+uniform int clipmapLevel;
+uniform int clipmapLevels;
+
+// The frames a texel takes to cool from just regenerated to cold
+const float coolFrames = 60.0f;
+
+// A fully saturated colour around the hue wheel (0-1)
+vec3 hue(float _h)
+{
+  return clamp(abs(mod(_h * 6.0f + vec3(0.0f, 4.0f, 2.0f), 6.0f) - 3.0f) - 1.0f, 0.0f, 1.0f);
+}
+
 void main ()
 {
-  // set the fragment colour to the current texture
-  outColour = vec4(vertColour,1.0);
+  if (debugMode != 1)
+  {
+    // set the fragment colour to the current texture
+    outColour = vec4(vertColour,1.0);
+    return;
+  }
+
+  // Each level its own hue, brighter the more of its texture was uploaded last frame
+  vec3 level = hue(float(clipmapLevel) / float(max(clipmapLevels, 1))) * (0.25f + 0.75f * clamp(levelCost.w, 0.0f, 1.0f));
+  // Texels glow white-hot when regenerated and cool to dark blue
+  float cooled = sqrt(clamp(regeneratedAge / coolFrames, 0.0f, 1.0f));
+  vec3 heat = mix(vec3(1.0f, 0.9f, 0.6f), vec3(0.05f, 0.05f, 0.25f), cooled);
+  // Shaded by height (the green of the normal colours) so the terrain's shape still shows
+  outColour = vec4(mix(level, heat, 0.5f) * (0.5f + 0.5f * vertColour.g), 1.0);
 }
@@ -4,7 +4,7 @@
 layout (location = 0) in vec2 inVert;
 
 // ==== Texture Buffers ====
-// The height data stored in a texture buffer
+// The height data stored in a texture buffer (r = fine height, g = the frame it was regenerated on, b = overlay)
 uniform samplerBuffer heightData;
 
 // ==== Uniforms ====
@@ -12,8 +12,12 @@ uniform samplerBuffer heightData;
 uniform mat4 MVP;
 // The location of the footprint in its clipmap's local coords
 uniform vec2 footprintLocalPos;
-// The offset of the clipmap level in the world
+// The offset of the clipmap level from the camera (never absolute, so it is
+// as precise far from the origin as it is at it)
 uniform vec2 clipmapOffsetPos;
+// How far the camera is past the clipmap level's snapped origin, [0, 1) of its samples, so the level slides smoothly
+// between samples rather than jumping a whole sample when its origin moves
+uniform vec2 clipmapSubTexelOffset;
 // The scale of the clipmap level
 uniform float clipmapScale;
 // The width of the clipmap
@@ -22,18 +26,38 @@ uniform float clipmapD;
 // uniform vec2 viewerPos;
 // The highest point in the clipmap - used for colour
 uniform float highestPoint;
+// How much heights are scaled by
+uniform float heightScale;
+// 0 to colour by height, 1 for the update cost view
+uniform int debugMode;
+// The level being drawn, only set for the update cost view
+uniform int clipmapLevel;
+// The frame being drawn, wrapped as the texels' frames are (only set for the update cost view)
+uniform float frameNumber;
+
+// ==== Uniform Blocks ====
+// Each level's costs over the last frame: x = texels regenerated, y = bytes uploaded, z and w = the same as fractions
+// of the level's whole texture (only updated for the update cost view)
+layout (std140, binding = 1) uniform UpdateCosts
+{
+  vec4 levelCosts[12];
+};
 
 // ==== Out Data ====
 out vec3 vertColour;
+// The frames since the texel was regenerated
+out float regeneratedAge;
+// The costs of the level being drawn
+flat out vec4 levelCost;
 
 void main()
 {
-  // Calculate world coordinates by translating then scaling based on the position of the clipmap level
-  vec2 worldPos = (inVert + footprintLocalPos + clipmapOffsetPos) * vec2(clipmapScale);
+  // Calculate camera-relative world coordinates by translating then scaling based on the position of the clipmap level
+  vec2 worldPos = (inVert + footprintLocalPos + clipmapOffsetPos - clipmapSubTexelOffset) * vec2(clipmapScale);
   // Calculate uv coordinates for height map lookup
   vec2 uv = inVert + footprintLocalPos;
   // sample the height map texture at the uv coordinates
-  vec2 height = texelFetch(heightData, int(uv.y * clipmapD + uv.x)).rg;
+  vec3 height = texelFetch(heightData, int(uv.y * clipmapD + uv.x)).rgb;
 
   // Unpack the fine and coarse values into their own floats
   float zf = height.r;
@@ -59,7 +83,7 @@ void main()
   // float z = zf + alpha.x * zc;
   // ==============================================================================
   float z = zf;
-  z = z * 50.0f;
+  z = z * heightScale;
 
   // vec4 worldPosFinal = vec4(worldPos.x, zf_zd, worldPos.y, 1.0f);
   vec4 worldPosFinal = vec4(worldPos.x, worldPos.y, -z, 1.0f);
@@ -68,4 +92,17 @@ void main()
   gl_Position = MVP * worldPosFinal;
   
   vertColour=vec3(0.0f, (height.r / highestPoint), 0.0f);
+  // Tint anything in the overlay (e.g. the parts of the terrain that can be seen from an observer)
+  vertColour = mix(vertColour, vec3(1.0f, 0.8f, 0.2f), 0.6f * height.b);
+
+  regeneratedAge = 0.0f;
+  levelCost = vec4(0.0f);
+  if (debugMode == 1)
+  {
+    // Frames are wrapped at 2^24 so they stay exact as floats. The wrap is undone only when the frame number has
+    // wrapped since, as adding 2^24 to every age would round the odd ones.
+    float age = frameNumber - height.g;
+    regeneratedAge = age < 0.0f ? age + 16777216.0f : age;
+    levelCost = levelCosts[clipmapLevel];
+  }
 }
\ No newline at end of file
@@ -117,4 +117,18 @@ namespace geoclipmap
     return ngl::Vec2{m_eye.m_x, m_eye.m_z};
   }
 
+  CameraState Camera::state() const noexcept
+  {
+    return CameraState{m_eye, m_look, m_yaw, m_pitch};
+  }
+
+  void Camera::setState(const CameraState &_state) noexcept
+  {
+    m_eye = _state.eye;
+    m_look = _state.look;
+    m_yaw = _state.yaw;
+    m_pitch = _state.pitch;
+    updateViewMatrix();
+  }
+
 } // end namespace geoclipmap
\ No newline at end of file
@@ -0,0 +1,159 @@
+/**
+ * @file CameraPath.cpp
+ * @author Ollie Nicholls
+ * @brief A recording of how the demo was viewed, one frame at a time: where
+ * the camera was, where the terrain had been moved to, whether it was
+ * following the camera and the clipmap settings
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <cstring>
+
+#include "CameraPath.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // Starts every camera path, the last character being the version of the format
+    constexpr char k_pathMagic[8] = {'G', 'C', 'C', 'A', 'M', 'P', 'T', '1'};
+
+    /**
+     * @brief The start of a camera path, followed by one PathRecord per frame
+     * until the end of the file. Written in the host's byte order like the
+     * other files the demo writes.
+     *
+     */
+    struct PathHeader
+    {
+      char magic[8];
+      uint32_t recordSize;
+      uint32_t reserved;
+    };
+    static_assert(sizeof(PathHeader) == 16, "PathHeader must have no padding");
+
+    /**
+     * @brief A frame as it is stored
+     *
+     */
+    struct PathRecord
+    {
+      float eye[3];
+      float look[3];
+      float yaw;
+      float pitch;
+      int64_t terrainX;
+      int64_t terrainY;
+      uint8_t K;
+      uint8_t L;
+      uint8_t R;
+      // 1 if the terrain was following the camera. Paths written before it was recorded have 0 here, as they
+      // were most likely made without following.
+      uint8_t followCamera;
+      uint8_t reserved[4];
+    };
+    static_assert(sizeof(PathRecord) == 56, "PathRecord must have no padding");
+  } // end namespace
+
+  std::unique_ptr<CameraPath> CameraPath::open(const std::string &_path) noexcept
+  {
+    std::ifstream file(_path, std::ios::binary);
+    PathHeader header{};
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, k_pathMagic, sizeof(k_pathMagic)) != 0 ||
+        header.recordSize != sizeof(PathRecord))
+    {
+      return nullptr;
+    }
+
+    std::unique_ptr<CameraPath> path(new CameraPath());
+    PathRecord record{};
+    // A frame cut short by the demo being killed mid-write is left out
+    while (file.read(reinterpret_cast<char *>(&record), sizeof(record)))
+    {
+      CameraPathFrame frame;
+      frame.camera.eye = ngl::Vec3(record.eye[0], record.eye[1], record.eye[2]);
+      frame.camera.look = ngl::Vec3(record.look[0], record.look[1], record.look[2]);
+      frame.camera.yaw = record.yaw;
+      frame.camera.pitch = record.pitch;
+      frame.terrainX = record.terrainX;
+      frame.terrainY = record.terrainY;
+      frame.followCamera = record.followCamera != 0;
+      frame.K = record.K;
+      frame.L = record.L;
+      frame.R = record.R;
+      path->m_frames.push_back(frame);
+    }
+
+    if (path->m_frames.empty())
+    {
+      return nullptr;
+    }
+    return path;
+  }
+
+  size_t CameraPath::frameCount() const noexcept
+  {
+    return m_frames.size();
+  }
+
+  const CameraPathFrame &CameraPath::frame(size_t _frame) const noexcept
+  {
+    return m_frames[_frame % m_frames.size()];
+  }
+
+  std::unique_ptr<CameraPathWriter> CameraPathWriter::create(const std::string &_path) noexcept
+  {
+    std::unique_ptr<CameraPathWriter> writer(new CameraPathWriter());
+    writer->m_file.open(_path, std::ios::binary | std::ios::trunc);
+    if (!writer->m_file)
+    {
+      return nullptr;
+    }
+
+    PathHeader header{};
+    std::memcpy(header.magic, k_pathMagic, sizeof(k_pathMagic));
+    header.recordSize = sizeof(PathRecord);
+    writer->m_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    writer->m_file.flush();
+    if (!writer->m_file)
+    {
+      return nullptr;
+    }
+    return writer;
+  }
+
+  bool CameraPathWriter::addFrame(const CameraPathFrame &_frame) noexcept
+  {
+    PathRecord record{};
+    const CameraState &camera = _frame.camera;
+    record.eye[0] = camera.eye.m_x;
+    record.eye[1] = camera.eye.m_y;
+    record.eye[2] = camera.eye.m_z;
+    record.look[0] = camera.look.m_x;
+    record.look[1] = camera.look.m_y;
+    record.look[2] = camera.look.m_z;
+    record.yaw = camera.yaw;
+    record.pitch = camera.pitch;
+    record.terrainX = _frame.terrainX;
+    record.terrainY = _frame.terrainY;
+    record.followCamera = _frame.followCamera ? 1 : 0;
+    record.K = _frame.K;
+    record.L = _frame.L;
+    record.R = _frame.R;
+    m_file.write(reinterpret_cast<const char *>(&record), sizeof(record));
+    m_file.flush();
+    if (!m_file)
+    {
+      return false;
+    }
+    m_framesWritten++;
+    return true;
+  }
+
+  size_t CameraPathWriter::framesWritten() const noexcept
+  {
+    return m_framesWritten;
+  }
+} // end namespace geoclipmap
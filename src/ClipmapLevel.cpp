@@ -6,13 +6,25 @@
  * @copyright Copyright (c) 2020
  * 
  */
+#include <algorithm>
 #include <cmath>
 
 #include "ClipmapLevel.h"
 #include "Manager.h"
+#include "Metrics.h"
+#include "Trace.h"
 
 namespace geoclipmap
 {
+  namespace
+  {
+    // Integer division rounding down, for coords that can be negative (_b > 0)
+    int64_t floorDiv(int64_t _a, int64_t _b) noexcept
+    {
+      return _a >= 0 ? _a / _b : -((-_a + _b - 1) / _b);
+    }
+  } // end namespace
+
   ClipmapLevel::ClipmapLevel(int _level,
                              Heightmap *_heightmap,
                              ClipmapLevel *_parent,
@@ -24,39 +36,133 @@ namespace geoclipmap
     size_t D = Manager::getInstance()->D();
     unsigned char L = Manager::getInstance()->L();
 
-    m_texture = std::vector<ngl::Vec2>(D * D);
+    m_texture = std::vector<ngl::Vec3>(D * D);
     m_scale = 1 << ((L - 1) - m_level);
+    accountMemory();
+  }
+
+  ClipmapLevel::~ClipmapLevel() noexcept
+  {
+    if (m_allocated)
+    {
+      glDeleteTextures(1, &m_tboTex);
+      glDeleteBuffers(1, &m_tbo);
+    }
   }
 
   void ClipmapLevel::setPosition(ngl::Vec2 _worldPosition,
-                                 ngl::Vec2 _heightmapPosition,
-                                 TrimLocation _trimLocation) noexcept
+                                 int64_t _originX,
+                                 int64_t _originY,
+                                 TrimLocation _trimLocation,
+                                 ngl::Vec2 _subTexelOffset) noexcept
   {
+    // The texture only depends on the origin, so moving within a sample or changing the trims keeps it
+    m_stale = m_stale || _originX != m_originX || _originY != m_originY;
     m_worldPosition = _worldPosition;
-    m_heightmapPosition = _heightmapPosition;
+    m_subTexelOffset = _subTexelOffset;
+    m_originX = _originX;
+    m_originY = _originY;
     m_trimLocation = _trimLocation;
   }
 
+  void ClipmapLevel::reconfigure() noexcept
+  {
+    size_t D = Manager::getInstance()->D();
+    unsigned char L = Manager::getInstance()->L();
+
+    // The heights are for the old size and scale, so nothing can be refreshed until the texture is read again
+    m_texture = std::vector<ngl::Vec3>(D * D);
+    m_heights.clear();
+    m_heights.shrink_to_fit();
+    m_overlayRow.clear();
+    m_overlayRow.shrink_to_fit();
+    m_scale = 1 << ((L - 1) - m_level);
+    m_dirtyBegin = 0;
+    m_dirtyEnd = 0;
+    m_stale = true;
+    accountMemory();
+  }
+
   void ClipmapLevel::updateTexture() noexcept
   {
+    GEOCLIPMAP_TRACE_ZONE("updateTexture", m_level);
     // When querying the heightmap, it is assumed the heightmap is always at 0,0
-    // So to get the correct pixels for this clipmaps texture we take its position
-    // and loop up to D and add this value to the position, then grab the pixel
+    // So to get the correct pixels for this clipmaps texture we take its origin
+    // and loop up to D and add this value to the origin, then grab the pixel
     // from the heightmap at this location adjusted for the scale
     size_t D = Manager::getInstance()->D();
 
-    // Get the integer part of the position as heightmap pixels are located at whole numbers
-    int xPosInt = static_cast<int>(floor(m_heightmapPosition.m_x));
-    int yPosInt = static_cast<int>(floor(m_heightmapPosition.m_y));
+    // Let the heightmap get everything this level reads ready at once (e.g. decompress the tiles in parallel)
+    int64_t lastSample = static_cast<int64_t>(D) - 1;
+    m_heightmap->prefetch(m_originX * m_scale,
+                          m_originY * m_scale,
+                          (m_originX + lastSample) * m_scale,
+                          (m_originY + lastSample) * m_scale,
+                          m_scale);
+
+    // Read the fine pixels for the whole texture at once so the heightmap can read them in whatever order suits its
+    // layout. The positions to read the pixels at must be scaled and offset based on the clipmap level
+    m_heights.resize(D * D);
+    m_heightmap->readWindow(m_originX * m_scale,
+                            m_originY * m_scale,
+                            m_scale,
+                            static_cast<int>(D),
+                            static_cast<int>(D),
+                            m_heights.data());
 
     for (int y = 0; y < D; y++)
     {
-      for (int x = 0; x < D; x++)
-      {
-        // The positions to generate the pixels at must be scaled and offset based on the clipmap level
-        m_texture[y * D + x] = generatePixelAt((xPosInt + x) * m_scale, (yPosInt + y) * m_scale);
-      }
+      generateRow(y, 0, static_cast<int>(D));
     }
+    markDirty(0, m_texture.size());
+    accountMemory();
+    m_stale = false;
+    Metrics::getInstance()->addTexels(m_level, D * D);
+  }
+
+  bool ClipmapLevel::refreshRegion(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) noexcept
+  {
+    int64_t D = static_cast<int64_t>(Manager::getInstance()->D());
+    // Only a texture that has been read can be partly read again
+    if (m_heights.size() != static_cast<size_t>(D * D))
+    {
+      return false;
+    }
+
+    // The texels whose samples ((origin + i) * scale) are in the region
+    int64_t firstX = std::max<int64_t>(-floorDiv(-_x0, m_scale) - m_originX, 0);
+    int64_t firstY = std::max<int64_t>(-floorDiv(-_y0, m_scale) - m_originY, 0);
+    int64_t lastX = std::min<int64_t>(floorDiv(_x1, m_scale) - m_originX, D - 1);
+    int64_t lastY = std::min<int64_t>(floorDiv(_y1, m_scale) - m_originY, D - 1);
+    if (firstX > lastX || firstY > lastY)
+    {
+      return false;
+    }
+
+    int countX = static_cast<int>(lastX - firstX + 1);
+    m_heightmap->prefetch((m_originX + firstX) * m_scale,
+                          (m_originY + firstY) * m_scale,
+                          (m_originX + lastX) * m_scale,
+                          (m_originY + lastY) * m_scale,
+                          m_scale);
+    for (int64_t y = firstY; y <= lastY; y++)
+    {
+      m_heightmap->readRow((m_originX + firstX) * m_scale,
+                           (m_originY + y) * m_scale,
+                           m_scale,
+                           countX,
+                           &m_heights[static_cast<size_t>(y * D + firstX)]);
+      generateRow(static_cast<int>(y), static_cast<int>(firstX), countX);
+    }
+    markDirty(static_cast<size_t>(firstY * D + firstX), static_cast<size_t>(lastY * D + lastX + 1));
+    Metrics::getInstance()->addTexels(m_level, static_cast<uint64_t>(countX) * static_cast<uint64_t>(lastY - firstY + 1));
+    return true;
+  }
+
+  void ClipmapLevel::setOverlay(OverlayReader _overlay) noexcept
+  {
+    m_overlay = std::move(_overlay);
+    m_stale = true;
   }
 
   int ClipmapLevel::scale() const noexcept
@@ -64,18 +170,49 @@ namespace geoclipmap
     return m_scale;
   }
 
+  bool ClipmapLevel::stale() const noexcept
+  {
+    return m_stale;
+  }
+
+  void ClipmapLevel::markStale() noexcept
+  {
+    m_stale = true;
+  }
+
   const ngl::Vec2 &ClipmapLevel::position() const noexcept
   {
     return m_worldPosition;
   }
 
+  const ngl::Vec2 &ClipmapLevel::subTexelOffset() const noexcept
+  {
+    return m_subTexelOffset;
+  }
+
+  int64_t ClipmapLevel::originX() const noexcept
+  {
+    return m_originX;
+  }
+
+  int64_t ClipmapLevel::originY() const noexcept
+  {
+    return m_originY;
+  }
+
+  const std::vector<ngl::Real> &ClipmapLevel::heights() const noexcept
+  {
+    return m_heights;
+  }
+
   TrimLocation ClipmapLevel::trimLocation() const noexcept
   {
     return m_trimLocation;
   }
 
-  void ClipmapLevel::bindTextures() noexcept
+  size_t ClipmapLevel::bindTextures() noexcept
   {
+    GEOCLIPMAP_TRACE_ZONE("bindTextures", m_level);
     if (!m_allocated)
     {
       // Generate the buffer and the texture object
@@ -84,16 +221,45 @@ namespace geoclipmap
       m_allocated = true;
     }
 
-    // Bind the buffer, then buffer the data
+    // Bind the buffer, then buffer the data if it has changed
     glBindBuffer(GL_TEXTURE_BUFFER, m_tbo);
-    glBufferData(GL_TEXTURE_BUFFER, m_texture.size() * sizeof(ngl::Vec2), &m_texture[0].m_x, GL_STATIC_DRAW);
+    TextureUpload upload = pendingUpload();
+    if (upload.allocate)
+    {
+      glBufferData(GL_TEXTURE_BUFFER, upload.bytes(), &m_texture[0].m_x, GL_DYNAMIC_DRAW);
+    }
+    else if (upload.begin < upload.end)
+    {
+      // Only the texels that changed since the last upload, e.g. a small region changed by a simulation
+      glBufferSubData(GL_TEXTURE_BUFFER, upload.begin * sizeof(ngl::Vec3), upload.bytes(), &m_texture[upload.begin].m_x);
+    }
 
     // Set the active texture, then bind the texture to the written data to be read in the shader
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_BUFFER, m_tboTex);
 
-    // Attach our texture buffer with RG32F format
-    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32F, m_tbo);
+    // Attach our texture buffer with RGB32F format
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32F, m_tbo);
+    return upload.bytes();
+  }
+
+  TextureUpload ClipmapLevel::pendingUpload() noexcept
+  {
+    TextureUpload upload;
+    if (m_bufferTexels != m_texture.size())
+    {
+      upload = TextureUpload{0, m_texture.size(), true};
+      m_bufferTexels = m_texture.size();
+      accountMemory();
+    }
+    else if (m_dirtyBegin < m_dirtyEnd)
+    {
+      upload = TextureUpload{m_dirtyBegin, m_dirtyEnd, false};
+    }
+    m_dirtyBegin = 0;
+    m_dirtyEnd = 0;
+    Metrics::getInstance()->addUpload(m_level, upload.bytes());
+    return upload;
   }
 
   void ClipmapLevel::unbindTextures() noexcept
@@ -107,9 +273,8 @@ namespace geoclipmap
   // {
   //   size_t D = Manager::getInstance()->D();
 
-  //   // Get the integer part of the position as heightmap pixels are located at whole numbers
-  //   int xPosInt = static_cast<int>(floor(m_heightmapPosition.m_x));
-  //   int yPosInt = static_cast<int>(floor(m_heightmapPosition.m_y));
+  //   int64_t xPosInt = m_originX;
+  //   int64_t yPosInt = m_originY;
 
   //   int xLoc = _x - xPosInt;
   //   int yLoc = _y - yPosInt;
@@ -125,12 +290,15 @@ namespace geoclipmap
 
   // ======================================= Private methods =======================================
 
-  ngl::Vec2 ClipmapLevel::generatePixelAt(int _x, int _y) noexcept
+  void ClipmapLevel::generateRow(int _row, int _first, int _count) noexcept
   {
-    // The value of the parent's pixel at this point which will be used in the shader for blending
-    ngl::Real coarsePixel{0.0f};
+    size_t D = Manager::getInstance()->D();
 
-    // This wasn't working as mentioned in the vertex shader
+    // The blending below was never finished, so the coarse pixel's channel instead holds the frame the texel was
+    // regenerated on for the update cost view (wrapped so it stays exact as a float)
+    auto regenerated = static_cast<ngl::Real>(Metrics::getInstance()->frameCount() % k_regeneratedFrameWrap);
+
+    // This wasn't working as mentioned in the vertex shader (it was done per pixel at heightmap location _x, _y)
     // // Computation for getting the parent pixel data
     // if (m_parent != nullptr)
     // {
@@ -172,11 +340,39 @@ namespace geoclipmap
     //   }
     // }
 
-    // The value of the pixel for this clipmap level
-    ngl::Real finePixel = m_heightmap->value(_x, _y);
+    // The overlay is read at the same samples as the heights
+    m_overlayRow.assign(_count, 0.0f);
+    if (m_overlay)
+    {
+      m_overlay((m_originX + _first) * m_scale, (m_originY + _row) * m_scale, m_scale, _count, m_overlayRow.data());
+    }
+
+    // Write vec3s where r is the fine pixel, g is the frame it was regenerated on and b is the overlay
+    const ngl::Real *finePixels = &m_heights[_row * D + _first];
+    ngl::Vec3 *pixels = &m_texture[_row * D + _first];
+    for (int x = 0; x < _count; x++)
+    {
+      pixels[x] = ngl::Vec3{finePixels[x], regenerated, m_overlayRow[x]};
+    }
+  }
 
-    // Return a vec2 where r fine pixel and g is the coarse pixel
-    return ngl::Vec2{finePixel, coarsePixel};
+  void ClipmapLevel::markDirty(size_t _begin, size_t _end) noexcept
+  {
+    if (m_dirtyBegin == m_dirtyEnd)
+    {
+      m_dirtyBegin = _begin;
+      m_dirtyEnd = _end;
+      return;
+    }
+    m_dirtyBegin = std::min(m_dirtyBegin, _begin);
+    m_dirtyEnd = std::max(m_dirtyEnd, _end);
+  }
+
+  void ClipmapLevel::accountMemory() noexcept
+  {
+    m_memory.setCpu(m_texture.capacity() * sizeof(ngl::Vec3) +
+                    (m_heights.capacity() + m_overlayRow.capacity()) * sizeof(ngl::Real));
+    m_memory.setGpu(m_bufferTexels * sizeof(ngl::Vec3));
   }
 
 } // end namespace geoclipmap
\ No newline at end of file
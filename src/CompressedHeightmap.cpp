@@ -0,0 +1,845 @@
+/**
+ * @file CompressedHeightmap.cpp
+ * @author Ollie Nicholls
+ * @brief Stores heights as a compressed multi-resolution pyramid, based on the
+ * compression used in "Geometry Clipmaps: Terrain Rendering Using Nested
+ * Regular Grids" by Losasso and Hoppe
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include "CompressedHeightmap.h"
+#include "RiceCoder.h"
+#include "ThreadPool.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    int32_t quantise(ngl::Real _value, ngl::Real _step)
+    {
+      return static_cast<int32_t>(std::lround(_value / _step));
+    }
+
+    // Starts every baked file, the last character being the version of the format
+    constexpr char k_bakedMagic[8] = {'G', 'C', 'T', 'I', 'L', 'E', 'S', '1'};
+
+    /**
+     * @brief The start of a baked file. Baked files are written in the host's
+     * byte order, which is little endian everywhere the demo runs.
+     *
+     */
+    struct BakedHeader
+    {
+      char magic[8];
+      int32_t width;
+      int32_t depth;
+      int32_t tileSize;
+      int32_t levels;
+      float step;
+      float maxError;
+      uint64_t rawBytes;
+      uint64_t compressedBytes;
+      // The number of tiles in the index that follows the header
+      uint64_t tiles;
+      // Where the first tile starts
+      uint64_t dataOffset;
+    };
+    static_assert(sizeof(BakedHeader) == 64, "BakedHeader must have no padding");
+
+    /**
+     * @brief Where a tile is in a baked file, one per tile after the header,
+     * finest level first and each level row-major
+     *
+     */
+    struct BakedTile
+    {
+      uint64_t offset;
+      uint64_t size;
+    };
+
+    /**
+     * @brief Read one range of a file with a TileReader
+     *
+     * @return true If all of it was read
+     */
+    bool readRange(TileReader &_reader, uint64_t _offset, size_t _size, void *o_data)
+    {
+      bool read = false;
+      _reader.readBatch({{_offset, _size}}, [&](size_t, const uint8_t *_data, size_t _read) {
+        if (_data && _read == _size)
+        {
+          std::memcpy(o_data, _data, _size);
+          read = true;
+        }
+      });
+      return read;
+    }
+  } // end namespace
+
+  double CompressionStats::ratio() const noexcept
+  {
+    return compressedBytes > 0 ? static_cast<double>(rawBytes) / static_cast<double>(compressedBytes) : 0.0;
+  }
+
+  double CompressionStats::samplesPerSecond() const noexcept
+  {
+    return decodeSeconds > 0.0 ? static_cast<double>(samplesDecoded) / decodeSeconds : 0.0;
+  }
+
+  double CompressionStats::hitRate() const noexcept
+  {
+    return tilesRequested > 0 ? static_cast<double>(tileHits) / static_cast<double>(tilesRequested) : 0.0;
+  }
+
+  double CompressionStats::tilesReadPerSecond() const noexcept
+  {
+    return readSeconds > 0.0 ? static_cast<double>(tilesRead) / readSeconds : 0.0;
+  }
+
+  CompressedHeightmap::CompressedHeightmap(int _width,
+                                           int _depth,
+                                           const std::vector<ngl::Real> &_heights,
+                                           ngl::Real _tolerance,
+                                           int _tileSize,
+                                           size_t _cacheTiles) noexcept : m_tileSize{_tileSize},
+                                                                          m_step{2.0f * std::max(_tolerance, 1e-6f)},
+                                                                          m_cacheTiles{std::max(_cacheTiles, static_cast<size_t>(16))}
+  {
+    buildLevels(_width, _depth);
+    m_stats.rawBytes = static_cast<size_t>(_width) * _depth * sizeof(ngl::Real);
+    encode(_heights);
+    m_encodedMemory.setCpu(m_stats.compressedBytes);
+  }
+
+  std::unique_ptr<CompressedHeightmap> CompressedHeightmap::open(std::unique_ptr<TileReader> _reader, size_t _cacheTiles) noexcept
+  {
+    BakedHeader header;
+    if (!_reader || !readRange(*_reader, 0, sizeof(header), &header) ||
+        std::memcmp(header.magic, k_bakedMagic, sizeof(k_bakedMagic)) != 0)
+    {
+      return nullptr;
+    }
+    // Tiles must be a power of 2 wide for the pyramid to line up
+    if (header.width <= 0 || header.depth <= 0 || header.tileSize <= 0 || (header.tileSize & (header.tileSize - 1)) != 0 ||
+        !(header.step > 0.0f))
+    {
+      return nullptr;
+    }
+
+    std::unique_ptr<CompressedHeightmap> heightmap(new CompressedHeightmap(header.tileSize, header.step, _cacheTiles));
+    heightmap->buildLevels(header.width, header.depth);
+    size_t tileCount = 0;
+    for (const auto &level : heightmap->m_levels)
+    {
+      tileCount += level.tiles.size();
+    }
+    if (heightmap->levels() != header.levels || tileCount != header.tiles)
+    {
+      return nullptr;
+    }
+
+    std::vector<BakedTile> index(tileCount);
+    if (!readRange(*_reader, sizeof(header), index.size() * sizeof(BakedTile), index.data()))
+    {
+      return nullptr;
+    }
+    size_t i = 0;
+    for (auto &level : heightmap->m_levels)
+    {
+      for (auto &tile : level.tiles)
+      {
+        tile.offset = index[i].offset;
+        tile.size = static_cast<size_t>(index[i].size);
+        i++;
+      }
+    }
+
+    // Worked out again rather than read, as older files counted a colour (3 floats) for each height
+    heightmap->m_stats.rawBytes = static_cast<size_t>(header.width) * header.depth * sizeof(ngl::Real);
+    heightmap->m_stats.compressedBytes = static_cast<size_t>(header.compressedBytes);
+    heightmap->m_stats.maxError = header.maxError;
+    heightmap->m_reader = std::move(_reader);
+    return heightmap;
+  }
+
+  ngl::Real CompressedHeightmap::sample(int64_t _x, int64_t _y) noexcept
+  {
+    // Every sample is read from the coarsest level that has it, so the same point always gives the same height
+    // whichever level a clipmap reads it through
+    int top = levels() - 1;
+    int level = 0;
+    while (level < top && ((_x | _y) & (1 << level)) == 0)
+    {
+      level++;
+    }
+
+    // Every level is narrower than 2^31 samples so its coords fit in an int
+    int x = static_cast<int>(_x >> level);
+    int y = static_cast<int>(_y >> level);
+    int tx = x / m_tileSize;
+    int ty = y / m_tileSize;
+    int tileWidth = std::min(m_tileSize, m_levels[level].width - tx * m_tileSize);
+
+    return residentTile(level, tx, ty)[static_cast<size_t>(y - ty * m_tileSize) * tileWidth + (x - tx * m_tileSize)];
+  }
+
+  void CompressedHeightmap::readWindow(int64_t _x,
+                                       int64_t _y,
+                                       int _stride,
+                                       int _countX,
+                                       int _countY,
+                                       size_t _pitch,
+                                       ngl::Real *_out) noexcept
+  {
+    // No sample in the window is on a finer level than the lowest set bit of its start and stride, and a block of
+    // level 0 tiles that size is within one tile of that level and every level above it
+    int top = levels() - 1;
+    int finest = 0;
+    while (finest < top && ((_x | _y | _stride) & (int64_t{1} << finest)) == 0)
+    {
+      finest++;
+    }
+    int64_t block = static_cast<int64_t>(m_tileSize) << finest;
+
+    struct BlockTile
+    {
+      std::shared_ptr<const std::vector<ngl::Real>> samples;
+      int x0 = 0;
+      int y0 = 0;
+      int width = 0;
+    };
+    std::vector<BlockTile> tiles(static_cast<size_t>(levels()));
+
+    // Only the blocks holding samples are visited, however far apart the samples are
+    for (int j0 = 0; j0 < _countY;)
+    {
+      int64_t by = (_y + static_cast<int64_t>(j0) * _stride) / block;
+      int j1 = static_cast<int>(std::min<int64_t>(_countY, ((by + 1) * block - _y + _stride - 1) / _stride));
+      for (int i0 = 0; i0 < _countX;)
+      {
+        int64_t bx = (_x + static_cast<int64_t>(i0) * _stride) / block;
+        int i1 = static_cast<int>(std::min<int64_t>(_countX, ((bx + 1) * block - _x + _stride - 1) / _stride));
+        for (auto &tile : tiles)
+        {
+          tile.samples.reset();
+        }
+
+        for (int j = j0; j < j1; j++)
+        {
+          int64_t y = _y + static_cast<int64_t>(j) * _stride;
+          ngl::Real *row = _out + static_cast<size_t>(j) * _pitch;
+          for (int i = i0; i < i1; i++)
+          {
+            // Every sample is read from the coarsest level that has it, as sample does
+            int64_t x = _x + static_cast<int64_t>(i) * _stride;
+            int level = finest;
+            while (level < top && ((x | y) & (int64_t{1} << level)) == 0)
+            {
+              level++;
+            }
+
+            BlockTile &tile = tiles[static_cast<size_t>(level)];
+            if (!tile.samples)
+            {
+              // Holding the tile keeps it alive even if looking up another level's tile evicts it
+              int tx = static_cast<int>(bx >> (level - finest));
+              int ty = static_cast<int>(by >> (level - finest));
+              residentTile(level, tx, ty);
+              tile.samples = m_levels[level].decoded[static_cast<size_t>(ty) * m_levels[level].tilesX + tx];
+              tile.x0 = tx * m_tileSize;
+              tile.y0 = ty * m_tileSize;
+              tile.width = std::min(m_tileSize, m_levels[level].width - tile.x0);
+            }
+            row[i] = (*tile.samples)[static_cast<size_t>((y >> level) - tile.y0) * tile.width + static_cast<size_t>((x >> level) - tile.x0)];
+          }
+        }
+        i0 = i1;
+      }
+      j0 = j1;
+    }
+  }
+
+  void CompressedHeightmap::decodeRegion(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, int _stride) noexcept
+  {
+    decode(_x0, _y0, _x1, _y1, _stride, false, std::numeric_limits<size_t>::max());
+  }
+
+  size_t CompressedHeightmap::warmRegion(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, int _stride, size_t _maxTiles) noexcept
+  {
+    return decode(_x0, _y0, _x1, _y1, _stride, true, _maxTiles);
+  }
+
+  bool CompressedHeightmap::bake(const std::string &_path) noexcept
+  {
+    if (m_reader)
+    {
+      return false;
+    }
+
+    auto pad = [](uint64_t _offset) {
+      return static_cast<size_t>((TileReader::k_alignment - _offset % TileReader::k_alignment) % TileReader::k_alignment);
+    };
+
+    BakedHeader header;
+    std::memcpy(header.magic, k_bakedMagic, sizeof(k_bakedMagic));
+    header.width = m_levels[0].width;
+    header.depth = m_levels[0].depth;
+    header.tileSize = m_tileSize;
+    header.levels = levels();
+    header.step = m_step;
+    header.maxError = m_stats.maxError;
+    header.rawBytes = m_stats.rawBytes;
+    header.compressedBytes = m_stats.compressedBytes;
+    header.tiles = 0;
+    for (const auto &level : m_levels)
+    {
+      header.tiles += level.tiles.size();
+    }
+    // The tiles start on a block boundary after the index, then are packed one after another as the reader rounds
+    // each read out to whole blocks anyway
+    uint64_t indexEnd = sizeof(header) + header.tiles * sizeof(BakedTile);
+    header.dataOffset = indexEnd + pad(indexEnd);
+
+    std::vector<BakedTile> index;
+    uint64_t offset = header.dataOffset;
+    for (const auto &level : m_levels)
+    {
+      for (const auto &tile : level.tiles)
+      {
+        index.push_back({offset, tile.bits.size()});
+        offset += tile.bits.size();
+      }
+    }
+
+    std::ofstream file(_path, std::ios::binary | std::ios::trunc);
+    std::vector<char> padding(TileReader::k_alignment, 0);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(BakedTile)));
+    file.write(padding.data(), static_cast<std::streamsize>(pad(indexEnd)));
+    for (const auto &level : m_levels)
+    {
+      for (const auto &tile : level.tiles)
+      {
+        file.write(reinterpret_cast<const char *>(tile.bits.data()), static_cast<std::streamsize>(tile.bits.size()));
+      }
+    }
+    // Pad the end so the last tile's rounded out read doesn't run off the end of the file
+    file.write(padding.data(), static_cast<std::streamsize>(pad(offset)));
+    file.close();
+    if (!file)
+    {
+      return false;
+    }
+
+    size_t i = 0;
+    for (auto &level : m_levels)
+    {
+      for (auto &tile : level.tiles)
+      {
+        tile.offset = index[i++].offset;
+      }
+    }
+    return true;
+  }
+
+  bool CompressedHeightmap::streamTiles(const std::string &_path, TileReaderBackend _backend, bool _directIO) noexcept
+  {
+    if (!bake(_path))
+    {
+      return false;
+    }
+    m_reader = TileReader::open(_path, _backend, _directIO);
+    if (!m_reader)
+    {
+      return false;
+    }
+
+    for (auto &level : m_levels)
+    {
+      for (auto &tile : level.tiles)
+      {
+        std::vector<uint8_t>().swap(tile.bits);
+      }
+    }
+    m_encodedMemory.setCpu(0);
+    return true;
+  }
+
+  const TileReader *CompressedHeightmap::tileReader() const noexcept
+  {
+    return m_reader.get();
+  }
+
+  int CompressedHeightmap::width() const noexcept
+  {
+    return m_levels[0].width;
+  }
+
+  int CompressedHeightmap::depth() const noexcept
+  {
+    return m_levels[0].depth;
+  }
+
+  int CompressedHeightmap::tileSize() const noexcept
+  {
+    return m_tileSize;
+  }
+
+  int CompressedHeightmap::levels() const noexcept
+  {
+    return static_cast<int>(m_levels.size());
+  }
+
+  const CompressionStats &CompressedHeightmap::stats() const noexcept
+  {
+    return m_stats;
+  }
+
+  // ======================================= Private methods =======================================
+
+  CompressedHeightmap::CompressedHeightmap(int _tileSize,
+                                           ngl::Real _step,
+                                           size_t _cacheTiles) noexcept : m_tileSize{_tileSize},
+                                                                          m_step{_step},
+                                                                          m_cacheTiles{std::max(_cacheTiles, static_cast<size_t>(16))}
+  {
+  }
+
+  void CompressedHeightmap::buildLevels(int _width, int _depth) noexcept
+  {
+    // Each level keeps every other sample of the one below, stopping once a level fits in one tile
+    Level level;
+    level.width = _width;
+    level.depth = _depth;
+    while (true)
+    {
+      level.tilesX = (level.width + m_tileSize - 1) / m_tileSize;
+      level.tilesY = (level.depth + m_tileSize - 1) / m_tileSize;
+      level.tiles.resize(static_cast<size_t>(level.tilesX) * level.tilesY);
+      level.decoded.resize(level.tiles.size());
+      level.lastUsed.resize(level.tiles.size());
+      level.cacheEntry.resize(level.tiles.size());
+      level.failed.resize(level.tiles.size());
+      m_levels.push_back(level);
+
+      if ((level.width <= m_tileSize && level.depth <= m_tileSize) || m_levels.size() == 16)
+      {
+        break;
+      }
+      level.width = (level.width + 1) / 2;
+      level.depth = (level.depth + 1) / 2;
+    }
+  }
+
+  size_t CompressedHeightmap::decode(int64_t _x0,
+                                     int64_t _y0,
+                                     int64_t _x1,
+                                     int64_t _y1,
+                                     int _stride,
+                                     bool _prefetch,
+                                     size_t _maxTiles) noexcept
+  {
+    if (_x0 > _x1 || _y0 > _y1 || _x1 < 0 || _y1 < 0 || _x0 >= m_levels[0].width || _y0 >= m_levels[0].depth)
+    {
+      return 0;
+    }
+    // Once clamped to the heightmap the region fits in an int
+    int x0 = static_cast<int>(std::max<int64_t>(_x0, 0));
+    int y0 = static_cast<int>(std::max<int64_t>(_y0, 0));
+    int x1 = static_cast<int>(std::min<int64_t>(_x1, m_levels[0].width - 1));
+    int y1 = static_cast<int>(std::min<int64_t>(_y1, m_levels[0].depth - 1));
+
+    // The finest level needed is the one whose spacing matches the stride
+    int finest = 0;
+    while (finest < levels() - 1 && (2 << finest) <= _stride)
+    {
+      finest++;
+    }
+
+    // Work out which tiles are missing at each level, marking the ones already resident as used so they
+    // don't get evicted to make room. Coarser tiles come first as the finer ones need them, so a prefetch cut short
+    // by _maxTiles only ever leaves out the finest tiles.
+    std::vector<std::vector<std::pair<int, int>>> missing(levels());
+    size_t missingCount = 0;
+    size_t missingSamples = 0;
+    m_useCounter++;
+    for (int l = levels() - 1; l >= finest; l--)
+    {
+      auto &level = m_levels[l];
+      for (int ty = (y0 >> l) / m_tileSize; ty <= (y1 >> l) / m_tileSize; ty++)
+      {
+        for (int tx = (x0 >> l) / m_tileSize; tx <= (x1 >> l) / m_tileSize; tx++)
+        {
+          size_t index = static_cast<size_t>(ty) * level.tilesX + tx;
+          touch(l, index);
+          // A tile that couldn't be read is only an estimate, so is read again as if it were missing
+          bool resident = level.decoded[index] && !level.failed[index];
+          if (!_prefetch)
+          {
+            m_stats.tilesRequested++;
+            m_stats.tileHits += resident ? 1 : 0;
+          }
+          if (!resident && missingCount < _maxTiles)
+          {
+            if (level.decoded[index])
+            {
+              release(l, index);
+            }
+            missing[l].emplace_back(tx, ty);
+            missingCount++;
+            missingSamples += static_cast<size_t>(std::min(m_tileSize, level.width - tx * m_tileSize)) *
+                              std::min(m_tileSize, level.depth - ty * m_tileSize);
+            if (_prefetch)
+            {
+              m_stats.bytesPrefetched += level.tiles[index].size;
+            }
+          }
+        }
+      }
+    }
+
+    if (missingCount == 0)
+    {
+      return 0;
+    }
+    m_stats.samplesDecoded += missingSamples;
+
+    evict(missingCount);
+
+    // Read every missing tile from disk at once, so the reads overlap rather than each waiting for the last
+    std::vector<std::pair<int, size_t>> toLoad;
+    for (int l = levels() - 1; l >= finest; l--)
+    {
+      for (const auto &tile : missing[l])
+      {
+        toLoad.emplace_back(l, static_cast<size_t>(tile.second) * m_levels[l].tilesX + tile.first);
+      }
+    }
+    loadTiles(toLoad);
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Each level needs the one above it, so decode a level at a time with the tiles of a level in parallel
+    for (int l = levels() - 1; l >= finest; l--)
+    {
+      const auto &tiles = missing[l];
+      ThreadPool::getInstance()->parallelFor(tiles.size(), [this, l, &tiles](size_t _i) {
+        decodeTile(l, tiles[_i].first, tiles[_i].second);
+      });
+    }
+    for (const auto &tile : toLoad)
+    {
+      addResident(tile.first, tile.second);
+    }
+    m_residentTiles += missingCount;
+    m_cacheMemory.setCpu(m_cacheMemory.cpuBytes() + missingSamples * sizeof(ngl::Real));
+    m_stats.tilesDecoded += missingCount;
+    if (_prefetch)
+    {
+      m_stats.tilesPrefetched += missingCount;
+    }
+
+    m_stats.decodeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return missingCount;
+  }
+
+  void CompressedHeightmap::encode(const std::vector<ngl::Real> &_heights) noexcept
+  {
+    int width = m_levels[0].width;
+    int top = levels() - 1;
+
+    // The reconstructed (decoded) values of the level above, which the residuals are taken against so
+    // the quantisation error never builds up down the pyramid
+    std::vector<ngl::Real> coarse;
+    std::vector<ngl::Real> current;
+    std::vector<int32_t> residuals;
+
+    for (int l = top; l >= 0; l--)
+    {
+      auto &level = m_levels[l];
+      current.assign(static_cast<size_t>(level.width) * level.depth, 0.0f);
+
+      for (int ty = 0; ty < level.tilesY; ty++)
+      {
+        for (int tx = 0; tx < level.tilesX; tx++)
+        {
+          int x0 = tx * m_tileSize;
+          int y0 = ty * m_tileSize;
+          int x1 = std::min(x0 + m_tileSize, level.width);
+          int y1 = std::min(y0 + m_tileSize, level.depth);
+          residuals.clear();
+
+          // The level above is only read within the one tile this tile sits under so tiles stay independent
+          int maxX = std::min((tx / 2) * m_tileSize + m_tileSize, (level.width + 1) / 2) - 1;
+          int maxY = std::min((ty / 2) * m_tileSize + m_tileSize, (level.depth + 1) / 2) - 1;
+
+          int32_t previousRow = 0;
+          for (int y = y0; y < y1; y++)
+          {
+            int32_t previous = previousRow;
+            for (int x = x0; x < x1; x++)
+            {
+              ngl::Real original = _heights[(static_cast<size_t>(y) << l) * width + (static_cast<size_t>(x) << l)];
+              ngl::Real &decoded = current[static_cast<size_t>(y) * level.width + x];
+
+              if (l == top)
+              {
+                // The coarsest level is stored as the difference to the previous sample
+                int32_t value = quantise(original, m_step);
+                residuals.push_back(value - previous);
+                decoded = static_cast<ngl::Real>(value) * m_step;
+                previous = value;
+                if (x == x0)
+                {
+                  previousRow = value;
+                }
+              }
+              else if ((x & 1) == 0 && (y & 1) == 0)
+              {
+                // The level above already has this sample
+                decoded = coarse[static_cast<size_t>(y / 2) * ((level.width + 1) / 2) + x / 2];
+              }
+              else
+              {
+                ngl::Real prediction = predict(coarse.data(), (level.width + 1) / 2, x, y, maxX, maxY);
+                int32_t residual = quantise(original - prediction, m_step);
+                residuals.push_back(residual);
+                decoded = prediction + static_cast<ngl::Real>(residual) * m_step;
+              }
+            }
+          }
+
+          auto &tile = level.tiles[static_cast<size_t>(ty) * level.tilesX + tx];
+          riceEncode(residuals, tile.bits);
+          tile.bits.shrink_to_fit();
+          tile.size = tile.bits.size();
+          m_stats.compressedBytes += tile.bits.size();
+        }
+      }
+
+      coarse.swap(current);
+    }
+
+    // The finest level has now been reconstructed so measure how far it is from the original
+    for (size_t i = 0; i < coarse.size(); i++)
+    {
+      m_stats.maxError = std::max(m_stats.maxError, std::abs(coarse[i] - _heights[i]));
+    }
+  }
+
+  void CompressedHeightmap::loadTiles(const std::vector<std::pair<int, size_t>> &_tiles) noexcept
+  {
+    if (!m_reader || _tiles.empty())
+    {
+      return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<TileRead> reads;
+    reads.reserve(_tiles.size());
+    for (const auto &tile : _tiles)
+    {
+      const auto &encoded = m_levels[tile.first].tiles[tile.second];
+      reads.push_back({encoded.offset, encoded.size});
+      m_stats.bytesRead += encoded.size;
+    }
+
+    // Each read fills a different tile, so the callback is safe to run on several threads at once
+    std::vector<uint8_t> read(_tiles.size(), 0);
+    m_reader->readBatch(reads, [this, &_tiles, &read](size_t _i, const uint8_t *_data, size_t _size) {
+      if (_data)
+      {
+        m_levels[_tiles[_i].first].tiles[_tiles[_i].second].bits.assign(_data, _data + _size);
+        read[_i] = 1;
+      }
+    });
+
+    // A tile that couldn't be read is left empty, which decodes as no residuals (an estimate from the level above
+    // rather than garbage), and marked failed so it isn't kept as if it were right
+    for (size_t i = 0; i < _tiles.size(); i++)
+    {
+      m_levels[_tiles[i].first].failed[_tiles[i].second] = read[i] ? 0 : 1;
+      m_stats.readErrors += read[i] ? 0 : 1;
+    }
+    m_stats.tilesRead += _tiles.size();
+    m_stats.readSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  ngl::Real CompressedHeightmap::predict(const ngl::Real *_coarse,
+                                         int _coarseWidth,
+                                         int _x,
+                                         int _y,
+                                         int _maxX,
+                                         int _maxY) noexcept
+  {
+    // Samples sit between the coarse samples so their prediction is the average of the 2 (or 4) around them
+    int x0 = _x >> 1;
+    int y0 = _y >> 1;
+    int x1 = std::min(x0 + (_x & 1), _maxX);
+    int y1 = std::min(y0 + (_y & 1), _maxY);
+
+    return 0.25f * (_coarse[static_cast<size_t>(y0) * _coarseWidth + x0] +
+                    _coarse[static_cast<size_t>(y0) * _coarseWidth + x1] +
+                    _coarse[static_cast<size_t>(y1) * _coarseWidth + x0] +
+                    _coarse[static_cast<size_t>(y1) * _coarseWidth + x1]);
+  }
+
+  void CompressedHeightmap::decodeTile(int _level, int _tx, int _ty) noexcept
+  {
+    auto &level = m_levels[_level];
+    auto &tile = level.tiles[static_cast<size_t>(_ty) * level.tilesX + _tx];
+    int x0 = _tx * m_tileSize;
+    int y0 = _ty * m_tileSize;
+    int tileWidth = std::min(m_tileSize, level.width - x0);
+    int tileDepth = std::min(m_tileSize, level.depth - y0);
+
+    auto decoded = std::make_shared<std::vector<ngl::Real>>(static_cast<size_t>(tileWidth) * tileDepth);
+    RiceDecoder reader(tile.bits);
+
+    if (_level == levels() - 1)
+    {
+      int32_t previousRow = 0;
+      for (int y = 0; y < tileDepth; y++)
+      {
+        int32_t previous = previousRow;
+        for (int x = 0; x < tileWidth; x++)
+        {
+          int32_t value = previous + reader.next();
+          (*decoded)[static_cast<size_t>(y) * tileWidth + x] = static_cast<ngl::Real>(value) * m_step;
+          previous = value;
+          if (x == 0)
+          {
+            previousRow = value;
+          }
+        }
+      }
+    }
+    else
+    {
+      // Take a reference to the tile above so it can't be evicted while this tile is using it
+      const auto &above = m_levels[_level + 1];
+      int parentX = _tx / 2;
+      int parentY = _ty / 2;
+      size_t parentIndex = static_cast<size_t>(parentY) * above.tilesX + parentX;
+      auto parent = above.decoded[parentIndex];
+      // Anything decoded from an estimate is only an estimate too
+      if (above.failed[parentIndex])
+      {
+        level.failed[static_cast<size_t>(_ty) * level.tilesX + _tx] = 1;
+      }
+      int parentWidth = std::min(m_tileSize, above.width - parentX * m_tileSize);
+      int parentDepth = std::min(m_tileSize, above.depth - parentY * m_tileSize);
+
+      // Coordinates relative to the parent tile's origin (doubled to this level) keep the same odd/even-ness
+      int offsetX = x0 - 2 * parentX * m_tileSize;
+      int offsetY = y0 - 2 * parentY * m_tileSize;
+
+      for (int y = 0; y < tileDepth; y++)
+      {
+        for (int x = 0; x < tileWidth; x++)
+        {
+          int px = x + offsetX;
+          int py = y + offsetY;
+          ngl::Real &value = (*decoded)[static_cast<size_t>(y) * tileWidth + x];
+
+          if ((px & 1) == 0 && (py & 1) == 0)
+          {
+            value = (*parent)[static_cast<size_t>(py / 2) * parentWidth + px / 2];
+          }
+          else
+          {
+            ngl::Real prediction = predict(parent->data(), parentWidth, px, py, parentWidth - 1, parentDepth - 1);
+            value = prediction + static_cast<ngl::Real>(reader.next()) * m_step;
+          }
+        }
+      }
+    }
+
+    level.decoded[static_cast<size_t>(_ty) * level.tilesX + _tx] = decoded;
+    if (m_reader)
+    {
+      // The residuals are on disk so only need to be in memory while decoding
+      std::vector<uint8_t>().swap(tile.bits);
+    }
+  }
+
+  const std::vector<ngl::Real> &CompressedHeightmap::residentTile(int _level, int _tx, int _ty) noexcept
+  {
+    auto &level = m_levels[_level];
+    size_t index = static_cast<size_t>(_ty) * level.tilesX + _tx;
+
+    // A tile that couldn't be read is used as it is (an estimate) until the next decode of a region it is in reads it
+    // again, rather than being read again for every sample
+    if (!level.decoded[index])
+    {
+      if (_level < levels() - 1)
+      {
+        residentTile(_level + 1, _tx / 2, _ty / 2);
+      }
+
+      loadTiles({{_level, index}});
+      auto start = std::chrono::steady_clock::now();
+      evict(1);
+      decodeTile(_level, _tx, _ty);
+      addResident(_level, index);
+      m_residentTiles++;
+      m_cacheMemory.setCpu(m_cacheMemory.cpuBytes() + level.decoded[index]->size() * sizeof(ngl::Real));
+      m_stats.tilesDecoded++;
+      m_stats.samplesDecoded += level.decoded[index]->size();
+      m_stats.decodeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    m_useCounter++;
+    touch(_level, index);
+    return *level.decoded[index];
+  }
+
+  void CompressedHeightmap::release(int _level, size_t _index) noexcept
+  {
+    auto &level = m_levels[_level];
+    m_cacheOrder.erase(level.cacheEntry[_index]);
+    m_cacheMemory.setCpu(m_cacheMemory.cpuBytes() - level.decoded[_index]->size() * sizeof(ngl::Real));
+    level.decoded[_index].reset();
+    level.failed[_index] = 0;
+    m_residentTiles--;
+  }
+
+  void CompressedHeightmap::touch(int _level, size_t _index) noexcept
+  {
+    auto &level = m_levels[_level];
+    level.lastUsed[_index] = m_useCounter;
+    if (level.decoded[_index])
+    {
+      m_cacheOrder.splice(m_cacheOrder.end(), m_cacheOrder, level.cacheEntry[_index]);
+    }
+  }
+
+  void CompressedHeightmap::addResident(int _level, size_t _index) noexcept
+  {
+    m_levels[_level].cacheEntry[_index] = m_cacheOrder.emplace(m_cacheOrder.end(), _level, _index);
+  }
+
+  void CompressedHeightmap::evict(size_t _incoming) noexcept
+  {
+    // Tiles stamped with the current counter are about to be used (or are the parents of tiles about to be decoded)
+    // and sit at the back of the use order, so eviction stops at them even if that means going over the limit for a
+    // while
+    while (m_residentTiles + _incoming > m_cacheTiles && !m_cacheOrder.empty())
+    {
+      auto [l, index] = m_cacheOrder.front();
+      if (m_levels[l].lastUsed[index] == m_useCounter)
+      {
+        break;
+      }
+      release(l, index);
+    }
+  }
+} // end namespace geoclipmap
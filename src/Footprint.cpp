@@ -11,6 +11,7 @@
 #include <ngl/VAOFactory.h>
 
 #include "Footprint.h"
+#include "Metrics.h"
 
 namespace geoclipmap
 {
@@ -21,6 +22,8 @@ namespace geoclipmap
     m_vertexCount = m_vertices.size();
     calculateIndices();
     m_indexCount = m_indices.size();
+    countTriangles();
+    m_memory.setCpu(m_vertices.capacity() * sizeof(ngl::Vec2) + m_indices.capacity() * sizeof(GLuint));
   }
 
   Footprint::Footprint(size_t _width) noexcept : m_width{_width},
@@ -30,6 +33,8 @@ namespace geoclipmap
     m_vertexCount = m_vertices.size();
     calculateIndicesDegenerate();
     m_indexCount = m_indices.size();
+    countTriangles();
+    m_memory.setCpu(m_vertices.capacity() * sizeof(ngl::Vec2) + m_indices.capacity() * sizeof(GLuint));
   }
 
   Footprint::~Footprint() noexcept
@@ -57,10 +62,20 @@ namespace geoclipmap
       m_vao->setVertexAttributePointer(0, 2, GL_FLOAT, 0, 0);
       m_vao->setIndexData(FootprintVAO::IndexData(m_indices.size() * sizeof(GLuint), m_indices[0]), m_indices.size());
       m_dataBound = true;
+      m_memory.setGpu(m_vertices.size() * sizeof(ngl::Vec2) + m_indices.size() * sizeof(GLuint));
     }
 
     m_vao->draw();
     m_vao->unbind();
+
+    Metrics *metrics = Metrics::getInstance();
+    metrics->add(Counter::DrawCalls, 1);
+    metrics->add(Counter::Triangles, m_triangleCount);
+  }
+
+  size_t Footprint::triangleCount() const noexcept
+  {
+    return m_triangleCount;
   }
 
   // ======================================= Private methods =======================================
@@ -136,4 +151,21 @@ namespace geoclipmap
     m_indices.push_back(0);
   }
 
+  void Footprint::countTriangles() noexcept
+  {
+    // Each strip between restarts makes a triangle from every index after its first two
+    m_triangleCount = 0;
+    size_t stripLength = 0;
+    for (GLuint index : m_indices)
+    {
+      if (index == std::numeric_limits<GLuint>::max())
+      {
+        stripLength = 0;
+      }
+      else if (++stripLength > 2)
+      {
+        m_triangleCount++;
+      }
+    }
+  }
 } // end namespace geoclipmap
\ No newline at end of file
@@ -40,6 +40,7 @@ namespace geoclipmap
     if (m_allocated == true)
     {
       glDeleteBuffers(1, &m_buffer);
+      glDeleteBuffers(1, &m_indexBuffer);
     }
 
     glDeleteVertexArrays(1, &m_id);
@@ -53,9 +54,8 @@ namespace geoclipmap
       std::cerr << "Warning trying to set vertex data on unbound Footprint VAO\n";
     }
 
-    GLuint vboID;
-    glGenBuffers(1, &vboID);
-    glBindBuffer(GL_ARRAY_BUFFER, vboID);
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
     glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(_data.m_size), &_data.m_data, _data.m_mode);
 
     m_allocated = true;
@@ -70,9 +70,8 @@ namespace geoclipmap
 
     m_indicesCount = _indexCount;
 
-    GLuint iboID;
-    glGenBuffers(1, &iboID);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iboID);
+    glGenBuffers(1, &m_indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLsizeiptr>(_data.m_size), &_data.m_data, _data.m_mode);
   }
 } // end namespace geoclipmap
\ No newline at end of file
@@ -0,0 +1,97 @@
+/**
+ * @file FrameStats.cpp
+ * @author Ollie Nicholls
+ * @brief The cost of each frame the demo draws, e.g. while playing back a
+ * camera path
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include "FrameStats.h"
+
+namespace geoclipmap
+{
+  size_t FrameStats::add(const FrameTiming &_timing) noexcept
+  {
+    m_frames.push_back(_timing);
+    return m_frames.size() - 1;
+  }
+
+  void FrameStats::setGpuTime(size_t _frame, double _gpuMs) noexcept
+  {
+    if (_frame < m_frames.size())
+    {
+      m_frames[_frame].gpuMs = _gpuMs;
+    }
+  }
+
+  size_t FrameStats::frameCount() const noexcept
+  {
+    return m_frames.size();
+  }
+
+  const FrameTiming &FrameStats::frame(size_t _frame) const noexcept
+  {
+    return m_frames[_frame];
+  }
+
+  double FrameStats::percentile(FrameTime _time, double _percentile) const noexcept
+  {
+    std::vector<double> times;
+    times.reserve(m_frames.size());
+    for (const FrameTiming &timing : m_frames)
+    {
+      switch (_time)
+      {
+      case FrameTime::Frame:
+        times.push_back(timing.frameMs);
+        break;
+      case FrameTime::Cpu:
+        times.push_back(timing.cpuMs);
+        break;
+      case FrameTime::Gpu:
+        if (timing.gpuMs >= 0.0)
+        {
+          times.push_back(timing.gpuMs);
+        }
+        break;
+      }
+    }
+    if (times.empty())
+    {
+      return 0.0;
+    }
+
+    // Nearest rank, so the 99th percentile of 100 frames is the 99th fastest rather than the slowest
+    auto rank = static_cast<size_t>(std::ceil(std::clamp(_percentile, 0.0, 1.0) * static_cast<double>(times.size())));
+    size_t n = std::min(times.size() - 1, rank > 0 ? rank - 1 : 0);
+    std::nth_element(times.begin(), times.begin() + n, times.end());
+    return times[n];
+  }
+
+  bool FrameStats::writeCsv(const std::string &_path) const noexcept
+  {
+    std::ofstream file(_path, std::ios::trunc);
+    if (!file)
+    {
+      return false;
+    }
+    file << "frame,frame_ms,cpu_ms,gpu_ms,upload_bytes,draws\n";
+    for (size_t i = 0; i < m_frames.size(); i++)
+    {
+      const FrameTiming &timing = m_frames[i];
+      file << i << ',' << timing.frameMs << ',' << timing.cpuMs << ',';
+      // Frames whose timer was never read back are left empty rather than given a made up time
+      if (timing.gpuMs >= 0.0)
+      {
+        file << timing.gpuMs;
+      }
+      file << ',' << timing.uploadBytes << ',' << timing.draws << '\n';
+    }
+    return static_cast<bool>(file);
+  }
+} // end namespace geoclipmap
@@ -0,0 +1,266 @@
+/**
+ * @file HeightQuery.cpp
+ * @author Ollie Nicholls
+ * @brief Answers batches of height queries, e.g. placing every vehicle and
+ * agent of a simulation on the terrain each tick
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <cmath>
+
+#include "HeightQuery.h"
+#include "Manager.h"
+#include "ThreadPool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HEIGHT_QUERY_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // Positions are answered in blocks small enough for every intermediate array to stay in L1
+    constexpr int k_blockSize = 256;
+    // Batches bigger than this are split into tasks of this many positions for the thread pool
+    constexpr size_t k_taskSize = 16384;
+
+    /**
+     * @brief The intermediate values of a block of positions, one array per
+     * value so they can be worked on 4 at a time
+     *
+     */
+    struct Block
+    {
+      alignas(16) ngl::Real x[k_blockSize];
+      alignas(16) ngl::Real y[k_blockSize];
+      // The sample at the top left of each position
+      alignas(16) int32_t sampleX[k_blockSize];
+      alignas(16) int32_t sampleY[k_blockSize];
+      // How far each position is between that sample and the next
+      alignas(16) ngl::Real fractionX[k_blockSize];
+      alignas(16) ngl::Real fractionY[k_blockSize];
+      // The samples around each position
+      alignas(16) ngl::Real h00[k_blockSize];
+      alignas(16) ngl::Real h10[k_blockSize];
+      alignas(16) ngl::Real h01[k_blockSize];
+      alignas(16) ngl::Real h11[k_blockSize];
+      // The results
+      alignas(16) ngl::Real height[k_blockSize];
+      alignas(16) ngl::Real normalX[k_blockSize];
+      alignas(16) ngl::Real normalY[k_blockSize];
+      alignas(16) ngl::Real normalZ[k_blockSize];
+    };
+
+    /**
+     * @brief Split each coordinate into the whole sample below it and the
+     * fraction of a sample past that
+     *
+     * @param _coords The coordinates (_count values, a multiple of 4)
+     * @param _count The number of coordinates
+     * @param o_samples Set to the whole samples
+     * @param o_fractions Set to the fractions [0, 1)
+     */
+    void split(const ngl::Real *_coords, int _count, int32_t *o_samples, ngl::Real *o_fractions) noexcept
+    {
+#ifdef HEIGHT_QUERY_SSE2
+      const __m128 one = _mm_set1_ps(1.0f);
+      for (int i = 0; i < _count; i += 4)
+      {
+        __m128 coord = _mm_load_ps(_coords + i);
+        // Truncating rounds negative coordinates up, so take 1 off those
+        __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(coord));
+        __m128 floored = _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, coord), one));
+        _mm_store_si128(reinterpret_cast<__m128i *>(o_samples + i), _mm_cvttps_epi32(floored));
+        _mm_store_ps(o_fractions + i, _mm_sub_ps(coord, floored));
+      }
+#else
+      for (int i = 0; i < _count; i++)
+      {
+        ngl::Real floored = std::floor(_coords[i]);
+        o_samples[i] = static_cast<int32_t>(floored);
+        o_fractions[i] = _coords[i] - floored;
+      }
+#endif
+    }
+
+    /**
+     * @brief Interpolate the heights (and normals) of a block from the samples
+     * around each position
+     *
+     * @param _block The block
+     * @param _count The number of positions (a multiple of 4)
+     * @param _normals Whether to work out the normals
+     */
+    void interpolate(Block &_block, int _count, bool _normals) noexcept
+    {
+#ifdef HEIGHT_QUERY_SSE2
+      const __m128 one = _mm_set1_ps(1.0f);
+      for (int i = 0; i < _count; i += 4)
+      {
+        __m128 fx = _mm_load_ps(_block.fractionX + i);
+        __m128 fy = _mm_load_ps(_block.fractionY + i);
+        __m128 h00 = _mm_load_ps(_block.h00 + i);
+        __m128 h10 = _mm_load_ps(_block.h10 + i);
+        __m128 h01 = _mm_load_ps(_block.h01 + i);
+        __m128 h11 = _mm_load_ps(_block.h11 + i);
+
+        __m128 top = _mm_add_ps(h00, _mm_mul_ps(fx, _mm_sub_ps(h10, h00)));
+        __m128 bottom = _mm_add_ps(h01, _mm_mul_ps(fx, _mm_sub_ps(h11, h01)));
+        _mm_store_ps(_block.height + i, _mm_add_ps(top, _mm_mul_ps(fy, _mm_sub_ps(bottom, top))));
+
+        if (_normals)
+        {
+          // The slopes of the bilinear surface, the normal is (-dx, -dy, 1) normalised
+          __m128 dx = _mm_add_ps(_mm_sub_ps(h10, h00), _mm_mul_ps(fy, _mm_sub_ps(_mm_sub_ps(h11, h01), _mm_sub_ps(h10, h00))));
+          __m128 dy = _mm_add_ps(_mm_sub_ps(h01, h00), _mm_mul_ps(fx, _mm_sub_ps(_mm_sub_ps(h11, h10), _mm_sub_ps(h01, h00))));
+          __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), one));
+          __m128 inverse = _mm_div_ps(one, length);
+          _mm_store_ps(_block.normalX + i, _mm_mul_ps(_mm_sub_ps(_mm_setzero_ps(), dx), inverse));
+          _mm_store_ps(_block.normalY + i, _mm_mul_ps(_mm_sub_ps(_mm_setzero_ps(), dy), inverse));
+          _mm_store_ps(_block.normalZ + i, inverse);
+        }
+      }
+#else
+      for (int i = 0; i < _count; i++)
+      {
+        ngl::Real fx = _block.fractionX[i];
+        ngl::Real fy = _block.fractionY[i];
+        ngl::Real top = _block.h00[i] + fx * (_block.h10[i] - _block.h00[i]);
+        ngl::Real bottom = _block.h01[i] + fx * (_block.h11[i] - _block.h01[i]);
+        _block.height[i] = top + fy * (bottom - top);
+
+        if (_normals)
+        {
+          ngl::Real dx = (_block.h10[i] - _block.h00[i]) + fy * ((_block.h11[i] - _block.h01[i]) - (_block.h10[i] - _block.h00[i]));
+          ngl::Real dy = (_block.h01[i] - _block.h00[i]) + fx * ((_block.h11[i] - _block.h10[i]) - (_block.h01[i] - _block.h00[i]));
+          ngl::Real inverse = 1.0f / std::sqrt(dx * dx + dy * dy + 1.0f);
+          _block.normalX[i] = -dx * inverse;
+          _block.normalY[i] = -dy * inverse;
+          _block.normalZ[i] = inverse;
+        }
+      }
+#endif
+    }
+  } // end namespace
+
+  HeightQuery::HeightQuery(Heightmap *_heightmap, Terrain *_terrain) noexcept : m_heightmap{_heightmap},
+                                                                               m_terrain{_terrain}
+  {
+  }
+
+  void HeightQuery::heights(const ngl::Vec2 *_positions, size_t _count, ngl::Real *o_heights, ngl::Vec3 *o_normals) noexcept
+  {
+    ResidentLevel level = residentLevel();
+
+    if (_count <= k_taskSize || !m_heightmap->concurrentReads())
+    {
+      heightsBatch(_positions, _count, o_heights, o_normals, level);
+      return;
+    }
+
+    size_t tasks = (_count + k_taskSize - 1) / k_taskSize;
+    ThreadPool::getInstance()->parallelFor(tasks, [&](size_t _task) {
+      size_t first = _task * k_taskSize;
+      size_t count = std::min(k_taskSize, _count - first);
+      heightsBatch(_positions + first, count, o_heights + first, o_normals ? o_normals + first : nullptr, level);
+    });
+  }
+
+  size_t HeightQuery::residentQueries() const noexcept
+  {
+    return m_residentQueries.load();
+  }
+
+  // ======================================= Private methods =======================================
+
+  HeightQuery::ResidentLevel HeightQuery::residentLevel() const noexcept
+  {
+    ResidentLevel level;
+    if (m_terrain == nullptr)
+    {
+      return level;
+    }
+
+    // Coarser levels would give a different answer depending on where the camera is, so only full resolution will do,
+    // and only once it has been filled if the terrain is refining progressively
+    const ClipmapLevel *finest = m_terrain->clipmaps()[m_terrain->readyFinest()];
+    int64_t size = static_cast<int64_t>(Manager::getInstance()->D());
+    if (finest->scale() != 1 || finest->heights().size() != static_cast<size_t>(size * size))
+    {
+      return level;
+    }
+
+    level.heights = finest->heights().data();
+    level.originX = finest->originX();
+    level.originY = finest->originY();
+    level.size = size;
+    return level;
+  }
+
+  void HeightQuery::heightsBatch(const ngl::Vec2 *_positions,
+                                 size_t _count,
+                                 ngl::Real *o_heights,
+                                 ngl::Vec3 *o_normals,
+                                 const ResidentLevel &_level) noexcept
+  {
+    Block block;
+    size_t resident = 0;
+
+    for (size_t first = 0; first < _count; first += k_blockSize)
+    {
+      int count = static_cast<int>(std::min<size_t>(k_blockSize, _count - first));
+      // The SIMD loops work 4 at a time so pad the block out with positions at the origin
+      int padded = (count + 3) & ~3;
+      for (int i = 0; i < count; i++)
+      {
+        block.x[i] = _positions[first + i].m_x;
+        block.y[i] = _positions[first + i].m_y;
+      }
+      std::fill(block.x + count, block.x + padded, 0.0f);
+      std::fill(block.y + count, block.y + padded, 0.0f);
+
+      split(block.x, padded, block.sampleX, block.fractionX);
+      split(block.y, padded, block.sampleY, block.fractionY);
+
+      for (int i = 0; i < padded; i++)
+      {
+        int64_t x = block.sampleX[i];
+        int64_t y = block.sampleY[i];
+        if (_level.heights && x >= _level.originX && y >= _level.originY && x + 1 < _level.originX + _level.size &&
+            y + 1 < _level.originY + _level.size)
+        {
+          const ngl::Real *samples = _level.heights + (y - _level.originY) * _level.size + (x - _level.originX);
+          block.h00[i] = samples[0];
+          block.h10[i] = samples[1];
+          block.h01[i] = samples[_level.size];
+          block.h11[i] = samples[_level.size + 1];
+          resident += i < count;
+        }
+        else
+        {
+          block.h00[i] = m_heightmap->value(x, y);
+          block.h10[i] = m_heightmap->value(x + 1, y);
+          block.h01[i] = m_heightmap->value(x, y + 1);
+          block.h11[i] = m_heightmap->value(x + 1, y + 1);
+        }
+      }
+
+      interpolate(block, padded, o_normals != nullptr);
+
+      std::copy(block.height, block.height + count, o_heights + first);
+      if (o_normals)
+      {
+        for (int i = 0; i < count; i++)
+        {
+          o_normals[first + i] = ngl::Vec3(block.normalX[i], block.normalY[i], block.normalZ[i]);
+        }
+      }
+    }
+
+    m_residentQueries += resident;
+  }
+} // end namespace geoclipmap
@@ -6,42 +6,162 @@
  * @copyright Copyright (c) 2020
  * 
  */
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
 #include "Heightmap.h"
+#include "HeightmapMosaic.h"
 
 namespace geoclipmap
 {
+  namespace
+  {
+    // Tiles are 32x32 samples (12KB of colour data) so a tile fits in L1 and a
+    // row of a clipmap window crosses a new page only every 32 samples
+    constexpr int k_tileShift = 5;
+    constexpr int k_tileSize = 1 << k_tileShift;
+    constexpr int k_tileMask = k_tileSize - 1;
+
+    // Spreads the 5 bits of a coordinate within a tile out to every other bit
+    // (e.g. 0b111 -> 0b10101) so Z-order offsets are spread[x] | spread[y] << 1
+    constexpr std::array<uint16_t, k_tileSize> makeSpread()
+    {
+      std::array<uint16_t, k_tileSize> spread{};
+      for (int i = 0; i < k_tileSize; i++)
+      {
+        for (int bit = 0; bit < k_tileShift; bit++)
+        {
+          spread[i] |= ((i >> bit) & 1) << (2 * bit);
+        }
+      }
+      return spread;
+    }
+    constexpr std::array<uint16_t, k_tileSize> k_spread = makeSpread();
+
+    /**
+     * @brief Find which of _count samples, starting at _start and stepping
+     * _stride each time, are in [0, _size)
+     *
+     * @param _start The first sample
+     * @param _stride The distance between samples (> 0)
+     * @param _count The number of samples
+     * @param _size The number of valid samples
+     * @param o_first Set to the index of the first sample in range
+     * @param o_last Set to one past the index of the last sample in range
+     */
+    void samplesInRange(int64_t _start, int _stride, int _count, int64_t _size, int &o_first, int &o_last) noexcept
+    {
+      o_first = _start < 0 ? static_cast<int>(std::min<int64_t>(_count, (-_start + _stride - 1) / _stride)) : 0;
+      o_last = _start < _size ? static_cast<int>(std::min<int64_t>(_count, (_size - 1 - _start) / _stride + 1)) : 0;
+      o_last = std::max(o_first, o_last);
+    }
+  } // end namespace
 
   Heightmap::Heightmap(ngl::Real _width,
                        ngl::Real _height,
-                       std::vector<ngl::Vec3> _data) noexcept : m_width{_width},
-                                                                m_depth{_height},
-                                                                m_data{_data}
+                       std::vector<ngl::Vec3> _data) noexcept : m_width{static_cast<int64_t>(_width)},
+                                                                m_depth{static_cast<int64_t>(_height)},
+                                                                m_data{_data},
+                                                                m_tilesX{(m_width + k_tileMask) >> k_tileShift}
   {
-    ngl::Real maxHeight = 0.0f;
-    for (auto pixel : m_data)
-    {
-      maxHeight = std::max(pixel.lengthSquared(), maxHeight);
-    }
-    m_highestPoint = maxHeight;
+    m_heightRanges = std::make_unique<MinMaxPyramid>(m_width, m_depth, sampleReader());
+    m_highestPoint = std::max(m_heightRanges->total().max, 0.0f);
+    accountMemory();
   }
 
+  Heightmap::Heightmap(std::unique_ptr<CompressedHeightmap> _compressed) noexcept : m_width{_compressed->width()},
+                                                                                    m_depth{_compressed->depth()},
+                                                                                    m_storage{HeightmapStorage::Compressed},
+                                                                                    m_tilesX{(m_width + k_tileMask) >> k_tileShift},
+                                                                                    m_compressed{std::move(_compressed)}
+  {
+    // Decode a whole row of tiles at once before the pyramid reads it, so streamed tiles are read in batches rather
+    // than one at a time
+    int64_t band = m_compressed->tileSize();
+    int64_t decodedTo = -1;
+    m_heightRanges = std::make_unique<MinMaxPyramid>(m_width, m_depth, [&](int64_t _x, int64_t _y, int _count, ngl::Real *_out) {
+      if (_y > decodedTo || _y < decodedTo - band + 1)
+      {
+        decodedTo = std::min(_y - _y % band + band - 1, m_depth - 1);
+        m_compressed->decodeRegion(0, _y - _y % band, m_width - 1, decodedTo, 1);
+      }
+      readRow(_x, _y, 1, _count, _out);
+    });
+    m_highestPoint = std::max(m_heightRanges->total().max, 0.0f);
+    accountMemory();
+  }
+
+  Heightmap::Heightmap(int64_t _width, int64_t _depth, const ngl::Real *_heights) noexcept : m_width{_width},
+                                                                                             m_depth{_depth},
+                                                                                             m_storage{HeightmapStorage::External},
+                                                                                             m_tilesX{(m_width + k_tileMask) >> k_tileShift},
+                                                                                             m_external{_heights}
+  {
+    m_heightRanges = std::make_unique<MinMaxPyramid>(m_width, m_depth, sampleReader());
+    m_highestPoint = std::max(m_heightRanges->total().max, 0.0f);
+    accountMemory();
+  }
+
+  Heightmap::Heightmap(std::unique_ptr<HeightmapMosaic> _mosaic) noexcept : m_width{_mosaic->width()},
+                                                                            m_depth{_mosaic->depth()},
+                                                                            m_storage{HeightmapStorage::Mosaic},
+                                                                            m_tilesX{(m_width + k_tileMask) >> k_tileShift},
+                                                                            m_mosaic{std::move(_mosaic)}
+  {
+    m_heightRanges = std::make_unique<MinMaxPyramid>(m_width, m_depth, sampleReader());
+    m_highestPoint = std::max(m_heightRanges->total().max, 0.0f);
+    accountMemory();
+  }
+
+  Heightmap::~Heightmap() = default;
+
   ngl::Real Heightmap::width() noexcept
   {
-    return m_width;
+    return static_cast<ngl::Real>(m_width);
   }
 
   ngl::Real Heightmap::depth() noexcept
   {
-    return m_depth;
+    return static_cast<ngl::Real>(m_depth);
   }
 
-  ngl::Real Heightmap::value(int _x, int _y) noexcept
+  ngl::Real Heightmap::value(int64_t _x, int64_t _y) noexcept
   {
-    return colour(_x, _y).lengthSquared();
+    // if the value is out of range of the heightmap return 0
+    if (_x < 0 || _x > m_width - 1 || _y < 0 || _y > m_depth - 1)
+    {
+      return 0.0f;
+    }
+
+    switch (m_storage)
+    {
+    case HeightmapStorage::Compressed:
+      return m_compressed->sample(_x, _y);
+    case HeightmapStorage::External:
+      return m_external[index(_x, _y, HeightmapLayout::RowMajor)];
+    case HeightmapStorage::Mosaic:
+      return m_mosaic->sample(_x, _y);
+    case HeightmapStorage::Quantised:
+    {
+      const QuantisedTile &tile = m_quantisedTiles[static_cast<size_t>(_y >> k_tileShift) * m_tilesX + (_x >> k_tileShift)];
+      return tile.offset + tile.scale * m_quantised[index(_x, _y, m_layout)];
+    }
+    default:
+      return m_data[index(_x, _y, m_layout)].lengthSquared();
+    }
   }
 
-  ngl::Vec3 Heightmap::colour(int _x, int _y) noexcept
+  ngl::Vec3 Heightmap::colour(int64_t _x, int64_t _y) noexcept
   {
+    if (m_storage != HeightmapStorage::Colour)
+    {
+      // The colours are gone so return the grey whose value is the height
+      return ngl::Vec3(std::sqrt(value(_x, _y) / 3.0f));
+    }
+
     // if the x value is out of range of the heightmap return 0
     if (_x < 0 || _x > m_width - 1)
     {
@@ -54,11 +174,525 @@ namespace geoclipmap
       return ngl::Vec3();
     }
 
-    return m_data[_y * static_cast<int>(m_width) + _x];
+    return m_data[index(_x, _y, m_layout)];
+  }
+
+  void Heightmap::readRow(int64_t _x, int64_t _y, int _stride, int _count, ngl::Real *_out) noexcept
+  {
+    readWindow(_x, _y, _stride, _count, 1, _out);
+  }
+
+  void Heightmap::readWindow(int64_t _x, int64_t _y, int _stride, int _countX, int _countY, ngl::Real *_out) noexcept
+  {
+    switch (m_storage)
+    {
+    case HeightmapStorage::Compressed:
+    {
+      // The compressed heights only read the samples within the heightmap, everything else is 0
+      int firstX, lastX, firstY, lastY;
+      samplesInRange(_x, _stride, _countX, m_width, firstX, lastX);
+      samplesInRange(_y, _stride, _countY, m_depth, firstY, lastY);
+      if (firstX > 0 || lastX < _countX || firstY > 0 || lastY < _countY)
+      {
+        std::fill(_out, _out + static_cast<size_t>(_countX) * _countY, 0.0f);
+      }
+      if (firstX < lastX && firstY < lastY)
+      {
+        m_compressed->readWindow(_x + static_cast<int64_t>(firstX) * _stride,
+                                 _y + static_cast<int64_t>(firstY) * _stride,
+                                 _stride,
+                                 lastX - firstX,
+                                 lastY - firstY,
+                                 static_cast<size_t>(_countX),
+                                 _out + static_cast<size_t>(firstY) * _countX + firstX);
+      }
+      break;
+    }
+    case HeightmapStorage::Mosaic:
+      // Each source is read a row at a time
+      for (int j = 0; j < _countY; j++)
+      {
+        m_mosaic->readRow(_x, _y + static_cast<int64_t>(j) * _stride, _stride, _countX, _out + static_cast<size_t>(j) * _countX);
+      }
+      break;
+    case HeightmapStorage::Quantised:
+    {
+      const uint16_t *samples = m_quantised.data();
+      const QuantisedTile *tiles = m_quantisedTiles.data();
+      readWindowWith(_x, _y, _stride, _countX, _countY, _out, [samples, tiles](size_t _index, size_t _tile) {
+        return tiles[_tile].offset + tiles[_tile].scale * samples[_index];
+      });
+      break;
+    }
+    case HeightmapStorage::External:
+    {
+      // External heights are always row-major, which is the layout's default
+      const ngl::Real *heights = m_external;
+      readWindowWith(_x, _y, _stride, _countX, _countY, _out, [heights](size_t _index, size_t /*_tile*/) {
+        return heights[_index];
+      });
+      break;
+    }
+    default:
+    {
+      const ngl::Vec3 *data = m_data.data();
+      readWindowWith(_x, _y, _stride, _countX, _countY, _out, [data](size_t _index, size_t /*_tile*/) {
+        return data[_index].lengthSquared();
+      });
+      break;
+    }
+    }
+  }
+
+  void Heightmap::setLayout(HeightmapLayout _layout) noexcept
+  {
+    // External heights can't be moved around by the heightmap
+    if (_layout == m_layout || m_storage == HeightmapStorage::External)
+    {
+      return;
+    }
+
+    int64_t width = m_width;
+    int64_t depth = m_depth;
+    int64_t tilesY = (depth + k_tileMask) >> k_tileShift;
+    // Tiled layouts pad the edge tiles out to a full tile
+    size_t size = _layout == HeightmapLayout::RowMajor
+                      ? static_cast<size_t>(width) * depth
+                      : (static_cast<size_t>(m_tilesX) * tilesY) << (2 * k_tileShift);
+
+    auto reorder = [&](auto &_samples) {
+      std::remove_reference_t<decltype(_samples)> reordered(size);
+      for (int64_t y = 0; y < depth; y++)
+      {
+        for (int64_t x = 0; x < width; x++)
+        {
+          reordered[index(x, y, _layout)] = _samples[index(x, y, m_layout)];
+        }
+      }
+      _samples.swap(reordered);
+    };
+
+    // Compressed heightmaps have no samples to reorder
+    if (m_storage == HeightmapStorage::Colour)
+    {
+      reorder(m_data);
+    }
+    else if (m_storage == HeightmapStorage::Quantised)
+    {
+      reorder(m_quantised);
+    }
+
+    m_layout = _layout;
+  }
+
+  HeightmapLayout Heightmap::layout() noexcept
+  {
+    return m_layout;
   }
 
   ngl::Real Heightmap::highestPoint() noexcept
   {
     return m_highestPoint;
   }
+
+  void Heightmap::quantise() noexcept
+  {
+    if (m_storage != HeightmapStorage::Colour)
+    {
+      return;
+    }
+
+    int64_t width = m_width;
+    int64_t depth = m_depth;
+    int64_t tilesY = (depth + k_tileMask) >> k_tileShift;
+
+    std::vector<uint16_t> quantised(m_data.size());
+    std::vector<QuantisedTile> tiles(static_cast<size_t>(m_tilesX) * tilesY);
+
+    QuantisationStats stats;
+    stats.rawBytes = m_data.size() * sizeof(ngl::Vec3);
+    stats.quantisedBytes = quantised.size() * sizeof(uint16_t) + tiles.size() * sizeof(QuantisedTile);
+    double squaredError = 0.0;
+    ngl::Real highestPoint = 0.0f;
+
+    for (int64_t ty = 0; ty < tilesY; ty++)
+    {
+      for (int64_t tx = 0; tx < m_tilesX; tx++)
+      {
+        int64_t x0 = tx << k_tileShift;
+        int64_t y0 = ty << k_tileShift;
+        int64_t x1 = std::min(width, x0 + k_tileSize);
+        int64_t y1 = std::min(depth, y0 + k_tileSize);
+
+        // Each tile spreads the 65536 levels over only its own range of heights
+        ngl::Real low = m_data[index(x0, y0, m_layout)].lengthSquared();
+        ngl::Real high = low;
+        for (int64_t y = y0; y < y1; y++)
+        {
+          for (int64_t x = x0; x < x1; x++)
+          {
+            ngl::Real height = m_data[index(x, y, m_layout)].lengthSquared();
+            low = std::min(low, height);
+            high = std::max(high, height);
+          }
+        }
+
+        QuantisedTile &tile = tiles[static_cast<size_t>(ty) * m_tilesX + tx];
+        tile.offset = low;
+        tile.scale = (high - low) / 65535.0f;
+
+        for (int64_t y = y0; y < y1; y++)
+        {
+          for (int64_t x = x0; x < x1; x++)
+          {
+            size_t i = index(x, y, m_layout);
+            ngl::Real height = m_data[i].lengthSquared();
+            uint16_t level = tile.scale > 0.0f
+                                 ? static_cast<uint16_t>(std::clamp(std::lround((height - low) / tile.scale), 0l, 65535l))
+                                 : 0;
+            quantised[i] = level;
+
+            ngl::Real error = std::abs(tile.offset + tile.scale * level - height);
+            stats.maxError = std::max(stats.maxError, error);
+            squaredError += static_cast<double>(error) * error;
+            highestPoint = std::max(highestPoint, tile.offset + tile.scale * level);
+          }
+        }
+      }
+    }
+    stats.rmsError = static_cast<ngl::Real>(std::sqrt(squaredError / (static_cast<double>(width) * depth)));
+
+    m_quantised.swap(quantised);
+    m_quantisedTiles.swap(tiles);
+    m_quantisationStats = std::make_unique<QuantisationStats>(stats);
+    // The highest point must be one value() can actually return
+    m_highestPoint = highestPoint;
+    m_storage = HeightmapStorage::Quantised;
+
+    // Release the colour data as the point is to not keep it in memory
+    std::vector<ngl::Vec3>().swap(m_data);
+
+    // The ranges must be of the heights value() now returns
+    m_heightRanges->update(0, 0, width - 1, depth - 1, sampleReader());
+    accountMemory();
+  }
+
+  const QuantisationStats *Heightmap::quantisationStats() noexcept
+  {
+    return m_quantisationStats.get();
+  }
+
+  void Heightmap::compress(ngl::Real _tolerance, int _tileSize) noexcept
+  {
+    // External heights keep changing so there's no point compressing them, and a mosaic's sources are compressed on their own
+    if (m_storage == HeightmapStorage::Compressed || m_storage == HeightmapStorage::External || m_storage == HeightmapStorage::Mosaic)
+    {
+      return;
+    }
+
+    // The compressor wants the heights row-major whatever the layout
+    int64_t width = m_width;
+    int64_t depth = m_depth;
+    std::vector<ngl::Real> heights(static_cast<size_t>(width) * depth);
+    readWindow(0, 0, 1, width, depth, heights.data());
+
+    m_compressed = std::make_unique<CompressedHeightmap>(static_cast<int>(width),
+                                                         static_cast<int>(depth),
+                                                         heights,
+                                                         _tolerance,
+                                                         _tileSize);
+    m_storage = HeightmapStorage::Compressed;
+
+    // Release the samples as the point is to not keep them in memory
+    std::vector<ngl::Vec3>().swap(m_data);
+    std::vector<uint16_t>().swap(m_quantised);
+    std::vector<QuantisedTile>().swap(m_quantisedTiles);
+    accountMemory();
+  }
+
+  HeightmapStorage Heightmap::storage() noexcept
+  {
+    return m_storage;
+  }
+
+  const CompressionStats *Heightmap::compressionStats() noexcept
+  {
+    return m_compressed ? &m_compressed->stats() : nullptr;
+  }
+
+  void Heightmap::prefetch(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, int _stride) noexcept
+  {
+    if (m_compressed)
+    {
+      m_compressed->decodeRegion(_x0, _y0, _x1, _y1, _stride);
+    }
+    else if (m_mosaic)
+    {
+      m_mosaic->prefetch(_x0, _y0, _x1, _y1, _stride);
+    }
+  }
+
+  size_t Heightmap::warm(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, int _stride, size_t _maxTiles) noexcept
+  {
+    if (m_mosaic)
+    {
+      return m_mosaic->warm(_x0, _y0, _x1, _y1, _stride, _maxTiles);
+    }
+    return m_compressed ? m_compressed->warmRegion(_x0, _y0, _x1, _y1, _stride, _maxTiles) : 0;
+  }
+
+  bool Heightmap::streamTiles(const std::string &_path, TileReaderBackend _backend, bool _directIO) noexcept
+  {
+    return m_compressed && m_compressed->streamTiles(_path, _backend, _directIO);
+  }
+
+  const TileReader *Heightmap::tileReader() noexcept
+  {
+    return m_compressed ? m_compressed->tileReader() : nullptr;
+  }
+
+  bool Heightmap::concurrentReads() noexcept
+  {
+    if (m_mosaic)
+    {
+      return m_mosaic->concurrentReads();
+    }
+    return m_storage != HeightmapStorage::Compressed;
+  }
+
+  HeightRange Heightmap::heightBounds(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) const noexcept
+  {
+    return m_heightRanges->bounds(_x0, _y0, _x1, _y1);
+  }
+
+  HeightRange Heightmap::exactHeightRange(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) noexcept
+  {
+    return m_heightRanges->exactRange(_x0, _y0, _x1, _y1, [this](int64_t _x, int64_t _y, int _count, ngl::Real *_out) {
+      readRow(_x, _y, 1, _count, _out);
+    });
+  }
+
+  const MinMaxPyramid &Heightmap::heightRanges() noexcept
+  {
+    return *m_heightRanges;
+  }
+
+  void Heightmap::setValue(int64_t _x, int64_t _y, ngl::Real _height) noexcept
+  {
+    setValues(_x, _y, 1, 1, &_height);
+  }
+
+  bool Heightmap::setValues(int64_t _x, int64_t _y, int _countX, int _countY, const ngl::Real *_heights, DirtyRect *_changed) noexcept
+  {
+    if (m_storage == HeightmapStorage::Compressed || m_storage == HeightmapStorage::External || m_storage == HeightmapStorage::Mosaic)
+    {
+      return false;
+    }
+
+    int firstX, lastX, firstY, lastY;
+    samplesInRange(_x, 1, _countX, m_width, firstX, lastX);
+    samplesInRange(_y, 1, _countY, m_depth, firstY, lastY);
+    if (firstX == lastX || firstY == lastY)
+    {
+      return false;
+    }
+
+    // Re-quantising a tile changes all of its heights, so then the ranges of the whole tiles need updating
+    bool requantised = false;
+    for (int j = firstY; j < lastY; j++)
+    {
+      int64_t y = _y + j;
+      const ngl::Real *heights = _heights + static_cast<size_t>(j) * _countX;
+      for (int i = firstX; i < lastX; i++)
+      {
+        int64_t x = _x + i;
+        if (m_storage == HeightmapStorage::Quantised)
+        {
+          requantised |= setQuantised(x >> k_tileShift, y >> k_tileShift, x, y, heights[i]);
+        }
+        else
+        {
+          m_data[index(x, y, m_layout)] = ngl::Vec3(std::sqrt(std::max(heights[i], 0.0f) / 3.0f));
+        }
+      }
+    }
+
+    int64_t x0 = _x + firstX;
+    int64_t y0 = _y + firstY;
+    int64_t x1 = _x + lastX - 1;
+    int64_t y1 = _y + lastY - 1;
+    if (requantised)
+    {
+      x0 &= ~static_cast<int64_t>(k_tileMask);
+      y0 &= ~static_cast<int64_t>(k_tileMask);
+      x1 = std::min<int64_t>(x1 | k_tileMask, m_width - 1);
+      y1 = std::min<int64_t>(y1 | k_tileMask, m_depth - 1);
+    }
+    m_heightRanges->update(x0, y0, x1, y1, sampleReader());
+    m_highestPoint = std::max(m_heightRanges->total().max, 0.0f);
+    if (_changed != nullptr)
+    {
+      *_changed = DirtyRect{x0, y0, x1, y1};
+    }
+    return true;
+  }
+
+  void Heightmap::heightsChanged(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) noexcept
+  {
+    m_heightRanges->update(_x0, _y0, _x1, _y1, sampleReader());
+    m_highestPoint = std::max(m_heightRanges->total().max, 0.0f);
+  }
+
+  // ======================================= Private methods =======================================
+
+  MinMaxPyramid::SampleReader Heightmap::sampleReader() noexcept
+  {
+    return [this](int64_t _x, int64_t _y, int _count, ngl::Real *_out) {
+      readRow(_x, _y, 1, _count, _out);
+    };
+  }
+
+  void Heightmap::accountMemory() noexcept
+  {
+    m_memory.setCpu(m_data.capacity() * sizeof(ngl::Vec3) + m_quantised.capacity() * sizeof(uint16_t) +
+                    m_quantisedTiles.capacity() * sizeof(QuantisedTile) + m_heightRanges->memoryBytes());
+  }
+
+  bool Heightmap::setQuantised(int64_t _tx, int64_t _ty, int64_t _x, int64_t _y, ngl::Real _height) noexcept
+  {
+    QuantisedTile &tile = m_quantisedTiles[static_cast<size_t>(_ty) * m_tilesX + _tx];
+    ngl::Real high = tile.offset + tile.scale * 65535.0f;
+    bool widen = _height < tile.offset || _height > high;
+    if (widen)
+    {
+      // Widen the tile's range to fit the new height and re-quantise the rest of it into that range
+      int64_t x0 = _tx << k_tileShift;
+      int64_t y0 = _ty << k_tileShift;
+      int64_t x1 = std::min(m_width, x0 + k_tileSize);
+      int64_t y1 = std::min(m_depth, y0 + k_tileSize);
+      std::vector<ngl::Real> heights(static_cast<size_t>(x1 - x0) * (y1 - y0));
+      readWindow(x0, y0, 1, static_cast<int>(x1 - x0), static_cast<int>(y1 - y0), heights.data());
+
+      QuantisedTile widened{std::min(tile.offset, _height), (std::max(high, _height) - std::min(tile.offset, _height)) / 65535.0f};
+      size_t i = 0;
+      for (int64_t y = y0; y < y1; y++)
+      {
+        for (int64_t x = x0; x < x1; x++, i++)
+        {
+          m_quantised[index(x, y, m_layout)] =
+              static_cast<uint16_t>(std::clamp(std::lround((heights[i] - widened.offset) / widened.scale), 0l, 65535l));
+        }
+      }
+      tile = widened;
+    }
+
+    m_quantised[index(_x, _y, m_layout)] = tile.scale > 0.0f
+                                               ? static_cast<uint16_t>(std::clamp(std::lround((_height - tile.offset) / tile.scale), 0l, 65535l))
+                                               : 0;
+    return widen;
+  }
+
+  template <typename Sample>
+  void Heightmap::readWindowWith(int64_t _x,
+                                 int64_t _y,
+                                 int _stride,
+                                 int _countX,
+                                 int _countY,
+                                 ngl::Real *_out,
+                                 const Sample &_sample) const noexcept
+  {
+    // Only the samples in [firstX, lastX) x [firstY, lastY) are within the heightmap, everything else is 0
+    int firstX, lastX, firstY, lastY;
+    samplesInRange(_x, _stride, _countX, m_width, firstX, lastX);
+    samplesInRange(_y, _stride, _countY, m_depth, firstY, lastY);
+    std::fill(_out, _out + static_cast<size_t>(firstY) * _countX, 0.0f);
+    std::fill(_out + static_cast<size_t>(lastY) * _countX, _out + static_cast<size_t>(_countY) * _countX, 0.0f);
+    for (int j = firstY; j < lastY; j++)
+    {
+      ngl::Real *row = _out + static_cast<size_t>(j) * _countX;
+      std::fill(row, row + firstX, 0.0f);
+      std::fill(row + lastX, row + _countX, 0.0f);
+    }
+
+    if (m_layout == HeightmapLayout::RowMajor)
+    {
+      // Rows are already the best order to read these in, only split at tile edges to know which tile each sample is in
+      for (int j = firstY; j < lastY; j++)
+      {
+        int64_t y = _y + static_cast<int64_t>(j) * _stride;
+        size_t rowStart = static_cast<size_t>(y * m_width);
+        size_t tileRow = static_cast<size_t>(y >> k_tileShift) * m_tilesX;
+        ngl::Real *out = _out + static_cast<size_t>(j) * _countX;
+
+        int i = firstX;
+        while (i < lastX)
+        {
+          int64_t x = _x + static_cast<int64_t>(i) * _stride;
+          size_t tile = tileRow + (x >> k_tileShift);
+          int endX = std::min(lastX, i + static_cast<int>((k_tileMask - (x & k_tileMask)) / _stride) + 1);
+          for (; i < endX; i++, x += _stride)
+          {
+            out[i] = _sample(rowStart + x, tile);
+          }
+        }
+      }
+      return;
+    }
+
+    // Read a tile at a time, every row of the window inside it, so each tile is only brought into the cache once
+    int j = firstY;
+    while (j < lastY)
+    {
+      int64_t y = _y + static_cast<int64_t>(j) * _stride;
+      size_t tileRow = static_cast<size_t>(y >> k_tileShift) * m_tilesX;
+      int endY = std::min(lastY, j + static_cast<int>((k_tileMask - (y & k_tileMask)) / _stride) + 1);
+
+      int i = firstX;
+      while (i < lastX)
+      {
+        int64_t x = _x + static_cast<int64_t>(i) * _stride;
+        size_t tile = tileRow + (x >> k_tileShift);
+        size_t tileStart = tile << (2 * k_tileShift);
+        int endX = std::min(lastX, i + static_cast<int>((k_tileMask - (x & k_tileMask)) / _stride) + 1);
+
+        for (int tj = j, inTileY = static_cast<int>(y & k_tileMask); tj < endY; tj++, inTileY += _stride)
+        {
+          ngl::Real *out = _out + static_cast<size_t>(tj) * _countX;
+          if (m_layout == HeightmapLayout::Tiled)
+          {
+            size_t rowStart = tileStart + (inTileY << k_tileShift);
+            for (int ti = i, inTileX = static_cast<int>(x & k_tileMask); ti < endX; ti++, inTileX += _stride)
+            {
+              out[ti] = _sample(rowStart + inTileX, tile);
+            }
+          }
+          else
+          {
+            size_t rowStart = tileStart + (k_spread[inTileY] << 1);
+            for (int ti = i, inTileX = static_cast<int>(x & k_tileMask); ti < endX; ti++, inTileX += _stride)
+            {
+              out[ti] = _sample(rowStart + k_spread[inTileX], tile);
+            }
+          }
+        }
+        i = endX;
+      }
+      j = endY;
+    }
+  }
+
+  size_t Heightmap::index(int64_t _x, int64_t _y, HeightmapLayout _layout) const noexcept
+  {
+    switch (_layout)
+    {
+    case HeightmapLayout::Tiled:
+      return ((static_cast<size_t>(_y >> k_tileShift) * m_tilesX + (_x >> k_tileShift)) << (2 * k_tileShift)) |
+             ((_y & k_tileMask) << k_tileShift) | (_x & k_tileMask);
+    case HeightmapLayout::Morton:
+      return ((static_cast<size_t>(_y >> k_tileShift) * m_tilesX + (_x >> k_tileShift)) << (2 * k_tileShift)) |
+             (k_spread[_y & k_tileMask] << 1) | k_spread[_x & k_tileMask];
+    default:
+      return static_cast<size_t>(_y * m_width + _x);
+    }
+  }
 } // end namespace geoclipmap
\ No newline at end of file
@@ -0,0 +1,233 @@
+/**
+ * @file HeightmapEditor.cpp
+ * @author Ollie Nicholls
+ * @brief Brush edits to a heightmap at runtime (e.g. craters, excavation or
+ * flattening the ground for a road)
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <cmath>
+
+#include "HeightmapEditor.h"
+
+namespace geoclipmap
+{
+  BrushArea BrushArea::rectangle(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) noexcept
+  {
+    BrushArea area;
+    area.x0 = _x0;
+    area.y0 = _y0;
+    area.x1 = _x1;
+    area.y1 = _y1;
+    return area;
+  }
+
+  BrushArea BrushArea::circle(ngl::Real _x, ngl::Real _y, ngl::Real _radius, ngl::Real _falloff) noexcept
+  {
+    BrushArea area;
+    if (_radius <= 0.0f)
+    {
+      return area;
+    }
+    area.x0 = static_cast<int64_t>(std::ceil(_x - _radius));
+    area.y0 = static_cast<int64_t>(std::ceil(_y - _radius));
+    area.x1 = static_cast<int64_t>(std::floor(_x + _radius));
+    area.y1 = static_cast<int64_t>(std::floor(_y + _radius));
+    area.centreX = _x;
+    area.centreY = _y;
+    area.radius = _radius;
+    area.falloff = std::min(std::max(_falloff, 0.0f), 1.0f);
+    return area;
+  }
+
+  ngl::Real BrushArea::weight(int64_t _x, int64_t _y) const noexcept
+  {
+    if (_x < x0 || _x > x1 || _y < y0 || _y > y1)
+    {
+      return 0.0f;
+    }
+    if (radius <= 0.0f)
+    {
+      return 1.0f;
+    }
+
+    ngl::Real distance = std::hypot(static_cast<ngl::Real>(_x) - centreX, static_cast<ngl::Real>(_y) - centreY);
+    ngl::Real inner = radius * (1.0f - falloff);
+    if (distance > radius)
+    {
+      return 0.0f;
+    }
+    if (distance <= inner)
+    {
+      return 1.0f;
+    }
+    // Fade out along half a cosine so there is no crease at either end
+    ngl::Real t = (distance - inner) / (radius - inner);
+    return 0.5f * (1.0f + std::cos(t * static_cast<ngl::Real>(M_PI)));
+  }
+
+  HeightmapEditor::HeightmapEditor(Heightmap *_heightmap, Terrain *_terrain) noexcept : m_heightmap{_heightmap},
+                                                                                       m_terrain{_terrain}
+  {
+  }
+
+  void HeightmapEditor::setTerrain(Terrain *_terrain) noexcept
+  {
+    m_terrain = _terrain;
+  }
+
+  bool HeightmapEditor::set(const BrushArea &_area, ngl::Real _height, ngl::Real _strength) noexcept
+  {
+    if (!readBrush(_area, 0))
+    {
+      return false;
+    }
+    writeBrush(_area, [&](int64_t _x, int64_t _y, ngl::Real _weight) {
+      ngl::Real height = before(_x, _y);
+      return height + (_height - height) * _weight * _strength;
+    });
+    return true;
+  }
+
+  bool HeightmapEditor::add(const BrushArea &_area, ngl::Real _amount) noexcept
+  {
+    if (!readBrush(_area, 0))
+    {
+      return false;
+    }
+    writeBrush(_area, [&](int64_t _x, int64_t _y, ngl::Real _weight) {
+      return before(_x, _y) + _amount * _weight;
+    });
+    return true;
+  }
+
+  bool HeightmapEditor::smooth(const BrushArea &_area, ngl::Real _strength) noexcept
+  {
+    if (!readBrush(_area, 1))
+    {
+      return false;
+    }
+    writeBrush(_area, [&](int64_t _x, int64_t _y, ngl::Real _weight) {
+      ngl::Real sum = 0.0f;
+      for (int64_t y = _y - 1; y <= _y + 1; y++)
+      {
+        for (int64_t x = _x - 1; x <= _x + 1; x++)
+        {
+          sum += before(x, y);
+        }
+      }
+      ngl::Real height = before(_x, _y);
+      return height + (sum / 9.0f - height) * _weight * _strength;
+    });
+    return true;
+  }
+
+  bool HeightmapEditor::flatten(const BrushArea &_area, ngl::Real _strength) noexcept
+  {
+    if (!readBrush(_area, 0))
+    {
+      return false;
+    }
+
+    // The brush's weights decide how much each height counts towards the level it is flattened to
+    double total = 0.0;
+    double weights = 0.0;
+    for (int64_t y = m_editY0; y <= m_editY1; y++)
+    {
+      for (int64_t x = m_editX0; x <= m_editX1; x++)
+      {
+        ngl::Real weight = _area.weight(x, y);
+        total += static_cast<double>(before(x, y)) * weight;
+        weights += weight;
+      }
+    }
+    if (weights <= 0.0)
+    {
+      return false;
+    }
+    ngl::Real level = static_cast<ngl::Real>(total / weights);
+
+    writeBrush(_area, [&](int64_t _x, int64_t _y, ngl::Real _weight) {
+      ngl::Real height = before(_x, _y);
+      return height + (level - height) * _weight * _strength;
+    });
+    return true;
+  }
+
+  size_t HeightmapEditor::samplesEdited() const noexcept
+  {
+    return m_samplesEdited;
+  }
+
+  // ======================================= Private methods =======================================
+
+  bool HeightmapEditor::readBrush(const BrushArea &_area, int _border) noexcept
+  {
+    HeightmapStorage storage = m_heightmap->storage();
+    if (storage == HeightmapStorage::Compressed || storage == HeightmapStorage::External || storage == HeightmapStorage::Mosaic)
+    {
+      return false;
+    }
+
+    int64_t width = static_cast<int64_t>(m_heightmap->width());
+    int64_t depth = static_cast<int64_t>(m_heightmap->depth());
+    m_editX0 = std::max<int64_t>(_area.x0, 0);
+    m_editY0 = std::max<int64_t>(_area.y0, 0);
+    m_editX1 = std::min(_area.x1, width - 1);
+    m_editY1 = std::min(_area.y1, depth - 1);
+    if (m_editX0 > m_editX1 || m_editY0 > m_editY1)
+    {
+      return false;
+    }
+
+    // Only the samples under the brush (and its border) are read, however big the heightmap is
+    m_beforeX = std::max<int64_t>(m_editX0 - _border, 0);
+    m_beforeY = std::max<int64_t>(m_editY0 - _border, 0);
+    m_beforeWidth = std::min(m_editX1 + _border, width - 1) - m_beforeX + 1;
+    m_beforeDepth = std::min(m_editY1 + _border, depth - 1) - m_beforeY + 1;
+    m_before.resize(static_cast<size_t>(m_beforeWidth * m_beforeDepth));
+    m_heightmap->readWindow(m_beforeX,
+                            m_beforeY,
+                            1,
+                            static_cast<int>(m_beforeWidth),
+                            static_cast<int>(m_beforeDepth),
+                            m_before.data());
+    return true;
+  }
+
+  template <typename Edit>
+  void HeightmapEditor::writeBrush(const BrushArea &_area, Edit &&_edit) noexcept
+  {
+    int64_t countX = m_editX1 - m_editX0 + 1;
+    int64_t countY = m_editY1 - m_editY0 + 1;
+    m_after.resize(static_cast<size_t>(countX * countY));
+    ngl::Real *after = m_after.data();
+    for (int64_t y = m_editY0; y <= m_editY1; y++)
+    {
+      for (int64_t x = m_editX0; x <= m_editX1; x++)
+      {
+        ngl::Real weight = _area.weight(x, y);
+        *after++ = weight > 0.0f ? _edit(x, y, weight) : before(x, y);
+      }
+    }
+
+    // Setting the heights updates the min/max pyramid's blocks holding them, then only the texels over them are read
+    // again. That can be more than the brush, re-quantising a tile to fit the edit shifts every height in it.
+    DirtyRect changed;
+    if (m_heightmap->setValues(m_editX0, m_editY0, static_cast<int>(countX), static_cast<int>(countY), m_after.data(), &changed) &&
+        m_terrain)
+    {
+      m_terrain->refreshRegion(changed.x0, changed.y0, changed.x1, changed.y1);
+    }
+    m_samplesEdited += m_after.size();
+  }
+
+  ngl::Real HeightmapEditor::before(int64_t _x, int64_t _y) const noexcept
+  {
+    int64_t x = std::min(std::max(_x, m_beforeX), m_beforeX + m_beforeWidth - 1) - m_beforeX;
+    int64_t y = std::min(std::max(_y, m_beforeY), m_beforeY + m_beforeDepth - 1) - m_beforeY;
+    return m_before[static_cast<size_t>(y * m_beforeWidth + x)];
+  }
+} // end namespace geoclipmap
@@ -0,0 +1,275 @@
+/**
+ * @file HeightmapFeed.cpp
+ * @author Ollie Nicholls
+ * @brief Heights shared live with another process (e.g. an erosion or flood
+ * simulation) through POSIX shared memory
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "HeightmapFeed.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    constexpr char k_feedMagic[8] = {'G', 'C', 'F', 'E', 'E', 'D', '0', '1'};
+
+    // The start of the shared memory region. Every field is fixed size so
+    // both processes agree on the layout whatever they were built with.
+    struct FeedHeader
+    {
+      char magic[8];
+      int64_t width;
+      int64_t depth;
+      uint32_t ringSize;
+      uint32_t reserved;
+      // The number of updates the writer has started writing to the ring
+      std::atomic<uint64_t> started;
+      // The number of updates the writer has finished writing to the ring
+      std::atomic<uint64_t> published;
+    };
+
+    // One update in the ring, at its sequence number modulo the ring's size
+    struct FeedEntry
+    {
+      std::atomic<int64_t> x0;
+      std::atomic<int64_t> y0;
+      std::atomic<int64_t> x1;
+      std::atomic<int64_t> y1;
+    };
+
+    // The other process must see the same memory, not a lock somewhere in this one
+    static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<int64_t>::is_always_lock_free,
+                  "Shared counters must be lock free");
+
+    FeedEntry *ring(void *_region)
+    {
+      return reinterpret_cast<FeedEntry *>(static_cast<char *>(_region) + sizeof(FeedHeader));
+    }
+
+    size_t heightsOffset(uint32_t _ringSize)
+    {
+      // Start the heights on a cache line of their own
+      size_t end = sizeof(FeedHeader) + _ringSize * sizeof(FeedEntry);
+      return (end + 63) & ~static_cast<size_t>(63);
+    }
+
+    size_t regionSize(int64_t _width, int64_t _depth, uint32_t _ringSize)
+    {
+      return heightsOffset(_ringSize) + static_cast<size_t>(_width) * static_cast<size_t>(_depth) * sizeof(ngl::Real);
+    }
+
+    void clampRect(DirtyRect &io_rect, int64_t _width, int64_t _depth)
+    {
+      io_rect.x0 = std::max<int64_t>(io_rect.x0, 0);
+      io_rect.y0 = std::max<int64_t>(io_rect.y0, 0);
+      io_rect.x1 = std::min(io_rect.x1, _width - 1);
+      io_rect.y1 = std::min(io_rect.y1, _depth - 1);
+    }
+  } // end namespace
+
+  std::unique_ptr<HeightmapFeed> HeightmapFeed::open(const std::string &_name) noexcept
+  {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = ::shm_open(_name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+      return nullptr;
+    }
+    struct stat info;
+    size_t size = ::fstat(fd, &info) == 0 ? static_cast<size_t>(info.st_size) : 0;
+    void *region = size >= sizeof(FeedHeader) ? ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (region == MAP_FAILED)
+    {
+      return nullptr;
+    }
+
+    std::unique_ptr<HeightmapFeed> feed(new HeightmapFeed(region, size));
+    const FeedHeader *header = static_cast<const FeedHeader *>(region);
+    if (std::memcmp(header->magic, k_feedMagic, sizeof(k_feedMagic)) != 0 || header->width <= 0 || header->depth <= 0 ||
+        header->ringSize == 0 || regionSize(header->width, header->depth, header->ringSize) > size)
+    {
+      return nullptr;
+    }
+    return feed;
+#else
+    (void)_name;
+    return nullptr;
+#endif
+  }
+
+  HeightmapFeed::~HeightmapFeed()
+  {
+#if defined(__unix__) || defined(__APPLE__)
+    ::munmap(m_region, m_size);
+#endif
+  }
+
+  int64_t HeightmapFeed::width() const noexcept
+  {
+    return static_cast<const FeedHeader *>(m_region)->width;
+  }
+
+  int64_t HeightmapFeed::depth() const noexcept
+  {
+    return static_cast<const FeedHeader *>(m_region)->depth;
+  }
+
+  const ngl::Real *HeightmapFeed::heights() const noexcept
+  {
+    const FeedHeader *header = static_cast<const FeedHeader *>(m_region);
+    return reinterpret_cast<const ngl::Real *>(static_cast<const char *>(m_region) + heightsOffset(header->ringSize));
+  }
+
+  bool HeightmapFeed::poll(std::vector<DirtyRect> &o_rects) noexcept
+  {
+    FeedHeader *header = static_cast<FeedHeader *>(m_region);
+    o_rects.clear();
+    uint64_t published = header->published.load(std::memory_order_acquire);
+    if (published == m_sequence)
+    {
+      return false;
+    }
+
+    uint64_t ringSize = header->ringSize;
+    bool lost = published - m_sequence > ringSize;
+    if (!lost)
+    {
+      const FeedEntry *entries = ring(m_region);
+      for (uint64_t sequence = m_sequence; sequence < published; sequence++)
+      {
+        const FeedEntry &entry = entries[sequence % ringSize];
+        DirtyRect rect;
+        rect.x0 = entry.x0.load(std::memory_order_relaxed);
+        rect.y0 = entry.y0.load(std::memory_order_relaxed);
+        rect.x1 = entry.x1.load(std::memory_order_relaxed);
+        rect.y1 = entry.y1.load(std::memory_order_relaxed);
+        clampRect(rect, width(), depth());
+        if (rect.x0 <= rect.x1 && rect.y0 <= rect.y1)
+        {
+          o_rects.push_back(rect);
+        }
+      }
+      // If the writer started overwriting any of those entries while they were read, they can't be trusted
+      std::atomic_thread_fence(std::memory_order_acquire);
+      lost = header->started.load(std::memory_order_relaxed) - m_sequence > ringSize;
+    }
+
+    if (lost)
+    {
+      // Fell too far behind to know what changed, so everything might have
+      o_rects.assign(1, {0, 0, width() - 1, depth() - 1});
+    }
+    m_sequence = published;
+    return true;
+  }
+
+  uint64_t HeightmapFeed::sequence() const noexcept
+  {
+    return m_sequence;
+  }
+
+  std::unique_ptr<HeightmapFeedWriter> HeightmapFeedWriter::create(const std::string &_name,
+                                                                   int64_t _width,
+                                                                   int64_t _depth,
+                                                                   uint32_t _ringSize) noexcept
+  {
+#if defined(__unix__) || defined(__APPLE__)
+    if (_width <= 0 || _depth <= 0 || _ringSize == 0)
+    {
+      return nullptr;
+    }
+    // Start afresh so a reader never sees a region left over from an earlier writer
+    ::shm_unlink(_name.c_str());
+    int fd = ::shm_open(_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+      return nullptr;
+    }
+    size_t size = regionSize(_width, _depth, _ringSize);
+    void *region = ::ftruncate(fd, static_cast<off_t>(size)) == 0
+                       ? ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                       : MAP_FAILED;
+    ::close(fd);
+    if (region == MAP_FAILED)
+    {
+      ::shm_unlink(_name.c_str());
+      return nullptr;
+    }
+
+    // The region starts zeroed, so the heights and counters are already 0
+    FeedHeader *header = static_cast<FeedHeader *>(region);
+    header->width = _width;
+    header->depth = _depth;
+    header->ringSize = _ringSize;
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, k_feedMagic, sizeof(k_feedMagic));
+    return std::unique_ptr<HeightmapFeedWriter>(new HeightmapFeedWriter(_name, region, size));
+#else
+    (void)_name;
+    (void)_width;
+    (void)_depth;
+    (void)_ringSize;
+    return nullptr;
+#endif
+  }
+
+  HeightmapFeedWriter::~HeightmapFeedWriter()
+  {
+#if defined(__unix__) || defined(__APPLE__)
+    ::munmap(m_region, m_size);
+    ::shm_unlink(m_name.c_str());
+#endif
+  }
+
+  ngl::Real *HeightmapFeedWriter::heights() noexcept
+  {
+    FeedHeader *header = static_cast<FeedHeader *>(m_region);
+    return reinterpret_cast<ngl::Real *>(static_cast<char *>(m_region) + heightsOffset(header->ringSize));
+  }
+
+  uint64_t HeightmapFeedWriter::publish(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) noexcept
+  {
+    FeedHeader *header = static_cast<FeedHeader *>(m_region);
+    DirtyRect rect{_x0, _y0, _x1, _y1};
+    clampRect(rect, header->width, header->depth);
+
+    // Only this process writes the counters, so it always knows the next sequence number
+    uint64_t sequence = header->published.load(std::memory_order_relaxed);
+    header->started.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    FeedEntry &entry = ring(m_region)[sequence % header->ringSize];
+    entry.x0.store(rect.x0, std::memory_order_relaxed);
+    entry.y0.store(rect.y0, std::memory_order_relaxed);
+    entry.x1.store(rect.x1, std::memory_order_relaxed);
+    entry.y1.store(rect.y1, std::memory_order_relaxed);
+    // Publishing also releases the heights written before this
+    header->published.store(sequence + 1, std::memory_order_release);
+    return sequence + 1;
+  }
+
+  // ======================================= Private methods =======================================
+
+  HeightmapFeed::HeightmapFeed(void *_region, size_t _size) noexcept : m_region{_region}, m_size{_size}
+  {
+  }
+
+  HeightmapFeedWriter::HeightmapFeedWriter(const std::string &_name, void *_region, size_t _size) noexcept : m_name{_name},
+                                                                                                            m_region{_region},
+                                                                                                            m_size{_size}
+  {
+  }
+} // end namespace geoclipmap
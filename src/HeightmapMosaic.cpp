@@ -0,0 +1,358 @@
+/**
+ * @file HeightmapMosaic.cpp
+ * @author Ollie Nicholls
+ * @brief Heightmaps of differing resolution layered over each other, e.g.
+ * high resolution surveys of a few areas over a low resolution global base
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "HeightmapMosaic.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    /**
+     * @brief Find which of _count samples, starting at _start and stepping
+     * _stride each time, are in [_low, _high]
+     *
+     * @param _start The first sample
+     * @param _stride The distance between samples (> 0)
+     * @param _count The number of samples
+     * @param _low The lowest sample covered
+     * @param _high The highest sample covered
+     * @param o_first Set to the index of the first sample covered
+     * @param o_last Set to one past the index of the last sample covered
+     */
+    void samplesCovered(int64_t _start, int _stride, int _count, int64_t _low, int64_t _high, int &o_first, int &o_last) noexcept
+    {
+      o_first = _start < _low ? static_cast<int>(std::min<int64_t>(_count, (_low - _start + _stride - 1) / _stride)) : 0;
+      o_last = _start <= _high ? static_cast<int>(std::min<int64_t>(_count, (_high - _start) / _stride + 1)) : 0;
+      o_last = std::max(o_first, o_last);
+    }
+
+    bool powerOfTwo(int _value) noexcept
+    {
+      return _value > 0 && (_value & (_value - 1)) == 0;
+    }
+  } // end namespace
+
+  HeightmapMosaic::HeightmapMosaic(std::unique_ptr<Heightmap> _base, int _spacing) noexcept
+  {
+    Source base;
+    base.width = static_cast<int64_t>(_base->width());
+    base.depth = static_cast<int64_t>(_base->depth());
+    base.spacing = std::max(_spacing, 1);
+    base.x0 = 0;
+    base.y0 = 0;
+    base.x1 = (base.width - 1) * base.spacing;
+    base.y1 = (base.depth - 1) * base.spacing;
+    // Nothing is beneath the base to fade into
+    base.feather = 0;
+    base.heights = std::move(_base);
+    m_width = base.x1 + 1;
+    m_depth = base.y1 + 1;
+    m_sources.push_back(std::move(base));
+  }
+
+  bool HeightmapMosaic::readLayers(const std::string &_path, std::vector<MosaicLayer> &o_layers) noexcept
+  {
+    o_layers.clear();
+    std::ifstream file(_path);
+    if (!file)
+    {
+      return false;
+    }
+
+    std::filesystem::path directory = std::filesystem::path(_path).parent_path();
+    std::string line;
+    while (std::getline(file, line))
+    {
+      std::istringstream words(line);
+      std::string kind;
+      if (!(words >> kind) || kind[0] == '#')
+      {
+        continue;
+      }
+
+      MosaicLayer layer;
+      if (kind == "base" && o_layers.empty())
+      {
+        layer.feather = 0;
+        if (!(words >> layer.image >> layer.spacing))
+        {
+          return false;
+        }
+      }
+      else if (kind == "inset" && !o_layers.empty())
+      {
+        if (!(words >> layer.image >> layer.x >> layer.y >> layer.spacing))
+        {
+          return false;
+        }
+        // The feather is optional
+        words >> layer.feather;
+      }
+      else
+      {
+        return false;
+      }
+      layer.image = (directory / layer.image).string();
+      o_layers.push_back(layer);
+    }
+    return !o_layers.empty();
+  }
+
+  bool HeightmapMosaic::addInset(std::unique_ptr<Heightmap> _inset, int64_t _x, int64_t _y, int _spacing, int64_t _feather) noexcept
+  {
+    // Insets have to sit on the mosaic's grid so their samples are at whole mosaic samples
+    if (!_inset || !powerOfTwo(_spacing) || _spacing > m_sources.back().spacing || _x < 0 || _y < 0 || _x % _spacing != 0 ||
+        _y % _spacing != 0)
+    {
+      return false;
+    }
+
+    Source inset;
+    inset.width = static_cast<int64_t>(_inset->width());
+    inset.depth = static_cast<int64_t>(_inset->depth());
+    inset.spacing = _spacing;
+    inset.x0 = _x;
+    inset.y0 = _y;
+    inset.x1 = _x + (inset.width - 1) * _spacing;
+    inset.y1 = _y + (inset.depth - 1) * _spacing;
+    inset.feather = std::max<int64_t>(_feather, 0);
+    if (inset.width < 1 || inset.depth < 1 || inset.x1 >= m_width || inset.y1 >= m_depth)
+    {
+      return false;
+    }
+    inset.heights = std::move(_inset);
+
+    // Go before every source at least as coarse, which keeps the base last
+    auto position = std::find_if(m_sources.begin(), m_sources.end(), [_spacing](const Source &_source) {
+      return _source.spacing >= _spacing;
+    });
+    m_sources.insert(position, std::move(inset));
+    return true;
+  }
+
+  int64_t HeightmapMosaic::width() const noexcept
+  {
+    return m_width;
+  }
+
+  int64_t HeightmapMosaic::depth() const noexcept
+  {
+    return m_depth;
+  }
+
+  size_t HeightmapMosaic::sourceCount() const noexcept
+  {
+    return m_sources.size();
+  }
+
+  size_t HeightmapMosaic::storedSamples() const noexcept
+  {
+    size_t samples = 0;
+    for (const Source &source : m_sources)
+    {
+      samples += static_cast<size_t>(source.width * source.depth);
+    }
+    return samples;
+  }
+
+  ngl::Real HeightmapMosaic::sample(int64_t _x, int64_t _y) noexcept
+  {
+    ngl::Real height;
+    readRow(_x, _y, 1, 1, &height);
+    return height;
+  }
+
+  void HeightmapMosaic::readRow(int64_t _x, int64_t _y, int _stride, int _count, ngl::Real *_out) noexcept
+  {
+    std::fill(_out, _out + _count, 0.0f);
+    if (_count <= 0 || _y < 0 || _y >= m_depth)
+    {
+      return;
+    }
+
+    // How much of each sample's height is still to come from coarser sources
+    thread_local std::vector<ngl::Real> remaining;
+    thread_local std::vector<ngl::Real> heights;
+    remaining.assign(static_cast<size_t>(_count), 1.0f);
+    heights.resize(static_cast<size_t>(_count));
+
+    for (Source &source : m_sources)
+    {
+      if (_y < source.y0 || _y > source.y1)
+      {
+        continue;
+      }
+
+      // Don't read the source where finer ones have already given the whole height
+      int first, last;
+      samplesCovered(_x, _stride, _count, source.x0, source.x1, first, last);
+      while (first < last && remaining[first] <= 0.0f)
+      {
+        first++;
+      }
+      while (last > first && remaining[last - 1] <= 0.0f)
+      {
+        last--;
+      }
+      if (first == last)
+      {
+        continue;
+      }
+
+      readSource(source, _x, _y, _stride, first, last, heights.data());
+      for (int i = first; i < last; i++)
+      {
+        if (remaining[i] > 0.0f)
+        {
+          ngl::Real w = weight(source, _x + static_cast<int64_t>(i) * _stride, _y);
+          _out[i] += remaining[i] * w * heights[i];
+          remaining[i] *= 1.0f - w;
+        }
+      }
+    }
+  }
+
+  void HeightmapMosaic::prefetch(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, int _stride) noexcept
+  {
+    DirtyRect region;
+    int stride;
+    for (Source &source : m_sources)
+    {
+      if (sourceRegion(source, _x0, _y0, _x1, _y1, _stride, region, stride))
+      {
+        source.heights->prefetch(region.x0, region.y0, region.x1, region.y1, stride);
+      }
+    }
+  }
+
+  size_t HeightmapMosaic::warm(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, int _stride, size_t _maxTiles) noexcept
+  {
+    size_t decoded = 0;
+    DirtyRect region;
+    int stride;
+    for (Source &source : m_sources)
+    {
+      if (decoded < _maxTiles && sourceRegion(source, _x0, _y0, _x1, _y1, _stride, region, stride))
+      {
+        decoded += source.heights->warm(region.x0, region.y0, region.x1, region.y1, stride, _maxTiles - decoded);
+      }
+    }
+    return decoded;
+  }
+
+  bool HeightmapMosaic::concurrentReads() noexcept
+  {
+    return std::all_of(m_sources.begin(), m_sources.end(), [](const Source &_source) {
+      return _source.heights->concurrentReads();
+    });
+  }
+
+  // ======================================= Private methods =======================================
+
+  void HeightmapMosaic::readSource(Source &_source, int64_t _x, int64_t _y, int _stride, int _first, int _last, ngl::Real *_out) noexcept
+  {
+    thread_local std::vector<ngl::Real> rows;
+    int64_t spacing = _source.spacing;
+    int64_t row = (_y - _source.y0) / spacing;
+    ngl::Real fy = static_cast<ngl::Real>((_y - _source.y0) % spacing) / static_cast<ngl::Real>(spacing);
+    int64_t dx = _x + static_cast<int64_t>(_first) * _stride - _source.x0;
+    int count = _last - _first;
+
+    if (_stride % spacing == 0 && dx % spacing == 0)
+    {
+      // Every sample is on one of the source's columns, so only its rows above and below need interpolating
+      int stride = static_cast<int>(_stride / spacing);
+      rows.resize(static_cast<size_t>(count) * 2);
+      _source.heights->readRow(dx / spacing, row, stride, count, rows.data());
+      if (fy > 0.0f)
+      {
+        _source.heights->readRow(dx / spacing, row + 1, stride, count, rows.data() + count);
+      }
+      for (int i = 0; i < count; i++)
+      {
+        _out[_first + i] = fy > 0.0f ? rows[i] + (rows[count + i] - rows[i]) * fy : rows[i];
+      }
+      return;
+    }
+
+    // Otherwise read every column the samples fall between
+    int64_t c0 = dx / spacing;
+    int64_t c1 = std::min((dx + static_cast<int64_t>(count - 1) * _stride) / spacing + 1, _source.width - 1);
+    int span = static_cast<int>(c1 - c0 + 1);
+    rows.resize(static_cast<size_t>(span) * 2);
+    _source.heights->readRow(c0, row, 1, span, rows.data());
+    if (fy > 0.0f)
+    {
+      _source.heights->readRow(c0, row + 1, 1, span, rows.data() + span);
+    }
+    for (int i = 0; i < count; i++)
+    {
+      int64_t position = dx + static_cast<int64_t>(i) * _stride;
+      size_t column = static_cast<size_t>(position / spacing - c0);
+      ngl::Real fx = static_cast<ngl::Real>(position % spacing) / static_cast<ngl::Real>(spacing);
+      ngl::Real above = fx > 0.0f ? rows[column] + (rows[column + 1] - rows[column]) * fx : rows[column];
+      if (fy > 0.0f)
+      {
+        const ngl::Real *below = rows.data() + span;
+        ngl::Real height = fx > 0.0f ? below[column] + (below[column + 1] - below[column]) * fx : below[column];
+        above += (height - above) * fy;
+      }
+      _out[_first + i] = above;
+    }
+  }
+
+  bool HeightmapMosaic::sourceRegion(const Source &_source,
+                                     int64_t _x0,
+                                     int64_t _y0,
+                                     int64_t _x1,
+                                     int64_t _y1,
+                                     int _stride,
+                                     DirtyRect &o_region,
+                                     int &o_stride) const noexcept
+  {
+    int64_t x0 = std::max(_x0, _source.x0);
+    int64_t y0 = std::max(_y0, _source.y0);
+    int64_t x1 = std::min(_x1, _source.x1);
+    int64_t y1 = std::min(_y1, _source.y1);
+    if (x0 > x1 || y0 > y1)
+    {
+      return false;
+    }
+
+    // The samples either side are read too when the region is between the source's samples
+    int64_t spacing = _source.spacing;
+    o_region.x0 = (x0 - _source.x0) / spacing;
+    o_region.y0 = (y0 - _source.y0) / spacing;
+    o_region.x1 = std::min((x1 - _source.x0 + spacing - 1) / spacing, _source.width - 1);
+    o_region.y1 = std::min((y1 - _source.y0 + spacing - 1) / spacing, _source.depth - 1);
+    o_stride = std::max(_stride / _source.spacing, 1);
+    return true;
+  }
+
+  ngl::Real HeightmapMosaic::weight(const Source &_source, int64_t _x, int64_t _y) const noexcept
+  {
+    if (_source.feather <= 0)
+    {
+      return 1.0f;
+    }
+    int64_t edge = std::min(std::min(_x - _source.x0, _source.x1 - _x), std::min(_y - _source.y0, _source.y1 - _y));
+    if (edge >= _source.feather)
+    {
+      return 1.0f;
+    }
+    // Smoothstep so the slope doesn't change suddenly at either end of the fade
+    ngl::Real t = static_cast<ngl::Real>(edge) / static_cast<ngl::Real>(_source.feather);
+    return t * t * (3.0f - 2.0f * t);
+  }
+} // end namespace geoclipmap
@@ -0,0 +1,468 @@
+/**
+ * @file HeightmapSequence.cpp
+ * @author Ollie Nicholls
+ * @brief Heightmaps that change over time (e.g. tides or moving dunes),
+ * stored as a keyframe and then the tiles that changed in each step
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include "HeightmapSequence.h"
+#include "RiceCoder.h"
+#include "ThreadPool.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // Starts every sequence file, the last character being the version of the format
+    constexpr char k_sequenceMagic[8] = {'G', 'C', 'S', 'E', 'Q', 'N', 'C', '1'};
+
+    /**
+     * @brief The start of a sequence file, followed by the frames and then
+     * the index of where each frame is. Written in the host's byte order like
+     * baked heightmaps.
+     *
+     * Each frame is the number of tiles it stores, then the index and coded
+     * size of each of those tiles, then their coded changes one after another.
+     *
+     */
+    struct SequenceHeader
+    {
+      char magic[8];
+      int32_t width;
+      int32_t depth;
+      int32_t tileSize;
+      int32_t frames;
+      float step;
+      float frameRate;
+      // Where the index of frames starts
+      uint64_t indexOffset;
+      uint64_t reserved[3];
+    };
+    static_assert(sizeof(SequenceHeader) == 64, "SequenceHeader must have no padding");
+
+    /**
+     * @brief Where a frame is in a sequence file, one per frame in the index
+     *
+     */
+    struct SequenceFrame
+    {
+      uint64_t offset;
+      uint64_t size;
+    };
+
+    /**
+     * @brief One of the tiles stored in a frame
+     *
+     */
+    struct SequenceTile
+    {
+      uint32_t tile;
+      uint32_t size;
+    };
+
+    int64_t tilesAcross(int64_t _size, int _tileSize)
+    {
+      return (_size + _tileSize - 1) / _tileSize;
+    }
+  } // end namespace
+
+  std::unique_ptr<HeightmapSequence> HeightmapSequence::open(const std::string &_path, size_t _lookahead) noexcept
+  {
+    std::ifstream file(_path, std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+      return nullptr;
+    }
+    std::unique_ptr<HeightmapSequence> sequence(new HeightmapSequence(std::max<size_t>(_lookahead, 1)));
+    std::streamoff size = file.tellg();
+    if (size < static_cast<std::streamoff>(sizeof(SequenceHeader)))
+    {
+      return nullptr;
+    }
+    sequence->m_data.resize(static_cast<size_t>(size));
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(sequence->m_data.data()), size);
+    if (!file)
+    {
+      return nullptr;
+    }
+
+    SequenceHeader header;
+    std::memcpy(&header, sequence->m_data.data(), sizeof(header));
+    uint64_t fileSize = static_cast<uint64_t>(size);
+    if (std::memcmp(header.magic, k_sequenceMagic, sizeof(k_sequenceMagic)) != 0 || header.width <= 0 ||
+        header.depth <= 0 || header.tileSize <= 0 || header.frames <= 0 || !(header.step > 0.0f) ||
+        header.indexOffset > fileSize ||
+        (fileSize - header.indexOffset) / sizeof(SequenceFrame) < static_cast<uint64_t>(header.frames))
+    {
+      return nullptr;
+    }
+
+    sequence->m_frames.resize(static_cast<size_t>(header.frames));
+    for (size_t i = 0; i < sequence->m_frames.size(); i++)
+    {
+      SequenceFrame frame;
+      std::memcpy(&frame, sequence->m_data.data() + header.indexOffset + i * sizeof(SequenceFrame), sizeof(frame));
+      if (frame.offset > fileSize || frame.size > fileSize - frame.offset)
+      {
+        return nullptr;
+      }
+      sequence->m_frames[i] = {frame.offset, frame.size};
+    }
+    sequence->m_width = header.width;
+    sequence->m_depth = header.depth;
+    sequence->m_tileSize = header.tileSize;
+    sequence->m_tilesX = tilesAcross(header.width, header.tileSize);
+    sequence->m_step = header.step;
+    sequence->m_frameRate = header.frameRate > 0.0f ? header.frameRate : 10.0f;
+    sequence->m_heights.assign(static_cast<size_t>(header.width) * static_cast<size_t>(header.depth), 0.0f);
+
+    // The first frame is needed straight away, the rest can be decoded while it's shown
+    DecodedFrame first;
+    sequence->decodeFrame(0, first);
+    std::vector<DirtyRect> rects;
+    sequence->applyFrame(first, rects);
+    sequence->queueFrames();
+    return sequence;
+  }
+
+  HeightmapSequence::~HeightmapSequence()
+  {
+    // The decoding tasks read this sequence's data
+    for (auto &pending : m_pending)
+    {
+      pending.done.wait();
+    }
+  }
+
+  int64_t HeightmapSequence::width() const noexcept
+  {
+    return m_width;
+  }
+
+  int64_t HeightmapSequence::depth() const noexcept
+  {
+    return m_depth;
+  }
+
+  int HeightmapSequence::frameCount() const noexcept
+  {
+    return static_cast<int>(m_frames.size());
+  }
+
+  ngl::Real HeightmapSequence::frameRate() const noexcept
+  {
+    return m_frameRate;
+  }
+
+  int HeightmapSequence::frame() const noexcept
+  {
+    return m_frame;
+  }
+
+  const ngl::Real *HeightmapSequence::heights() const noexcept
+  {
+    return m_heights.data();
+  }
+
+  bool HeightmapSequence::step(std::vector<DirtyRect> &o_rects) noexcept
+  {
+    o_rects.clear();
+    if (m_pending.empty())
+    {
+      return false;
+    }
+
+    PendingFrame pending = std::move(m_pending.front());
+    m_pending.pop_front();
+    if (pending.done.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    {
+      m_stalls++;
+    }
+    pending.done.wait();
+
+    if (pending.frame == 0)
+    {
+      // The first frame holds the heights themselves rather than changes to the last frame
+      std::fill(m_heights.begin(), m_heights.end(), 0.0f);
+      applyFrame(*pending.decoded, o_rects);
+      o_rects.assign(1, {0, 0, m_width - 1, m_depth - 1});
+    }
+    else
+    {
+      applyFrame(*pending.decoded, o_rects);
+    }
+    m_frame = pending.frame;
+    queueFrames();
+    return !o_rects.empty();
+  }
+
+  size_t HeightmapSequence::stalls() const noexcept
+  {
+    return m_stalls;
+  }
+
+  std::unique_ptr<HeightmapSequenceWriter> HeightmapSequenceWriter::create(const std::string &_path,
+                                                                           int64_t _width,
+                                                                           int64_t _depth,
+                                                                           ngl::Real _step,
+                                                                           ngl::Real _frameRate,
+                                                                           int _tileSize) noexcept
+  {
+    if (_width <= 0 || _depth <= 0 || _width > INT32_MAX || _depth > INT32_MAX || !(_step > 0.0f) || _tileSize <= 0)
+    {
+      return nullptr;
+    }
+    std::unique_ptr<HeightmapSequenceWriter> writer(new HeightmapSequenceWriter(_width, _depth, _step, _frameRate, _tileSize));
+    writer->m_file.open(_path, std::ios::binary | std::ios::trunc);
+    if (!writer->m_file)
+    {
+      return nullptr;
+    }
+
+    // The header is written again with the number of frames by finish
+    SequenceHeader header{};
+    writer->m_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    writer->m_offset = sizeof(header);
+    return writer;
+  }
+
+  HeightmapSequenceWriter::~HeightmapSequenceWriter()
+  {
+    if (!m_finished)
+    {
+      finish();
+    }
+  }
+
+  bool HeightmapSequenceWriter::addFrame(const ngl::Real *_heights) noexcept
+  {
+    if (m_finished)
+    {
+      return false;
+    }
+
+    int64_t tilesX = tilesAcross(m_width, m_tileSize);
+    int64_t tilesY = tilesAcross(m_depth, m_tileSize);
+    bool first = m_frames.empty();
+    std::vector<SequenceTile> tiles;
+    std::vector<uint8_t> bits;
+    std::vector<int32_t> changes;
+    std::vector<int32_t> residuals;
+    for (int64_t ty = 0; ty < tilesY; ty++)
+    {
+      for (int64_t tx = 0; tx < tilesX; tx++)
+      {
+        int64_t x0 = tx * m_tileSize;
+        int64_t y0 = ty * m_tileSize;
+        int64_t x1 = std::min(x0 + m_tileSize, m_width);
+        int64_t y1 = std::min(y0 + m_tileSize, m_depth);
+
+        // Each height's change from what the reader will have, so rounding never builds up over frames
+        changes.clear();
+        bool changed = first;
+        for (int64_t y = y0; y < y1; y++)
+        {
+          for (int64_t x = x0; x < x1; x++)
+          {
+            size_t i = static_cast<size_t>(y * m_width + x);
+            int32_t change = static_cast<int32_t>(std::lround(_heights[i] / m_step)) - m_current[i];
+            changes.push_back(change);
+            changed |= change != 0;
+          }
+        }
+        if (!changed)
+        {
+          continue;
+        }
+
+        // Neighbouring changes are usually alike, so code each as the difference to the one before it in its row
+        int64_t width = x1 - x0;
+        residuals.resize(changes.size());
+        for (size_t i = 0; i < changes.size(); i++)
+        {
+          residuals[i] = i % static_cast<size_t>(width) == 0 ? changes[i] : changes[i] - changes[i - 1];
+        }
+        size_t start = bits.size();
+        riceEncode(residuals, bits);
+        tiles.push_back({static_cast<uint32_t>(ty * tilesX + tx), static_cast<uint32_t>(bits.size() - start)});
+
+        size_t i = 0;
+        for (int64_t y = y0; y < y1; y++)
+        {
+          for (int64_t x = x0; x < x1; x++)
+          {
+            m_current[static_cast<size_t>(y * m_width + x)] += changes[i++];
+          }
+        }
+      }
+    }
+
+    uint32_t count = static_cast<uint32_t>(tiles.size());
+    m_file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    m_file.write(reinterpret_cast<const char *>(tiles.data()), static_cast<std::streamsize>(tiles.size() * sizeof(SequenceTile)));
+    m_file.write(reinterpret_cast<const char *>(bits.data()), static_cast<std::streamsize>(bits.size()));
+    uint64_t size = sizeof(count) + tiles.size() * sizeof(SequenceTile) + bits.size();
+    m_frames.push_back({m_offset, size});
+    m_offset += size;
+    m_tilesWritten += tiles.size();
+    return static_cast<bool>(m_file);
+  }
+
+  bool HeightmapSequenceWriter::finish() noexcept
+  {
+    if (m_finished)
+    {
+      return false;
+    }
+    m_finished = true;
+
+    for (const auto &frame : m_frames)
+    {
+      SequenceFrame entry{frame.first, frame.second};
+      m_file.write(reinterpret_cast<const char *>(&entry), sizeof(entry));
+    }
+
+    SequenceHeader header{};
+    std::memcpy(header.magic, k_sequenceMagic, sizeof(k_sequenceMagic));
+    header.width = static_cast<int32_t>(m_width);
+    header.depth = static_cast<int32_t>(m_depth);
+    header.tileSize = m_tileSize;
+    header.frames = static_cast<int32_t>(m_frames.size());
+    header.step = m_step;
+    header.frameRate = m_frameRate;
+    header.indexOffset = m_offset;
+    m_file.seekp(0);
+    m_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    m_file.close();
+    return !m_frames.empty() && static_cast<bool>(m_file);
+  }
+
+  size_t HeightmapSequenceWriter::tilesWritten() const noexcept
+  {
+    return m_tilesWritten;
+  }
+
+  // ======================================= Private methods =======================================
+
+  HeightmapSequence::HeightmapSequence(size_t _lookahead) noexcept : m_lookahead{_lookahead}
+  {
+  }
+
+  HeightmapSequenceWriter::HeightmapSequenceWriter(int64_t _width,
+                                                   int64_t _depth,
+                                                   ngl::Real _step,
+                                                   ngl::Real _frameRate,
+                                                   int _tileSize) noexcept : m_width{_width},
+                                                                             m_depth{_depth},
+                                                                             m_step{_step},
+                                                                             m_frameRate{_frameRate},
+                                                                             m_tileSize{_tileSize},
+                                                                             m_current(static_cast<size_t>(_width * _depth), 0)
+  {
+  }
+
+  void HeightmapSequence::decodeFrame(int _frame, DecodedFrame &o_decoded) const noexcept
+  {
+    o_decoded.tiles.clear();
+    o_decoded.changes.clear();
+    const uint8_t *data = m_data.data() + m_frames[static_cast<size_t>(_frame)].first;
+    uint64_t size = m_frames[static_cast<size_t>(_frame)].second;
+    uint32_t count = 0;
+    if (size < sizeof(count))
+    {
+      return;
+    }
+    std::memcpy(&count, data, sizeof(count));
+    uint64_t tileCount = static_cast<uint64_t>(m_tilesX) * static_cast<uint64_t>(tilesAcross(m_depth, m_tileSize));
+    uint64_t bitsOffset = sizeof(count) + static_cast<uint64_t>(count) * sizeof(SequenceTile);
+    if (count > tileCount || bitsOffset > size)
+    {
+      return;
+    }
+
+    std::vector<int32_t> &changes = o_decoded.changes;
+    for (uint32_t t = 0; t < count; t++)
+    {
+      SequenceTile tile;
+      std::memcpy(&tile, data + sizeof(count) + t * sizeof(SequenceTile), sizeof(tile));
+      if (tile.tile >= tileCount || tile.size > size - bitsOffset)
+      {
+        o_decoded.tiles.clear();
+        changes.clear();
+        return;
+      }
+
+      int64_t x0 = (tile.tile % m_tilesX) * m_tileSize;
+      int64_t y0 = (tile.tile / m_tilesX) * m_tileSize;
+      int64_t width = std::min<int64_t>(m_tileSize, m_width - x0);
+      int64_t depth = std::min<int64_t>(m_tileSize, m_depth - y0);
+      RiceDecoder decoder(data + bitsOffset, tile.size);
+      for (int64_t y = 0; y < depth; y++)
+      {
+        int32_t change = 0;
+        for (int64_t x = 0; x < width; x++)
+        {
+          change += decoder.next();
+          changes.push_back(change);
+        }
+      }
+      o_decoded.tiles.push_back(tile.tile);
+      bitsOffset += tile.size;
+    }
+  }
+
+  void HeightmapSequence::applyFrame(const DecodedFrame &_decoded, std::vector<DirtyRect> &o_rects) noexcept
+  {
+    const int32_t *change = _decoded.changes.data();
+    for (uint32_t tile : _decoded.tiles)
+    {
+      int64_t x0 = (tile % m_tilesX) * m_tileSize;
+      int64_t y0 = (tile / m_tilesX) * m_tileSize;
+      int64_t x1 = std::min<int64_t>(x0 + m_tileSize, m_width) - 1;
+      int64_t y1 = std::min<int64_t>(y0 + m_tileSize, m_depth) - 1;
+      for (int64_t y = y0; y <= y1; y++)
+      {
+        ngl::Real *height = &m_heights[static_cast<size_t>(y * m_width + x0)];
+        for (int64_t x = x0; x <= x1; x++, height++)
+        {
+          // Heights are always whole steps, so rounding gets back the exact step the writer had
+          *height = static_cast<ngl::Real>(std::lround(*height / m_step) + *change++) * m_step;
+        }
+      }
+
+      // Tiles are stored in order, so neighbours along a row of tiles can be refreshed together
+      if (!o_rects.empty() && o_rects.back().y0 == y0 && o_rects.back().x1 + 1 == x0)
+      {
+        o_rects.back().x1 = x1;
+      }
+      else
+      {
+        o_rects.push_back({x0, y0, x1, y1});
+      }
+    }
+  }
+
+  void HeightmapSequence::queueFrames() noexcept
+  {
+    size_t frames = m_frames.size();
+    // Frames ahead of the current one, which can't include the current one itself
+    size_t ahead = std::min(m_lookahead, frames - 1);
+    while (m_pending.size() < ahead)
+    {
+      int next = static_cast<int>(((m_pending.empty() ? m_frame : m_pending.back().frame) + 1) % frames);
+      auto decoded = std::make_shared<DecodedFrame>();
+      std::future<void> done = ThreadPool::getInstance()->submit([this, next, decoded]() {
+        decodeFrame(next, *decoded);
+      });
+      m_pending.push_back({next, decoded, std::move(done)});
+    }
+  }
+} // end namespace geoclipmap
@@ -0,0 +1,562 @@
+/**
+ * @file HttpTileReader.cpp
+ * @author Ollie Nicholls
+ * @brief Reads tiles of a baked heightmap from a tile server over HTTP, with
+ * a pool of persistent connections and a cache of tiles on disk
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include "HttpTileReader.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // How long to wait for the server before giving up on a connection
+    constexpr int k_timeoutSeconds = 10;
+    // How much to ask the socket for at a time
+    constexpr size_t k_receiveSize = 64 * 1024;
+
+    /**
+     * @brief Split an http:// URL into its host, port and path
+     *
+     * @return true If it's a valid URL
+     */
+    bool parseUrl(const std::string &_url, std::string &o_host, std::string &o_port, std::string &o_path)
+    {
+      const std::string scheme = "http://";
+      if (_url.compare(0, scheme.size(), scheme) != 0)
+      {
+        return false;
+      }
+      size_t pathStart = _url.find('/', scheme.size());
+      std::string authority = _url.substr(scheme.size(), pathStart == std::string::npos ? std::string::npos : pathStart - scheme.size());
+      o_path = pathStart == std::string::npos ? "/" : _url.substr(pathStart);
+
+      size_t colon = authority.rfind(':');
+      o_host = authority.substr(0, colon);
+      o_port = colon == std::string::npos ? "80" : authority.substr(colon + 1);
+      return !o_host.empty() && !o_port.empty() && o_port.find_first_not_of("0123456789") == std::string::npos;
+    }
+
+    /**
+     * @brief Connect a socket to a server
+     *
+     * @return int The socket, or -1 if it couldn't connect
+     */
+    int openSocket(const std::string &_host, const std::string &_port)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+      addrinfo hints{};
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      addrinfo *addresses = nullptr;
+      if (::getaddrinfo(_host.c_str(), _port.c_str(), &hints, &addresses) != 0)
+      {
+        return -1;
+      }
+
+      int result = -1;
+      for (addrinfo *address = addresses; address && result < 0; address = address->ai_next)
+      {
+        int fd = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd < 0)
+        {
+          continue;
+        }
+        // Requests are small and sent together, so don't hold them back waiting for more
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+        ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        timeval timeout{k_timeoutSeconds, 0};
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (::connect(fd, address->ai_addr, address->ai_addrlen) == 0)
+        {
+          result = fd;
+        }
+        else
+        {
+          ::close(fd);
+        }
+      }
+      ::freeaddrinfo(addresses);
+      return result;
+#else
+      (void)_host;
+      (void)_port;
+      return -1;
+#endif
+    }
+
+    void closeSocket(int _socket)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+      ::close(_socket);
+#else
+      (void)_socket;
+#endif
+    }
+
+    bool sendAll(int _socket, const std::string &_data)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+#ifdef MSG_NOSIGNAL
+      // A server that has gone away shouldn't kill the process with SIGPIPE
+      constexpr int flags = MSG_NOSIGNAL;
+#else
+      constexpr int flags = 0;
+#endif
+      size_t sent = 0;
+      while (sent < _data.size())
+      {
+        ssize_t result = ::send(_socket, _data.data() + sent, _data.size() - sent, flags);
+        if (result < 0 && errno == EINTR)
+        {
+          continue;
+        }
+        if (result <= 0)
+        {
+          return false;
+        }
+        sent += static_cast<size_t>(result);
+      }
+      return true;
+#else
+      (void)_socket;
+      (void)_data;
+      return false;
+#endif
+    }
+
+    /**
+     * @brief Append whatever has arrived on a socket (waiting for something)
+     *
+     * @return true If anything arrived
+     */
+    bool receive(int _socket, std::string &io_buffer)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+      char data[k_receiveSize];
+      while (true)
+      {
+        ssize_t result = ::recv(_socket, data, sizeof(data), 0);
+        if (result < 0 && errno == EINTR)
+        {
+          continue;
+        }
+        if (result <= 0)
+        {
+          return false;
+        }
+        io_buffer.append(data, static_cast<size_t>(result));
+        return true;
+      }
+#else
+      (void)_socket;
+      (void)io_buffer;
+      return false;
+#endif
+    }
+
+    /**
+     * @brief Find a header's value in headers read by readResponse
+     *
+     * @return true If the header is there
+     */
+    bool findHeader(const std::string &_headers, const std::string &_name, std::string &o_value)
+    {
+      // Every header line starts after a newline
+      size_t start = _headers.find("\n" + _name + ":");
+      if (start == std::string::npos)
+      {
+        return false;
+      }
+      start += _name.size() + 2;
+      size_t end = _headers.find('\r', start);
+      o_value = _headers.substr(start, end == std::string::npos ? std::string::npos : end - start);
+      o_value.erase(0, o_value.find_first_not_of(' '));
+      return true;
+    }
+  } // end namespace
+
+  std::unique_ptr<HttpTileReader> HttpTileReader::open(const std::string &_url,
+                                                       const std::string &_cacheDirectory,
+                                                       size_t _connections,
+                                                       size_t _pipelineDepth) noexcept
+  {
+    std::string host, port, path;
+    if (!parseUrl(_url, host, port, path))
+    {
+      return nullptr;
+    }
+
+    std::unique_ptr<HttpTileReader> reader(new HttpTileReader(host,
+                                                              port,
+                                                              path,
+                                                              _cacheDirectory,
+                                                              std::max<size_t>(_connections, 1),
+                                                              std::max<size_t>(_pipelineDepth, 1)));
+    if (!reader->validateCache())
+    {
+      // Without the server a cache from an earlier run is all there is
+      std::error_code error;
+      if (_cacheDirectory.empty() || !std::filesystem::exists(std::filesystem::path(_cacheDirectory) / "etag", error))
+      {
+        return nullptr;
+      }
+      reader->m_offline = true;
+    }
+    return reader;
+  }
+
+  HttpTileReader::~HttpTileReader()
+  {
+    for (auto &connection : m_connections)
+    {
+      disconnect(connection);
+    }
+  }
+
+  void HttpTileReader::readBatch(const std::vector<TileRead> &_reads, const TileReadCallback &_callback) noexcept
+  {
+    static const uint8_t empty = 0;
+
+    // Everything already in the cache can be handed over straight away
+    std::vector<size_t> missing;
+    std::vector<uint8_t> cached;
+    for (size_t i = 0; i < _reads.size(); i++)
+    {
+      const TileRead &read = _reads[i];
+      if (read.size == 0)
+      {
+        _callback(i, &empty, 0);
+        continue;
+      }
+      if (!m_cacheDirectory.empty())
+      {
+        std::ifstream file(cachePath(read), std::ios::binary);
+        cached.resize(read.size + 1);
+        file.read(reinterpret_cast<char *>(cached.data()), static_cast<std::streamsize>(cached.size()));
+        // A file of the wrong size was cut short or belongs to something else
+        if (file.gcount() == static_cast<std::streamsize>(read.size))
+        {
+          m_cacheHits++;
+          _callback(i, cached.data(), read.size);
+          continue;
+        }
+      }
+      missing.push_back(i);
+    }
+
+    if (m_offline)
+    {
+      for (size_t i : missing)
+      {
+        m_failures++;
+        _callback(i, nullptr, 0);
+      }
+      return;
+    }
+
+    // Each connection takes a pipeline's worth of tiles at a time until there are none left
+    std::atomic<size_t> next{0};
+    m_pool.parallelFor(m_connections.size(), [&](size_t _connection) {
+      std::vector<size_t> indices;
+      while (true)
+      {
+        size_t first = next.fetch_add(m_pipelineDepth);
+        if (first >= missing.size())
+        {
+          break;
+        }
+        indices.assign(missing.begin() + first, missing.begin() + std::min(first + m_pipelineDepth, missing.size()));
+        fetch(m_connections[_connection], _reads, indices, _callback);
+      }
+    });
+  }
+
+  TileReaderBackend HttpTileReader::backend() const noexcept
+  {
+    return TileReaderBackend::Http;
+  }
+
+  bool HttpTileReader::directIO() const noexcept
+  {
+    return false;
+  }
+
+  bool HttpTileReader::offline() const noexcept
+  {
+    return m_offline;
+  }
+
+  HttpStats HttpTileReader::stats() const noexcept
+  {
+    HttpStats stats;
+    stats.requests = m_requests;
+    stats.cacheHits = m_cacheHits;
+    stats.bytesFetched = m_bytesFetched;
+    stats.connections = m_connectionsOpened;
+    stats.failures = m_failures;
+    return stats;
+  }
+
+  // ======================================= Private methods =======================================
+
+  HttpTileReader::HttpTileReader(const std::string &_host,
+                                 const std::string &_port,
+                                 const std::string &_path,
+                                 const std::string &_cacheDirectory,
+                                 size_t _connections,
+                                 size_t _pipelineDepth) noexcept : m_host{_host},
+                                                                   m_port{_port},
+                                                                   m_path{_path},
+                                                                   m_cacheDirectory{_cacheDirectory},
+                                                                   m_connections(_connections),
+                                                                   m_pipelineDepth{_pipelineDepth},
+                                                                   m_pool{_connections}
+  {
+  }
+
+  bool HttpTileReader::connect(Connection &io_connection) noexcept
+  {
+    if (io_connection.socket >= 0)
+    {
+      return true;
+    }
+    io_connection.socket = openSocket(m_host, m_port);
+    io_connection.buffer.clear();
+    m_connectionsOpened += io_connection.socket >= 0 ? 1 : 0;
+    return io_connection.socket >= 0;
+  }
+
+  void HttpTileReader::disconnect(Connection &io_connection) noexcept
+  {
+    if (io_connection.socket >= 0)
+    {
+      closeSocket(io_connection.socket);
+    }
+    io_connection.socket = -1;
+    io_connection.buffer.clear();
+  }
+
+  bool HttpTileReader::readResponse(Connection &io_connection, int &o_status, std::string &o_headers, std::string &o_body, bool _head) noexcept
+  {
+    size_t end;
+    while ((end = io_connection.buffer.find("\r\n\r\n")) == std::string::npos)
+    {
+      if (!receive(io_connection.socket, io_connection.buffer))
+      {
+        return false;
+      }
+    }
+    std::string head = io_connection.buffer.substr(0, end + 2);
+    io_connection.buffer.erase(0, end + 4);
+
+    // The status line is e.g. "HTTP/1.1 206 Partial Content"
+    size_t lineEnd = head.find("\r\n");
+    size_t space = head.find(' ');
+    if (head.compare(0, 5, "HTTP/") != 0 || space > lineEnd)
+    {
+      return false;
+    }
+    o_status = std::atoi(head.c_str() + space + 1);
+    o_headers = head.substr(lineEnd + 1);
+    std::transform(o_headers.begin(), o_headers.end(), o_headers.begin(), [](unsigned char _c) {
+      return static_cast<char>(std::tolower(_c));
+    });
+
+    o_body.clear();
+    std::string length;
+    if (!_head && o_status != 204 && o_status != 304)
+    {
+      // Only bodies with a length are supported, not chunked ones
+      if (!findHeader(o_headers, "content-length", length))
+      {
+        return false;
+      }
+      size_t size = static_cast<size_t>(std::strtoull(length.c_str(), nullptr, 10));
+      while (io_connection.buffer.size() < size)
+      {
+        if (!receive(io_connection.socket, io_connection.buffer))
+        {
+          return false;
+        }
+      }
+      o_body = io_connection.buffer.substr(0, size);
+      io_connection.buffer.erase(0, size);
+    }
+
+    std::string connection;
+    if (findHeader(o_headers, "connection", connection) && connection == "close")
+    {
+      // Anything else pipelined on this connection won't be answered, so is sent again on a new one
+      disconnect(io_connection);
+    }
+    return true;
+  }
+
+  void HttpTileReader::fetch(Connection &io_connection,
+                             const std::vector<TileRead> &_reads,
+                             const std::vector<size_t> &_indices,
+                             const TileReadCallback &_callback) noexcept
+  {
+    std::vector<size_t> remaining = _indices;
+    // A kept alive connection can be closed by the server at any time, so a broken one gets a second chance
+    for (int attempt = 0; attempt < 2 && !remaining.empty(); attempt++)
+    {
+      if (!connect(io_connection))
+      {
+        continue;
+      }
+
+      std::string requests;
+      for (size_t i : remaining)
+      {
+        const TileRead &read = _reads[i];
+        requests += "GET " + m_path + " HTTP/1.1\r\nHost: " + m_host + "\r\nRange: bytes=" + std::to_string(read.offset) + "-" +
+                    std::to_string(read.offset + read.size - 1) + "\r\n\r\n";
+      }
+      m_requests += remaining.size();
+      if (!sendAll(io_connection.socket, requests))
+      {
+        disconnect(io_connection);
+        continue;
+      }
+
+      size_t done = 0;
+      int status = 0;
+      std::string headers;
+      std::string body;
+      for (; done < remaining.size(); done++)
+      {
+        if (io_connection.socket < 0 || !readResponse(io_connection, status, headers, body, false))
+        {
+          disconnect(io_connection);
+          break;
+        }
+
+        size_t index = remaining[done];
+        const TileRead &read = _reads[index];
+        const uint8_t *data = nullptr;
+        if (status == 206 && body.size() == read.size)
+        {
+          data = reinterpret_cast<const uint8_t *>(body.data());
+        }
+        else if (status == 200 && body.size() >= read.offset + read.size)
+        {
+          // The server ignored the range and sent the whole file
+          data = reinterpret_cast<const uint8_t *>(body.data()) + read.offset;
+        }
+
+        if (!data)
+        {
+          m_failures++;
+          _callback(index, nullptr, 0);
+          continue;
+        }
+        m_bytesFetched += read.size;
+        if (!m_cacheDirectory.empty())
+        {
+          // Write to a file of this thread's own then rename it, so a half written tile is never read
+          std::string path = cachePath(read);
+          std::string temporary = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+          {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(read.size));
+          }
+          std::error_code error;
+          std::filesystem::rename(temporary, path, error);
+        }
+        _callback(index, data, read.size);
+      }
+      remaining.erase(remaining.begin(), remaining.begin() + static_cast<std::ptrdiff_t>(done));
+    }
+
+    for (size_t i : remaining)
+    {
+      m_failures++;
+      _callback(i, nullptr, 0);
+    }
+  }
+
+  bool HttpTileReader::validateCache() noexcept
+  {
+    Connection &connection = m_connections[0];
+    if (!connect(connection))
+    {
+      return false;
+    }
+    int status = 0;
+    std::string headers;
+    std::string body;
+    m_requests++;
+    if (!sendAll(connection.socket, "HEAD " + m_path + " HTTP/1.1\r\nHost: " + m_host + "\r\n\r\n") ||
+        !readResponse(connection, status, headers, body, true))
+    {
+      disconnect(connection);
+      return false;
+    }
+    if (status != 200)
+    {
+      return false;
+    }
+    if (m_cacheDirectory.empty())
+    {
+      return true;
+    }
+
+    // The ETag (and length, for servers without ETags) changes whenever the baked file does
+    std::string etag;
+    std::string length;
+    findHeader(headers, "etag", etag);
+    findHeader(headers, "content-length", length);
+    std::string version = etag + " " + length;
+
+    namespace fs = std::filesystem;
+    std::error_code error;
+    fs::create_directories(m_cacheDirectory, error);
+    fs::path versionPath = fs::path(m_cacheDirectory) / "etag";
+    std::string cachedVersion;
+    std::getline(std::ifstream(versionPath), cachedVersion);
+    if (cachedVersion != version)
+    {
+      for (const auto &entry : fs::directory_iterator(m_cacheDirectory, error))
+      {
+        if (entry.path().extension() == ".tile")
+        {
+          fs::remove(entry.path(), error);
+        }
+      }
+      std::ofstream(versionPath) << version << "\n";
+    }
+    return true;
+  }
+
+  std::string HttpTileReader::cachePath(const TileRead &_read) const
+  {
+    return (std::filesystem::path(m_cacheDirectory) / (std::to_string(_read.offset) + "-" + std::to_string(_read.size) + ".tile")).string();
+  }
+} // end namespace geoclipmap
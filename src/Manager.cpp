@@ -51,6 +51,46 @@ namespace geoclipmap
     m_R = std::clamp(_r, m_RMin, m_RMax);
   }
 
+  void Manager::setStorage(HeightmapStorage _storage)
+  {
+    m_storage = _storage;
+  }
+
+  void Manager::setLayout(HeightmapLayout _layout)
+  {
+    m_layout = _layout;
+  }
+
+  void Manager::setTileFile(const std::string &_tileFile)
+  {
+    m_tileFile = _tileFile;
+  }
+
+  void Manager::setTileReader(TileReaderBackend _backend)
+  {
+    m_tileReader = _backend;
+  }
+
+  void Manager::setDirectIO(bool _directIO)
+  {
+    m_directIO = _directIO;
+  }
+
+  void Manager::setTileCache(const std::string &_tileCache)
+  {
+    m_tileCache = _tileCache;
+  }
+
+  void Manager::setProgressive(bool _progressive)
+  {
+    m_progressive = _progressive;
+  }
+
+  void Manager::setUpdateBudget(size_t _texels)
+  {
+    m_updateBudget = _texels;
+  }
+
   unsigned char Manager::K()
   {
     return m_K;
@@ -90,4 +130,49 @@ namespace geoclipmap
   {
     return m_R;
   }
+
+  HeightmapStorage Manager::storage()
+  {
+    return m_storage;
+  }
+
+  HeightmapLayout Manager::layout()
+  {
+    return m_layout;
+  }
+
+  ngl::Real Manager::heightScale()
+  {
+    return m_heightScale;
+  }
+
+  const std::string &Manager::tileFile()
+  {
+    return m_tileFile;
+  }
+
+  TileReaderBackend Manager::tileReader()
+  {
+    return m_tileReader;
+  }
+
+  bool Manager::directIO()
+  {
+    return m_directIO;
+  }
+
+  const std::string &Manager::tileCache()
+  {
+    return m_tileCache;
+  }
+
+  bool Manager::progressive()
+  {
+    return m_progressive;
+  }
+
+  size_t Manager::updateBudget()
+  {
+    return m_updateBudget;
+  }
 } // end namespace geoclipmap
\ No newline at end of file
@@ -0,0 +1,118 @@
+/**
+ * @file MemoryTracker.cpp
+ * @author Ollie Nicholls
+ * @brief Keeps a running total of the CPU and GPU memory held by each part
+ * of the engine
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include "MemoryTracker.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // The names of the subsystems, in the order of MemorySubsystem
+    const char *const k_subsystemNames[k_memorySubsystems] = {"heightmap", "tile_cache", "clipmap_levels", "footprints"};
+  } // end namespace
+
+  MemoryTracker *MemoryTracker::m_instance = nullptr;
+
+  MemoryTracker *MemoryTracker::getInstance()
+  {
+    if (!m_instance)
+    {
+      m_instance = new MemoryTracker();
+    }
+    return m_instance;
+  }
+
+  const char *MemoryTracker::name(MemorySubsystem _subsystem) noexcept
+  {
+    return k_subsystemNames[static_cast<size_t>(_subsystem)];
+  }
+
+  void MemoryTracker::add(MemorySubsystem _subsystem, int64_t _cpuBytes, int64_t _gpuBytes) noexcept
+  {
+    m_cpuBytes[static_cast<size_t>(_subsystem)].fetch_add(_cpuBytes, std::memory_order_relaxed);
+    m_gpuBytes[static_cast<size_t>(_subsystem)].fetch_add(_gpuBytes, std::memory_order_relaxed);
+  }
+
+  MemoryUsage MemoryTracker::usage(MemorySubsystem _subsystem) const noexcept
+  {
+    MemoryUsage usage;
+    usage.cpuBytes = m_cpuBytes[static_cast<size_t>(_subsystem)].load(std::memory_order_relaxed);
+    usage.gpuBytes = m_gpuBytes[static_cast<size_t>(_subsystem)].load(std::memory_order_relaxed);
+    return usage;
+  }
+
+  MemoryUsage MemoryTracker::total() const noexcept
+  {
+    MemoryUsage total;
+    for (size_t i = 0; i < k_memorySubsystems; i++)
+    {
+      MemoryUsage subsystem = usage(static_cast<MemorySubsystem>(i));
+      total.cpuBytes += subsystem.cpuBytes;
+      total.gpuBytes += subsystem.gpuBytes;
+    }
+    return total;
+  }
+
+  MemoryAccount::MemoryAccount(MemorySubsystem _subsystem) noexcept : m_subsystem{_subsystem}
+  {
+  }
+
+  MemoryAccount::MemoryAccount(const MemoryAccount &_other) noexcept : m_subsystem{_other.m_subsystem}
+  {
+    setCpu(_other.m_cpuBytes);
+    setGpu(_other.m_gpuBytes);
+  }
+
+  MemoryAccount &MemoryAccount::operator=(const MemoryAccount &_other) noexcept
+  {
+    if (this != &_other)
+    {
+      setCpu(0);
+      setGpu(0);
+      m_subsystem = _other.m_subsystem;
+      setCpu(_other.m_cpuBytes);
+      setGpu(_other.m_gpuBytes);
+    }
+    return *this;
+  }
+
+  MemoryAccount::~MemoryAccount() noexcept
+  {
+    setCpu(0);
+    setGpu(0);
+  }
+
+  void MemoryAccount::setCpu(size_t _bytes) noexcept
+  {
+    if (_bytes != m_cpuBytes)
+    {
+      MemoryTracker::getInstance()->add(m_subsystem, static_cast<int64_t>(_bytes) - static_cast<int64_t>(m_cpuBytes), 0);
+      m_cpuBytes = _bytes;
+    }
+  }
+
+  void MemoryAccount::setGpu(size_t _bytes) noexcept
+  {
+    if (_bytes != m_gpuBytes)
+    {
+      MemoryTracker::getInstance()->add(m_subsystem, 0, static_cast<int64_t>(_bytes) - static_cast<int64_t>(m_gpuBytes));
+      m_gpuBytes = _bytes;
+    }
+  }
+
+  size_t MemoryAccount::cpuBytes() const noexcept
+  {
+    return m_cpuBytes;
+  }
+
+  size_t MemoryAccount::gpuBytes() const noexcept
+  {
+    return m_gpuBytes;
+  }
+} // end namespace geoclipmap
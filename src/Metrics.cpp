@@ -0,0 +1,277 @@
+/**
+ * @file Metrics.cpp
+ * @author Ollie Nicholls
+ * @brief Counters the engine adds to as it works, gathered up each frame and
+ * written to a log every so often
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <cmath>
+
+#include "MemoryTracker.h"
+#include "Metrics.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // The number of recent frames whose times are kept for the percentiles
+    constexpr size_t k_frameWindow = 240;
+
+    // The names of the counters and gauges in the log, in the order of Counter and Gauge
+    const char *const k_counterNames[k_counters] = {"texels", "bytes_uploaded", "draw_calls", "triangles", "inactive_level_blocks"};
+    const char *const k_gaugeNames[k_gauges] = {"worker_queue_depth", "tile_cache_hit_rate"};
+
+    /**
+     * @brief Get the nearest rank _percentile (0-1) of some times
+     *
+     */
+    double percentile(std::vector<double> _times, double _percentile)
+    {
+      if (_times.empty())
+      {
+        return 0.0;
+      }
+      auto rank = static_cast<size_t>(std::ceil(std::clamp(_percentile, 0.0, 1.0) * static_cast<double>(_times.size())));
+      size_t n = std::min(_times.size() - 1, rank > 0 ? rank - 1 : 0);
+      std::nth_element(_times.begin(), _times.begin() + n, _times.end());
+      return _times[n];
+    }
+  } // end namespace
+
+  Metrics *Metrics::m_instance = nullptr;
+
+  Metrics *Metrics::getInstance()
+  {
+    if (!m_instance)
+    {
+      m_instance = new Metrics();
+    }
+    return m_instance;
+  }
+
+  void Metrics::add(Counter _counter, uint64_t _amount) noexcept
+  {
+    m_counters[static_cast<size_t>(_counter)].fetch_add(_amount, std::memory_order_relaxed);
+  }
+
+  void Metrics::addTexels(int _level, uint64_t _texels) noexcept
+  {
+    add(Counter::TexelsRegenerated, _texels);
+    if (_level >= 0 && static_cast<size_t>(_level) < k_metricsLevels)
+    {
+      m_levelTexels[static_cast<size_t>(_level)].fetch_add(_texels, std::memory_order_relaxed);
+    }
+  }
+
+  void Metrics::addUpload(int _level, uint64_t _bytes) noexcept
+  {
+    add(Counter::BytesUploaded, _bytes);
+    if (_level >= 0 && static_cast<size_t>(_level) < k_metricsLevels)
+    {
+      m_levelBytes[static_cast<size_t>(_level)].fetch_add(_bytes, std::memory_order_relaxed);
+    }
+  }
+
+  void Metrics::set(Gauge _gauge, double _value) noexcept
+  {
+    m_gauges[static_cast<size_t>(_gauge)].store(_value, std::memory_order_relaxed);
+  }
+
+  void Metrics::frameFinished(double _frameMs) noexcept
+  {
+    m_lastFrame.frameMs = _frameMs;
+    for (size_t i = 0; i < k_counters; i++)
+    {
+      m_lastFrame.counters[i] = m_counters[i].exchange(0, std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < k_metricsLevels; i++)
+    {
+      m_lastFrame.levelTexels[i] = m_levelTexels[i].exchange(0, std::memory_order_relaxed);
+      m_lastFrame.levelBytes[i] = m_levelBytes[i].exchange(0, std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < k_gauges; i++)
+    {
+      m_lastFrame.gauges[i] = m_gauges[i].load(std::memory_order_relaxed);
+    }
+
+    if (m_frameTimes.size() < k_frameWindow)
+    {
+      m_frameTimes.push_back(_frameMs);
+    }
+    else
+    {
+      m_frameTimes[m_frames % k_frameWindow] = _frameMs;
+    }
+    m_frames++;
+
+    if (!m_log.is_open())
+    {
+      return;
+    }
+    m_logTotals.frameMs += _frameMs;
+    for (size_t i = 0; i < k_counters; i++)
+    {
+      m_logTotals.counters[i] += m_lastFrame.counters[i];
+    }
+    for (size_t i = 0; i < k_metricsLevels; i++)
+    {
+      m_logTotals.levelTexels[i] += m_lastFrame.levelTexels[i];
+    }
+    // The queue's deepest over the row, as it is usually empty by the end of a frame, and the latest hit rate
+    auto queueDepth = static_cast<size_t>(Gauge::WorkerQueueDepth);
+    m_logTotals.gauges[queueDepth] = std::max(m_logTotals.gauges[queueDepth], m_lastFrame.gauges[queueDepth]);
+    auto hitRate = static_cast<size_t>(Gauge::TileCacheHitRate);
+    m_logTotals.gauges[hitRate] = m_lastFrame.gauges[hitRate];
+    m_logFrameTimes.push_back(_frameMs);
+
+    if (std::chrono::steady_clock::now() - m_logRowStart >= m_logInterval)
+    {
+      writeLogRow();
+    }
+  }
+
+  const MetricsFrame &Metrics::lastFrame() const noexcept
+  {
+    return m_lastFrame;
+  }
+
+  size_t Metrics::frameCount() const noexcept
+  {
+    return m_frames;
+  }
+
+  double Metrics::frameTimePercentile(double _percentile) const noexcept
+  {
+    return percentile(m_frameTimes, _percentile);
+  }
+
+  bool Metrics::openLog(const std::string &_path, double _intervalSeconds) noexcept
+  {
+    closeLog();
+    m_log.open(_path, std::ios::trunc);
+    if (!m_log)
+    {
+      m_log.close();
+      return false;
+    }
+    m_logJson = _path.size() >= 5 && _path.compare(_path.size() - 5, 5, ".json") == 0;
+    m_logInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(std::max(_intervalSeconds, 0.0)));
+    m_logOpened = std::chrono::steady_clock::now();
+    m_logRowStart = m_logOpened;
+    m_logTotals = MetricsFrame();
+    m_logFrameTimes.clear();
+
+    if (!m_logJson)
+    {
+      m_log << "time_s,frames,fps,frame_ms_p50,frame_ms_p95,frame_ms_p99,frame_ms_max";
+      for (const char *name : k_counterNames)
+      {
+        m_log << ',' << name;
+      }
+      for (const char *name : k_gaugeNames)
+      {
+        m_log << ',' << name;
+      }
+      for (size_t i = 0; i < k_metricsLevels; i++)
+      {
+        m_log << ",texels_l" << i;
+      }
+      for (size_t i = 0; i < k_memorySubsystems; i++)
+      {
+        const char *name = MemoryTracker::name(static_cast<MemorySubsystem>(i));
+        m_log << ',' << name << "_cpu_bytes," << name << "_gpu_bytes";
+      }
+      m_log << '\n';
+      m_log.flush();
+    }
+    return true;
+  }
+
+  void Metrics::closeLog() noexcept
+  {
+    if (!m_log.is_open())
+    {
+      return;
+    }
+    if (!m_logFrameTimes.empty())
+    {
+      writeLogRow();
+    }
+    m_log.close();
+  }
+
+  // ======================================= Private methods =======================================
+
+  void Metrics::writeLogRow() noexcept
+  {
+    auto now = std::chrono::steady_clock::now();
+    double time = std::chrono::duration<double>(now - m_logOpened).count();
+    double rowSeconds = std::chrono::duration<double>(now - m_logRowStart).count();
+    size_t frames = m_logFrameTimes.size();
+    double fps = rowSeconds > 0.0 ? static_cast<double>(frames) / rowSeconds : 0.0;
+    double times[] = {percentile(m_logFrameTimes, 0.5), percentile(m_logFrameTimes, 0.95), percentile(m_logFrameTimes, 0.99),
+                      percentile(m_logFrameTimes, 1.0)};
+    // The memory held when the row is written rather than added up over the row
+    MemoryTracker *memory = MemoryTracker::getInstance();
+
+    if (m_logJson)
+    {
+      m_log << "{\"time_s\":" << time << ",\"frames\":" << frames << ",\"fps\":" << fps
+            << ",\"frame_ms_p50\":" << times[0] << ",\"frame_ms_p95\":" << times[1]
+            << ",\"frame_ms_p99\":" << times[2] << ",\"frame_ms_max\":" << times[3];
+      for (size_t i = 0; i < k_counters; i++)
+      {
+        m_log << ",\"" << k_counterNames[i] << "\":" << m_logTotals.counters[i];
+      }
+      for (size_t i = 0; i < k_gauges; i++)
+      {
+        m_log << ",\"" << k_gaugeNames[i] << "\":" << m_logTotals.gauges[i];
+      }
+      m_log << ",\"memory\":{";
+      for (size_t i = 0; i < k_memorySubsystems; i++)
+      {
+        auto subsystem = static_cast<MemorySubsystem>(i);
+        MemoryUsage usage = memory->usage(subsystem);
+        m_log << (i > 0 ? "," : "") << '"' << MemoryTracker::name(subsystem) << "\":{\"cpu_bytes\":" << usage.cpuBytes
+              << ",\"gpu_bytes\":" << usage.gpuBytes << '}';
+      }
+      m_log << "},\"texels_per_level\":[";
+      for (size_t i = 0; i < k_metricsLevels; i++)
+      {
+        m_log << (i > 0 ? "," : "") << m_logTotals.levelTexels[i];
+      }
+      m_log << "]}\n";
+    }
+    else
+    {
+      m_log << time << ',' << frames << ',' << fps << ',' << times[0] << ',' << times[1] << ',' << times[2] << ',' << times[3];
+      for (uint64_t count : m_logTotals.counters)
+      {
+        m_log << ',' << count;
+      }
+      for (double value : m_logTotals.gauges)
+      {
+        m_log << ',' << value;
+      }
+      for (uint64_t texels : m_logTotals.levelTexels)
+      {
+        m_log << ',' << texels;
+      }
+      for (size_t i = 0; i < k_memorySubsystems; i++)
+      {
+        MemoryUsage usage = memory->usage(static_cast<MemorySubsystem>(i));
+        m_log << ',' << usage.cpuBytes << ',' << usage.gpuBytes;
+      }
+      m_log << '\n';
+    }
+    // Flushed every row so a soak run that is killed still has everything up to then
+    m_log.flush();
+
+    m_logTotals = MetricsFrame();
+    m_logFrameTimes.clear();
+    m_logRowStart = now;
+  }
+} // end namespace geoclipmap
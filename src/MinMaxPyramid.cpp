@@ -0,0 +1,210 @@
+/**
+ * @file MinMaxPyramid.cpp
+ * @author Ollie Nicholls
+ * @brief A pyramid of the lowest and highest heights of ever larger square
+ * blocks of a heightmap, used to find the range of heights in any rectangle
+ * without reading every sample in it
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include "MinMaxPyramid.h"
+
+namespace geoclipmap
+{
+  MinMaxPyramid::MinMaxPyramid(int64_t _width,
+                               int64_t _depth,
+                               const SampleReader &_reader) noexcept : m_width{_width},
+                                                                      m_depth{_depth}
+  {
+    if (m_width <= 0 || m_depth <= 0)
+    {
+      return;
+    }
+
+    // Halve the blocks until a single block covers the whole heightmap
+    int64_t width = (m_width + k_blockSize - 1) >> k_blockShift;
+    int64_t depth = (m_depth + k_blockSize - 1) >> k_blockShift;
+    while (true)
+    {
+      Level level;
+      level.width = width;
+      level.depth = depth;
+      level.ranges.resize(static_cast<size_t>(width) * depth);
+      m_levels.push_back(std::move(level));
+      if (width == 1 && depth == 1)
+      {
+        break;
+      }
+      width = (width + 1) / 2;
+      depth = (depth + 1) / 2;
+    }
+
+    rebuild(0, 0, m_width - 1, m_depth - 1, _reader);
+  }
+
+  HeightRange MinMaxPyramid::bounds(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) const noexcept
+  {
+    if (!clamp(_x0, _y0, _x1, _y1))
+    {
+      return HeightRange();
+    }
+
+    // The finest level where the rectangle is within 2x2 blocks, blocks at least as wide as the rectangle always are
+    size_t l = 0;
+    int shift = k_blockShift;
+    while (l + 1 < m_levels.size() && ((_x1 >> shift) - (_x0 >> shift) > 1 || (_y1 >> shift) - (_y0 >> shift) > 1))
+    {
+      l++;
+      shift++;
+    }
+
+    const Level &level = m_levels[l];
+    HeightRange range = k_emptyRange;
+    for (int64_t by = _y0 >> shift; by <= _y1 >> shift; by++)
+    {
+      for (int64_t bx = _x0 >> shift; bx <= _x1 >> shift; bx++)
+      {
+        merge(range, level.ranges[static_cast<size_t>(by * level.width + bx)]);
+      }
+    }
+    return range;
+  }
+
+  HeightRange MinMaxPyramid::total() const noexcept
+  {
+    return m_levels.empty() ? HeightRange() : m_levels.back().ranges[0];
+  }
+
+  void MinMaxPyramid::update(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, const SampleReader &_reader) noexcept
+  {
+    if (!clamp(_x0, _y0, _x1, _y1))
+    {
+      return;
+    }
+
+    rebuild(_x0, _y0, _x1, _y1, _reader);
+  }
+
+  int MinMaxPyramid::levels() const noexcept
+  {
+    return static_cast<int>(m_levels.size());
+  }
+
+  int64_t MinMaxPyramid::levelWidth(int _level) const noexcept
+  {
+    return m_levels[static_cast<size_t>(_level)].width;
+  }
+
+  int64_t MinMaxPyramid::levelDepth(int _level) const noexcept
+  {
+    return m_levels[static_cast<size_t>(_level)].depth;
+  }
+
+  int MinMaxPyramid::blockShift(int _level) const noexcept
+  {
+    return k_blockShift + _level;
+  }
+
+  HeightRange MinMaxPyramid::cellRange(int _level, int64_t _bx, int64_t _by) const noexcept
+  {
+    const Level &level = m_levels[static_cast<size_t>(_level)];
+    HeightRange range = k_emptyRange;
+    for (int64_t by = _by; by < std::min(level.depth, _by + 2); by++)
+    {
+      for (int64_t bx = _bx; bx < std::min(level.width, _bx + 2); bx++)
+      {
+        merge(range, level.ranges[static_cast<size_t>(by * level.width + bx)]);
+      }
+    }
+    return range;
+  }
+
+  size_t MinMaxPyramid::memoryBytes() const noexcept
+  {
+    size_t bytes = 0;
+    for (const Level &level : m_levels)
+    {
+      bytes += level.ranges.capacity() * sizeof(HeightRange);
+    }
+    return bytes;
+  }
+
+  // ======================================= Private methods =======================================
+
+  void MinMaxPyramid::rebuild(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1, const SampleReader &_reader) noexcept
+  {
+    int64_t bx0 = _x0 >> k_blockShift;
+    int64_t by0 = _y0 >> k_blockShift;
+    int64_t bx1 = _x1 >> k_blockShift;
+    int64_t by1 = _y1 >> k_blockShift;
+
+    // Level 0 from the samples of every block touched, a row of them at a time
+    Level &leaves = m_levels[0];
+    for (int64_t by = by0; by <= by1; by++)
+    {
+      std::fill(leaves.ranges.begin() + static_cast<size_t>(by * leaves.width + bx0),
+                leaves.ranges.begin() + static_cast<size_t>(by * leaves.width + bx1 + 1),
+                k_emptyRange);
+    }
+
+    int64_t sx0 = bx0 << k_blockShift;
+    int64_t sx1 = std::min(m_width, (bx1 + 1) << k_blockShift);
+    int64_t sy0 = by0 << k_blockShift;
+    int64_t sy1 = std::min(m_depth, (by1 + 1) << k_blockShift);
+    std::vector<ngl::Real> row(static_cast<size_t>(sx1 - sx0));
+    for (int64_t y = sy0; y < sy1; y++)
+    {
+      _reader(sx0, y, static_cast<int>(row.size()), row.data());
+      HeightRange *ranges = &leaves.ranges[static_cast<size_t>((y >> k_blockShift) * leaves.width)];
+      for (int64_t x = sx0; x < sx1; x++)
+      {
+        HeightRange &range = ranges[x >> k_blockShift];
+        ngl::Real height = row[static_cast<size_t>(x - sx0)];
+        range.min = std::min(range.min, height);
+        range.max = std::max(range.max, height);
+      }
+    }
+
+    // Then only the blocks above those
+    for (size_t l = 1; l < m_levels.size(); l++)
+    {
+      const Level &below = m_levels[l - 1];
+      Level &level = m_levels[l];
+      bx0 >>= 1;
+      by0 >>= 1;
+      bx1 >>= 1;
+      by1 >>= 1;
+      for (int64_t by = by0; by <= by1; by++)
+      {
+        for (int64_t bx = bx0; bx <= bx1; bx++)
+        {
+          HeightRange range = k_emptyRange;
+          for (int64_t cy = by * 2; cy < std::min(below.depth, by * 2 + 2); cy++)
+          {
+            for (int64_t cx = bx * 2; cx < std::min(below.width, bx * 2 + 2); cx++)
+            {
+              merge(range, below.ranges[static_cast<size_t>(cy * below.width + cx)]);
+            }
+          }
+          level.ranges[static_cast<size_t>(by * level.width + bx)] = range;
+        }
+      }
+    }
+  }
+
+  bool MinMaxPyramid::clamp(int64_t &_x0, int64_t &_y0, int64_t &_x1, int64_t &_y1) const noexcept
+  {
+    _x0 = std::max<int64_t>(_x0, 0);
+    _y0 = std::max<int64_t>(_y0, 0);
+    _x1 = std::min(_x1, m_width - 1);
+    _y1 = std::min(_y1, m_depth - 1);
+    return !m_levels.empty() && _x0 <= _x1 && _y0 <= _y1;
+  }
+
+  void MinMaxPyramid::merge(HeightRange &_range, const HeightRange &_other) noexcept
+  {
+    _range.min = std::min(_range.min, _other.min);
+    _range.max = std::max(_range.max, _other.max);
+  }
+} // end namespace geoclipmap
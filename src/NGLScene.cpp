@@ -7,6 +7,11 @@
  * @copyright Copyright (c) 2020
  * 
  */
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+
 #include <QGuiApplication>
 #include <QMouseEvent>
 
@@ -15,6 +20,7 @@
 #include <ngl/Transformation.h>
 #include <ngl/VAOPrimitives.h>
 
+#include "HttpTileReader.h"
 #include "NGLScene.h"
 
 namespace geoclipmap
@@ -24,13 +30,55 @@ namespace geoclipmap
     std::string title = fmt::format("Geometry Clipmap Demo - {}", _fname);
     setTitle(QString::fromStdString(title));
     m_imageName = _fname;
+    m_gpuTimerFrames.fill(SIZE_MAX);
   }
 
   NGLScene::~NGLScene()
   {
+    if (m_pathWriter)
+    {
+      std::cout << fmt::format("Recorded {} frames to the camera path\n", m_pathWriter->framesWritten());
+    }
+    // The trace's queries and the terrain's buffers belong to the context, so it has to be current to delete them
+    makeCurrent();
+    m_gpuTrace.reset();
+    m_updateCosts.reset();
+    m_prefetcher.reset();
+    m_editor.reset();
+    m_terrain.reset();
     std::cout << "Shutting down NGL, removing VAO's and Shaders\n";
   }
 
+  bool NGLScene::recordPath(const std::string &_path)
+  {
+    m_pathWriter = CameraPathWriter::create(_path);
+    return m_pathWriter != nullptr;
+  }
+
+  bool NGLScene::replayPath(const std::string &_path, size_t _frames, const std::string &_statsPath)
+  {
+    m_replay = CameraPath::open(_path);
+    if (!m_replay)
+    {
+      return false;
+    }
+    m_replayName = _path;
+    m_replayFrames = _frames > 0 ? _frames : m_replay->frameCount();
+    m_statsPath = _statsPath;
+    return true;
+  }
+
+  void NGLScene::setFollowCamera(bool _follow) noexcept
+  {
+    m_win.followCamera = _follow;
+  }
+
+  bool NGLScene::setGovernor(double _targetMs, const std::string &_logPath)
+  {
+    m_governor = std::make_unique<QualityGovernor>(_targetMs);
+    return _logPath.empty() || m_governor->openLog(_logPath);
+  }
+
   void NGLScene::resizeGL(int _w, int _h)
   {
     m_projection = ngl::perspective(m_win.m_fov, static_cast<float>(_w) / _h, m_win.m_near, m_win.m_far);
@@ -109,54 +157,171 @@ namespace geoclipmap
 
     // Finally generate the terrain
     generateTerrain();
+    m_gpuTrace = std::make_unique<GpuTrace>();
+
+    if (m_replay || m_governor)
+    {
+      glGenQueries(static_cast<GLsizei>(m_gpuTimers.size()), m_gpuTimers.data());
+    }
+    if (m_replay)
+    {
+      std::cout << fmt::format("Replaying {} frames of camera path {} ({} frames long)\n", m_replayFrames, m_replayName, m_replay->frameCount());
+    }
   }
 
   void NGLScene::paintGL()
   {
+    int64_t traceStart = Tracer::capturing() ? Tracer::now() : 0;
+    auto frameStart = std::chrono::steady_clock::now();
+    size_t timer = m_timedFrames % m_gpuTimers.size();
+    bool timed = m_replay || m_governor;
+    if (m_replay)
+    {
+      applyPathFrame(m_replay->frame(m_replayFrame));
+    }
+    if (timed)
+    {
+      // A timer whose frame still hasn't finished on the GPU is reused, and that frame's GPU time left unknown
+      readGpuTimers(false);
+      m_gpuTimerFrames[timer] = SIZE_MAX;
+      glBeginQuery(GL_TIME_ELAPSED, m_gpuTimers[timer]);
+    }
+
     // TODO: Colour terrain based on clipmap level?
     // clear the screen and depth buffer
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glViewport(0, 0, m_win.width, m_win.height);
 
+    // Move the terrain once a frame, however many moves there were since the last. Following the camera the terrain
+    // is centred under it and drawn offset by as much, so the heightmap stays still in the world as the clipmap slides
+    // over it, only the levels whose origins move a whole sample are filled again
+    auto updateStart = std::chrono::steady_clock::now();
+    m_terrain->beginFrame();
+    ngl::Vec2 follow = m_win.followCamera ? m_cam->position() : ngl::Vec2();
+    m_terrain->moveTo(m_terrainX, m_terrainY, follow);
+
     // Set the correct shader program for terrain drawing
     ngl::ShaderLib::use(m_shaderProgram);
     m_transform.setRotation(90.0f, 0.0f, 0.0f);
+    m_transform.setPosition(follow.m_x, 0.0f, follow.m_y);
 
     // Calculate the MVP matrix
     ngl::Mat4 MVP;
     MVP = m_projection * m_cam->view() * m_transform.getMatrix();
     ngl::ShaderLib::setUniform("MVP", MVP);
 
+    // The update cost view shows what the last finished frame cost each level, and how many frames ago each texel was
+    // regenerated. None of it is set when the view is off.
+    ngl::ShaderLib::setUniform("debugMode", m_showUpdateCosts ? 1 : 0);
+    if (m_showUpdateCosts)
+    {
+      if (!m_updateCosts)
+      {
+        m_updateCosts = std::make_unique<UpdateCostBuffer>();
+      }
+      m_updateCosts->update(Metrics::getInstance()->lastFrame(), m_manager->D() * m_manager->D());
+      ngl::ShaderLib::setUniform("frameNumber", static_cast<ngl::Real>(Metrics::getInstance()->frameCount() % k_regeneratedFrameWrap));
+      ngl::ShaderLib::setUniform("clipmapLevels", static_cast<int>(m_manager->L()));
+    }
+
+    // Re-read just the parts of the textures the feed's writer has changed since the last frame
+    if (m_feed && m_feed->poll(m_feedRects))
+    {
+      for (const auto &rect : m_feedRects)
+      {
+        m_heightmap->heightsChanged(rect.x0, rect.y0, rect.x1, rect.y1);
+        m_terrain->refreshRegion(rect.x0, rect.y0, rect.x1, rect.y1);
+      }
+    }
+
+    // Play the sequence at its own frame rate whatever the display's, refreshing only the tiles each step changed
+    if (m_sequence && m_playingSequence)
+    {
+      int64_t due = static_cast<int64_t>(static_cast<double>(m_sequenceClock.elapsed()) * m_sequence->frameRate() / 1000.0) - m_sequenceSteps;
+      // Every step applies its changes to the one before, so none can be skipped. Catching up on all the missed steps
+      // at once would stall this frame, so at most a few are applied each frame and the rest on the frames after,
+      // the sequence playing slower than its frame rate until it has caught up.
+      int64_t steps = std::clamp<int64_t>(due, 0, 4);
+      m_sequenceSteps += steps;
+      for (int64_t i = 0; i < steps; i++)
+      {
+        if (m_sequence->step(m_feedRects))
+        {
+          for (const auto &rect : m_feedRects)
+          {
+            m_heightmap->heightsChanged(rect.x0, rect.y0, rect.x1, rect.y1);
+            m_terrain->refreshRegion(rect.x0, rect.y0, rect.x1, rect.y1);
+          }
+        }
+      }
+    }
+
     // Set the active LoD levels based on the camera height
     m_terrain->setActiveLevels(m_cam->height());
+    // Fill the next finer level if refining progressively, but only once the levels already filled have been drawn so
+    // the first frame after a jump is shown as soon as it can be
+    if (m_fillShown == m_terrain->fillStarted())
+    {
+      m_terrain->refine();
+    }
+    double updateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - updateStart).count();
+
+    if (m_pathWriter)
+    {
+      CameraPathFrame frame;
+      frame.camera = m_cam->state();
+      frame.terrainX = m_terrainX;
+      frame.terrainY = m_terrainY;
+      frame.followCamera = m_win.followCamera;
+      frame.K = m_manager->K();
+      frame.L = m_manager->L();
+      frame.R = m_manager->R();
+      m_pathWriter->addFrame(frame);
+    }
 
     auto clipmaps = m_terrain->clipmaps();
+    size_t uploadBytes = 0;
+    size_t draws = 0;
 
-    // Loop through each of the active levels
-    for (int l = static_cast<int>(m_terrain->activeFinest()); l >= static_cast<int>(m_terrain->activeCoarsest()); l--)
+    // Loop through each of the active levels that are ready, the finest of them covering the finer levels still to be
+    // filled with all of its footprints
+    int readyFinest = static_cast<int>(m_terrain->readyFinest());
+    for (int l = readyFinest; l >= static_cast<int>(m_terrain->activeCoarsest()); l--)
     {
       auto currentLevel = clipmaps[l];
 
       // Bind the height texture before drawing
-      currentLevel->bindTextures();
+      m_gpuTrace->begin("upload", l);
+      uploadBytes += currentLevel->bindTextures();
+      m_gpuTrace->end();
+      m_gpuTrace->begin("draw", l);
+      GEOCLIPMAP_TRACE_ZONE("drawLevel", l);
+      if (m_showUpdateCosts)
+      {
+        ngl::ShaderLib::setUniform("clipmapLevel", l);
+      }
 
       // Loop through each of the footprint locations of the current clipmap level
-      for (auto location : m_terrain->selectLocations(currentLevel->trimLocation()))
+      for (auto location : m_terrain->selectLocations(l == readyFinest ? TrimLocation::All : currentLevel->trimLocation()))
       {
         auto footprint = location->footprint;
 
         ngl::ShaderLib::setUniform("footprintLocalPos", static_cast<ngl::Real>(location->x), static_cast<ngl::Real>(location->y));
         ngl::ShaderLib::setUniform("clipmapOffsetPos", currentLevel->position());
+        ngl::ShaderLib::setUniform("clipmapSubTexelOffset", currentLevel->subTexelOffset());
         ngl::ShaderLib::setUniform("clipmapScale", static_cast<ngl::Real>(currentLevel->scale()));
         ngl::ShaderLib::setUniform("clipmapD", static_cast<ngl::Real>(m_manager->D()));
         // ngl::ShaderLib::setUniform("viewerPos", m_cam.position());
         ngl::ShaderLib::setUniform("highestPoint", m_heightmap->highestPoint());
+        ngl::ShaderLib::setUniform("heightScale", m_manager->heightScale());
 
         footprint->draw();
+        draws++;
       }
 
       // Unbind as done
       currentLevel->unbindTextures();
+      m_gpuTrace->end();
     }
 
     // Draw axis
@@ -164,11 +329,198 @@ namespace geoclipmap
 
     // Draw text
     drawText();
+
+    // Get ready for where the terrain is heading while waiting for the next frame
+    m_prefetcher->update(m_cam->height());
+
+    // Live heights keep changing without any input, so keep drawing
+    if (m_feed || (m_sequence && m_playingSequence))
+    {
+      update();
+    }
+
+    metricsFrameFinished(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+    fillFrameFinished();
+    governorFrameFinished(updateMs);
+
+    if (traceStart != 0)
+    {
+      Tracer::getInstance()->addZone("paintGL", traceStart, Tracer::now());
+    }
+    traceFrameFinished();
+
+    if (timed)
+    {
+      glEndQuery(GL_TIME_ELAPSED);
+      m_gpuTimerFrames[timer] = m_timedFrames++;
+    }
+    if (m_replay)
+    {
+      auto frameEnd = std::chrono::steady_clock::now();
+      FrameTiming timing;
+      timing.cpuMs = std::chrono::duration<double, std::milli>(frameEnd - frameStart).count();
+      // The first frame has nothing before it, so its CPU time stands in
+      timing.frameMs = m_replayFrame == 0 ? timing.cpuMs : std::chrono::duration<double, std::milli>(frameStart - m_lastFrameStart).count();
+      timing.uploadBytes = uploadBytes;
+      timing.draws = draws;
+      m_gpuTimerFrames[timer] = m_frameStats.add(timing);
+      m_lastFrameStart = frameStart;
+
+      if (++m_replayFrame < m_replayFrames)
+      {
+        update();
+      }
+      else
+      {
+        finishReplay();
+      }
+    }
   }
 
   void NGLScene::generateTerrain()
   {
-    QImage image(m_imageName.c_str());
+    // A baked heightmap on a tile server is already compressed, and its tiles are fetched as they're needed
+    if (m_imageName.rfind("http://", 0) == 0)
+    {
+      auto reader = HttpTileReader::open(m_imageName, m_manager->tileCache());
+      bool offline = reader && reader->offline();
+      auto compressed = CompressedHeightmap::open(std::move(reader));
+      if (!compressed)
+      {
+        std::cerr << fmt::format("Couldn't open height map {}\n", m_imageName);
+        exit(EXIT_FAILURE);
+      }
+      std::cout << fmt::format("Opened height map {}{}, size {}x{}\n", m_imageName, offline ? " (offline, from the tile cache)" : "",
+                               compressed->width(), compressed->depth());
+      m_heightmap = new Heightmap(std::move(compressed));
+    }
+    // A live feed from another process is read in place as it changes
+    else if (m_imageName.rfind("shm://", 0) == 0)
+    {
+      m_feed = HeightmapFeed::open("/" + m_imageName.substr(6));
+      if (!m_feed)
+      {
+        std::cerr << fmt::format("Couldn't open height map feed {}\n", m_imageName);
+        exit(EXIT_FAILURE);
+      }
+      std::cout << fmt::format("Reading live height map {}, size {}x{}\n", m_imageName, m_feed->width(), m_feed->depth());
+      m_heightmap = new Heightmap(m_feed->width(), m_feed->depth(), m_feed->heights());
+      // Skip whatever was published before now, as the heights are read in full anyway
+      m_feed->poll(m_feedRects);
+    }
+    // A sequence of heightmaps over time is played back in place, one step of changed tiles at a time
+    else if (m_imageName.size() > 6 && m_imageName.compare(m_imageName.size() - 6, 6, ".gcseq") == 0)
+    {
+      m_sequence = HeightmapSequence::open(m_imageName);
+      if (!m_sequence)
+      {
+        std::cerr << fmt::format("Couldn't open height map sequence {}\n", m_imageName);
+        exit(EXIT_FAILURE);
+      }
+      std::cout << fmt::format("Playing height map sequence {}, size {}x{}, {} frames at {} fps\n", m_imageName,
+                               m_sequence->width(), m_sequence->depth(), m_sequence->frameCount(), m_sequence->frameRate());
+      m_heightmap = new Heightmap(m_sequence->width(), m_sequence->depth(), m_sequence->heights());
+      m_playingSequence = true;
+      m_sequenceClock.start();
+    }
+    // A mosaic of insets over a base reads each sample from the finest image covering it
+    else if (m_imageName.size() > 7 && m_imageName.compare(m_imageName.size() - 7, 7, ".mosaic") == 0)
+    {
+      std::vector<MosaicLayer> layers;
+      if (!HeightmapMosaic::readLayers(m_imageName, layers))
+      {
+        std::cerr << fmt::format("Couldn't read height map mosaic {}\n", m_imageName);
+        exit(EXIT_FAILURE);
+      }
+
+      std::unique_ptr<HeightmapMosaic> mosaic;
+      for (const MosaicLayer &layer : layers)
+      {
+        auto source = loadImage(layer.image);
+        source->setLayout(m_manager->layout());
+        if (m_manager->storage() == HeightmapStorage::Compressed)
+        {
+          source->compress(source->highestPoint() / 8192.0f);
+        }
+        else if (m_manager->storage() == HeightmapStorage::Quantised)
+        {
+          source->quantise();
+        }
+
+        if (!mosaic)
+        {
+          mosaic = std::make_unique<HeightmapMosaic>(std::move(source), layer.spacing);
+        }
+        else if (!mosaic->addInset(std::move(source), layer.x, layer.y, layer.spacing, layer.feather))
+        {
+          std::cerr << fmt::format("Couldn't add inset {} at {}, {}, it isn't on the mosaic's grid or within its base\n",
+                                   layer.image, layer.x, layer.y);
+        }
+      }
+      std::cout << fmt::format("Built height map mosaic {}, size {}x{} from {} images holding {} samples\n", m_imageName,
+                               mosaic->width(), mosaic->depth(), mosaic->sourceCount(), mosaic->storedSamples());
+      m_heightmap = new Heightmap(std::move(mosaic));
+    }
+    else
+    {
+      m_heightmap = loadImage(m_imageName).release();
+      m_heightmap->setLayout(m_manager->layout());
+
+      if (m_manager->storage() == HeightmapStorage::Compressed)
+      {
+        // Allow an error of 1/8192 of the height range, well under a pixel at the height scale used for drawing
+        m_heightmap->compress(m_heightmap->highestPoint() / 8192.0f);
+        auto stats = m_heightmap->compressionStats();
+        std::cout << fmt::format("Compressed height map {} -> {} bytes ({:.1f}:1), max error {}\n",
+                                 stats->rawBytes, stats->compressedBytes, stats->ratio(), stats->maxError);
+
+        const std::string &tileFile = m_manager->tileFile();
+        if (!tileFile.empty())
+        {
+          if (m_heightmap->streamTiles(tileFile, m_manager->tileReader(), m_manager->directIO()))
+          {
+            const TileReader *reader = m_heightmap->tileReader();
+            std::cout << fmt::format("Streaming tiles from {} with {}{}\n", tileFile,
+                                     reader->backend() == TileReaderBackend::IoUring ? "io_uring" : "pread",
+                                     reader->directIO() ? " (O_DIRECT)" : "");
+          }
+          else
+          {
+            std::cerr << fmt::format("Couldn't stream tiles from {}, keeping them in memory\n", tileFile);
+          }
+        }
+      }
+      else if (m_manager->storage() == HeightmapStorage::Quantised)
+      {
+        m_heightmap->quantise();
+        auto stats = m_heightmap->quantisationStats();
+        std::cout << fmt::format("Quantised height map {} -> {} bytes, max error {}, RMS error {}\n",
+                                 stats->rawBytes, stats->quantisedBytes, stats->maxError, stats->rmsError);
+      }
+    }
+
+    // Then generate a terrain from that heightmap
+    m_terrain = std::make_unique<Terrain>(m_heightmap);
+    m_prefetcher = std::make_unique<TilePrefetcher>(m_terrain.get(), m_heightmap);
+    m_rayCaster = std::make_unique<RayCaster>(m_heightmap);
+    m_viewshed = std::make_unique<Viewshed>(m_heightmap);
+    m_editor = std::make_unique<HeightmapEditor>(m_heightmap, m_terrain.get());
+
+    // Now move the terrain so it is centred on the camera
+    m_terrainX = static_cast<int64_t>(m_heightmap->width()) / 2;
+    m_terrainY = static_cast<int64_t>(m_heightmap->depth()) / 2;
+    m_terrain->moveTo(m_terrainX, m_terrainY);
+
+    if (auto stats = m_heightmap->compressionStats())
+    {
+      std::cout << fmt::format("Decompressed {} tiles at {:.1f} Msamples/s\n",
+                               stats->tilesDecoded, stats->samplesPerSecond() / 1e6);
+    }
+  }
+
+  std::unique_ptr<Heightmap> NGLScene::loadImage(const std::string &_name)
+  {
+    QImage image(_name.c_str());
 
     // Convert image to 16-bit colour depth
     image = image.convertToFormat(QImage::Format_RGB16);
@@ -176,7 +528,7 @@ namespace geoclipmap
     // Get the image sizes and output them to console
     int imageWidth = image.size().width();
     int imageHeight = image.size().height();
-    std::cout << "Loading height map " << m_imageName << ", size " << imageWidth << "x" << imageHeight << "\n";
+    std::cout << "Loading height map " << _name << ", size " << imageWidth << "x" << imageHeight << "\n";
 
     std::vector<ngl::Vec3> gridPoints;
 
@@ -191,20 +543,210 @@ namespace geoclipmap
     }
 
     // Create a heightmap from the image data
-    m_heightmap = new Heightmap(imageWidth, imageHeight, gridPoints);
+    return std::make_unique<Heightmap>(imageWidth, imageHeight, gridPoints);
+  }
 
-    // Then generate a terrain from that heightmap
-    m_terrain = new Terrain(m_heightmap);
+  void NGLScene::reconfigureTerrain()
+  {
+    // Footprints and levels that are no longer needed belong to the context, so it has to be current to delete them.
+    // Everything pointing at the terrain (the prefetcher, the editor, the overlay) keeps working as it's the same one.
+    makeCurrent();
+    m_terrain->reconfigure();
+  }
 
-    // Now move the terrain so it is centred on the camera
-    m_terrainX = imageWidth / 2;
-    m_terrainY = imageHeight / 2;
-    m_terrain->move(m_terrainX, m_terrainY);
+  void NGLScene::toggleViewshed()
+  {
+    m_showViewshed = !m_showViewshed;
+    if (!m_showViewshed)
+    {
+      m_terrain->setOverlay(nullptr);
+      return;
+    }
+
+    // An observer whose eye is 2 samples above the ground when drawn
+    int64_t x = m_picked.hit ? m_picked.sampleX : m_terrainX;
+    int64_t y = m_picked.hit ? m_picked.sampleY : m_terrainY;
+    auto start = std::chrono::steady_clock::now();
+    m_viewshed->compute(x, y, 2.0f / m_manager->heightScale());
+    std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - start;
+    std::cout << fmt::format("Viewshed from ({}, {}): {} samples visible, found in {:.1f}ms\n", x, y, m_viewshed->visibleCount(), time.count());
+
+    m_terrain->setOverlay([this](int64_t _x, int64_t _y, int _stride, int _count, ngl::Real *_out) {
+      m_viewshed->readRow(_x, _y, _stride, _count, _out);
+    });
+  }
+
+  void NGLScene::applyPathFrame(const CameraPathFrame &_frame)
+  {
+    if (_frame.K != m_manager->K() || _frame.L != m_manager->L() || _frame.R != m_manager->R())
+    {
+      m_manager->setK(_frame.K);
+      m_manager->setL(_frame.L);
+      m_manager->setR(_frame.R);
+      reconfigureTerrain();
+    }
+    // The terrain is moved there when the frame is drawn
+    m_terrainX = _frame.terrainX;
+    m_terrainY = _frame.terrainY;
+    m_win.followCamera = _frame.followCamera;
+    m_cam->setState(_frame.camera);
+  }
+
+  void NGLScene::readGpuTimers(bool _wait)
+  {
+    for (size_t i = 0; i < m_gpuTimers.size(); i++)
+    {
+      if (m_gpuTimerFrames[i] == SIZE_MAX)
+      {
+        continue;
+      }
+      GLint available = GL_FALSE;
+      glGetQueryObjectiv(m_gpuTimers[i], GL_QUERY_RESULT_AVAILABLE, &available);
+      if (available == GL_FALSE && !_wait)
+      {
+        continue;
+      }
+      GLuint64 elapsed = 0;
+      glGetQueryObjectui64v(m_gpuTimers[i], GL_QUERY_RESULT, &elapsed);
+      m_lastGpuMs = static_cast<double>(elapsed) / 1e6;
+      if (m_replay)
+      {
+        m_frameStats.setGpuTime(m_gpuTimerFrames[i], m_lastGpuMs);
+      }
+      m_gpuTimerFrames[i] = SIZE_MAX;
+    }
+  }
+
+  void NGLScene::finishReplay()
+  {
+    readGpuTimers(true);
+    size_t frames = m_frameStats.frameCount();
+    size_t uploadBytes = 0;
+    size_t draws = 0;
+    for (size_t i = 0; i < frames; i++)
+    {
+      uploadBytes += m_frameStats.frame(i).uploadBytes;
+      draws += m_frameStats.frame(i).draws;
+    }
+
+    std::cout << fmt::format("Replayed {} frames, {:.2f}MB uploaded and {:.1f} draws a frame\n", frames,
+                             static_cast<double>(uploadBytes) / 1e6 / static_cast<double>(frames),
+                             static_cast<double>(draws) / static_cast<double>(frames));
+    for (auto time : {std::make_pair(FrameTime::Frame, "Frame"), std::make_pair(FrameTime::Cpu, "CPU"), std::make_pair(FrameTime::Gpu, "GPU")})
+    {
+      std::cout << fmt::format("{} time: p50 {:.3f}ms, p95 {:.3f}ms, p99 {:.3f}ms\n", time.second,
+                               m_frameStats.percentile(time.first, 0.5),
+                               m_frameStats.percentile(time.first, 0.95),
+                               m_frameStats.percentile(time.first, 0.99));
+    }
+
+    if (!m_statsPath.empty())
+    {
+      if (m_frameStats.writeCsv(m_statsPath))
+      {
+        std::cout << fmt::format("Wrote every frame's costs to {}\n", m_statsPath);
+      }
+      else
+      {
+        std::cerr << fmt::format("Couldn't write frame costs to {}\n", m_statsPath);
+      }
+    }
+
+    // Any frame drawn before the application quits goes back to following the mouse and keyboard
+    glDeleteQueries(static_cast<GLsizei>(m_gpuTimers.size()), m_gpuTimers.data());
+    m_replay.reset();
+    QGuiApplication::exit(EXIT_SUCCESS);
+  }
+
+  void NGLScene::traceFrameFinished()
+  {
+    Tracer *tracer = Tracer::getInstance();
+    if (tracer->frameFinished())
+    {
+      m_gpuTrace->collect(true);
+      std::string path = fmt::format("geoclipmap_trace_{}.json", std::time(nullptr));
+      if (tracer->write(path))
+      {
+        std::cout << fmt::format("Wrote {} zones from {} frames to {}, open it at https://ui.perfetto.dev\n", tracer->zoneCount(), m_win.m_traceFrames, path);
+      }
+      else
+      {
+        std::cerr << fmt::format("Couldn't write the trace to {}\n", path);
+      }
+      return;
+    }
+
+    if (m_gpuTrace->pending() > 0)
+    {
+      m_gpuTrace->collect(false);
+    }
+    // A capture is of frames one after another, not whenever something happens to be drawn
+    if (Tracer::capturing())
+    {
+      update();
+    }
+  }
+
+  void NGLScene::metricsFrameFinished(double _frameMs)
+  {
+    Metrics *metrics = Metrics::getInstance();
+    // Each level is 12 blocks of M x M around its fixups, trims and finer level, none of which are drawn when it isn't active
+    size_t activeLevels = static_cast<size_t>(m_terrain->activeFinest() - m_terrain->activeCoarsest() + 1);
+    metrics->add(Counter::InactiveLevelBlocks, 12 * (m_manager->L() - activeLevels));
+    metrics->set(Gauge::WorkerQueueDepth, static_cast<double>(ThreadPool::getInstance()->takePeakQueueDepth()));
+    if (auto stats = m_heightmap->compressionStats())
+    {
+      metrics->set(Gauge::TileCacheHitRate, stats->hitRate());
+    }
+    metrics->frameFinished(_frameMs);
+  }
+
+  void NGLScene::fillFrameFinished()
+  {
+    auto now = std::chrono::steady_clock::now();
+    auto started = m_terrain->fillStarted();
+    if (m_fillShown != started)
+    {
+      m_fillShown = started;
+      m_timeToFirstFrame = std::chrono::duration<double, std::milli>(now - started).count();
+      m_timeToFullDetail = -1.0;
+    }
+    if (m_terrain->refining())
+    {
+      update();
+    }
+    else if (m_timeToFullDetail < 0.0)
+    {
+      m_timeToFullDetail = std::chrono::duration<double, std::milli>(now - started).count();
+      std::cout << fmt::format("Terrain filled: first frame after {:.1f}ms, full detail after {:.1f}ms\n", m_timeToFirstFrame, m_timeToFullDetail);
+    }
   }
 
-  void NGLScene::regenerateTerrain()
+  void NGLScene::governorFrameFinished(double _updateMs)
   {
-    m_terrain = new Terrain(m_heightmap);
+    GovernorDecision decision;
+    if (!m_governor || !m_governor->frameFinished(_updateMs, m_lastGpuMs, decision))
+    {
+      return;
+    }
+    // R and the update budget are read afresh every frame, only K needs the terrain rebuilt (the context is current)
+    if (decision.setting == GovernorSetting::K)
+    {
+      m_terrain->reconfigure();
+    }
+    std::cout << fmt::format("Governor: {} {} -> {} ({}, update {:.2f}ms, GPU {:.2f}ms, target {:.1f}ms) at frame {}\n",
+                             QualityGovernor::name(decision.setting), decision.from, decision.to, decision.reason,
+                             decision.cpuUpdateMs, decision.gpuMs, m_governor->targetMs(), decision.frame);
+    update();
+  }
+
+  BrushArea NGLScene::pickedBrush() const
+  {
+    if (!m_picked.hit)
+    {
+      return BrushArea();
+    }
+    return BrushArea::circle(static_cast<ngl::Real>(m_picked.sampleX), static_cast<ngl::Real>(m_picked.sampleY), 16.0f);
   }
 
   void NGLScene::drawText()
@@ -222,10 +764,17 @@ namespace geoclipmap
     {
       m_text->renderText(10, 700, "===== CONTROLS =====");
       m_text->renderText(10, (textPos-=19), "= 'arrow keys' - move terrain (always follows world axes)");
+      m_text->renderText(10, (textPos-=19), "= 'm' - toggle the terrain following the camera");
       m_text->renderText(10, (textPos-=19), "= '[' - reduce LOD, ']' - increase LOD (K)");
       m_text->renderText(10, (textPos-=19), "= '-' - reduce clipmap count, '=' - increase clipmap count (L)");
       m_text->renderText(10, (textPos-=19), "= '9' - reduce clipmap range, '0' - increase clipmap range (R)");
       m_text->renderText(10, (textPos-=19), "= 'LMB' - orbit camera, 'MMB' - pedestal camera (up/down), 'RMB' - dolly camera (in/out)");
+      m_text->renderText(10, (textPos-=19), "= 'LMB double click' - pick a point on the terrain");
+      m_text->renderText(10, (textPos-=19), "= 'v' - toggle what can be seen from the picked point");
+      m_text->renderText(10, (textPos-=19), "= 'c' - dig a crater, 'f' - flatten, 'g' - smooth around the picked point");
+      m_text->renderText(10, (textPos-=19), "= 'p' - pause or play a height map sequence");
+      m_text->renderText(10, (textPos-=19), "= 'u' - colour the terrain by what it costs to update");
+      m_text->renderText(10, (textPos-=19), fmt::format("= 't' - capture the next {} frames to a trace file", m_win.m_traceFrames));
       m_text->renderText(10, (textPos-=19), "= 'spacebar' - reset camera");
       m_text->renderText(10, (textPos-=19), "= 'F11' - toggle fullscreen");
       m_text->renderText(10, (textPos-=19), "= 'Esc' - quit");
@@ -237,6 +786,96 @@ namespace geoclipmap
 
     std::string text = fmt::format("Current values: K={}, L={}, R={}", m_manager->K(), m_manager->L(), m_manager->R());
     m_text->renderText(10, (textPos-=19), text);
+
+    // How long the terrain took to appear after it was last filled afresh, and to show every level
+    if (m_terrain->refining())
+    {
+      text = fmt::format("Fill: first frame {:.1f}ms, refining level {} of {}", m_timeToFirstFrame,
+                         m_terrain->readyFinest() - m_terrain->activeCoarsest() + 1, m_terrain->activeFinest() - m_terrain->activeCoarsest() + 1);
+    }
+    else
+    {
+      text = fmt::format("Fill: first frame {:.1f}ms, full detail {:.1f}ms", m_timeToFirstFrame, m_timeToFullDetail);
+    }
+    m_text->renderText(10, (textPos-=19), text);
+
+    if (m_governor)
+    {
+      text = fmt::format("Governor: target {:.1f}ms, update budget {}, GPU {:.2f}ms", m_governor->targetMs(),
+                         m_governor->budgetLevels() == 0 ? std::string("no limit") : fmt::format("{} levels", m_governor->budgetLevels()), m_lastGpuMs);
+      m_text->renderText(10, (textPos-=19), text);
+    }
+
+    // What the last frame cost, against the frames before it
+    Metrics *metrics = Metrics::getInstance();
+    const MetricsFrame &frame = metrics->lastFrame();
+    text = fmt::format("Frame: {:.2f}ms (p50 {:.2f}ms, p95 {:.2f}ms, p99 {:.2f}ms), {} draws, {} triangles, {} blocks in inactive levels",
+                       frame.frameMs, metrics->frameTimePercentile(0.5), metrics->frameTimePercentile(0.95), metrics->frameTimePercentile(0.99),
+                       frame.counter(Counter::DrawCalls), frame.counter(Counter::Triangles), frame.counter(Counter::InactiveLevelBlocks));
+    m_text->renderText(10, (textPos-=19), text);
+    text = fmt::format("Regenerated {} texels (", frame.counter(Counter::TexelsRegenerated));
+    for (size_t l = 0; l < std::min<size_t>(m_manager->L(), k_metricsLevels); l++)
+    {
+      text += fmt::format("{}{}", l > 0 ? " " : "", frame.levelTexels[l]);
+    }
+    text += fmt::format(" per level), uploaded {:.1f}KB, {} tasks queued at most",
+                        static_cast<double>(frame.counter(Counter::BytesUploaded)) / 1e3, frame.gauge(Gauge::WorkerQueueDepth));
+    m_text->renderText(10, (textPos-=19), text);
+
+    // Where the memory is, CPU and GPU for each part that holds any
+    MemoryTracker *memory = MemoryTracker::getInstance();
+    MemoryUsage total = memory->total();
+    text = fmt::format("Memory: {:.1f}MB CPU, {:.1f}MB GPU (", static_cast<double>(total.cpuBytes) / 1e6, static_cast<double>(total.gpuBytes) / 1e6);
+    for (size_t i = 0; i < k_memorySubsystems; i++)
+    {
+      auto subsystem = static_cast<MemorySubsystem>(i);
+      MemoryUsage usage = memory->usage(subsystem);
+      text += fmt::format("{}{} {:.1f}/{:.1f}MB", i > 0 ? ", " : "", MemoryTracker::name(subsystem),
+                          static_cast<double>(usage.cpuBytes) / 1e6, static_cast<double>(usage.gpuBytes) / 1e6);
+    }
+    text += ")";
+    m_text->renderText(10, (textPos-=19), text);
+
+    if (auto stats = m_heightmap->compressionStats())
+    {
+      text = fmt::format("Compressed heightmap: {:.1f}:1, decoding {:.1f} Msamples/s", stats->ratio(), stats->samplesPerSecond() / 1e6);
+      m_text->renderText(10, (textPos-=19), text);
+      const PrefetchStats &prefetch = m_prefetcher->stats();
+      text = fmt::format("Tile cache: {:.1f}% hits, {} of {} frames stalled, {:.1f}MB prefetched",
+                         stats->hitRate() * 100.0, prefetch.stalledFrames, prefetch.frames, static_cast<double>(stats->bytesPrefetched) / 1e6);
+      m_text->renderText(10, (textPos-=19), text);
+      if (m_heightmap->tileReader())
+      {
+        text = fmt::format("Tile reads: {} tiles, {:.1f}MB at {:.0f} tiles/s, {} errors",
+                           stats->tilesRead, static_cast<double>(stats->bytesRead) / 1e6, stats->tilesReadPerSecond(), stats->readErrors);
+        m_text->renderText(10, (textPos-=19), text);
+      }
+    }
+
+    if (m_feed)
+    {
+      text = fmt::format("Live feed: update {}", m_feed->sequence());
+      m_text->renderText(10, (textPos-=19), text);
+    }
+
+    if (m_sequence)
+    {
+      text = fmt::format("Sequence: frame {} of {}{}, {} stalls", m_sequence->frame() + 1, m_sequence->frameCount(),
+                         m_playingSequence ? "" : " (paused)", m_sequence->stalls());
+      m_text->renderText(10, (textPos-=19), text);
+    }
+
+    if (m_picked.hit)
+    {
+      text = fmt::format("Picked: sample ({}, {}), height {:.3f}", m_picked.sampleX, m_picked.sampleY, m_picked.position.m_z);
+      m_text->renderText(10, (textPos-=19), text);
+    }
+
+    if (m_showViewshed)
+    {
+      text = fmt::format("Viewshed: {} samples visible", m_viewshed->visibleCount());
+      m_text->renderText(10, (textPos-=19), text);
+    }
   }
 
   void NGLScene::keyPressEvent(QKeyEvent *_event)
@@ -275,65 +914,93 @@ namespace geoclipmap
     case Qt::Key_H:
       m_win.showHelp = !m_win.showHelp;
       break;
+    // Toggle the viewshed overlay
+    case Qt::Key_V:
+      toggleViewshed();
+      break;
+    // Edit the terrain around the picked point
+    case Qt::Key_C:
+      m_editor->add(pickedBrush(), -20.0f / m_manager->heightScale());
+      break;
+    case Qt::Key_F:
+      m_editor->flatten(pickedBrush());
+      break;
+    case Qt::Key_G:
+      m_editor->smooth(pickedBrush());
+      break;
+    // Pause or play the sequence
+    case Qt::Key_P:
+      if (m_sequence)
+      {
+        m_playingSequence = !m_playingSequence;
+        m_sequenceClock.restart();
+        m_sequenceSteps = 0;
+      }
+      break;
+    // Toggle colouring the terrain by what it costs to update
+    case Qt::Key_U:
+      m_showUpdateCosts = !m_showUpdateCosts;
+      break;
+    // Capture the next frames to a trace file
+    case Qt::Key_T:
+      if (!Tracer::capturing())
+      {
+        Tracer::getInstance()->start(static_cast<size_t>(m_win.m_traceFrames));
+      }
+      break;
     // Reset camera position
     case Qt::Key_Space:
       m_cam->reset();
       break;
-    // Terrain movement
+    // Toggle the terrain following the camera
+    case Qt::Key_M:
+      m_win.followCamera = !m_win.followCamera;
+      break;
+    // Terrain movement, applied when the next frame is drawn
     case Qt::Key_Left:
-      m_terrain->move(m_win.m_moveSpeed, 0);
-      m_terrainX += m_win.m_moveSpeed;
+      m_terrainX += static_cast<int64_t>(m_win.m_moveSpeed);
       break;
     case Qt::Key_Up:
-      m_terrain->move(0, m_win.m_moveSpeed);
-      m_terrainY += m_win.m_moveSpeed;
+      m_terrainY += static_cast<int64_t>(m_win.m_moveSpeed);
       break;
     case Qt::Key_Right:
       if (m_terrainX > 0)
       {
-        m_terrain->move(-m_win.m_moveSpeed, 0);
-        m_terrainX -= m_win.m_moveSpeed;
+        m_terrainX -= static_cast<int64_t>(m_win.m_moveSpeed);
       }
       break;
     case Qt::Key_Down:
       if (m_terrainY > 0)
       {
-        m_terrain->move(0, -m_win.m_moveSpeed);
-        m_terrainY -= m_win.m_moveSpeed;
+        m_terrainY -= static_cast<int64_t>(m_win.m_moveSpeed);
       }
       break;
     // K adjustment
     case Qt::Key_BracketLeft:
       m_manager->setK(m_manager->K() - 1);
-      regenerateTerrain();
-      m_terrain->move(m_terrainX, m_terrainY);
+      reconfigureTerrain();
       break;
     case Qt::Key_BracketRight:
       m_manager->setK(m_manager->K() + 1);
-      regenerateTerrain();
-      m_terrain->move(m_terrainX, m_terrainY);
+      reconfigureTerrain();
       break;
     // L adjustment
     case Qt::Key_Minus:
       m_manager->setL(m_manager->L() - 1);
-      regenerateTerrain();
-      m_terrain->move(m_terrainX, m_terrainY);
+      reconfigureTerrain();
       break;
     case Qt::Key_Equal:
       m_manager->setL(m_manager->L() + 1);
-      regenerateTerrain();
-      m_terrain->move(m_terrainX, m_terrainY);
+      reconfigureTerrain();
       break;
     // R adjustment
     case Qt::Key_9:
       m_manager->setR(m_manager->R() - 1);
-      regenerateTerrain();
-      m_terrain->move(m_terrainX, m_terrainY);
+      reconfigureTerrain();
       break;
     case Qt::Key_0:
       m_manager->setR(m_manager->R() + 1);
-      regenerateTerrain();
-      m_terrain->move(m_terrainX, m_terrainY);
+      reconfigureTerrain();
       break;
     default:
       break;
@@ -7,6 +7,10 @@
  * @copyright Copyright (c) 2020
  * 
  */
+#include <iostream>
+
+#include <ngl/Vec4.h>
+
 #include <QMouseEvent>
 
 #include "NGLScene.h"
@@ -63,4 +67,40 @@ namespace geoclipmap
       m_win.origY = _event->y();
     }
   }
+
+  void NGLScene::mouseDoubleClickEvent(QMouseEvent *_event)
+  {
+    // LMB double click picks the point on the terrain under the mouse
+    if (_event->button() == Qt::LeftButton)
+    {
+      m_picked = pick(_event->x(), _event->y());
+      if (m_picked.hit)
+      {
+        std::cout << fmt::format("Picked sample ({}, {}) height {}\n", m_picked.sampleX, m_picked.sampleY, m_picked.position.m_z);
+      }
+      update();
+    }
+  }
+
+  RayHit NGLScene::pick(int _x, int _y)
+  {
+    // Unproject the near and far points under the mouse back into model space
+    ngl::Mat4 inverseMVP = (m_projection * m_cam->view() * m_transform.getMatrix()).inverse();
+    ngl::Real ndcX = 2.0f * static_cast<ngl::Real>(_x) / static_cast<ngl::Real>(width()) - 1.0f;
+    ngl::Real ndcY = 1.0f - 2.0f * static_cast<ngl::Real>(_y) / static_cast<ngl::Real>(height());
+    ngl::Vec4 nearPoint = inverseMVP * ngl::Vec4(ndcX, ndcY, -1.0f, 1.0f);
+    ngl::Vec4 farPoint = inverseMVP * ngl::Vec4(ndcX, ndcY, 1.0f, 1.0f);
+    nearPoint /= nearPoint.m_w;
+    farPoint /= farPoint.m_w;
+
+    // Model space is camera-relative with heights scaled and pointing down -z (see terrain.vert.glsl)
+    const ngl::Vec2 &fraction = m_terrain->positionFraction();
+    auto toHeightmap = [&](const ngl::Vec4 &_point) {
+      return ngl::Vec3(_point.m_x + static_cast<ngl::Real>(m_terrain->positionX()) + fraction.m_x,
+                       _point.m_y + static_cast<ngl::Real>(m_terrain->positionY()) + fraction.m_y,
+                       -_point.m_z / m_manager->heightScale());
+    };
+    ngl::Vec3 origin = toHeightmap(nearPoint);
+    return m_rayCaster->cast(origin, toHeightmap(farPoint) - origin);
+  }
 } // end namespace geoclipmap
\ No newline at end of file
@@ -0,0 +1,239 @@
+/**
+ * @file QualityGovernor.cpp
+ * @author Ollie Nicholls
+ * @brief Watches what frames cost on the CPU and the GPU and turns the
+ * terrain's quality (K, R and the update budget) down or up to hold a target
+ * frame time, logging every change it makes
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+
+#include "Manager.h"
+#include "QualityGovernor.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // The frames ignored after a change, as the first few refill the terrain and cost more than the rest will
+    constexpr size_t k_settleFrames = 10;
+    // The frames averaged over for each decision
+    constexpr size_t k_windowFrames = 30;
+    // Over the target by this much turns the quality down, under it by this much (for long enough) turns it up. The
+    // gap between them keeps a setting that lands just either side of the target from flipping back and forth.
+    constexpr double k_overTarget = 1.1;
+    constexpr double k_underTarget = 0.7;
+    // The share of the target the terrain's CPU update may take, the rest being left for drawing
+    constexpr double k_updateShare = 0.5;
+    // The windows in a row well under the target before the quality is turned up, and the most that can grow to
+    constexpr size_t k_raiseAfter = 3;
+    constexpr size_t k_raiseAfterMax = 64;
+    // The update budgets in levels a frame, from no limit down
+    constexpr int k_budgetSteps[] = {0, 4, 2, 1};
+
+    const char *const k_settingNames[] = {"update_budget_levels", "R", "K"};
+  } // end namespace
+
+  QualityGovernor::QualityGovernor(double _targetMs) noexcept : m_targetMs{_targetMs},
+                                                               m_raiseAfter{k_raiseAfter}
+  {
+    // Start from whatever budget has been set, rounded to whole levels
+    Manager *manager = Manager::getInstance();
+    size_t levelTexels = manager->D() * manager->D();
+    if (manager->updateBudget() > 0)
+    {
+      m_budgetLevels = static_cast<int>(std::max<size_t>(manager->updateBudget() / levelTexels, 1));
+    }
+  }
+
+  QualityGovernor::~QualityGovernor() noexcept
+  {
+    m_log.close();
+  }
+
+  bool QualityGovernor::openLog(const std::string &_path) noexcept
+  {
+    m_log.close();
+    m_log.open(_path, std::ios::trunc);
+    if (!m_log)
+    {
+      m_log.close();
+      return false;
+    }
+    m_log << "frame,cpu_update_ms,gpu_ms,target_ms,setting,from,to,reason\n";
+    m_log.flush();
+    return true;
+  }
+
+  bool QualityGovernor::frameFinished(double _cpuUpdateMs, double _gpuMs, GovernorDecision &o_decision) noexcept
+  {
+    m_frames++;
+    if (m_settling > 0)
+    {
+      m_settling--;
+      return false;
+    }
+    m_cpuSum += _cpuUpdateMs;
+    if (_gpuMs >= 0.0)
+    {
+      m_gpuSum += _gpuMs;
+      m_gpuFrames++;
+    }
+    if (++m_windowFrames < k_windowFrames)
+    {
+      return false;
+    }
+
+    double cpu = m_cpuSum / static_cast<double>(m_windowFrames);
+    double gpu = m_gpuFrames > 0 ? m_gpuSum / static_cast<double>(m_gpuFrames) : -1.0;
+    m_windowFrames = 0;
+    m_cpuSum = 0.0;
+    m_gpuSum = 0.0;
+    m_gpuFrames = 0;
+
+    // Each is measured against its own target, the CPU's update only getting its share of the frame
+    double cpuTarget = m_targetMs * k_updateShare;
+    bool gpuOver = gpu > m_targetMs * k_overTarget;
+    bool cpuOver = cpu > cpuTarget * k_overTarget;
+    bool changed = false;
+    if (gpuOver || cpuOver)
+    {
+      m_headroom = 0;
+      // Turning the quality up straight away put it over, so wait longer before trying again
+      if (m_raised)
+      {
+        m_raiseAfter = std::min(m_raiseAfter * 2, k_raiseAfterMax);
+      }
+      bool gpuBound = gpuOver && (!cpuOver || gpu / m_targetMs >= cpu / cpuTarget);
+      changed = lower(gpuBound, o_decision);
+      m_raised = false;
+    }
+    else if (cpu < cpuTarget * k_underTarget && gpu < m_targetMs * k_underTarget)
+    {
+      if (++m_headroom >= m_raiseAfter)
+      {
+        m_headroom = 0;
+        changed = raise(o_decision);
+        m_raised = changed;
+      }
+    }
+    else
+    {
+      m_headroom = 0;
+      m_raised = false;
+    }
+    if (!changed)
+    {
+      return false;
+    }
+
+    o_decision.frame = m_frames;
+    o_decision.cpuUpdateMs = cpu;
+    o_decision.gpuMs = gpu;
+    m_settling = k_settleFrames;
+    if (m_log.is_open())
+    {
+      m_log << o_decision.frame << ',' << o_decision.cpuUpdateMs << ',' << o_decision.gpuMs << ',' << m_targetMs << ','
+            << name(o_decision.setting) << ',' << o_decision.from << ',' << o_decision.to << ',' << o_decision.reason << '\n';
+      m_log.flush();
+    }
+    return true;
+  }
+
+  double QualityGovernor::targetMs() const noexcept
+  {
+    return m_targetMs;
+  }
+
+  int QualityGovernor::budgetLevels() const noexcept
+  {
+    return m_budgetLevels;
+  }
+
+  const char *QualityGovernor::name(GovernorSetting _setting) noexcept
+  {
+    return k_settingNames[static_cast<size_t>(_setting)];
+  }
+
+  // ======================================= Private methods =======================================
+
+  bool QualityGovernor::lower(bool _gpuBound, GovernorDecision &o_decision) noexcept
+  {
+    Manager *manager = Manager::getInstance();
+    if (_gpuBound)
+    {
+      // Fewer levels draw fewer blocks, smaller levels draw fewer triangles in each
+      return change(GovernorSetting::R, manager->R() - 1, "gpu over target", o_decision) ||
+             change(GovernorSetting::K, manager->K() - 1, "gpu over target", o_decision);
+    }
+
+    // Filling fewer levels a frame spreads the work out, smaller levels are quicker to fill
+    const int *step = std::find(std::begin(k_budgetSteps), std::end(k_budgetSteps), m_budgetLevels);
+    int budget = step != std::end(k_budgetSteps) && step + 1 != std::end(k_budgetSteps) ? *(step + 1) : 1;
+    return change(GovernorSetting::UpdateBudget, budget, "cpu update over target", o_decision) ||
+           change(GovernorSetting::K, manager->K() - 1, "cpu update over target", o_decision);
+  }
+
+  bool QualityGovernor::raise(GovernorDecision &o_decision) noexcept
+  {
+    Manager *manager = Manager::getInstance();
+    const int *step = std::find(std::begin(k_budgetSteps), std::end(k_budgetSteps), m_budgetLevels);
+    int budget = step != std::end(k_budgetSteps) && step != std::begin(k_budgetSteps) ? *(step - 1) : 0;
+    if (change(GovernorSetting::UpdateBudget, budget, "headroom", o_decision))
+    {
+      return true;
+    }
+    // Only as many levels as there are below the finest
+    if (manager->R() + 1 < manager->L() && change(GovernorSetting::R, manager->R() + 1, "headroom", o_decision))
+    {
+      return true;
+    }
+    return change(GovernorSetting::K, manager->K() + 1, "headroom", o_decision);
+  }
+
+  bool QualityGovernor::change(GovernorSetting _setting, int _to, const char *_reason, GovernorDecision &o_decision) noexcept
+  {
+    Manager *manager = Manager::getInstance();
+    int from = 0;
+    int to = 0;
+    switch (_setting)
+    {
+    case GovernorSetting::UpdateBudget:
+      from = m_budgetLevels;
+      m_budgetLevels = _to;
+      applyBudget();
+      to = m_budgetLevels;
+      break;
+    case GovernorSetting::R:
+      from = manager->R();
+      manager->setR(static_cast<unsigned char>(std::max(_to, 0)));
+      to = manager->R();
+      break;
+    case GovernorSetting::K:
+      from = manager->K();
+      manager->setK(static_cast<unsigned char>(std::max(_to, 0)));
+      to = manager->K();
+      // The budget is in texels, so follows the levels' size
+      applyBudget();
+      break;
+    }
+    if (from == to)
+    {
+      return false;
+    }
+
+    o_decision.setting = _setting;
+    o_decision.from = from;
+    o_decision.to = to;
+    o_decision.reason = _reason;
+    return true;
+  }
+
+  void QualityGovernor::applyBudget() noexcept
+  {
+    Manager *manager = Manager::getInstance();
+    manager->setUpdateBudget(static_cast<size_t>(m_budgetLevels) * manager->D() * manager->D());
+  }
+} // end namespace geoclipmap
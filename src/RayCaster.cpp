@@ -0,0 +1,326 @@
+/**
+ * @file RayCaster.cpp
+ * @author Ollie Nicholls
+ * @brief Finds where rays hit a heightmap, e.g. for picking, placing markers
+ * and line of sight checks
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "RayCaster.h"
+#include "ThreadPool.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // Batches are split into tasks of this many rays for the thread pool
+    constexpr size_t k_taskSize = 64;
+
+    /**
+     * @brief Clip [io_tEnter, io_tExit] to where the ray is inside the box
+     * [_x0, _x1] x [_y0, _y1] (any height)
+     *
+     * @return true If any of the ray is left
+     */
+    bool clipToBox(const ngl::Vec3 &_origin,
+                   const ngl::Vec3 &_direction,
+                   double _x0,
+                   double _y0,
+                   double _x1,
+                   double _y1,
+                   double &io_tEnter,
+                   double &io_tExit) noexcept
+    {
+      auto clipAxis = [&](double _origin, double _direction, double _min, double _max) {
+        if (_direction == 0.0)
+        {
+          return _origin >= _min && _origin <= _max;
+        }
+        double t0 = (_min - _origin) / _direction;
+        double t1 = (_max - _origin) / _direction;
+        if (t0 > t1)
+        {
+          std::swap(t0, t1);
+        }
+        io_tEnter = std::max(io_tEnter, t0);
+        io_tExit = std::min(io_tExit, t1);
+        return true;
+      };
+
+      return clipAxis(_origin.m_x, _direction.m_x, _x0, _x1) && clipAxis(_origin.m_y, _direction.m_y, _y0, _y1) &&
+             io_tEnter <= io_tExit;
+    }
+  } // end namespace
+
+  RayCaster::RayCaster(Heightmap *_heightmap) noexcept : m_heightmap{_heightmap}
+  {
+  }
+
+  RayHit RayCaster::cast(const ngl::Vec3 &_origin, const ngl::Vec3 &_direction, ngl::Real _maxDistance) noexcept
+  {
+    RayHit hit;
+    const MinMaxPyramid &pyramid = m_heightmap->heightRanges();
+    int64_t width = static_cast<int64_t>(m_heightmap->width());
+    int64_t depth = static_cast<int64_t>(m_heightmap->depth());
+    double length = _direction.length();
+    if (width < 2 || depth < 2 || length == 0.0)
+    {
+      return hit;
+    }
+
+    // Compressed heights can be out from the pyramid by up to the compression error
+    auto stats = m_heightmap->compressionStats();
+    double margin = stats ? stats->maxError : 0.0;
+
+    double tEnter = 0.0;
+    double tExit = _maxDistance / length;
+    if (!clipToBox(_origin, _direction, 0.0, 0.0, static_cast<double>(width - 1), static_cast<double>(depth - 1), tEnter, tExit))
+    {
+      return hit;
+    }
+
+    struct Node
+    {
+      int level;
+      int64_t bx;
+      int64_t by;
+      double tEnter;
+      double tExit;
+    };
+    // Each block pushes at most 3 more than it pops, so this is plenty for any heightmap that fits in memory
+    std::array<Node, 256> stack;
+    size_t size = 0;
+    stack[size++] = Node{pyramid.levels() - 1, 0, 0, tEnter, tExit};
+
+    double t = 0.0;
+    while (size > 0)
+    {
+      Node node = stack[--size];
+
+      // The ray passes over the top of everything in this block
+      HeightRange range = pyramid.cellRange(node.level, node.bx, node.by);
+      double zEnter = _origin.m_z + _direction.m_z * node.tEnter;
+      double zExit = _origin.m_z + _direction.m_z * node.tExit;
+      if (std::min(zEnter, zExit) > range.max + margin)
+      {
+        continue;
+      }
+
+      if (node.level == 0)
+      {
+        if (marchBlock(_origin, _direction, node.bx, node.by, node.tEnter, node.tExit, t))
+        {
+          hit.hit = true;
+          hit.position = _origin + _direction * static_cast<ngl::Real>(t);
+          hit.distance = static_cast<ngl::Real>(t * length);
+          hit.sampleX = std::llround(hit.position.m_x);
+          hit.sampleY = std::llround(hit.position.m_y);
+          return hit;
+        }
+        continue;
+      }
+
+      // Visit the children the ray passes through nearest first
+      int level = node.level - 1;
+      int shift = pyramid.blockShift(level);
+      std::array<Node, 4> children;
+      int count = 0;
+      for (int64_t cy = node.by * 2; cy < std::min(pyramid.levelDepth(level), node.by * 2 + 2); cy++)
+      {
+        for (int64_t cx = node.bx * 2; cx < std::min(pyramid.levelWidth(level), node.bx * 2 + 2); cx++)
+        {
+          // Only cells whose top left sample is in the block, and cells need a sample to their right and below
+          int64_t x0 = cx << shift;
+          int64_t y0 = cy << shift;
+          if (x0 >= width - 1 || y0 >= depth - 1)
+          {
+            continue;
+          }
+          int64_t x1 = std::min((cx + 1) << shift, width - 1);
+          int64_t y1 = std::min((cy + 1) << shift, depth - 1);
+
+          Node child{level, cx, cy, node.tEnter, node.tExit};
+          if (clipToBox(_origin, _direction, static_cast<double>(x0), static_cast<double>(y0), static_cast<double>(x1), static_cast<double>(y1), child.tEnter, child.tExit))
+          {
+            children[count++] = child;
+          }
+        }
+      }
+      // At most 4 of them so an insertion sort
+      for (int i = 1; i < count; i++)
+      {
+        for (int j = i; j > 0 && children[j].tEnter < children[j - 1].tEnter; j--)
+        {
+          std::swap(children[j], children[j - 1]);
+        }
+      }
+      for (int i = count - 1; i >= 0; i--)
+      {
+        stack[size++] = children[i];
+      }
+    }
+
+    return hit;
+  }
+
+  void RayCaster::castBatch(const ngl::Vec3 *_origins,
+                            const ngl::Vec3 *_directions,
+                            size_t _count,
+                            RayHit *o_hits,
+                            ngl::Real _maxDistance) noexcept
+  {
+    if (_count <= k_taskSize || !m_heightmap->concurrentReads())
+    {
+      for (size_t i = 0; i < _count; i++)
+      {
+        o_hits[i] = cast(_origins[i], _directions[i], _maxDistance);
+      }
+      return;
+    }
+
+    size_t tasks = (_count + k_taskSize - 1) / k_taskSize;
+    ThreadPool::getInstance()->parallelFor(tasks, [&](size_t _task) {
+      for (size_t i = _task * k_taskSize; i < std::min(_count, (_task + 1) * k_taskSize); i++)
+      {
+        o_hits[i] = cast(_origins[i], _directions[i], _maxDistance);
+      }
+    });
+  }
+
+  // ======================================= Private methods =======================================
+
+  bool RayCaster::intersectCell(const ngl::Vec3 &_origin,
+                                const ngl::Vec3 &_direction,
+                                int64_t _cx,
+                                int64_t _cy,
+                                double _tEnter,
+                                double _tExit,
+                                double &o_t) noexcept
+  {
+    double h00 = m_heightmap->value(_cx, _cy);
+    double h10 = m_heightmap->value(_cx + 1, _cy);
+    double h01 = m_heightmap->value(_cx, _cy + 1);
+    double h11 = m_heightmap->value(_cx + 1, _cy + 1);
+
+    double zEnter = _origin.m_z + _direction.m_z * _tEnter;
+    double zExit = _origin.m_z + _direction.m_z * _tExit;
+    if (std::min(zEnter, zExit) > std::max(std::max(h00, h10), std::max(h01, h11)))
+    {
+      return false;
+    }
+
+    // Along the ray (s from the cell entry) the surface is h00 + a u + b v + c u v with u and v linear in s, so the
+    // ray's height minus the surface's is the quadratic A s^2 + B s + C
+    double u = _origin.m_x + _direction.m_x * _tEnter - static_cast<double>(_cx);
+    double v = _origin.m_y + _direction.m_y * _tEnter - static_cast<double>(_cy);
+    double a = h10 - h00;
+    double b = h01 - h00;
+    double c = h00 - h10 - h01 + h11;
+    double A = -c * _direction.m_x * _direction.m_y;
+    double B = _direction.m_z - (a * _direction.m_x + b * _direction.m_y + c * (u * _direction.m_y + v * _direction.m_x));
+    double C = zEnter - (h00 + a * u + b * v + c * u * v);
+    double length = _tExit - _tEnter;
+
+    // Already on or under the surface where it enters
+    if (C <= 0.0)
+    {
+      o_t = _tEnter;
+      return true;
+    }
+
+    double s = -1.0;
+    if (std::abs(A) < 1e-12)
+    {
+      if (B < 0.0)
+      {
+        s = -C / B;
+      }
+    }
+    else
+    {
+      double discriminant = B * B - 4.0 * A * C;
+      if (discriminant < 0.0)
+      {
+        return false;
+      }
+      // The numerically stable form of the two roots
+      double q = -0.5 * (B + std::copysign(std::sqrt(discriminant), B));
+      double r0 = q / A;
+      double r1 = q != 0.0 ? C / q : r0;
+      if (r0 > r1)
+      {
+        std::swap(r0, r1);
+      }
+      s = r0 >= 0.0 ? r0 : r1;
+    }
+
+    if (s < 0.0 || s > length)
+    {
+      return false;
+    }
+    o_t = _tEnter + s;
+    return true;
+  }
+
+  bool RayCaster::marchBlock(const ngl::Vec3 &_origin,
+                             const ngl::Vec3 &_direction,
+                             int64_t _bx,
+                             int64_t _by,
+                             double _tEnter,
+                             double _tExit,
+                             double &o_t) noexcept
+  {
+    int shift = m_heightmap->heightRanges().blockShift(0);
+    int64_t cx0 = _bx << shift;
+    int64_t cy0 = _by << shift;
+    int64_t cx1 = std::min(((_bx + 1) << shift) - 1, static_cast<int64_t>(m_heightmap->width()) - 2);
+    int64_t cy1 = std::min(((_by + 1) << shift) - 1, static_cast<int64_t>(m_heightmap->depth()) - 2);
+
+    // Step through the cells a grid line at a time
+    double t = _tEnter;
+    int64_t cx = std::clamp(static_cast<int64_t>(std::floor(_origin.m_x + _direction.m_x * t)), cx0, cx1);
+    int64_t cy = std::clamp(static_cast<int64_t>(std::floor(_origin.m_y + _direction.m_y * t)), cy0, cy1);
+    int stepX = _direction.m_x > 0.0f ? 1 : -1;
+    int stepY = _direction.m_y > 0.0f ? 1 : -1;
+    double infinity = std::numeric_limits<double>::infinity();
+    double tNextX = _direction.m_x != 0.0f ? (static_cast<double>(stepX > 0 ? cx + 1 : cx) - _origin.m_x) / _direction.m_x : infinity;
+    double tNextY = _direction.m_y != 0.0f ? (static_cast<double>(stepY > 0 ? cy + 1 : cy) - _origin.m_y) / _direction.m_y : infinity;
+    double tDeltaX = _direction.m_x != 0.0f ? 1.0 / std::abs(_direction.m_x) : infinity;
+    double tDeltaY = _direction.m_y != 0.0f ? 1.0 / std::abs(_direction.m_y) : infinity;
+
+    while (true)
+    {
+      double tCellExit = std::min(std::min(tNextX, tNextY), _tExit);
+      if (intersectCell(_origin, _direction, cx, cy, t, std::max(t, tCellExit), o_t))
+      {
+        return true;
+      }
+      if (tCellExit >= _tExit)
+      {
+        return false;
+      }
+
+      if (tNextX < tNextY)
+      {
+        cx += stepX;
+        t = tNextX;
+        tNextX += tDeltaX;
+      }
+      else
+      {
+        cy += stepY;
+        t = tNextY;
+        tNextY += tDeltaY;
+      }
+      if (cx < cx0 || cx > cx1 || cy < cy0 || cy > cy1)
+      {
+        return false;
+      }
+    }
+  }
+} // end namespace geoclipmap
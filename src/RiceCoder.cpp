@@ -0,0 +1,52 @@
+/**
+ * @file RiceCoder.cpp
+ * @author Ollie Nicholls
+ * @brief The adaptive Rice coding used for the residuals of compressed
+ * heightmap tiles and the deltas of heightmap sequences
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+
+#include "RiceCoder.h"
+
+namespace geoclipmap
+{
+  void riceEncode(const std::vector<int32_t> &_residuals, std::vector<uint8_t> &o_out)
+  {
+    BitWriter writer(o_out);
+    RiceState state;
+
+    for (size_t group = 0; group < _residuals.size(); group += k_groupSize)
+    {
+      size_t end = std::min(group + k_groupSize, _residuals.size());
+      bool allZero = std::all_of(_residuals.begin() + group, _residuals.begin() + end, [](int32_t _r) { return _r == 0; });
+      writer.write(allZero ? 0 : 1, 1);
+      if (allZero)
+      {
+        continue;
+      }
+
+      for (size_t i = group; i < end; i++)
+      {
+        uint32_t value = zigzag(_residuals[i]);
+        uint32_t k = state.k();
+        uint32_t quotient = value >> k;
+        if (quotient < k_escapeLength)
+        {
+          // Unary quotient (ones then a zero) followed by the low bits
+          writer.write((1ull << quotient) - 1, quotient + 1);
+          writer.write(value, k);
+        }
+        else
+        {
+          writer.write((1ull << k_escapeLength) - 1, k_escapeLength);
+          writer.write(value, 32);
+        }
+        state.update(value);
+      }
+    }
+    writer.flush();
+  }
+} // end namespace geoclipmap
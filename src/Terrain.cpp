@@ -6,22 +6,26 @@
  * 
  */
 #include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
 
 #include "Manager.h"
 #include "Terrain.h"
+#include "Trace.h"
 
 namespace geoclipmap
 {
   Terrain::Terrain(Heightmap *_heightmap) noexcept : m_heightmap{_heightmap},
                                                      m_footprints(6),
-                                                     m_position{},
+                                                     m_positionFraction{},
                                                      m_activeCoarsest{0}
   {
     unsigned char L = Manager::getInstance()->L();
 
     m_clipmaps = std::vector<ClipmapLevel *>(L);
     m_activeFinest = L - 1;
+    m_D = Manager::getInstance()->D();
 
     generateFootprints();
     generateLocations();
@@ -29,6 +33,22 @@ namespace geoclipmap
     updatePosition();
   }
 
+  Terrain::~Terrain() noexcept
+  {
+    for (auto level : m_clipmaps)
+    {
+      delete level;
+    }
+    for (auto location : m_locations)
+    {
+      delete location;
+    }
+    for (auto footprint : m_footprints)
+    {
+      delete footprint;
+    }
+  }
+
   std::vector<ClipmapLevel *> &Terrain::clipmaps() noexcept
   {
     return m_clipmaps;
@@ -73,31 +93,196 @@ namespace geoclipmap
     return selectedLocations;
   }
 
+  bool Terrain::reconfigure() noexcept
+  {
+    Manager *manager = Manager::getInstance();
+    size_t D = manager->D();
+    unsigned char L = manager->L();
+    if (D == m_D && L == m_clipmaps.size())
+    {
+      return false;
+    }
+    GEOCLIPMAP_TRACE_ZONE("reconfigure");
+
+    // Only the footprints' sizes depend on K, where they are placed in a level is worked out from M as they're made
+    if (D != m_D)
+    {
+      for (auto location : m_locations)
+      {
+        delete location;
+      }
+      m_locations.clear();
+      for (auto &footprint : m_footprints)
+      {
+        delete footprint;
+        footprint = nullptr;
+      }
+      generateFootprints();
+      generateLocations();
+      m_D = D;
+    }
+
+    // Levels are numbered from the coarsest, so the finest ones are added or removed and every level's scale changes
+    for (size_t l = L; l < m_clipmaps.size(); l++)
+    {
+      delete m_clipmaps[l];
+    }
+    size_t kept = std::min<size_t>(m_clipmaps.size(), L);
+    m_clipmaps.resize(L);
+    for (size_t l = kept; l < L; l++)
+    {
+      m_clipmaps[l] = new ClipmapLevel(static_cast<int>(l), m_heightmap, l > 0 ? m_clipmaps[l - 1] : nullptr);
+      m_clipmaps[l]->setOverlay(m_overlay);
+    }
+    for (auto level : m_clipmaps)
+    {
+      level->reconfigure();
+    }
+
+    // Every level is filled afresh (progressively if refining), the camera sets the active levels again next frame
+    m_activeFinest = std::min<unsigned char>(m_activeFinest, L - 1);
+    m_activeCoarsest = std::min(m_activeCoarsest, m_activeFinest);
+    m_filled = false;
+    updatePosition();
+    return true;
+  }
+
+  void Terrain::beginFrame() noexcept
+  {
+    m_frameTexels = 0;
+  }
+
   void Terrain::move(float _x, float _y) noexcept
   {
-    m_position.m_x += _x;
-    m_position.m_y += _y;
+    // Move the fraction then carry any whole samples over to the integer position, a float position would stop
+    // being able to represent small moves far from the origin
+    m_positionFraction.m_x += _x;
+    m_positionFraction.m_y += _y;
+    ngl::Real wholeX = std::floor(m_positionFraction.m_x);
+    ngl::Real wholeY = std::floor(m_positionFraction.m_y);
+    m_positionX += static_cast<int64_t>(wholeX);
+    m_positionY += static_cast<int64_t>(wholeY);
+    m_positionFraction -= ngl::Vec2(wholeX, wholeY);
+    updatePosition();
+  }
+
+  void Terrain::moveTo(int64_t _x, int64_t _y, ngl::Vec2 _fraction) noexcept
+  {
+    ngl::Real wholeX = std::floor(_fraction.m_x);
+    ngl::Real wholeY = std::floor(_fraction.m_y);
+    m_positionX = _x + static_cast<int64_t>(wholeX);
+    m_positionY = _y + static_cast<int64_t>(wholeY);
+    m_positionFraction = _fraction - ngl::Vec2(wholeX, wholeY);
     updatePosition();
   }
 
+  int64_t Terrain::positionX() const noexcept
+  {
+    return m_positionX;
+  }
+
+  int64_t Terrain::positionY() const noexcept
+  {
+    return m_positionY;
+  }
+
+  const ngl::Vec2 &Terrain::positionFraction() const noexcept
+  {
+    return m_positionFraction;
+  }
+
   void Terrain::setActiveLevels(ngl::Real _camHeight)
+  {
+    levelsForHeight(_camHeight, m_activeFinest, m_activeCoarsest);
+    updatePosition();
+  }
+
+  void Terrain::levelsForHeight(ngl::Real _camHeight, unsigned char &o_finest, unsigned char &o_coarsest) const noexcept
   {
     unsigned char L = Manager::getInstance()->L();
     unsigned char R = Manager::getInstance()->R();
     unsigned char adjustedHeight = static_cast<unsigned char>(_camHeight / 250);
 
-    m_activeFinest = static_cast<unsigned char>(L - std::clamp(adjustedHeight, static_cast<unsigned char>(1), static_cast<unsigned char>(L)));
+    o_finest = static_cast<unsigned char>(L - std::clamp(adjustedHeight, static_cast<unsigned char>(1), static_cast<unsigned char>(L)));
 
-    if (m_activeFinest < R)
+    if (o_finest < R)
     {
-      m_activeCoarsest = 0;
+      o_coarsest = 0;
     }
     else
     {
-      m_activeCoarsest = m_activeFinest - R;
+      o_coarsest = o_finest - R;
     }
+  }
 
-    updatePosition();
+  unsigned char Terrain::readyFinest() const noexcept
+  {
+    return m_readyFinest;
+  }
+
+  bool Terrain::refine() noexcept
+  {
+    if (m_readyFinest >= m_activeFinest)
+    {
+      return false;
+    }
+    // The level's position was set with the others, only its texture was left until now (unless it never moved). At
+    // least one level is filled a frame however small the update budget, so refining always finishes.
+    ClipmapLevel *next = m_clipmaps[m_readyFinest + 1];
+    if (next->stale())
+    {
+      if (m_frameTexels > 0 && !withinBudget())
+      {
+        return false;
+      }
+      fill(next);
+    }
+    m_readyFinest++;
+    return true;
+  }
+
+  bool Terrain::refining() const noexcept
+  {
+    return m_readyFinest < m_activeFinest;
+  }
+
+  std::chrono::steady_clock::time_point Terrain::fillStarted() const noexcept
+  {
+    return m_fillStarted;
+  }
+
+  void Terrain::setOverlay(OverlayReader _overlay) noexcept
+  {
+    m_overlay = std::move(_overlay);
+    for (auto level : m_clipmaps)
+    {
+      level->setOverlay(m_overlay);
+    }
+
+    // The levels only read the overlay when they move, so read it now rather than waiting for that (levels still to
+    // be refined read it when they are)
+    for (int l = m_activeCoarsest; l <= m_readyFinest; l++)
+    {
+      m_clipmaps[l]->updateTexture();
+    }
+  }
+
+  int Terrain::refreshRegion(int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) noexcept
+  {
+    int refreshed = 0;
+    for (int l = 0; l < static_cast<int>(m_clipmaps.size()); l++)
+    {
+      if (l >= m_activeCoarsest && l <= m_readyFinest)
+      {
+        refreshed += m_clipmaps[l]->refreshRegion(_x0, _y0, _x1, _y1) ? 1 : 0;
+      }
+      else
+      {
+        // Read in full when it's next needed, as a level that hasn't moved isn't filled again
+        m_clipmaps[l]->markStale();
+      }
+    }
+    return refreshed;
   }
 
   // ======================================= Private methods =======================================
@@ -186,14 +371,18 @@ namespace geoclipmap
     size_t M = Manager::getInstance()->M();
     size_t D2 = Manager::getInstance()->D2();
     // If nothing has changed return
-    if (m_prevPosition == m_position && m_prevActiveFinest == m_activeFinest && m_prevActiveCoarsest == m_activeCoarsest)
+    if (m_filled && m_prevPositionX == m_positionX && m_prevPositionY == m_positionY &&
+        m_prevPositionFraction == m_positionFraction && m_prevActiveFinest == m_activeFinest &&
+        m_prevActiveCoarsest == m_activeCoarsest)
     {
       return;
     }
+    GEOCLIPMAP_TRACE_ZONE("updatePosition");
 
     // The terrain is always positioned at the camera X,Z coordinate
-    // Each clipmap level is then at a position based on their scale and an offset
-    auto position = m_position;
+    // Each clipmap level is then at a position based on their scale and an offset. These world positions are relative
+    // to the camera so they stay small (and precise as floats) wherever the camera is, only the origins on the
+    // heightmap are absolute and those are whole numbers kept in 64 bits
 
     // This is the offset of half of the clipmap width so that the finest level is positioned in the centre
     // then all other clipmaps are offset from that
@@ -211,9 +400,8 @@ namespace geoclipmap
       // The position of this level in world space (not scaled as this is done in the shader)
       ngl::Vec2 newWorldPosition = previousWorldPosition;
 
-      // Round the values to integers to get rid of the decimal part
-      int xPos = static_cast<int>(position.m_x);
-      int yPos = static_cast<int>(position.m_y);
+      int64_t xPos = m_positionX;
+      int64_t yPos = m_positionY;
       int scale = currentLevel->scale();
 
       TrimLocation trimLocation;
@@ -257,23 +445,72 @@ namespace geoclipmap
         }
       }
 
-      // The position of this level in heightmap space
-      ngl::Vec2 newHeightmapPosition = newWorldPosition + (position / static_cast<ngl::Real>(scale));
-
-      currentLevel->setPosition(newWorldPosition, newHeightmapPosition, trimLocation);
+      // The position of this level in heightmap space is floor(world position + position / scale). Split the position
+      // into the whole number of this level's samples (exact in 64 bits) and the small remainder, so only small values
+      // ever go through a float
+      ngl::Vec2 remainder(static_cast<ngl::Real>(xPos & (scale - 1)) + m_positionFraction.m_x,
+                          static_cast<ngl::Real>(yPos & (scale - 1)) + m_positionFraction.m_y);
+      ngl::Vec2 localPosition = newWorldPosition + remainder / static_cast<ngl::Real>(scale);
+      int64_t originX = ((xPos - (xPos & (scale - 1))) / scale) + static_cast<int64_t>(std::floor(localPosition.m_x));
+      int64_t originY = ((yPos - (yPos & (scale - 1))) / scale) + static_cast<int64_t>(std::floor(localPosition.m_y));
+      // What is left over after snapping to the origin is taken off in the shader, so the level slides smoothly
+      // with the camera and only has to be filled again once the origin moves a whole sample
+      ngl::Vec2 subTexelOffset(localPosition.m_x - std::floor(localPosition.m_x), localPosition.m_y - std::floor(localPosition.m_y));
+
+      currentLevel->setPosition(newWorldPosition, originX, originY, trimLocation, subTexelOffset);
       // Divide the position by 2 as each subsequent level is scaled with powers of 2
       previousWorldPosition = newWorldPosition / 2.0f;
     }
 
-    // Update in reverse order
-    for (int l = m_activeCoarsest; l <= m_activeFinest; l++)
+    // A jump of half the finest level's width or more leaves nothing on screen that was there before, so every level
+    // has to be filled afresh
+    int64_t jump = static_cast<int64_t>(D2) * m_clipmaps[m_activeFinest]->scale();
+    if (!m_filled || std::abs(m_positionX - m_prevPositionX) >= jump || std::abs(m_positionY - m_prevPositionY) >= jump)
+    {
+      m_fillStarted = std::chrono::steady_clock::now();
+      m_filled = true;
+      // Progressively only the coarsest level is filled now, refine fills the rest over the following frames
+      m_readyFinest = m_activeCoarsest;
+    }
+    // Levels already showing are kept up to date, as are levels that become active below the finest one ready
+    m_readyFinest = Manager::getInstance()->progressive() ? std::clamp(m_readyFinest, m_activeCoarsest, m_activeFinest) : m_activeFinest;
+
+    // Update in reverse order, only the levels whose origins have moved (or that weren't filled for it before) and
+    // only as many as the frame's update budget allows. The coarsest is always filled so there is something to draw,
+    // the finest level filled covers the rest until refine gets to them.
+    for (int l = m_activeCoarsest; l <= m_readyFinest; l++)
     {
       auto currentLevel = m_clipmaps[l];
-      currentLevel->updateTexture();
+      if (!currentLevel->stale())
+      {
+        continue;
+      }
+      if (l > m_activeCoarsest && !withinBudget())
+      {
+        m_readyFinest = static_cast<unsigned char>(l - 1);
+        break;
+      }
+      fill(currentLevel);
     }
 
-    m_prevPosition = m_position;
+    m_prevPositionX = m_positionX;
+    m_prevPositionY = m_positionY;
+    m_prevPositionFraction = m_positionFraction;
     m_prevActiveFinest = m_activeFinest;
     m_prevActiveCoarsest = m_activeCoarsest;
   }
+
+  bool Terrain::withinBudget() const noexcept
+  {
+    size_t budget = Manager::getInstance()->updateBudget();
+    size_t D = Manager::getInstance()->D();
+    return budget == 0 || m_frameTexels + D * D <= budget;
+  }
+
+  void Terrain::fill(ClipmapLevel *_level) noexcept
+  {
+    size_t D = Manager::getInstance()->D();
+    _level->updateTexture();
+    m_frameTexels += D * D;
+  }
 } // end namespace geoclipmap
\ No newline at end of file
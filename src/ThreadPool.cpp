@@ -0,0 +1,156 @@
+/**
+ * @file ThreadPool.cpp
+ * @author Ollie Nicholls
+ * @brief A small pool of worker threads shared by the parts of the geoclipmap
+ * that can split their work up (e.g. decompressing heightmap tiles)
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "ThreadPool.h"
+
+namespace geoclipmap
+{
+  ThreadPool *ThreadPool::m_instance = 0;
+
+  ThreadPool *ThreadPool::getInstance()
+  {
+    if (!m_instance)
+    {
+      // If there isn't an instance, make a pool with a thread per core
+      m_instance = new ThreadPool(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    return m_instance;
+  }
+
+  ThreadPool::ThreadPool(size_t _threads) noexcept
+  {
+    _threads = std::max(static_cast<size_t>(1), _threads);
+    for (size_t i = 0; i < _threads; i++)
+    {
+      m_workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+  }
+
+  ThreadPool::~ThreadPool() noexcept
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for (auto &worker : m_workers)
+    {
+      worker.join();
+    }
+  }
+
+  std::future<void> ThreadPool::submit(std::function<void()> _task)
+  {
+    std::packaged_task<void()> task(std::move(_task));
+    std::future<void> result = task.get_future();
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_tasks.push_back(std::move(task));
+      m_peakQueueDepth = std::max(m_peakQueueDepth, m_tasks.size());
+    }
+    m_wake.notify_one();
+    return result;
+  }
+
+  void ThreadPool::parallelFor(size_t _count, const std::function<void(size_t)> &_task)
+  {
+    if (_count == 0)
+    {
+      return;
+    }
+
+    // Not worth waking the workers for a single item
+    if (_count == 1)
+    {
+      _task(0);
+      return;
+    }
+
+    // Every thread (including this one) pulls the next index off a shared counter until they run out,
+    // so a slow or busy worker never holds anything up
+    struct Shared
+    {
+      std::atomic<size_t> next{0};
+      std::atomic<size_t> done{0};
+      std::mutex mutex;
+      std::condition_variable finished;
+    };
+    auto shared = std::make_shared<Shared>();
+
+    auto run = [shared, _count, &_task]() {
+      size_t processed = 0;
+      for (size_t i = shared->next++; i < _count; i = shared->next++)
+      {
+        _task(i);
+        processed++;
+      }
+
+      if (processed > 0 && (shared->done += processed) == _count)
+      {
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        shared->finished.notify_all();
+      }
+    };
+
+    size_t helpers = std::min(m_workers.size(), _count - 1);
+    for (size_t i = 0; i < helpers; i++)
+    {
+      submit(run);
+    }
+
+    run();
+
+    // Wait for any indices still being processed by the workers. Helpers that start after everything is done
+    // find no work and only touch the shared state, which they keep alive themselves
+    std::unique_lock<std::mutex> lock(shared->mutex);
+    shared->finished.wait(lock, [&shared, _count]() { return shared->done == _count; });
+  }
+
+  size_t ThreadPool::threadCount() const noexcept
+  {
+    return m_workers.size();
+  }
+
+  size_t ThreadPool::takePeakQueueDepth() noexcept
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t peak = m_peakQueueDepth;
+    m_peakQueueDepth = m_tasks.size();
+    return peak;
+  }
+
+  // ======================================= Private methods =======================================
+
+  void ThreadPool::workerLoop() noexcept
+  {
+    while (true)
+    {
+      std::packaged_task<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+
+        if (m_tasks.empty())
+        {
+          // Only reached when stopping and there is nothing left to do
+          return;
+        }
+
+        task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+      }
+      task();
+    }
+  }
+} // end namespace geoclipmap
@@ -0,0 +1,106 @@
+/**
+ * @file TilePrefetcher.cpp
+ * @author Ollie Nicholls
+ * @brief Predicts where the terrain's levels will need tiles from recent
+ * movement and decodes them before they are needed
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <cmath>
+
+#include "Manager.h"
+#include "TilePrefetcher.h"
+#include "Trace.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // The number of frames movement is averaged over, enough to smooth out key repeats
+    constexpr size_t k_historyLength = 8;
+  } // end namespace
+
+  TilePrefetcher::TilePrefetcher(Terrain *_terrain,
+                                 Heightmap *_heightmap,
+                                 int _frames,
+                                 size_t _tilesPerFrame) noexcept : m_terrain{_terrain},
+                                                                   m_heightmap{_heightmap},
+                                                                   m_frames{_frames},
+                                                                   m_tilesPerFrame{_tilesPerFrame}
+  {
+  }
+
+  void TilePrefetcher::update(ngl::Real _cameraHeight) noexcept
+  {
+    const CompressionStats *cacheStats = m_heightmap->compressionStats();
+    if (cacheStats == nullptr)
+    {
+      // Nothing is decoded so there is nothing to wait for
+      return;
+    }
+    GEOCLIPMAP_TRACE_ZONE("prefetch");
+
+    // Any tiles the levels had to decode since the last frame stalled this one
+    size_t misses = cacheStats->tilesRequested - cacheStats->tileHits;
+    m_stats.frames++;
+    m_stats.stalledFrames += misses > m_misses ? 1 : 0;
+
+    size_t D = Manager::getInstance()->D();
+    size_t D2 = Manager::getInstance()->D2();
+    unsigned char L = Manager::getInstance()->L();
+
+    // A jump further than a level's window (e.g. the terrain being reset) isn't movement to predict from
+    Sample sample{m_terrain->positionX(), m_terrain->positionY(), _cameraHeight};
+    if (!m_history.empty() && (std::abs(sample.x - m_history.back().x) > static_cast<int64_t>(D) ||
+                               std::abs(sample.y - m_history.back().y) > static_cast<int64_t>(D)))
+    {
+      m_history.clear();
+    }
+    m_history.push_back(sample);
+    if (m_history.size() > k_historyLength)
+    {
+      m_history.pop_front();
+    }
+
+    // The average movement per frame
+    ngl::Real velocityX = 0.0f;
+    ngl::Real velocityY = 0.0f;
+    ngl::Real velocityHeight = 0.0f;
+    if (m_history.size() > 1)
+    {
+      ngl::Real frames = static_cast<ngl::Real>(m_history.size() - 1);
+      velocityX = static_cast<ngl::Real>(sample.x - m_history.front().x) / frames;
+      velocityY = static_cast<ngl::Real>(sample.y - m_history.front().y) / frames;
+      velocityHeight = (sample.height - m_history.front().height) / frames;
+    }
+
+    // Warm the windows the active levels will have over the next frames, nearest frame and coarsest level first as
+    // those are needed soonest and the finer tiles need them
+    size_t budget = m_tilesPerFrame;
+    for (int f = 1; f <= m_frames && budget > 0; f++)
+    {
+      int64_t x = sample.x + static_cast<int64_t>(std::lround(velocityX * static_cast<ngl::Real>(f)));
+      int64_t y = sample.y + static_cast<int64_t>(std::lround(velocityY * static_cast<ngl::Real>(f)));
+      unsigned char finest;
+      unsigned char coarsest;
+      m_terrain->levelsForHeight(sample.height + velocityHeight * static_cast<ngl::Real>(f), finest, coarsest);
+
+      for (int l = coarsest; l <= finest && budget > 0; l++)
+      {
+        // A level's window is D samples centred on the terrain's position, give or take its trims
+        int scale = 1 << ((L - 1) - l);
+        int64_t half = static_cast<int64_t>(D2 + 2) * scale;
+        budget -= m_heightmap->warm(x - half, y - half, x + half, y + half, scale, budget);
+      }
+    }
+
+    // Prefetching doesn't count as a miss but reads waiting for tiles do
+    m_misses = cacheStats->tilesRequested - cacheStats->tileHits;
+  }
+
+  const PrefetchStats &TilePrefetcher::stats() const noexcept
+  {
+    return m_stats;
+  }
+} // end namespace geoclipmap
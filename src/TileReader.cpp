@@ -0,0 +1,492 @@
+/**
+ * @file TileReader.cpp
+ * @author Ollie Nicholls
+ * @brief Reads batches of tiles from a file on disk, either with io_uring or
+ * with a pool of threads calling pread
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#include "HttpTileReader.h"
+#include "ThreadPool.h"
+#include "TileReader.h"
+
+namespace geoclipmap
+{
+#if defined(__unix__) || defined(__APPLE__)
+  namespace
+  {
+    // Reads mostly wait on the disk rather than a core, so the fallback uses more threads than there are cores
+    constexpr size_t k_preadThreads = 16;
+    // The most reads io_uring has queued or in flight at once
+    constexpr unsigned k_queueDepth = 64;
+
+    struct AlignedFree
+    {
+      void operator()(uint8_t *_buffer) const noexcept
+      {
+        std::free(_buffer);
+      }
+    };
+    using AlignedBuffer = std::unique_ptr<uint8_t[], AlignedFree>;
+
+    uint64_t alignDown(uint64_t _value) noexcept
+    {
+      return _value & ~static_cast<uint64_t>(TileReader::k_alignment - 1);
+    }
+
+    uint64_t alignUp(uint64_t _value) noexcept
+    {
+      return alignDown(_value + TileReader::k_alignment - 1);
+    }
+
+    /**
+     * @brief Make sure an aligned buffer holds at least _size bytes
+     *
+     * @return true If it does
+     */
+    bool reserve(AlignedBuffer &io_buffer, size_t &io_capacity, size_t _size) noexcept
+    {
+      if (_size <= io_capacity)
+      {
+        return true;
+      }
+      io_buffer.reset(static_cast<uint8_t *>(std::aligned_alloc(TileReader::k_alignment, _size)));
+      io_capacity = io_buffer ? _size : 0;
+      return io_buffer != nullptr;
+    }
+
+    /**
+     * @brief Read a tile with pread, rounded out to the alignment
+     *
+     * @return const uint8_t* Where the tile starts in the buffer, or nullptr
+     * if it couldn't be read
+     */
+    const uint8_t *preadTile(int _fd, const TileRead &_read, AlignedBuffer &io_buffer, size_t &io_capacity) noexcept
+    {
+      uint64_t begin = alignDown(_read.offset);
+      size_t length = static_cast<size_t>(alignUp(_read.offset + _read.size) - begin);
+      size_t needed = static_cast<size_t>(_read.offset - begin) + _read.size;
+      if (!reserve(io_buffer, io_capacity, length))
+      {
+        return nullptr;
+      }
+
+      // pread can return less than asked for, and a read ending at the end of the file always does
+      size_t done = 0;
+      while (done < needed)
+      {
+        ssize_t result = ::pread(_fd, io_buffer.get() + done, length - done, static_cast<off_t>(begin + done));
+        if (result < 0 && errno == EINTR)
+        {
+          continue;
+        }
+        if (result <= 0)
+        {
+          return nullptr;
+        }
+        done += static_cast<size_t>(result);
+      }
+      return io_buffer.get() + (_read.offset - begin);
+    }
+
+    /**
+     * @brief Reads tiles with a pool of threads each calling pread
+     *
+     */
+    class PreadTileReader : public TileReader
+    {
+    public:
+      PreadTileReader(int _fd, bool _directIO) noexcept : m_fd{_fd}, m_directIO{_directIO}, m_pool{k_preadThreads}
+      {
+      }
+
+      ~PreadTileReader() override
+      {
+        ::close(m_fd);
+      }
+
+      void readBatch(const std::vector<TileRead> &_reads, const TileReadCallback &_callback) noexcept override
+      {
+        m_pool.parallelFor(_reads.size(), [&](size_t _i) {
+          // Each thread keeps its buffer between batches
+          thread_local AlignedBuffer buffer;
+          thread_local size_t capacity = 0;
+          const uint8_t *data = preadTile(m_fd, _reads[_i], buffer, capacity);
+          _callback(_i, data, data ? _reads[_i].size : 0);
+        });
+      }
+
+      TileReaderBackend backend() const noexcept override
+      {
+        return TileReaderBackend::Pread;
+      }
+
+      bool directIO() const noexcept override
+      {
+        return m_directIO;
+      }
+
+    private:
+      int m_fd;
+      bool m_directIO;
+      // The pool's own threads, as blocking reads on the shared pool would hold up everything else using it
+      ThreadPool m_pool;
+    };
+
+#ifdef __linux__
+    /**
+     * @brief Reads tiles by queueing them with io_uring. liburing isn't a
+     * dependency so the rings are set up with the raw system calls.
+     *
+     */
+    class UringTileReader : public TileReader
+    {
+    public:
+      /**
+       * @brief Set up a ring to read _fd with, taking ownership of _fd if it
+       * succeeds
+       *
+       * @return std::unique_ptr<UringTileReader> The reader, or nullptr if
+       * the kernel doesn't support io_uring
+       */
+      static std::unique_ptr<UringTileReader> create(int _fd, bool _directIO) noexcept
+      {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        int ring = static_cast<int>(::syscall(__NR_io_uring_setup, k_queueDepth, &params));
+        if (ring < 0)
+        {
+          return nullptr;
+        }
+
+        std::unique_ptr<UringTileReader> reader(new UringTileReader(_fd, _directIO, ring));
+        if (!reader->map(params))
+        {
+          // Don't let the reader close the file as the caller still owns it
+          reader->m_fd = -1;
+          return nullptr;
+        }
+        return reader;
+      }
+
+      ~UringTileReader() override
+      {
+        if (m_sqes != MAP_FAILED)
+        {
+          ::munmap(m_sqes, m_sqesSize);
+        }
+        if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+        {
+          ::munmap(m_cqRing, m_cqRingSize);
+        }
+        if (m_sqRing != MAP_FAILED)
+        {
+          ::munmap(m_sqRing, m_sqRingSize);
+        }
+        ::close(m_ring);
+        if (m_fd >= 0)
+        {
+          ::close(m_fd);
+        }
+      }
+
+      void readBatch(const std::vector<TileRead> &_reads, const TileReadCallback &_callback) noexcept override
+      {
+        if (m_failed)
+        {
+          preadBatch(_reads, 0, _callback);
+          return;
+        }
+
+        std::vector<unsigned> freeSlots;
+        std::vector<bool> busy(m_slots.size(), false);
+        for (unsigned slot = 0; slot < m_slots.size(); slot++)
+        {
+          freeSlots.push_back(slot);
+        }
+
+        size_t next = 0;
+        // Reads in the submission queue the kernel hasn't taken yet, and reads it has taken but not completed
+        unsigned unsubmitted = 0;
+        unsigned inFlight = 0;
+        while (next < _reads.size() || unsubmitted > 0 || inFlight > 0)
+        {
+          // Queue as many reads as there are free slots, then tell the kernel about them all at once
+          unsigned tail = *m_sqTail;
+          while (next < _reads.size() && !freeSlots.empty())
+          {
+            unsigned slotIndex = freeSlots.back();
+            Slot &slot = m_slots[slotIndex];
+            const TileRead &read = _reads[next];
+            uint64_t begin = alignDown(read.offset);
+            size_t length = static_cast<size_t>(alignUp(read.offset + read.size) - begin);
+            if (!reserve(slot.buffer, slot.capacity, length))
+            {
+              _callback(next++, nullptr, 0);
+              continue;
+            }
+            freeSlots.pop_back();
+            busy[slotIndex] = true;
+            slot.read = next++;
+            slot.iov.iov_base = slot.buffer.get();
+            slot.iov.iov_len = length;
+
+            unsigned index = tail & *m_sqMask;
+            io_uring_sqe &sqe = m_sqes[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_READV;
+            sqe.fd = m_fd;
+            sqe.addr = reinterpret_cast<uint64_t>(&slot.iov);
+            sqe.len = 1;
+            sqe.off = begin;
+            sqe.user_data = slotIndex;
+            m_sqArray[index] = index;
+            tail++;
+            unsubmitted++;
+          }
+          // The kernel mustn't see the new tail before the entries it covers
+          __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+          if (unsubmitted == 0 && inFlight == 0)
+          {
+            // Every read left failed to get a buffer so there's nothing to wait for
+            continue;
+          }
+
+          int result = static_cast<int>(::syscall(__NR_io_uring_enter, m_ring, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+          if (result >= 0)
+          {
+            unsubmitted -= static_cast<unsigned>(result);
+            inFlight += static_cast<unsigned>(result);
+          }
+          else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+          {
+            // The ring can't be trusted any more so read everything not yet completed with pread from now on
+            m_failed = true;
+            for (size_t slot = 0; slot < m_slots.size(); slot++)
+            {
+              if (busy[slot])
+              {
+                preadBatch(_reads, m_slots[slot].read, _callback, 1);
+              }
+            }
+            preadBatch(_reads, next, _callback);
+            return;
+          }
+
+          // Take every completion that has arrived
+          unsigned head = *m_cqHead;
+          unsigned completed = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+          while (head != completed)
+          {
+            const io_uring_cqe &cqe = m_cqes[head & *m_cqMask];
+            unsigned slotIndex = static_cast<unsigned>(cqe.user_data);
+            complete(_reads, m_slots[slotIndex], cqe.res, _callback);
+            freeSlots.push_back(slotIndex);
+            busy[slotIndex] = false;
+            inFlight--;
+            head++;
+          }
+          __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        }
+      }
+
+      TileReaderBackend backend() const noexcept override
+      {
+        return TileReaderBackend::IoUring;
+      }
+
+      bool directIO() const noexcept override
+      {
+        return m_directIO;
+      }
+
+    private:
+      struct Slot
+      {
+        // The aligned buffer the read goes into
+        AlignedBuffer buffer;
+        size_t capacity = 0;
+        // The buffer as the one element of a vectored read
+        iovec iov{};
+        // The index of the read in the batch
+        size_t read = 0;
+      };
+
+      int m_fd;
+      bool m_directIO;
+      int m_ring;
+      // Set if the kernel stops accepting reads, after which they're all read with pread
+      bool m_failed = false;
+      // The mapped rings and submission entries
+      void *m_sqRing = MAP_FAILED;
+      size_t m_sqRingSize = 0;
+      void *m_cqRing = MAP_FAILED;
+      size_t m_cqRingSize = 0;
+      io_uring_sqe *m_sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+      size_t m_sqesSize = 0;
+      // Pointers into the rings
+      unsigned *m_sqTail = nullptr;
+      unsigned *m_sqMask = nullptr;
+      unsigned *m_sqArray = nullptr;
+      unsigned *m_cqHead = nullptr;
+      unsigned *m_cqTail = nullptr;
+      unsigned *m_cqMask = nullptr;
+      io_uring_cqe *m_cqes = nullptr;
+      // One per submission entry
+      std::vector<Slot> m_slots;
+
+      UringTileReader(int _fd, bool _directIO, int _ring) noexcept : m_fd{_fd}, m_directIO{_directIO}, m_ring{_ring}
+      {
+      }
+
+      /**
+       * @brief Map the rings the kernel shares with us
+       *
+       * @return true If they were all mapped
+       */
+      bool map(const io_uring_params &_params) noexcept
+      {
+        m_sqRingSize = _params.sq_off.array + _params.sq_entries * sizeof(unsigned);
+        m_cqRingSize = _params.cq_off.cqes + _params.cq_entries * sizeof(io_uring_cqe);
+        // Newer kernels put both rings in one mapping
+        bool single = (_params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+        {
+          m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+        }
+
+        m_sqRing = ::mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQ_RING);
+        if (m_sqRing == MAP_FAILED)
+        {
+          return false;
+        }
+        m_cqRing = single ? m_sqRing : ::mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED)
+        {
+          return false;
+        }
+        m_sqesSize = _params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = static_cast<io_uring_sqe *>(::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES));
+        if (m_sqes == MAP_FAILED)
+        {
+          return false;
+        }
+
+        auto *sq = static_cast<uint8_t *>(m_sqRing);
+        auto *cq = static_cast<uint8_t *>(m_cqRing);
+        m_sqTail = reinterpret_cast<unsigned *>(sq + _params.sq_off.tail);
+        m_sqMask = reinterpret_cast<unsigned *>(sq + _params.sq_off.ring_mask);
+        m_sqArray = reinterpret_cast<unsigned *>(sq + _params.sq_off.array);
+        m_cqHead = reinterpret_cast<unsigned *>(cq + _params.cq_off.head);
+        m_cqTail = reinterpret_cast<unsigned *>(cq + _params.cq_off.tail);
+        m_cqMask = reinterpret_cast<unsigned *>(cq + _params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe *>(cq + _params.cq_off.cqes);
+        m_slots.resize(_params.sq_entries);
+        return true;
+      }
+
+      /**
+       * @brief Hand a completed read to the callback, finishing it with pread
+       * if the kernel only read part of it
+       *
+       */
+      void complete(const std::vector<TileRead> &_reads, Slot &io_slot, int _result, const TileReadCallback &_callback) noexcept
+      {
+        const TileRead &read = _reads[io_slot.read];
+        size_t skip = static_cast<size_t>(read.offset - alignDown(read.offset));
+        if (_result >= 0 && static_cast<size_t>(_result) >= skip + read.size)
+        {
+          _callback(io_slot.read, io_slot.buffer.get() + skip, read.size);
+          return;
+        }
+        const uint8_t *data = preadTile(m_fd, read, io_slot.buffer, io_slot.capacity);
+        _callback(io_slot.read, data, data ? read.size : 0);
+      }
+
+      /**
+       * @brief Read up to _count reads of a batch from _first with pread on
+       * this thread
+       *
+       */
+      void preadBatch(const std::vector<TileRead> &_reads,
+                      size_t _first,
+                      const TileReadCallback &_callback,
+                      size_t _count = static_cast<size_t>(-1)) noexcept
+      {
+        // A separate buffer, as a read the kernel still has in flight may yet write into its slot's
+        thread_local AlignedBuffer buffer;
+        thread_local size_t capacity = 0;
+        for (size_t i = _first; i < _reads.size() && i - _first < _count; i++)
+        {
+          const uint8_t *data = preadTile(m_fd, _reads[i], buffer, capacity);
+          _callback(i, data, data ? _reads[i].size : 0);
+        }
+      }
+    };
+#endif
+  } // end namespace
+#endif
+
+  std::unique_ptr<TileReader> TileReader::open(const std::string &_path, TileReaderBackend _backend, bool _directIO) noexcept
+  {
+    if (_backend == TileReaderBackend::Http)
+    {
+      return HttpTileReader::open(_path);
+    }
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = -1;
+    bool direct = false;
+#ifdef __linux__
+    // Not every file system supports O_DIRECT (tmpfs doesn't) so fall back to going through the page cache
+    if (_directIO)
+    {
+      fd = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+      direct = fd >= 0;
+    }
+#endif
+    if (fd < 0)
+    {
+      fd = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0)
+    {
+      return nullptr;
+    }
+
+#ifdef __linux__
+    if (_backend == TileReaderBackend::IoUring)
+    {
+      if (auto reader = UringTileReader::create(fd, direct))
+      {
+        return reader;
+      }
+    }
+#endif
+    return std::make_unique<PreadTileReader>(fd, direct);
+#else
+    (void)_path;
+    (void)_backend;
+    (void)_directIO;
+    return nullptr;
+#endif
+  }
+} // end namespace geoclipmap
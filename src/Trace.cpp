@@ -0,0 +1,225 @@
+/**
+ * @file Trace.cpp
+ * @author Ollie Nicholls
+ * @brief Scoped CPU timers and GL timer queries that show where a frame's
+ * time goes, written as a Chrome trace
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <chrono>
+#include <fstream>
+
+#include "Trace.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // Hands out a track to each thread as it first records a zone (0 is the GPU's)
+    std::atomic<uint32_t> g_nextTrack{1};
+    thread_local uint32_t t_track = 0;
+
+    uint32_t threadTrack() noexcept
+    {
+      if (t_track == 0)
+      {
+        t_track = g_nextTrack.fetch_add(1, std::memory_order_relaxed);
+      }
+      return t_track;
+    }
+  } // end namespace
+
+  Tracer *Tracer::m_instance = nullptr;
+  std::atomic<bool> Tracer::s_capturing{false};
+
+  Tracer *Tracer::getInstance()
+  {
+    if (!m_instance)
+    {
+      m_instance = new Tracer();
+    }
+    return m_instance;
+  }
+
+  int64_t Tracer::now() noexcept
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void Tracer::start(size_t _frames) noexcept
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_zones.clear();
+    m_origin = now();
+    m_framesLeft = _frames;
+    m_captureId.fetch_add(1, std::memory_order_relaxed);
+    s_capturing.store(_frames > 0, std::memory_order_relaxed);
+  }
+
+  bool Tracer::frameFinished() noexcept
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!s_capturing.load(std::memory_order_relaxed) || --m_framesLeft > 0)
+    {
+      return false;
+    }
+    s_capturing.store(false, std::memory_order_relaxed);
+    return true;
+  }
+
+  uint32_t Tracer::captureId() const noexcept
+  {
+    return m_captureId.load(std::memory_order_relaxed);
+  }
+
+  void Tracer::addZone(const char *_name, int64_t _start, int64_t _end, int _level) noexcept
+  {
+    uint32_t track = threadTrack();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_zones.push_back(Zone{_name, _start, _end, track, _level});
+  }
+
+  void Tracer::addGpuZone(const char *_name, int64_t _start, int64_t _end, int _level) noexcept
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_zones.push_back(Zone{_name, _start, _end, 0, _level});
+  }
+
+  size_t Tracer::zoneCount() const noexcept
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_zones.size();
+  }
+
+  bool Tracer::write(const std::string &_path) const noexcept
+  {
+    std::ofstream file(_path, std::ios::trunc);
+    if (!file)
+    {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    file.setf(std::ios::fixed);
+    file.precision(3);
+    // Complete ("X") events in microseconds, with the GPU's track named so it stands apart from the threads
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GeoClipmapDemo\"}},\n";
+    file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+    for (const Zone &zone : m_zones)
+    {
+      file << ",\n{\"name\":\"" << zone.name << "\",\"cat\":\"" << (zone.track == 0 ? "gpu" : "cpu")
+           << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << zone.track
+           << ",\"ts\":" << static_cast<double>(zone.start - m_origin) / 1000.0
+           << ",\"dur\":" << static_cast<double>(zone.end - zone.start) / 1000.0;
+      if (zone.level >= 0)
+      {
+        file << ",\"args\":{\"level\":" << zone.level << "}";
+      }
+      file << "}";
+    }
+    file << "\n]}\n";
+    return static_cast<bool>(file);
+  }
+
+  GpuTrace::~GpuTrace()
+  {
+    for (const Pending &zone : m_pending)
+    {
+      m_free.push_back(zone.start);
+      m_free.push_back(zone.end);
+    }
+    if (m_open.name)
+    {
+      m_free.push_back(m_open.start);
+    }
+    if (!m_free.empty())
+    {
+      glDeleteQueries(static_cast<GLsizei>(m_free.size()), m_free.data());
+    }
+  }
+
+  void GpuTrace::begin(const char *_name, int _level) noexcept
+  {
+    if (!Tracer::capturing())
+    {
+      return;
+    }
+
+    // Line the GPU's clock up with the CPU's once a capture, as the two drift apart over time
+    uint32_t captureId = Tracer::getInstance()->captureId();
+    if (captureId != m_captureId)
+    {
+      GLint64 gpuNow = 0;
+      glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+      m_offset = Tracer::now() - static_cast<int64_t>(gpuNow);
+      m_captureId = captureId;
+    }
+
+    if (m_open.name)
+    {
+      m_free.push_back(m_open.start);
+    }
+    m_open = Pending{_name, _level, query(), 0};
+    glQueryCounter(m_open.start, GL_TIMESTAMP);
+  }
+
+  void GpuTrace::end() noexcept
+  {
+    if (!m_open.name)
+    {
+      return;
+    }
+    m_open.end = query();
+    glQueryCounter(m_open.end, GL_TIMESTAMP);
+    m_pending.push_back(m_open);
+    m_open.name = nullptr;
+  }
+
+  void GpuTrace::collect(bool _wait) noexcept
+  {
+    // The GPU finishes zones in order, so stop at the first that isn't ready
+    while (!m_pending.empty())
+    {
+      const Pending &zone = m_pending.front();
+      if (!_wait)
+      {
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(zone.end, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available == GL_FALSE)
+        {
+          break;
+        }
+      }
+      GLuint64 start = 0;
+      GLuint64 end = 0;
+      glGetQueryObjectui64v(zone.start, GL_QUERY_RESULT, &start);
+      glGetQueryObjectui64v(zone.end, GL_QUERY_RESULT, &end);
+      Tracer::getInstance()->addGpuZone(zone.name, static_cast<int64_t>(start) + m_offset, static_cast<int64_t>(end) + m_offset, zone.level);
+      m_free.push_back(zone.start);
+      m_free.push_back(zone.end);
+      m_pending.pop_front();
+    }
+  }
+
+  size_t GpuTrace::pending() const noexcept
+  {
+    return m_pending.size();
+  }
+
+  // ======================================= Private methods =======================================
+
+  GLuint GpuTrace::query() noexcept
+  {
+    if (m_free.empty())
+    {
+      // A frame has a few zones per level, so a batch of queries lasts a while
+      m_free.resize(32);
+      glGenQueries(static_cast<GLsizei>(m_free.size()), m_free.data());
+    }
+    GLuint id = m_free.back();
+    m_free.pop_back();
+    return id;
+  }
+} // end namespace geoclipmap
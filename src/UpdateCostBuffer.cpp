@@ -0,0 +1,63 @@
+/**
+ * @file UpdateCostBuffer.cpp
+ * @author Ollie Nicholls
+ * @brief A small uniform buffer holding what each clipmap level cost to
+ * update over the last frame
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+
+#include "UpdateCostBuffer.h"
+
+namespace geoclipmap
+{
+  UpdateCostBuffer::~UpdateCostBuffer()
+  {
+    if (m_buffer != 0)
+    {
+      glDeleteBuffers(1, &m_buffer);
+    }
+  }
+
+  void UpdateCostBuffer::update(const MetricsFrame &_frame, size_t _levelTexels) noexcept
+  {
+    static_assert(sizeof(ngl::Vec4) == 16, "The costs must match the shader's std140 vec4 array");
+    m_costs = computeCosts(_frame, _levelTexels);
+
+    if (m_buffer == 0)
+    {
+      glGenBuffers(1, &m_buffer);
+      glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+      glBufferData(GL_UNIFORM_BUFFER, sizeof(m_costs), m_costs.data(), GL_DYNAMIC_DRAW);
+    }
+    else
+    {
+      glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+      glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(m_costs), m_costs.data());
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, k_updateCostBinding, m_buffer);
+  }
+
+  std::array<ngl::Vec4, k_metricsLevels> UpdateCostBuffer::computeCosts(const MetricsFrame &_frame,
+                                                                         size_t _levelTexels) noexcept
+  {
+    std::array<ngl::Vec4, k_metricsLevels> costs{};
+    auto texels = static_cast<ngl::Real>(std::max<size_t>(_levelTexels, 1));
+    ngl::Real bytes = texels * sizeof(ngl::Vec3);
+    for (size_t i = 0; i < k_metricsLevels; i++)
+    {
+      auto levelTexels = static_cast<ngl::Real>(_frame.levelTexels[i]);
+      auto levelBytes = static_cast<ngl::Real>(_frame.levelBytes[i]);
+      costs[i] = ngl::Vec4(levelTexels, levelBytes, levelTexels / texels, levelBytes / bytes);
+    }
+    return costs;
+  }
+
+  const std::array<ngl::Vec4, k_metricsLevels> &UpdateCostBuffer::costs() const noexcept
+  {
+    return m_costs;
+  }
+} // end namespace geoclipmap
@@ -0,0 +1,181 @@
+/**
+ * @file Viewshed.cpp
+ * @author Ollie Nicholls
+ * @brief Finds which parts of a heightmap can be seen from an observer, and
+ * whether there is a clear line of sight between any two points
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <cmath>
+
+#include "ThreadPool.h"
+#include "Viewshed.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // There are 8 octants around the observer, swept independently
+    constexpr int k_octants = 8;
+  } // end namespace
+
+  Viewshed::Viewshed(Heightmap *_heightmap) noexcept : m_heightmap{_heightmap},
+                                                       m_rayCaster{_heightmap}
+  {
+  }
+
+  void Viewshed::compute(int64_t _x,
+                         int64_t _y,
+                         ngl::Real _observerHeight,
+                         ngl::Real _targetHeight,
+                         int64_t _radius) noexcept
+  {
+    int64_t width = static_cast<int64_t>(m_heightmap->width());
+    int64_t depth = static_cast<int64_t>(m_heightmap->depth());
+    m_mask.clear();
+    m_width = 0;
+    m_depth = 0;
+    if (_x < 0 || _y < 0 || _x >= width || _y >= depth || _radius < 0)
+    {
+      return;
+    }
+
+    // Nothing is further away than the heightmap is wide or deep
+    _radius = std::min(_radius, std::max(width, depth));
+    m_x0 = std::max<int64_t>(_x - _radius, 0);
+    m_y0 = std::max<int64_t>(_y - _radius, 0);
+    m_width = std::min(_x + _radius, width - 1) - m_x0 + 1;
+    m_depth = std::min(_y + _radius, depth - 1) - m_y0 + 1;
+    m_mask.assign(static_cast<size_t>(m_width * m_depth), 0);
+    m_mask[static_cast<size_t>((_y - m_y0) * m_width + (_x - m_x0))] = 1;
+
+    ngl::Real eye = m_heightmap->value(_x, _y) + _observerHeight;
+    if (!m_heightmap->concurrentReads())
+    {
+      // The compressed tile cache is only safe to use from one thread
+      for (int octant = 0; octant < k_octants; octant++)
+      {
+        sweepOctant(octant, _x, _y, eye, _targetHeight, _radius);
+      }
+      return;
+    }
+
+    ThreadPool::getInstance()->parallelFor(k_octants, [&](size_t _octant) {
+      sweepOctant(static_cast<int>(_octant), _x, _y, eye, _targetHeight, _radius);
+    });
+  }
+
+  bool Viewshed::visible(int64_t _x, int64_t _y) const noexcept
+  {
+    _x -= m_x0;
+    _y -= m_y0;
+    if (_x < 0 || _y < 0 || _x >= m_width || _y >= m_depth)
+    {
+      return false;
+    }
+    return m_mask[static_cast<size_t>(_y * m_width + _x)] != 0;
+  }
+
+  void Viewshed::readRow(int64_t _x, int64_t _y, int _stride, int _count, ngl::Real *_out) const noexcept
+  {
+    for (int i = 0; i < _count; i++)
+    {
+      _out[i] = visible(_x + static_cast<int64_t>(i) * _stride, _y) ? 1.0f : 0.0f;
+    }
+  }
+
+  size_t Viewshed::visibleCount() const noexcept
+  {
+    return static_cast<size_t>(std::count(m_mask.begin(), m_mask.end(), 1));
+  }
+
+  bool Viewshed::lineOfSight(const ngl::Vec3 &_from, const ngl::Vec3 &_to) noexcept
+  {
+    ngl::Vec3 direction = _to - _from;
+    ngl::Real length = direction.length();
+    if (length == 0.0f)
+    {
+      return true;
+    }
+    // Stop just short of the end so a point on the ground doesn't block itself
+    return !m_rayCaster.cast(_from, direction, length * 0.9999f).hit;
+  }
+
+  // ======================================= Private methods =======================================
+
+  void Viewshed::sweepOctant(int _octant, int64_t _x, int64_t _y, ngl::Real _eye, ngl::Real _targetHeight, int64_t _radius) noexcept
+  {
+    bool yMajor = (_octant & 1) != 0;
+    int64_t majorSign = (_octant & 2) != 0 ? -1 : 1;
+    int64_t minorSign = (_octant & 4) != 0 ? -1 : 1;
+    int64_t majorPosition = yMajor ? _y : _x;
+    int64_t minorPosition = yMajor ? _x : _y;
+    int64_t majorSize = static_cast<int64_t>(yMajor ? m_heightmap->depth() : m_heightmap->width());
+    int64_t minorSize = static_cast<int64_t>(yMajor ? m_heightmap->width() : m_heightmap->depth());
+
+    // How far the octant reaches along each axis before the radius or the edge of the heightmap
+    int64_t maxI = std::min(_radius, majorSign > 0 ? majorSize - 1 - majorPosition : majorPosition);
+    int64_t maxJ = std::min(_radius, minorSign > 0 ? minorSize - 1 - minorPosition : minorPosition);
+    if (maxI <= 0)
+    {
+      return;
+    }
+
+    // The minor axis line belongs to the positive octants and the diagonal to the x major ones, so every sample is
+    // written by exactly one octant
+    int64_t firstJ = minorSign > 0 ? 0 : 1;
+    double radius2 = static_cast<double>(_radius) * static_cast<double>(_radius);
+
+    // The horizon of each sample in the previous and current ring, the observer's own ring sees everything
+    std::vector<double> previous(static_cast<size_t>(maxJ + 1), std::numeric_limits<double>::lowest());
+    std::vector<double> current(static_cast<size_t>(maxJ + 1));
+    std::vector<ngl::Real> heights(static_cast<size_t>(maxJ + 1));
+
+    for (int64_t i = 1; i <= maxI; i++)
+    {
+      // Read the ring's samples in one go, nearest the major axis first if the minor axis is positive
+      int64_t count = std::min(i, maxJ) + 1;
+      int64_t major = majorPosition + majorSign * i;
+      int64_t minorStart = minorSign > 0 ? minorPosition : minorPosition - (count - 1);
+      if (yMajor)
+      {
+        m_heightmap->readWindow(minorStart, major, 1, static_cast<int>(count), 1, heights.data());
+      }
+      else
+      {
+        m_heightmap->readWindow(major, minorStart, 1, 1, static_cast<int>(count), heights.data());
+      }
+
+      int64_t lastJ = yMajor ? i - 1 : i;
+      double toPrevious = static_cast<double>(i - 1) / static_cast<double>(i);
+      for (int64_t j = 0; j < count; j++)
+      {
+        // Where the line back to the observer crosses the previous ring
+        double p = static_cast<double>(j) * toPrevious;
+        int64_t k = static_cast<int64_t>(p);
+        double f = p - static_cast<double>(k);
+        double horizon = previous[static_cast<size_t>(k)];
+        if (f > 0.0)
+        {
+          horizon = horizon * (1.0 - f) + previous[static_cast<size_t>(k + 1)] * f;
+        }
+
+        double distance2 = static_cast<double>(i * i + j * j);
+        double distance = std::sqrt(distance2);
+        double height = heights[static_cast<size_t>(minorSign > 0 ? j : count - 1 - j)];
+        current[static_cast<size_t>(j)] = std::max(horizon, (height - _eye) / distance);
+
+        if (j >= firstJ && j <= lastJ && distance2 <= radius2)
+        {
+          int64_t x = yMajor ? minorPosition + minorSign * j : major;
+          int64_t y = yMajor ? major : minorPosition + minorSign * j;
+          bool seen = (height + _targetHeight - _eye) / distance >= horizon;
+          m_mask[static_cast<size_t>((y - m_y0) * m_width + (x - m_x0))] = seen ? 1 : 0;
+        }
+      }
+      std::swap(previous, current);
+    }
+  }
+} // end namespace geoclipmap
@@ -7,6 +7,7 @@
  * @copyright Copyright (c) 2020
  * 
  */
+#include <cstdlib>
 #include <iostream>
 
 #include <QtGui/QGuiApplication>
@@ -17,10 +18,132 @@ int main(int argc, char **argv)
 {
 	if(argc <2 )
 	{
-		std::cerr <<"Usage: GeoClipmapDemo.exe <heightmap_file>\n";
+		std::cerr <<"Usage: GeoClipmapDemo.exe <heightmap_file|sequence.gcseq|layers.mosaic|http://server/baked_file|shm://feed> [--compress|--quantise] [--layout=row-major|tiled|morton] [--stream=<tile_file> [--stream-pread] [--direct-io]] [--tile-cache=<dir>] [--progressive] [--follow] [--record=<path_file> | --replay=<path_file> [--frames=<n>] [--stats=<csv_file>]] [--metrics-log=<csv_or_json_file> [--metrics-interval=<seconds>]] [--governor=<target_ms> [--governor-log=<csv_file>]]\n";
 		exit(EXIT_FAILURE);
 	}
 
+	std::string recordPath;
+	std::string replayPath;
+	size_t replayFrames = 0;
+	std::string statsPath;
+	std::string metricsPath;
+	double metricsInterval = 1.0;
+	bool followCamera = false;
+	double governorTarget = 0.0;
+	std::string governorPath;
+	for (int i = 2; i < argc; i++)
+	{
+		std::string option(argv[i]);
+		if (option == "--compress")
+		{
+			geoclipmap::Manager::getInstance()->setStorage(geoclipmap::HeightmapStorage::Compressed);
+		}
+		else if (option == "--quantise")
+		{
+			geoclipmap::Manager::getInstance()->setStorage(geoclipmap::HeightmapStorage::Quantised);
+		}
+		else if (option == "--layout=row-major")
+		{
+			geoclipmap::Manager::getInstance()->setLayout(geoclipmap::HeightmapLayout::RowMajor);
+		}
+		else if (option == "--layout=tiled")
+		{
+			geoclipmap::Manager::getInstance()->setLayout(geoclipmap::HeightmapLayout::Tiled);
+		}
+		else if (option == "--layout=morton")
+		{
+			geoclipmap::Manager::getInstance()->setLayout(geoclipmap::HeightmapLayout::Morton);
+		}
+		else if (option.rfind("--stream=", 0) == 0 && option.size() > 9)
+		{
+			// Only compressed tiles can be streamed
+			geoclipmap::Manager::getInstance()->setStorage(geoclipmap::HeightmapStorage::Compressed);
+			geoclipmap::Manager::getInstance()->setTileFile(option.substr(9));
+		}
+		else if (option == "--stream-pread")
+		{
+			geoclipmap::Manager::getInstance()->setTileReader(geoclipmap::TileReaderBackend::Pread);
+		}
+		else if (option == "--direct-io")
+		{
+			geoclipmap::Manager::getInstance()->setDirectIO(true);
+		}
+		else if (option.rfind("--tile-cache=", 0) == 0 && option.size() > 13)
+		{
+			geoclipmap::Manager::getInstance()->setTileCache(option.substr(13));
+		}
+		else if (option == "--progressive")
+		{
+			geoclipmap::Manager::getInstance()->setProgressive(true);
+		}
+		else if (option == "--follow")
+		{
+			followCamera = true;
+		}
+		else if (option.rfind("--record=", 0) == 0 && option.size() > 9)
+		{
+			recordPath = option.substr(9);
+		}
+		else if (option.rfind("--replay=", 0) == 0 && option.size() > 9)
+		{
+			replayPath = option.substr(9);
+		}
+		else if (option.rfind("--frames=", 0) == 0 && option.size() > 9)
+		{
+			replayFrames = std::strtoull(option.c_str() + 9, nullptr, 10);
+		}
+		else if (option.rfind("--stats=", 0) == 0 && option.size() > 8)
+		{
+			statsPath = option.substr(8);
+		}
+		else if (option.rfind("--metrics-log=", 0) == 0 && option.size() > 14)
+		{
+			metricsPath = option.substr(14);
+		}
+		else if (option.rfind("--metrics-interval=", 0) == 0 && option.size() > 19)
+		{
+			metricsInterval = std::strtod(option.c_str() + 19, nullptr);
+		}
+		else if (option.rfind("--governor=", 0) == 0 && option.size() > 11)
+		{
+			governorTarget = std::strtod(option.c_str() + 11, nullptr);
+		}
+		else if (option.rfind("--governor-log=", 0) == 0 && option.size() > 15)
+		{
+			governorPath = option.substr(15);
+		}
+		else
+		{
+			std::cerr << "Unknown option " << option << "\n";
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (!metricsPath.empty() && !geoclipmap::Metrics::getInstance()->openLog(metricsPath, metricsInterval))
+	{
+		std::cerr << "Couldn't create metrics log " << metricsPath << "\n";
+		exit(EXIT_FAILURE);
+	}
+
+	if (!recordPath.empty() && !replayPath.empty())
+	{
+		std::cerr << "Can't record and replay a camera path at the same time\n";
+		exit(EXIT_FAILURE);
+	}
+
+	// A replay sets K, L and R from its path, which the governor would fight over
+	if (governorTarget > 0.0 && !replayPath.empty())
+	{
+		std::cerr << "Can't govern the quality of a replay\n";
+		exit(EXIT_FAILURE);
+	}
+
+	// Replays are drawn offscreen unless a platform is asked for, e.g. QT_QPA_PLATFORM=xcb to watch one
+	if (!replayPath.empty() && qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+	{
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+	}
+
 	QGuiApplication app(argc, argv);
 	QSurfaceFormat format;
 	
@@ -29,6 +152,11 @@ int main(int argc, char **argv)
 	format.setMinorVersion(3);
 	format.setProfile(QSurfaceFormat::CoreProfile);
 	format.setDepthBufferSize(24);
+	// Replays draw as fast as they can rather than waiting for the display
+	if (!replayPath.empty())
+	{
+		format.setSwapInterval(0);
+	}
 
 	// geoclipmap::NGLScene window("./img/grand_canyon.png");
 	// geoclipmap::NGLScene window("./img/poole_harbour.png");
@@ -37,11 +165,30 @@ int main(int argc, char **argv)
 	geoclipmap::NGLScene window(argv[1]);
 	
 	window.setFormat(format);
+	window.setFollowCamera(followCamera);
+	if (governorTarget > 0.0 && !window.setGovernor(governorTarget, governorPath))
+	{
+		std::cerr << "Couldn't create governor log " << governorPath << "\n";
+		exit(EXIT_FAILURE);
+	}
+
+	if (!recordPath.empty() && !window.recordPath(recordPath))
+	{
+		std::cerr << "Couldn't create camera path " << recordPath << "\n";
+		exit(EXIT_FAILURE);
+	}
+	if (!replayPath.empty() && !window.replayPath(replayPath, replayFrames, statsPath))
+	{
+		std::cerr << "Couldn't read camera path " << replayPath << "\n";
+		exit(EXIT_FAILURE);
+	}
 
 	std::cout << "Profile is " << format.majorVersion() << " " << format.minorVersion() << "\n";
 
 	window.resize(1024, 720);
 	window.show();
 
-	return app.exec();
+	int result = app.exec();
+	geoclipmap::Metrics::getInstance()->closeLog();
+	return result;
 }
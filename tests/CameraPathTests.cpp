@@ -0,0 +1,107 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <filesystem>
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+#include "CameraPath.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    std::string pathFile()
+    {
+      return (std::filesystem::temp_directory_path() / "geoclipmap_camera.gccam").string();
+    }
+
+    CameraPathFrame frameAt(int _i)
+    {
+      CameraPathFrame frame;
+      frame.camera.eye = ngl::Vec3(0.1f * _i, 100.0f - _i, 50.0f);
+      frame.camera.look = ngl::Vec3(0.0f, 100.0f - _i, 0.0f);
+      frame.camera.yaw = 1.5f * _i;
+      frame.camera.pitch = -45.0f + _i;
+      frame.terrainX = 1024 + 10 * _i;
+      frame.terrainY = 2048 - 10 * _i;
+      frame.followCamera = _i % 2 == 1;
+      frame.K = 8;
+      frame.L = static_cast<unsigned char>(6 + _i % 3);
+      frame.R = 4;
+      return frame;
+    }
+  } // end namespace
+
+  TEST(CameraPathTest, round_trip)
+  {
+    std::string path = pathFile();
+    {
+      auto writer = CameraPathWriter::create(path);
+      ASSERT_NE(writer, nullptr);
+      for (int i = 0; i < 5; i++)
+      {
+        EXPECT_TRUE(writer->addFrame(frameAt(i)));
+      }
+      EXPECT_EQ(writer->framesWritten(), 5u);
+    }
+
+    auto camera = CameraPath::open(path);
+    ASSERT_NE(camera, nullptr);
+    ASSERT_EQ(camera->frameCount(), 5u);
+    for (int i = 0; i < 5; i++)
+    {
+      CameraPathFrame expected = frameAt(i);
+      const CameraPathFrame &frame = camera->frame(static_cast<size_t>(i));
+      EXPECT_EQ(frame.camera.eye, expected.camera.eye);
+      EXPECT_EQ(frame.camera.look, expected.camera.look);
+      EXPECT_EQ(frame.camera.yaw, expected.camera.yaw);
+      EXPECT_EQ(frame.camera.pitch, expected.camera.pitch);
+      EXPECT_EQ(frame.terrainX, expected.terrainX);
+      EXPECT_EQ(frame.terrainY, expected.terrainY);
+      // Following can be toggled mid-path, so it is kept for every frame
+      EXPECT_EQ(frame.followCamera, expected.followCamera);
+      EXPECT_EQ(frame.K, expected.K);
+      EXPECT_EQ(frame.L, expected.L);
+      EXPECT_EQ(frame.R, expected.R);
+    }
+
+    // Playing on past the end starts again
+    EXPECT_EQ(camera->frame(7).terrainX, frameAt(2).terrainX);
+    std::filesystem::remove(path);
+  }
+
+  TEST(CameraPathTest, cut_short)
+  {
+    std::string path = pathFile();
+    {
+      auto writer = CameraPathWriter::create(path);
+      ASSERT_NE(writer, nullptr);
+      EXPECT_TRUE(writer->addFrame(frameAt(0)));
+      EXPECT_TRUE(writer->addFrame(frameAt(1)));
+    }
+
+    // Half of a frame at the end, as if the demo was killed while writing it
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 20);
+    auto camera = CameraPath::open(path);
+    ASSERT_NE(camera, nullptr);
+    EXPECT_EQ(camera->frameCount(), 1u);
+    EXPECT_EQ(camera->frame(0).terrainX, frameAt(0).terrainX);
+
+    // A path with no frames has nothing to play
+    CameraPathWriter::create(path);
+    EXPECT_EQ(CameraPath::open(path), nullptr);
+
+    // Neither does a file that isn't a camera path
+    {
+      std::ofstream file(path, std::ios::binary | std::ios::trunc);
+      file << "GCSEQNC1 this is something else entirely, long enough for a frame or two of a path";
+    }
+    EXPECT_EQ(CameraPath::open(path), nullptr);
+    EXPECT_EQ(CameraPath::open("/nonexistent/path.gccam"), nullptr);
+    EXPECT_EQ(CameraPathWriter::create("/nonexistent/path.gccam"), nullptr);
+    std::filesystem::remove(path);
+  }
+} // end namespace geoclipmap
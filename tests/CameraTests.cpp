@@ -196,4 +196,35 @@ namespace geoclipmap
 
     EXPECT_EQ(camera.m_eye.m_z, eye.m_z - 0.005f * 5.0f);
   }
+
+  TEST(CameraTest, camera_state)
+  {
+    ngl::Vec3 eye{0.0f, 100.0f, 50.0f};
+    ngl::Vec3 look{0.0f, 100.0f, 0.0f};
+    ngl::Vec3 up{0.0f, 1.0f, 0.0f};
+
+    // Move a camera about and record where it ends up
+    Camera camera(eye, look, up);
+    camera.orbit(20.0f, -45.0f);
+    camera.pedestal(-30.0f);
+    camera.dolly(12.0f);
+    CameraState state = camera.state();
+    EXPECT_EQ(state.eye, camera.m_eye);
+    EXPECT_EQ(state.look, camera.m_look);
+    EXPECT_EQ(state.yaw, camera.m_yaw);
+    EXPECT_EQ(state.pitch, camera.m_pitch);
+
+    // Another camera put in that state views the same and keeps moving the same way
+    Camera replayed(eye, look, up);
+    replayed.setState(state);
+    EXPECT_EQ(replayed.view(), camera.view());
+    EXPECT_EQ(replayed.m_right, camera.m_right);
+    camera.orbit(3.0f, 4.0f);
+    replayed.orbit(3.0f, 4.0f);
+    EXPECT_EQ(replayed.view(), camera.view());
+
+    // Resetting still goes back to where it was constructed
+    replayed.reset();
+    EXPECT_EQ(replayed.m_eye, eye);
+  }
 } // end namespace geoclipmap
\ No newline at end of file
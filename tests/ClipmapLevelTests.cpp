@@ -6,6 +6,7 @@
 
 #include "ClipmapLevel.h"
 #include "Manager.h"
+#include "Metrics.h"
 
 namespace geoclipmap
 {
@@ -24,7 +25,7 @@ namespace geoclipmap
     EXPECT_EQ(c.m_heightmap, heightmap);
     EXPECT_EQ(c.m_parent, parent);
 
-    std::vector<ngl::Vec2> texture = c.m_texture;
+    std::vector<ngl::Vec3> texture = c.m_texture;
     EXPECT_EQ(texture.size(), manager->D() * manager->D());
 
     EXPECT_EQ(c.scale(), 1 << ((manager->L() - 1) - 0));
@@ -48,7 +49,7 @@ namespace geoclipmap
     EXPECT_EQ(c.m_heightmap, heightmap);
     EXPECT_EQ(c.m_parent, parent);
 
-    std::vector<ngl::Vec2> texture = c.m_texture;
+    std::vector<ngl::Vec3> texture = c.m_texture;
     EXPECT_EQ(texture.size(), manager->D() * manager->D());
 
     EXPECT_EQ(c.scale(), 1 << ((manager->L() - 1) - 0));
@@ -68,13 +69,182 @@ namespace geoclipmap
     ClipmapLevel c(0, heightmap, parent);
 
     ngl::Vec2 worldPosition{1.0f, 2.0f};
-    ngl::Vec2 heightmapPosition{3.0f, 4.0f};
+    // Far beyond what a float or a 32 bit index can address
+    int64_t originX = (static_cast<int64_t>(1) << 40) + 3;
+    int64_t originY = -(static_cast<int64_t>(1) << 36) + 4;
     TrimLocation trimLocation = TrimLocation::TopLeft;
 
-    c.setPosition(worldPosition, heightmapPosition, trimLocation);
+    c.setPosition(worldPosition, originX, originY, trimLocation);
 
     EXPECT_EQ(c.position(), worldPosition);
-    EXPECT_EQ(c.m_heightmapPosition, heightmapPosition);
+    EXPECT_EQ(c.originX(), originX);
+    EXPECT_EQ(c.originY(), originY);
     EXPECT_EQ(c.trimLocation(), trimLocation);
   }
-} // end namespace geoclipmap
\ No newline at end of file
+
+  TEST(ClipmapTest, overlay)
+  {
+    Manager *manager = Manager::getInstance();
+    size_t D = manager->D();
+    std::vector<ngl::Vec3> heightmapData(16, ngl::Vec3(0.5f));
+    Heightmap *heightmap = new Heightmap(4, 4, heightmapData);
+    ClipmapLevel c(manager->L() - 2, heightmap, nullptr);
+    c.setPosition(ngl::Vec2{}, 1, 0, TrimLocation::All);
+
+    // No overlay is all 0
+    c.updateTexture();
+    EXPECT_EQ(c.m_texture[0].m_z, 0.0f);
+
+    // The overlay is read at the same (scaled) samples as the heights
+    c.setOverlay([](int64_t _x, int64_t _y, int _stride, int _count, ngl::Real *_out) {
+      for (int i = 0; i < _count; i++)
+      {
+        _out[i] = static_cast<ngl::Real>(_x + i * _stride + _y * 1000);
+      }
+    });
+    c.updateTexture();
+    EXPECT_EQ(c.m_texture[0].m_x, 0.75f);
+    EXPECT_EQ(c.m_texture[0].m_z, 2.0f);
+    EXPECT_EQ(c.m_texture[1].m_z, 4.0f);
+    EXPECT_EQ(c.m_texture[D + 2].m_z, 6.0f + 2000.0f);
+
+    c.setOverlay(nullptr);
+    c.updateTexture();
+    EXPECT_EQ(c.m_texture[D + 2].m_z, 0.0f);
+  }
+  TEST(ClipmapTest, refresh_region)
+  {
+    Manager *manager = Manager::getInstance();
+    size_t D = manager->D();
+    std::vector<ngl::Real> heights(64 * 64, 1.0f);
+    Heightmap heightmap(64, 64, heights.data());
+
+    // The finest level reads every sample, the next every other one
+    ClipmapLevel fine(manager->L() - 1, &heightmap, nullptr);
+    ClipmapLevel coarse(manager->L() - 2, &heightmap, nullptr);
+    EXPECT_FALSE(fine.refreshRegion(0, 0, 63, 63));
+    fine.setPosition(ngl::Vec2{}, -4, 2, TrimLocation::All);
+    coarse.setPosition(ngl::Vec2{}, 3, 0, TrimLocation::All);
+    fine.updateTexture();
+    coarse.updateTexture();
+    EXPECT_EQ(fine.m_dirtyBegin, 0u);
+    EXPECT_EQ(fine.m_dirtyEnd, D * D);
+    // The first upload allocates the buffer with the whole texture
+    TextureUpload upload = fine.pendingUpload();
+    EXPECT_TRUE(upload.allocate);
+    EXPECT_EQ(upload.bytes(), D * D * sizeof(ngl::Vec3));
+    coarse.pendingUpload();
+    EXPECT_EQ(fine.m_dirtyEnd, 0u);
+    EXPECT_EQ(fine.pendingUpload().bytes(), 0u);
+
+    heights[10 * 64 + 20] = 5.0f;
+    heights[10 * 64 + 21] = 6.0f;
+    EXPECT_TRUE(fine.refreshRegion(20, 10, 21, 10));
+    EXPECT_EQ(fine.m_texture[8 * D + 24].m_x, 5.0f);
+    EXPECT_EQ(fine.m_texture[8 * D + 25].m_x, 6.0f);
+    // Only the changed texels are uploaded again
+    EXPECT_EQ(fine.m_dirtyBegin, 8 * D + 24);
+    EXPECT_EQ(fine.m_dirtyEnd, 8 * D + 26);
+
+    // Only sample 20 is in the coarse level, at texel (20 / 2 - 3, 10 / 2)
+    EXPECT_TRUE(coarse.refreshRegion(20, 10, 21, 10));
+    EXPECT_EQ(coarse.m_texture[5 * D + 7].m_x, 5.0f);
+    EXPECT_EQ(coarse.m_dirtyEnd - coarse.m_dirtyBegin, 1u);
+    EXPECT_FALSE(coarse.refreshRegion(21, 11, 21, 11));
+
+    // Regions the texture doesn't reach change nothing
+    EXPECT_FALSE(coarse.refreshRegion(0, 0, 5, 63));
+    upload = fine.pendingUpload();
+    EXPECT_FALSE(upload.allocate);
+    EXPECT_EQ(upload.begin, 8 * D + 24);
+    EXPECT_EQ(upload.bytes(), 2 * sizeof(ngl::Vec3));
+    EXPECT_FALSE(fine.refreshRegion(-100, -100, -10, -10));
+    EXPECT_EQ(fine.m_dirtyEnd, 0u);
+  }
+
+  TEST(ClipmapTest, memory)
+  {
+    Manager *manager = Manager::getInstance();
+    size_t D = manager->D();
+    std::vector<ngl::Real> heights(64 * 64, 1.0f);
+    Heightmap heightmap(64, 64, heights.data());
+    MemoryTracker *tracker = MemoryTracker::getInstance();
+    MemoryUsage before = tracker->usage(MemorySubsystem::ClipmapLevels);
+    {
+      ClipmapLevel level(manager->L() - 1, &heightmap, nullptr);
+      EXPECT_EQ(level.m_memory.cpuBytes(), D * D * sizeof(ngl::Vec3));
+      EXPECT_EQ(level.m_memory.gpuBytes(), 0u);
+
+      // Reading the texture keeps the heights and a row of the overlay too
+      level.setPosition(ngl::Vec2{}, 0, 0, TrimLocation::All);
+      level.updateTexture();
+      EXPECT_GE(level.m_memory.cpuBytes(), D * D * (sizeof(ngl::Vec3) + sizeof(ngl::Real)) + D * sizeof(ngl::Real));
+      // The buffer is counted once the upload that allocates it is taken
+      level.pendingUpload();
+      EXPECT_EQ(level.m_memory.gpuBytes(), D * D * sizeof(ngl::Vec3));
+      MemoryUsage during = tracker->usage(MemorySubsystem::ClipmapLevels);
+      EXPECT_EQ(during.cpuBytes - before.cpuBytes, static_cast<int64_t>(level.m_memory.cpuBytes()));
+      EXPECT_EQ(during.gpuBytes - before.gpuBytes, static_cast<int64_t>(D * D * sizeof(ngl::Vec3)));
+    }
+    MemoryUsage after = tracker->usage(MemorySubsystem::ClipmapLevels);
+    EXPECT_EQ(after.cpuBytes, before.cpuBytes);
+    EXPECT_EQ(after.gpuBytes, before.gpuBytes);
+  }
+
+  TEST(ClipmapTest, regenerated_frame)
+  {
+    Manager *manager = Manager::getInstance();
+    size_t D = manager->D();
+    std::vector<ngl::Real> heights(64 * 64, 1.0f);
+    Heightmap heightmap(64, 64, heights.data());
+    Metrics *metrics = Metrics::getInstance();
+    ClipmapLevel level(manager->L() - 1, &heightmap, nullptr);
+    level.setPosition(ngl::Vec2{}, 0, 0, TrimLocation::All);
+
+    // Every texel read is stamped with the frame it was read on
+    auto first = static_cast<ngl::Real>(metrics->frameCount() % k_regeneratedFrameWrap);
+    level.updateTexture();
+    EXPECT_EQ(level.m_texture[0].m_y, first);
+    EXPECT_EQ(level.m_texture[D * D - 1].m_y, first);
+
+    // Refreshing a region only stamps the texels in it
+    metrics->frameFinished(1.0);
+    metrics->frameFinished(1.0);
+    level.refreshRegion(4, 4, 4, 4);
+    EXPECT_EQ(level.m_texture[4 * D + 4].m_y, first + 2.0f);
+    EXPECT_EQ(level.m_texture[4 * D + 5].m_y, first);
+  }
+
+  TEST(ClipmapTest, stale)
+  {
+    Manager *manager = Manager::getInstance();
+    std::vector<ngl::Real> heights(64 * 64, 1.0f);
+    Heightmap heightmap(64, 64, heights.data());
+    ClipmapLevel level(manager->L() - 1, &heightmap, nullptr);
+
+    // A new level has to be filled
+    EXPECT_TRUE(level.stale());
+    level.setPosition(ngl::Vec2{}, 0, 0, TrimLocation::All);
+    level.updateTexture();
+    EXPECT_FALSE(level.stale());
+
+    // Moving within a sample or changing the trims keeps the texture
+    level.setPosition(ngl::Vec2{-1.0f, -1.0f}, 0, 0, TrimLocation::TopLeft, ngl::Vec2{0.5f, 0.25f});
+    EXPECT_FALSE(level.stale());
+    EXPECT_EQ(level.subTexelOffset(), (ngl::Vec2{0.5f, 0.25f}));
+
+    // Moving the origin doesn't, even if it moves back before the texture is updated
+    level.setPosition(ngl::Vec2{}, 1, 0, TrimLocation::All);
+    EXPECT_TRUE(level.stale());
+    level.setPosition(ngl::Vec2{}, 0, 0, TrimLocation::All);
+    EXPECT_TRUE(level.stale());
+    level.updateTexture();
+
+    // Nor does a new overlay or being marked
+    level.setOverlay(nullptr);
+    EXPECT_TRUE(level.stale());
+    level.updateTexture();
+    level.markStale();
+    EXPECT_TRUE(level.stale());
+  }
+} // end namespace geoclipmap
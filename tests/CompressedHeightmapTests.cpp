@@ -0,0 +1,423 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+#include "CompressedHeightmap.h"
+#include "Heightmap.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // A smooth terrain with some detail, like a real heightmap
+    std::vector<ngl::Real> makeHeights(int _width, int _depth)
+    {
+      std::vector<ngl::Real> heights(static_cast<size_t>(_width) * _depth);
+      for (int y = 0; y < _depth; y++)
+      {
+        for (int x = 0; x < _width; x++)
+        {
+          heights[static_cast<size_t>(y) * _width + x] =
+              1.5f + std::sin(x * 0.02f) * std::cos(y * 0.03f) + 0.2f * std::sin(x * 0.07f + y * 0.05f) * std::sin(y * 0.11f);
+        }
+      }
+      return heights;
+    }
+
+    // Reads through another reader, or fails every read while offline
+    class FlakyReader : public TileReader
+    {
+    public:
+      FlakyReader(std::unique_ptr<TileReader> _reader, const bool *_offline) : m_reader{std::move(_reader)}, m_offline{_offline} {}
+      void readBatch(const std::vector<TileRead> &_reads, const TileReadCallback &_callback) noexcept override
+      {
+        if (*m_offline)
+        {
+          for (size_t i = 0; i < _reads.size(); i++)
+          {
+            _callback(i, nullptr, 0);
+          }
+          return;
+        }
+        m_reader->readBatch(_reads, _callback);
+      }
+      TileReaderBackend backend() const noexcept override { return m_reader->backend(); }
+      bool directIO() const noexcept override { return m_reader->directIO(); }
+
+    private:
+      std::unique_ptr<TileReader> m_reader;
+      const bool *m_offline;
+    };
+  } // end namespace
+
+  TEST(CompressedHeightmapTest, pyramid_levels)
+  {
+    int width = 300;
+    int depth = 200;
+    auto heights = makeHeights(width, depth);
+    CompressedHeightmap c(width, depth, heights, 0.001f, 32);
+
+    // 300 -> 150 -> 75 -> 38 -> 19 which fits in a single tile
+    EXPECT_EQ(c.levels(), 5);
+    EXPECT_EQ(c.m_levels[1].width, 150);
+    EXPECT_EQ(c.m_levels[1].depth, 100);
+    EXPECT_EQ(c.m_levels[4].tilesX, 1);
+    EXPECT_EQ(c.m_levels[4].tilesY, 1);
+  }
+
+  TEST(CompressedHeightmapTest, within_tolerance)
+  {
+    int width = 257;
+    int depth = 131;
+    ngl::Real tolerance = 0.001f;
+    auto heights = makeHeights(width, depth);
+    CompressedHeightmap c(width, depth, heights, tolerance, 32);
+
+    // Allow for float rounding on top of the quantisation error
+    EXPECT_LE(c.stats().maxError, tolerance * 1.01f);
+
+    for (int y = 0; y < depth; y++)
+    {
+      for (int x = 0; x < width; x++)
+      {
+        ASSERT_NEAR(c.sample(x, y), heights[static_cast<size_t>(y) * width + x], tolerance * 1.01f);
+      }
+    }
+  }
+
+  TEST(CompressedHeightmapTest, ratio)
+  {
+    int width = 512;
+    int depth = 512;
+    auto heights = makeHeights(width, depth);
+    CompressedHeightmap c(width, depth, heights, 3.0f / 8192.0f);
+
+    EXPECT_EQ(c.stats().rawBytes, heights.size() * sizeof(ngl::Real));
+    EXPECT_GT(c.stats().ratio(), 8.0);
+  }
+
+  TEST(CompressedHeightmapTest, decode_region)
+  {
+    int width = 256;
+    int depth = 256;
+    auto heights = makeHeights(width, depth);
+    CompressedHeightmap c(width, depth, heights, 0.001f, 32);
+
+    // A stride of 4 reads from level 2 (64x64) so only needs its 2x2 tiles and the single tile above
+    c.decodeRegion(0, 0, width - 1, depth - 1, 4);
+    EXPECT_EQ(c.stats().tilesDecoded, 5);
+    EXPECT_EQ(c.m_residentTiles, 5);
+
+    // Reading those samples shouldn't need anything else decoded
+    for (int y = 0; y < depth; y += 4)
+    {
+      for (int x = 0; x < width; x += 4)
+      {
+        c.sample(x, y);
+      }
+    }
+    EXPECT_EQ(c.stats().tilesDecoded, 5);
+    EXPECT_GT(c.stats().samplesPerSecond(), 0.0);
+
+    // The same region again is already resident
+    c.decodeRegion(0, 0, width - 1, depth - 1, 4);
+    EXPECT_EQ(c.stats().tilesDecoded, 5);
+  }
+
+  TEST(CompressedHeightmapTest, read_window)
+  {
+    int width = 256;
+    int depth = 200;
+    auto heights = makeHeights(width, depth);
+    CompressedHeightmap c(width, depth, heights, 0.001f, 32);
+
+    // Windows read the same heights as sampling one at a time, whatever their start and stride
+    struct Window
+    {
+      int x, y, stride, countX, countY;
+    };
+    for (const Window &w : {Window{0, 0, 1, 256, 200}, Window{3, 5, 1, 70, 41}, Window{8, 4, 4, 60, 49},
+                            Window{6, 2, 2, 100, 90}, Window{1, 7, 3, 80, 60}, Window{0, 0, 64, 4, 4}})
+    {
+      std::vector<ngl::Real> window(static_cast<size_t>(w.countX + 1) * w.countY, -1.0f);
+      c.readWindow(w.x, w.y, w.stride, w.countX, w.countY, static_cast<size_t>(w.countX + 1), window.data());
+      for (int j = 0; j < w.countY; j++)
+      {
+        for (int i = 0; i < w.countX; i++)
+        {
+          ASSERT_EQ(window[static_cast<size_t>(j) * (w.countX + 1) + i], c.sample(w.x + i * w.stride, w.y + j * w.stride))
+              << w.x << "," << w.y << " stride " << w.stride << " at " << i << "," << j;
+        }
+        // The pitch leaves the rest of the row alone
+        ASSERT_EQ(window[static_cast<size_t>(j) * (w.countX + 1) + w.countX], -1.0f);
+      }
+    }
+
+    // Each tile is looked up once per block it is read in, not once per sample
+    c.decodeRegion(0, 0, width - 1, depth - 1, 1);
+    uint64_t before = c.m_useCounter;
+    std::vector<ngl::Real> window(static_cast<size_t>(width) * depth);
+    c.readWindow(0, 0, 1, width, depth, static_cast<size_t>(width), window.data());
+    EXPECT_LE(c.m_useCounter - before, static_cast<uint64_t>(8 * 7 * c.levels()));
+
+    // Through a heightmap, samples outside it are 0
+    Heightmap heightmap(std::make_unique<CompressedHeightmap>(width, depth, heights, 0.001f, 32));
+    std::vector<ngl::Real> edge(4 * 3);
+    heightmap.readWindow(width - 2, -1, 1, 4, 3, edge.data());
+    EXPECT_EQ(edge[0], 0.0f);
+    EXPECT_EQ(edge[4 + 2], 0.0f);
+    EXPECT_EQ(edge[4 + 1], heightmap.value(width - 1, 0));
+    EXPECT_NEAR(edge[8], heights[static_cast<size_t>(1) * width + width - 2], 0.00101f);
+  }
+
+  TEST(CompressedHeightmapTest, eviction)
+  {
+    int width = 512;
+    int depth = 512;
+    auto heights = makeHeights(width, depth);
+    CompressedHeightmap c(width, depth, heights, 0.001f, 32, 16);
+
+    // 256 level 0 tiles won't fit in the cache but every sample must still decode correctly
+    for (int y = 0; y < depth; y += 7)
+    {
+      for (int x = 0; x < width; x += 5)
+      {
+        ASSERT_NEAR(c.sample(x, y), heights[static_cast<size_t>(y) * width + x], 0.00101f);
+      }
+    }
+    EXPECT_LE(c.m_residentTiles, 16);
+    EXPECT_EQ(c.m_cacheOrder.size(), c.m_residentTiles);
+
+    // The tiles used longest ago go first, apart from those a new tile is decoded from (here the top tile, which
+    // every level 0 tile is decoded from)
+    auto top = c.m_cacheOrder.front();
+    auto next = *std::next(c.m_cacheOrder.begin());
+    ASSERT_EQ(top.first, c.levels() - 1);
+    ASSERT_EQ(next.first, 0);
+    c.sample(1, 1);
+    EXPECT_NE(c.m_levels[top.first].decoded[top.second], nullptr);
+    EXPECT_EQ(c.m_levels[next.first].decoded[next.second], nullptr);
+    EXPECT_EQ(c.m_cacheOrder.back(), std::make_pair(0, static_cast<size_t>(0)));
+  }
+
+  TEST(CompressedHeightmapTest, warm_region)
+  {
+    int width = 256;
+    int depth = 192;
+    CompressedHeightmap c(width, depth, makeHeights(width, depth), 0.001f, 32);
+    size_t allTiles = 0;
+    for (const auto &level : c.m_levels)
+    {
+      allTiles += level.tiles.size();
+    }
+
+    // Only as many tiles as asked for, coarsest first
+    EXPECT_EQ(c.warmRegion(0, 0, width - 1, depth - 1, 1, 5), 5u);
+    EXPECT_EQ(c.stats().tilesPrefetched, 5u);
+    EXPECT_GT(c.stats().bytesPrefetched, 0u);
+    EXPECT_EQ(c.stats().tilesRequested, 0u);
+    EXPECT_TRUE(c.m_levels.back().decoded[0]);
+
+    // Then the rest
+    EXPECT_EQ(c.warmRegion(0, 0, width - 1, depth - 1, 1, 1000), allTiles - 5);
+    EXPECT_EQ(c.warmRegion(0, 0, width - 1, depth - 1, 1, 1000), 0u);
+    EXPECT_EQ(c.stats().tilesPrefetched, allTiles);
+
+    // So reading the region doesn't have to decode anything
+    size_t decoded = c.stats().tilesDecoded;
+    c.decodeRegion(0, 0, width - 1, depth - 1, 1);
+    EXPECT_EQ(c.stats().tilesDecoded, decoded);
+    EXPECT_EQ(c.stats().tilesRequested, allTiles);
+    EXPECT_EQ(c.stats().tileHits, allTiles);
+    EXPECT_EQ(c.stats().hitRate(), 1.0);
+  }
+
+  TEST(CompressedHeightmapTest, stream_tiles)
+  {
+    int width = 256;
+    int depth = 192;
+    auto heights = makeHeights(width, depth);
+    CompressedHeightmap inMemory(width, depth, heights, 0.001f, 32);
+    std::string path = (std::filesystem::temp_directory_path() / "geoclipmap_stream_tiles.bin").string();
+
+    for (auto backend : {TileReaderBackend::Pread, TileReaderBackend::IoUring})
+    {
+      // A small cache so tiles are evicted and have to be read back again
+      CompressedHeightmap streamed(width, depth, heights, 0.001f, 32, 16);
+      ASSERT_TRUE(streamed.streamTiles(path, backend, false));
+      EXPECT_FALSE(streamed.streamTiles(path, backend, false));
+      ASSERT_NE(streamed.tileReader(), nullptr);
+      for (const auto &level : streamed.m_levels)
+      {
+        for (const auto &tile : level.tiles)
+        {
+          EXPECT_TRUE(tile.bits.empty());
+        }
+      }
+
+      streamed.decodeRegion(0, 0, width - 1, depth - 1, 4);
+      for (int y = 0; y < depth; y += 3)
+      {
+        for (int x = 0; x < width; x += 5)
+        {
+          ASSERT_EQ(streamed.sample(x, y), inMemory.sample(x, y));
+        }
+      }
+      EXPECT_GT(streamed.stats().tilesRead, 0u);
+      EXPECT_GT(streamed.stats().bytesRead, 0u);
+      EXPECT_EQ(streamed.stats().readErrors, 0u);
+      // The residuals are only kept while a tile is being decoded
+      for (const auto &level : streamed.m_levels)
+      {
+        for (const auto &tile : level.tiles)
+        {
+          EXPECT_TRUE(tile.bits.empty());
+        }
+      }
+    }
+    std::filesystem::remove(path);
+
+    // A file that can't be written leaves the tiles in memory
+    CompressedHeightmap unwritable(width, depth, heights, 0.001f, 32);
+    EXPECT_FALSE(unwritable.streamTiles("/nonexistent/directory/tiles.bin", TileReaderBackend::Pread, false));
+    EXPECT_EQ(unwritable.tileReader(), nullptr);
+    EXPECT_EQ(unwritable.sample(17, 31), inMemory.sample(17, 31));
+  }
+
+  TEST(CompressedHeightmapTest, open_baked)
+  {
+    int width = 200;
+    int depth = 136;
+    auto heights = makeHeights(width, depth);
+    CompressedHeightmap original(width, depth, heights, 0.001f, 32);
+    std::string path = (std::filesystem::temp_directory_path() / "geoclipmap_open_baked.tiles").string();
+    ASSERT_TRUE(original.bake(path));
+    // The tiles start on an alignment boundary after the index, then are packed one after another
+    EXPECT_EQ(original.m_levels[0].tiles[0].offset % TileReader::k_alignment, 0u);
+    EXPECT_EQ(original.m_levels[0].tiles[1].offset, original.m_levels[0].tiles[0].offset + original.m_levels[0].tiles[0].bits.size());
+
+    auto opened = CompressedHeightmap::open(TileReader::open(path, TileReaderBackend::Pread, false), 16);
+    ASSERT_NE(opened, nullptr);
+    EXPECT_EQ(opened->width(), width);
+    EXPECT_EQ(opened->depth(), depth);
+    EXPECT_EQ(opened->tileSize(), 32);
+    EXPECT_EQ(opened->levels(), original.levels());
+    EXPECT_EQ(opened->stats().rawBytes, original.stats().rawBytes);
+    EXPECT_EQ(opened->stats().compressedBytes, original.stats().compressedBytes);
+    EXPECT_FALSE(opened->bake(path));
+
+    opened->decodeRegion(0, 0, width - 1, depth - 1, 1);
+    for (int y = 0; y < depth; y += 3)
+    {
+      for (int x = 0; x < width; x += 5)
+      {
+        ASSERT_EQ(opened->sample(x, y), original.sample(x, y));
+      }
+    }
+    EXPECT_EQ(opened->stats().readErrors, 0u);
+
+    // Anything that isn't a baked heightmap is refused
+    {
+      std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+      file.write("NOTTILES", 8);
+    }
+    EXPECT_EQ(CompressedHeightmap::open(TileReader::open(path, TileReaderBackend::Pread, false)), nullptr);
+    EXPECT_EQ(CompressedHeightmap::open(nullptr), nullptr);
+    std::filesystem::remove(path);
+  }
+
+  TEST(CompressedHeightmapTest, heightmap_compress)
+  {
+    std::vector<ngl::Vec3> data;
+    for (int i = 0; i < 64 * 64; i++)
+    {
+      data.push_back(ngl::Vec3(static_cast<ngl::Real>(i % 64) / 64.0f));
+    }
+    Heightmap h(64, 64, data);
+    ngl::Real highest = h.highestPoint();
+
+    EXPECT_EQ(h.storage(), HeightmapStorage::Colour);
+    EXPECT_EQ(h.compressionStats(), nullptr);
+
+    h.compress(0.0001f, 16);
+
+    EXPECT_EQ(h.storage(), HeightmapStorage::Compressed);
+    ASSERT_NE(h.compressionStats(), nullptr);
+    EXPECT_EQ(h.highestPoint(), highest);
+
+    h.prefetch(0, 0, 63, 63, 1);
+    for (int y = 0; y < 64; y++)
+    {
+      for (int x = 0; x < 64; x++)
+      {
+        EXPECT_NEAR(h.value(x, y), data[y * 64 + x].lengthSquared(), 0.000101f);
+        EXPECT_NEAR(h.colour(x, y).lengthSquared(), h.value(x, y), 0.00001f);
+      }
+    }
+
+    // Out of range is still 0
+    EXPECT_EQ(h.value(-1, 0), 0.0f);
+    EXPECT_EQ(h.value(0, 64), 0.0f);
+  }
+
+  TEST(CompressedHeightmapTest, failed_reads)
+  {
+    int width = 200;
+    int depth = 136;
+    auto heights = makeHeights(width, depth);
+    CompressedHeightmap original(width, depth, heights, 0.001f, 32);
+    std::string path = (std::filesystem::temp_directory_path() / "geoclipmap_failed_reads.tiles").string();
+    ASSERT_TRUE(original.bake(path));
+
+    bool offline = false;
+    auto reader = std::make_unique<FlakyReader>(TileReader::open(path, TileReaderBackend::Pread, false), &offline);
+    auto opened = CompressedHeightmap::open(std::move(reader), 64);
+    ASSERT_NE(opened, nullptr);
+    offline = true;
+
+    // Tiles that can't be read are estimated and marked failed, as is everything decoded from them
+    opened->decodeRegion(0, 0, width - 1, depth - 1, 1);
+    EXPECT_GT(opened->stats().readErrors, 0u);
+    for (const auto &level : opened->m_levels)
+    {
+      for (size_t i = 0; i < level.decoded.size(); i++)
+      {
+        ASSERT_NE(level.decoded[i], nullptr);
+        EXPECT_EQ(level.failed[i], 1);
+      }
+    }
+    // Sampling one serves the estimate without reading it again each time
+    size_t tilesRead = opened->stats().tilesRead;
+    opened->sample(3, 5);
+    opened->sample(5, 3);
+    EXPECT_EQ(opened->stats().tilesRead, tilesRead);
+
+    // Once back online, the next decode reads them again, and isn't counted as hits
+    offline = false;
+    size_t hits = opened->stats().tileHits;
+    opened->decodeRegion(0, 0, width - 1, depth - 1, 1);
+    EXPECT_EQ(opened->stats().tileHits, hits);
+    EXPECT_EQ(opened->m_residentTiles, opened->m_cacheOrder.size());
+    for (int y = 0; y < depth; y += 3)
+    {
+      for (int x = 0; x < width; x += 5)
+      {
+        ASSERT_EQ(opened->sample(x, y), original.sample(x, y));
+      }
+    }
+    for (const auto &level : opened->m_levels)
+    {
+      for (uint8_t failed : level.failed)
+      {
+        EXPECT_EQ(failed, 0);
+      }
+    }
+    std::filesystem::remove(path);
+  }
+} // end namespace geoclipmap
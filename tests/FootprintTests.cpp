@@ -52,4 +52,32 @@ namespace geoclipmap
     EXPECT_EQ(expectedIndices.size(), f.m_indexCount);
   }
 
+  TEST(FootprintTest, triangle_count)
+  {
+    // Each row of a block is a strip of 2 * width indices, ended by a restart
+    Footprint block(4, 3);
+    EXPECT_EQ(block.triangleCount(), 2u * (2u * 4u - 2u));
+    EXPECT_EQ(block.m_triangleCount, block.triangleCount());
+
+    // A ring is one strip all the way round
+    Footprint ring(4);
+    EXPECT_EQ(ring.triangleCount(), 14u);
+  }
+
+  TEST(FootprintTest, memory)
+  {
+    MemoryTracker *tracker = MemoryTracker::getInstance();
+    int64_t before = tracker->usage(MemorySubsystem::Footprints).cpuBytes;
+    {
+      // Nothing is on the GPU until the footprint is first drawn
+      Footprint block(4, 3);
+      size_t bytes = block.m_vertices.capacity() * sizeof(ngl::Vec2) + block.m_indices.capacity() * sizeof(GLuint);
+      EXPECT_GE(bytes, 12u * sizeof(ngl::Vec2) + 18u * sizeof(GLuint));
+      EXPECT_EQ(block.m_memory.cpuBytes(), bytes);
+      EXPECT_EQ(block.m_memory.gpuBytes(), 0u);
+      EXPECT_EQ(tracker->usage(MemorySubsystem::Footprints).cpuBytes, before + static_cast<int64_t>(bytes));
+    }
+    EXPECT_EQ(tracker->usage(MemorySubsystem::Footprints).cpuBytes, before);
+  }
+
 } // end namespace geoclipmap
\ No newline at end of file
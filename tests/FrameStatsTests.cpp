@@ -0,0 +1,75 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "FrameStats.h"
+
+namespace geoclipmap
+{
+  TEST(FrameStatsTest, percentiles)
+  {
+    FrameStats stats;
+    EXPECT_EQ(stats.percentile(FrameTime::Frame, 0.5), 0.0);
+
+    // 100 frames of 1 to 100ms, added out of order
+    for (int i = 0; i < 100; i++)
+    {
+      FrameTiming timing;
+      timing.frameMs = static_cast<double>((i * 37) % 100 + 1);
+      timing.cpuMs = timing.frameMs / 2.0;
+      EXPECT_EQ(stats.add(timing), static_cast<size_t>(i));
+    }
+    EXPECT_EQ(stats.frameCount(), 100u);
+    EXPECT_EQ(stats.percentile(FrameTime::Frame, 0.5), 50.0);
+    EXPECT_EQ(stats.percentile(FrameTime::Frame, 0.95), 95.0);
+    EXPECT_EQ(stats.percentile(FrameTime::Frame, 0.99), 99.0);
+    EXPECT_EQ(stats.percentile(FrameTime::Frame, 1.0), 100.0);
+    EXPECT_EQ(stats.percentile(FrameTime::Frame, 0.0), 1.0);
+    EXPECT_EQ(stats.percentile(FrameTime::Cpu, 0.5), 25.0);
+
+    // Only the frames whose GPU time has been read back count towards its percentiles
+    EXPECT_EQ(stats.percentile(FrameTime::Gpu, 0.5), 0.0);
+    stats.setGpuTime(3, 4.0);
+    stats.setGpuTime(4, 2.0);
+    stats.setGpuTime(5, 3.0);
+    stats.setGpuTime(500, 9.0);
+    EXPECT_EQ(stats.percentile(FrameTime::Gpu, 0.5), 3.0);
+    EXPECT_EQ(stats.percentile(FrameTime::Gpu, 0.99), 4.0);
+    EXPECT_EQ(stats.frame(4).gpuMs, 2.0);
+  }
+
+  TEST(FrameStatsTest, write_csv)
+  {
+    FrameStats stats;
+    FrameTiming timing;
+    timing.frameMs = 16.5;
+    timing.cpuMs = 4.25;
+    timing.uploadBytes = 3072;
+    timing.draws = 96;
+    stats.add(timing);
+    timing.gpuMs = 2.5;
+    stats.add(timing);
+
+    std::string path = (std::filesystem::temp_directory_path() / "geoclipmap_frames.csv").string();
+    ASSERT_TRUE(stats.writeCsv(path));
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    EXPECT_EQ(line, "frame,frame_ms,cpu_ms,gpu_ms,upload_bytes,draws");
+    // A GPU time that was never read back is left empty
+    std::getline(file, line);
+    EXPECT_EQ(line, "0,16.5,4.25,,3072,96");
+    std::getline(file, line);
+    EXPECT_EQ(line, "1,16.5,4.25,2.5,3072,96");
+    EXPECT_FALSE(std::getline(file, line));
+    std::filesystem::remove(path);
+
+    EXPECT_FALSE(stats.writeCsv("/nonexistent/frames.csv"));
+  }
+} // end namespace geoclipmap
@@ -0,0 +1,107 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <cmath>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "HeightQuery.h"
+#include "Manager.h"
+#include "TestHeightmaps.h"
+
+namespace geoclipmap
+{
+  TEST(HeightQueryTest, bilinear)
+  {
+    // A plane, which bilinear interpolation should give back exactly (give or take float rounding)
+    int width = 40;
+    int depth = 30;
+    std::vector<ngl::Vec3> data;
+    for (int y = 0; y < depth; y++)
+    {
+      for (int x = 0; x < width; x++)
+      {
+        data.push_back(grey(1.0f + 0.5f * x + 0.25f * y));
+      }
+    }
+    Heightmap h(static_cast<ngl::Real>(width), static_cast<ngl::Real>(depth), data);
+    HeightQuery query(&h);
+
+    std::vector<ngl::Vec2> positions{{0.0f, 0.0f}, {3.5f, 7.25f}, {10.0f, 20.0f}, {38.9f, 28.1f}, {-5.0f, 3.0f}, {12.5f, 100.0f}};
+    std::vector<ngl::Real> heights(positions.size());
+    std::vector<ngl::Vec3> normals(positions.size());
+    query.heights(positions.data(), positions.size(), heights.data(), normals.data());
+
+    for (size_t i = 0; i < 4; i++)
+    {
+      EXPECT_NEAR(heights[i], 1.0f + 0.5f * positions[i].m_x + 0.25f * positions[i].m_y, 0.0001f);
+      ngl::Real length = std::sqrt(0.5f * 0.5f + 0.25f * 0.25f + 1.0f);
+      EXPECT_NEAR(normals[i].m_x, -0.5f / length, 0.0001f);
+      EXPECT_NEAR(normals[i].m_y, -0.25f / length, 0.0001f);
+      EXPECT_NEAR(normals[i].m_z, 1.0f / length, 0.0001f);
+    }
+    // Well outside the heightmap is 0 and flat
+    EXPECT_EQ(heights[4], 0.0f);
+    EXPECT_EQ(heights[5], 0.0f);
+    EXPECT_EQ(normals[5].m_z, 1.0f);
+
+    // Halfway between samples is their average
+    ngl::Vec2 between{7.5f, 4.0f};
+    ngl::Real height;
+    query.heights(&between, 1, &height);
+    EXPECT_NEAR(height, (h.value(7, 4) + h.value(8, 4)) / 2.0f, 0.0001f);
+    EXPECT_EQ(query.residentQueries(), 0);
+  }
+
+  TEST(HeightQueryTest, resident_level)
+  {
+    Manager *manager = Manager::getInstance();
+    int64_t size = 600;
+    std::vector<ngl::Vec3> data = hills(static_cast<int>(size), static_cast<int>(size), {1.0f, 1.0f, 0.05f, 0.07f});
+    Heightmap h(static_cast<ngl::Real>(size), static_cast<ngl::Real>(size), data);
+    Terrain terrain(&h);
+    terrain.moveTo(300, 300);
+
+    // Enough positions to be split across threads, all over the heightmap and a little off it
+    std::mt19937 random(11);
+    std::uniform_real_distribution<ngl::Real> coord(-10.0f, static_cast<ngl::Real>(size) + 10.0f);
+    std::vector<ngl::Vec2> positions(50000);
+    for (auto &p : positions)
+    {
+      p = ngl::Vec2(coord(random), coord(random));
+    }
+
+    HeightQuery fromTerrain(&h, &terrain);
+    HeightQuery fromHeightmap(&h);
+    std::vector<ngl::Real> terrainHeights(positions.size());
+    std::vector<ngl::Real> heightmapHeights(positions.size());
+    fromTerrain.heights(positions.data(), positions.size(), terrainHeights.data());
+    fromHeightmap.heights(positions.data(), positions.size(), heightmapHeights.data());
+
+    // The finest level holds exactly the heightmap's samples so both agree exactly
+    EXPECT_EQ(terrainHeights, heightmapHeights);
+
+    // And the positions inside the finest level were answered from it
+    const ClipmapLevel *finest = terrain.clipmaps()[terrain.activeFinest()];
+    int64_t D = static_cast<int64_t>(manager->D());
+    size_t inside = 0;
+    for (auto &p : positions)
+    {
+      int64_t x = static_cast<int64_t>(std::floor(p.m_x));
+      int64_t y = static_cast<int64_t>(std::floor(p.m_y));
+      inside += x >= finest->originX() && y >= finest->originY() && x + 1 < finest->originX() + D && y + 1 < finest->originY() + D;
+    }
+    EXPECT_GT(inside, 0);
+    EXPECT_EQ(fromTerrain.residentQueries(), inside);
+    EXPECT_EQ(fromHeightmap.residentQueries(), 0);
+
+    // Once the finest level isn't full resolution it isn't used
+    terrain.setActiveLevels(600.0f);
+    ASSERT_NE(terrain.clipmaps()[terrain.activeFinest()]->scale(), 1);
+    fromTerrain.heights(positions.data(), positions.size(), terrainHeights.data());
+    EXPECT_EQ(fromTerrain.residentQueries(), inside);
+    EXPECT_EQ(terrainHeights, heightmapHeights);
+  }
+} // end namespace geoclipmap
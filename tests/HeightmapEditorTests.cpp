@@ -0,0 +1,233 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "HeightmapEditor.h"
+#include "Manager.h"
+#include "TestHeightmaps.h"
+
+namespace geoclipmap
+{
+  TEST(HeightmapEditorTest, brush_weights)
+  {
+    BrushArea rectangle = BrushArea::rectangle(2, 3, 5, 4);
+    EXPECT_EQ(rectangle.weight(2, 3), 1.0f);
+    EXPECT_EQ(rectangle.weight(5, 4), 1.0f);
+    EXPECT_EQ(rectangle.weight(6, 4), 0.0f);
+    EXPECT_EQ(rectangle.weight(2, 2), 0.0f);
+
+    BrushArea circle = BrushArea::circle(10.0f, 10.0f, 4.0f, 0.5f);
+    EXPECT_EQ(circle.x0, 6);
+    EXPECT_EQ(circle.y0, 6);
+    EXPECT_EQ(circle.x1, 14);
+    EXPECT_EQ(circle.y1, 14);
+    EXPECT_EQ(circle.weight(10, 10), 1.0f);
+    EXPECT_EQ(circle.weight(12, 10), 1.0f);
+    // Halfway through the falloff is half strength
+    EXPECT_NEAR(circle.weight(13, 10), 0.5f, 1e-5f);
+    EXPECT_NEAR(circle.weight(14, 10), 0.0f, 1e-5f);
+    EXPECT_EQ(circle.weight(13, 13), 0.0f);
+
+    // A hard edge is full strength right up to the radius
+    BrushArea hard = BrushArea::circle(10.0f, 10.0f, 4.0f, 0.0f);
+    EXPECT_EQ(hard.weight(14, 10), 1.0f);
+    EXPECT_EQ(hard.weight(13, 13), 0.0f);
+
+    // An empty brush covers nothing
+    BrushArea empty = BrushArea::circle(10.0f, 10.0f, 0.0f);
+    EXPECT_GT(empty.x0, empty.x1);
+  }
+
+  TEST(HeightmapEditorTest, set_and_add)
+  {
+    int width = 64;
+    int depth = 64;
+    Heightmap heightmap(width, depth, std::vector<ngl::Vec3>(static_cast<size_t>(width) * depth, grey(1.0f)));
+    HeightmapEditor editor(&heightmap);
+
+    EXPECT_TRUE(editor.set(BrushArea::rectangle(10, 10, 19, 14), 3.0f));
+    EXPECT_NEAR(heightmap.value(10, 10), 3.0f, 1e-4f);
+    EXPECT_NEAR(heightmap.value(19, 14), 3.0f, 1e-4f);
+    EXPECT_NEAR(heightmap.value(20, 14), 1.0f, 1e-4f);
+    EXPECT_NEAR(heightmap.value(19, 15), 1.0f, 1e-4f);
+    // The min/max pyramid knows about the edit straight away
+    EXPECT_NEAR(heightmap.exactHeightRange(0, 0, 63, 63).max, 3.0f, 1e-4f);
+    EXPECT_NEAR(heightmap.exactHeightRange(30, 30, 63, 63).max, 1.0f, 1e-4f);
+
+    // Half strength goes half way
+    EXPECT_TRUE(editor.set(BrushArea::rectangle(10, 10, 10, 10), 1.0f, 0.5f));
+    EXPECT_NEAR(heightmap.value(10, 10), 2.0f, 1e-4f);
+
+    // A crater is deepest in the middle and fades out to nothing at its edge
+    EXPECT_TRUE(editor.add(BrushArea::circle(40.0f, 40.0f, 6.0f), -0.5f));
+    EXPECT_NEAR(heightmap.value(40, 40), 0.5f, 1e-4f);
+    EXPECT_GT(heightmap.value(44, 40), 0.5f);
+    EXPECT_LT(heightmap.value(44, 40), 1.0f);
+    EXPECT_NEAR(heightmap.value(46, 40), 1.0f, 1e-4f);
+    EXPECT_NEAR(heightmap.exactHeightRange(30, 30, 50, 50).min, 0.5f, 1e-4f);
+
+    // Colours can't hold heights below 0
+    EXPECT_TRUE(editor.add(BrushArea::rectangle(0, 0, 3, 3), -10.0f));
+    EXPECT_EQ(heightmap.value(0, 0), 0.0f);
+
+    // Brushes are clipped to the heightmap
+    EXPECT_TRUE(editor.add(BrushArea::rectangle(-5, 60, 2, 100), 1.0f));
+    EXPECT_NEAR(heightmap.value(0, 63), 2.0f, 1e-4f);
+    EXPECT_FALSE(editor.add(BrushArea::rectangle(-5, -5, -1, -1), 1.0f));
+    EXPECT_EQ(editor.samplesEdited(), 50u + 1u + 13u * 13u + 16u + 3u * 4u);
+  }
+
+  TEST(HeightmapEditorTest, smooth_and_flatten)
+  {
+    int width = 64;
+    int depth = 64;
+    Heightmap flat(width, depth, std::vector<ngl::Vec3>(static_cast<size_t>(width) * depth, grey(1.0f)));
+    HeightmapEditor flatEditor(&flat);
+
+    // Smoothing a spike spreads it out to its neighbours
+    flat.setValue(20, 20, 10.0f);
+    EXPECT_TRUE(flatEditor.smooth(BrushArea::rectangle(18, 18, 22, 22)));
+    EXPECT_NEAR(flat.value(20, 20), 2.0f, 1e-4f);
+    EXPECT_NEAR(flat.value(21, 19), 2.0f, 1e-4f);
+    EXPECT_NEAR(flat.value(22, 20), 1.0f, 1e-4f);
+
+    // The edge of the heightmap is repeated rather than pulled down to nothing
+    EXPECT_TRUE(flatEditor.smooth(BrushArea::rectangle(0, 0, 3, 3)));
+    EXPECT_NEAR(flat.value(0, 0), 1.0f, 1e-4f);
+
+    // Flattening levels the brush at the average height under it
+    Heightmap hilly(width, depth, hills(width, depth));
+    HeightmapEditor hillyEditor(&hilly);
+    std::vector<ngl::Real> heights(100);
+    hilly.readWindow(30, 30, 1, 10, 10, heights.data());
+    ngl::Real average = 0.0f;
+    for (ngl::Real height : heights)
+    {
+      average += height / 100.0f;
+    }
+    EXPECT_TRUE(hillyEditor.flatten(BrushArea::rectangle(30, 30, 39, 39)));
+    HeightRange range = hilly.exactHeightRange(30, 30, 39, 39);
+    EXPECT_NEAR(range.min, average, 1e-3f);
+    EXPECT_NEAR(range.max, average, 1e-3f);
+    EXPECT_NE(hilly.value(40, 30), average);
+  }
+
+  TEST(HeightmapEditorTest, storage)
+  {
+    int width = 64;
+    int depth = 64;
+
+    // Quantised tiles are widened to fit edits outside their range
+    Heightmap quantised(width, depth, hills(width, depth));
+    quantised.quantise();
+    HeightmapEditor editor(&quantised);
+    EXPECT_TRUE(editor.set(BrushArea::rectangle(5, 5, 8, 8), 7.0f));
+    EXPECT_NEAR(quantised.value(6, 6), 7.0f, 1e-3f);
+    EXPECT_NEAR(quantised.exactHeightRange(0, 0, 31, 31).max, 7.0f, 1e-3f);
+
+    // Digging deep bottoms out at 0 in colours but not in quantised tiles
+    Heightmap coloured(width, depth, hills(width, depth));
+    HeightmapEditor colouredEditor(&coloured);
+    EXPECT_TRUE(colouredEditor.add(BrushArea::rectangle(40, 40, 43, 43), -100.0f));
+    EXPECT_EQ(coloured.value(41, 41), 0.0f);
+    EXPECT_EQ(coloured.exactHeightRange(40, 40, 43, 43).min, 0.0f);
+    ngl::Real before = quantised.value(41, 41);
+    EXPECT_TRUE(editor.add(BrushArea::rectangle(40, 40, 43, 43), -100.0f));
+    EXPECT_NEAR(quantised.value(41, 41), before - 100.0f, 1e-2f);
+    EXPECT_LT(quantised.exactHeightRange(40, 40, 43, 43).min, 0.0f);
+
+    // External heights belong to someone else
+    std::vector<ngl::Real> heights(static_cast<size_t>(width) * depth, 1.0f);
+    Heightmap external(width, depth, heights.data());
+    HeightmapEditor externalEditor(&external);
+    EXPECT_FALSE(externalEditor.set(BrushArea::rectangle(5, 5, 8, 8), 7.0f));
+    EXPECT_EQ(heights[6 * width + 6], 1.0f);
+    EXPECT_EQ(externalEditor.samplesEdited(), 0u);
+  }
+
+  TEST(HeightmapEditorTest, reads_only_brush)
+  {
+    int width = 512;
+    int depth = 512;
+    Heightmap heightmap(width, depth, std::vector<ngl::Vec3>(static_cast<size_t>(width) * depth, grey(1.0f)));
+    HeightmapEditor editor(&heightmap);
+
+    // However big the heightmap, an edit only reads the samples it covers
+    EXPECT_TRUE(editor.add(BrushArea::circle(100.0f, 200.0f, 3.0f), 1.0f));
+    EXPECT_EQ(editor.m_before.size(), 7u * 7u);
+    EXPECT_EQ(editor.m_after.size(), 7u * 7u);
+    EXPECT_EQ(editor.m_beforeX, 97);
+    EXPECT_EQ(editor.m_beforeY, 197);
+
+    // Smoothing reads one more sample around it, except past the heightmap's edge
+    EXPECT_TRUE(editor.smooth(BrushArea::circle(100.0f, 200.0f, 3.0f)));
+    EXPECT_EQ(editor.m_before.size(), 9u * 9u);
+    EXPECT_TRUE(editor.smooth(BrushArea::rectangle(0, 0, 4, 4)));
+    EXPECT_EQ(editor.m_beforeWidth, 6);
+    EXPECT_EQ(editor.m_beforeDepth, 6);
+  }
+
+  TEST(HeightmapEditorTest, refreshes_terrain)
+  {
+    Manager *manager = Manager::getInstance();
+    int K = manager->K();
+    int L = manager->L();
+    manager->setK(5);
+    manager->setL(4);
+
+    Heightmap heightmap(256, 256, hills(256, 256));
+    Terrain t(&heightmap);
+    t.moveTo(128, 128);
+    HeightmapEditor editor(&heightmap, &t);
+
+    // A crater and a flattened strip, then every active level still matches the heightmap
+    EXPECT_TRUE(editor.add(BrushArea::circle(130.0f, 126.0f, 9.0f), -0.4f));
+    EXPECT_TRUE(editor.flatten(BrushArea::rectangle(100, 140, 160, 143)));
+    // Every level starts active
+    for (size_t l = 0; l < t.clipmaps().size(); l++)
+    {
+      ClipmapLevel *level = t.clipmaps()[l];
+      int D = static_cast<int>(manager->D());
+      std::vector<ngl::Real> expected(static_cast<size_t>(D) * D);
+      heightmap.readWindow(level->originX() * level->scale(), level->originY() * level->scale(), level->scale(), D, D, expected.data());
+      EXPECT_EQ(level->heights(), expected) << "level " << l;
+    }
+
+    manager->setK(K);
+    manager->setL(L);
+  }
+
+  TEST(HeightmapEditorTest, refreshes_requantised_tiles)
+  {
+    Manager *manager = Manager::getInstance();
+    int K = manager->K();
+    int L = manager->L();
+    manager->setK(5);
+    manager->setL(4);
+
+    Heightmap heightmap(256, 256, hills(256, 256));
+    heightmap.quantise();
+    Terrain t(&heightmap);
+    t.moveTo(128, 128);
+    HeightmapEditor editor(&heightmap, &t);
+
+    // A spike far above its tile's range shifts every height in the tile, not just the brush's
+    EXPECT_TRUE(editor.set(BrushArea::rectangle(130, 126, 131, 127), 9.0f));
+    int D = static_cast<int>(manager->D());
+    for (size_t l = 0; l < t.clipmaps().size(); l++)
+    {
+      ClipmapLevel *level = t.clipmaps()[l];
+      std::vector<ngl::Real> expected(static_cast<size_t>(D) * D);
+      heightmap.readWindow(level->originX() * level->scale(), level->originY() * level->scale(), level->scale(), D, D, expected.data());
+      EXPECT_EQ(level->heights(), expected) << "level " << l;
+    }
+
+    manager->setK(K);
+    manager->setL(L);
+  }
+} // end namespace geoclipmap
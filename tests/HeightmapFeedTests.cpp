@@ -0,0 +1,107 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include "Heightmap.h"
+#include "HeightmapFeed.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // Each test run gets its own region so runs in parallel don't collide
+    std::string feedName()
+    {
+      return "/geoclipmap_feed_test_" + std::to_string(::getpid());
+    }
+  } // end namespace
+
+  TEST(HeightmapFeedTest, shares_heights)
+  {
+    auto writer = HeightmapFeedWriter::create(feedName(), 40, 30);
+    ASSERT_NE(writer, nullptr);
+    auto feed = HeightmapFeed::open(feedName());
+    ASSERT_NE(feed, nullptr);
+    EXPECT_EQ(feed->width(), 40);
+    EXPECT_EQ(feed->depth(), 30);
+    EXPECT_EQ(feed->heights()[0], 0.0f);
+
+    // Nothing has been published yet
+    std::vector<DirtyRect> rects;
+    EXPECT_FALSE(feed->poll(rects));
+    EXPECT_TRUE(rects.empty());
+
+    // The reader sees the writer's heights in place, with nothing copied
+    writer->heights()[5 * 40 + 7] = 2.5f;
+    EXPECT_EQ(feed->heights()[5 * 40 + 7], 2.5f);
+    Heightmap heightmap(feed->width(), feed->depth(), feed->heights());
+    EXPECT_EQ(heightmap.value(7, 5), 2.5f);
+
+    // Updates arrive in order, clamped to the heightmap
+    EXPECT_EQ(writer->publish(7, 5, 7, 5), 1u);
+    EXPECT_EQ(writer->publish(-10, 20, 100, 25), 2u);
+    ASSERT_TRUE(feed->poll(rects));
+    ASSERT_EQ(rects.size(), 2u);
+    EXPECT_EQ(rects[0].x0, 7);
+    EXPECT_EQ(rects[0].y1, 5);
+    EXPECT_EQ(rects[1].x0, 0);
+    EXPECT_EQ(rects[1].y0, 20);
+    EXPECT_EQ(rects[1].x1, 39);
+    EXPECT_EQ(rects[1].y1, 25);
+    EXPECT_EQ(feed->sequence(), 2u);
+    EXPECT_FALSE(feed->poll(rects));
+  }
+
+  TEST(HeightmapFeedTest, falls_behind)
+  {
+    auto writer = HeightmapFeedWriter::create(feedName(), 16, 16, 8);
+    ASSERT_NE(writer, nullptr);
+    auto feed = HeightmapFeed::open(feedName());
+    ASSERT_NE(feed, nullptr);
+
+    // A ring's worth of updates can still be read one by one
+    std::vector<DirtyRect> rects;
+    for (int i = 0; i < 8; i++)
+    {
+      writer->publish(i, i, i, i);
+    }
+    ASSERT_TRUE(feed->poll(rects));
+    ASSERT_EQ(rects.size(), 8u);
+    EXPECT_EQ(rects[7].x0, 7);
+
+    // Any more and the oldest have been overwritten, so the whole heightmap might have changed
+    for (int i = 0; i < 9; i++)
+    {
+      writer->publish(i, i, i, i);
+    }
+    ASSERT_TRUE(feed->poll(rects));
+    ASSERT_EQ(rects.size(), 1u);
+    EXPECT_EQ(rects[0].x0, 0);
+    EXPECT_EQ(rects[0].y0, 0);
+    EXPECT_EQ(rects[0].x1, 15);
+    EXPECT_EQ(rects[0].y1, 15);
+    EXPECT_EQ(feed->sequence(), 17u);
+  }
+
+  TEST(HeightmapFeedTest, missing)
+  {
+    EXPECT_EQ(HeightmapFeed::open("/geoclipmap_feed_test_missing"), nullptr);
+    EXPECT_EQ(HeightmapFeedWriter::create(feedName(), 0, 16), nullptr);
+
+    // The region goes once its writer does, though a reader that has it mapped keeps it
+    auto writer = HeightmapFeedWriter::create(feedName(), 4, 4);
+    ASSERT_NE(writer, nullptr);
+    auto feed = HeightmapFeed::open(feedName());
+    ASSERT_NE(feed, nullptr);
+    writer->heights()[3] = 1.0f;
+    writer.reset();
+    EXPECT_EQ(HeightmapFeed::open(feedName()), nullptr);
+    EXPECT_EQ(feed->heights()[3], 1.0f);
+  }
+} // end namespace geoclipmap
@@ -0,0 +1,229 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "HeightmapMosaic.h"
+#include "Manager.h"
+#include "Terrain.h"
+#include "TestHeightmaps.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    std::unique_ptr<Heightmap> flat(int _width, int _depth, ngl::Real _height)
+    {
+      return std::make_unique<Heightmap>(_width, _depth, std::vector<ngl::Vec3>(static_cast<size_t>(_width) * _depth, grey(_height)));
+    }
+
+    std::unique_ptr<Heightmap> hillsHeightmap(int _width, int _depth)
+    {
+      return std::make_unique<Heightmap>(_width, _depth, hills(_width, _depth, {1.0f, 0.6f, 0.3f, 0.2f}));
+    }
+  } // end namespace
+
+  TEST(HeightmapMosaicTest, base)
+  {
+    Heightmap *base = hillsHeightmap(16, 12).release();
+    std::unique_ptr<Heightmap> owned(base);
+    ngl::Real corner = base->value(15, 11);
+    ngl::Real a = base->value(3, 5);
+    ngl::Real b = base->value(4, 5);
+    ngl::Real c = base->value(3, 6);
+    ngl::Real d = base->value(4, 6);
+    HeightmapMosaic mosaic(std::move(owned), 4);
+
+    // The last base sample is on the mosaic's edge
+    EXPECT_EQ(mosaic.width(), 61);
+    EXPECT_EQ(mosaic.depth(), 45);
+    EXPECT_EQ(mosaic.sourceCount(), 1u);
+    EXPECT_EQ(mosaic.storedSamples(), 16u * 12u);
+    EXPECT_NEAR(mosaic.sample(60, 44), corner, 1e-5f);
+    EXPECT_NEAR(mosaic.sample(12, 20), a, 1e-5f);
+    EXPECT_EQ(mosaic.sample(61, 44), 0.0f);
+    EXPECT_EQ(mosaic.sample(-1, 0), 0.0f);
+
+    // Heights between the base's samples are interpolated
+    EXPECT_NEAR(mosaic.sample(14, 20), 0.5f * (a + b), 1e-5f);
+    EXPECT_NEAR(mosaic.sample(13, 23), 0.0625f * (3.0f * a + b + 9.0f * c + 3.0f * d), 1e-5f);
+  }
+
+  TEST(HeightmapMosaicTest, feathered_inset)
+  {
+    HeightmapMosaic mosaic(flat(33, 33, 1.0f), 4);
+    // 129 mosaic samples across with an inset of 65 samples at 32, 32
+    EXPECT_TRUE(mosaic.addInset(flat(65, 65, 3.0f), 32, 32, 1, 8));
+    EXPECT_EQ(mosaic.storedSamples(), 33u * 33u + 65u * 65u);
+
+    // The inset is used everywhere inside its feather
+    EXPECT_NEAR(mosaic.sample(64, 64), 3.0f, 1e-5f);
+    EXPECT_NEAR(mosaic.sample(40, 40), 3.0f, 1e-5f);
+    EXPECT_NEAR(mosaic.sample(96, 60), 1.0f, 1e-5f);
+    // It fades into the base over the feather
+    EXPECT_NEAR(mosaic.sample(36, 64), 2.0f, 1e-5f);
+    EXPECT_GT(mosaic.sample(34, 64), 1.0f);
+    EXPECT_LT(mosaic.sample(34, 64), 2.0f);
+    // So there is no step at its edge
+    EXPECT_NEAR(mosaic.sample(32, 64), 1.0f, 1e-5f);
+    EXPECT_NEAR(mosaic.sample(31, 64), 1.0f, 1e-5f);
+    EXPECT_NEAR(mosaic.sample(10, 10), 1.0f, 1e-5f);
+
+    // A hard edge switches straight to the inset
+    HeightmapMosaic hard(flat(33, 33, 1.0f), 4);
+    EXPECT_TRUE(hard.addInset(flat(65, 65, 3.0f), 32, 32, 1, 0));
+    EXPECT_NEAR(hard.sample(32, 64), 3.0f, 1e-5f);
+    EXPECT_NEAR(hard.sample(31, 64), 1.0f, 1e-5f);
+  }
+
+  TEST(HeightmapMosaicTest, finest_first)
+  {
+    HeightmapMosaic mosaic(flat(33, 33, 1.0f), 4);
+    // A coarse inset added after a fine one it overlaps is still read after it
+    EXPECT_TRUE(mosaic.addInset(flat(9, 9, 4.0f), 40, 40, 1, 0));
+    EXPECT_TRUE(mosaic.addInset(flat(33, 33, 2.0f), 32, 32, 2, 0));
+    EXPECT_TRUE(mosaic.addInset(flat(9, 9, 5.0f), 60, 60, 1, 0));
+    ASSERT_EQ(mosaic.sourceCount(), 4u);
+    EXPECT_EQ(mosaic.m_sources[0].x0, 60);
+    EXPECT_EQ(mosaic.m_sources[1].x0, 40);
+    EXPECT_EQ(mosaic.m_sources[2].spacing, 2);
+    EXPECT_EQ(mosaic.m_sources[3].spacing, 4);
+
+    EXPECT_NEAR(mosaic.sample(44, 44), 4.0f, 1e-5f);
+    EXPECT_NEAR(mosaic.sample(64, 64), 5.0f, 1e-5f);
+    EXPECT_NEAR(mosaic.sample(52, 44), 2.0f, 1e-5f);
+    EXPECT_NEAR(mosaic.sample(20, 20), 1.0f, 1e-5f);
+
+    // Insets have to be on the mosaic's grid, within it and no coarser than the base
+    EXPECT_FALSE(mosaic.addInset(flat(9, 9, 1.0f), 1, 0, 2));
+    EXPECT_FALSE(mosaic.addInset(flat(9, 9, 1.0f), 0, 0, 3));
+    EXPECT_FALSE(mosaic.addInset(flat(9, 9, 1.0f), 0, 0, 8));
+    EXPECT_FALSE(mosaic.addInset(flat(9, 9, 1.0f), 121, 0, 1));
+    EXPECT_FALSE(mosaic.addInset(flat(9, 9, 1.0f), -4, 0, 1));
+    EXPECT_FALSE(mosaic.addInset(nullptr, 0, 0, 1));
+    EXPECT_EQ(mosaic.sourceCount(), 4u);
+  }
+
+  TEST(HeightmapMosaicTest, read_row)
+  {
+    HeightmapMosaic mosaic(hillsHeightmap(40, 40), 8);
+    EXPECT_TRUE(mosaic.addInset(hillsHeightmap(50, 30), 64, 96, 2, 12));
+    EXPECT_TRUE(mosaic.addInset(hillsHeightmap(40, 40), 100, 110, 1, 6));
+
+    // Reading a row gives the same as reading each sample, whichever stride and offset it is read at
+    std::vector<ngl::Real> row(200);
+    for (int stride : {1, 2, 3, 4, 8, 16})
+    {
+      for (int64_t x : {-13, 0, 5, 64, 99})
+      {
+        for (int64_t y : {0, 97, 100, 111, 130, 312})
+        {
+          mosaic.readRow(x, y, stride, 200, row.data());
+          for (int i = 0; i < 200; i++)
+          {
+            ASSERT_NEAR(row[i], mosaic.sample(x + static_cast<int64_t>(i) * stride, y), 1e-5f)
+                << "stride " << stride << " x " << x << " y " << y << " sample " << i;
+          }
+        }
+      }
+    }
+  }
+
+  TEST(HeightmapMosaicTest, heightmap)
+  {
+    Manager *manager = Manager::getInstance();
+    int K = manager->K();
+    int L = manager->L();
+    manager->setK(5);
+    manager->setL(4);
+
+    auto mosaic = std::make_unique<HeightmapMosaic>(hillsHeightmap(33, 33), 8);
+    EXPECT_TRUE(mosaic->addInset(flat(64, 64, 2.5f), 100, 100, 1));
+    HeightmapMosaic *sources = mosaic.get();
+    Heightmap heightmap(std::move(mosaic));
+    EXPECT_EQ(heightmap.storage(), HeightmapStorage::Mosaic);
+    EXPECT_EQ(heightmap.width(), 257.0f);
+    EXPECT_EQ(heightmap.depth(), 257.0f);
+    EXPECT_TRUE(heightmap.concurrentReads());
+    EXPECT_NEAR(heightmap.value(120, 120), 2.5f, 1e-5f);
+    EXPECT_EQ(heightmap.value(120, 120), sources->sample(120, 120));
+    EXPECT_NEAR(heightmap.exactHeightRange(110, 110, 150, 150).max, 2.5f, 1e-5f);
+
+    // Mosaics can't be edited
+    heightmap.setValue(120, 120, 7.0f);
+    EXPECT_NEAR(heightmap.value(120, 120), 2.5f, 1e-5f);
+
+    // Every level of a terrain over the mosaic reads it like any other heightmap
+    Terrain t(&heightmap);
+    t.moveTo(128, 128);
+    int D = static_cast<int>(manager->D());
+    for (size_t l = 0; l < t.clipmaps().size(); l++)
+    {
+      ClipmapLevel *level = t.clipmaps()[l];
+      std::vector<ngl::Real> expected(static_cast<size_t>(D) * D);
+      for (int j = 0; j < D; j++)
+      {
+        sources->readRow(level->originX() * level->scale(), (level->originY() + j) * level->scale(), level->scale(), D,
+                         expected.data() + static_cast<size_t>(j) * D);
+      }
+      EXPECT_EQ(level->heights(), expected) << "level " << l;
+    }
+
+    // Compressed sources can only be read from one thread at a time
+    auto compressed = std::make_unique<HeightmapMosaic>(hillsHeightmap(33, 33), 8);
+    auto inset = hillsHeightmap(32, 32);
+    inset->compress(1e-3f);
+    EXPECT_TRUE(compressed->addInset(std::move(inset), 0, 0, 1));
+    Heightmap compressedHeightmap(std::move(compressed));
+    EXPECT_FALSE(compressedHeightmap.concurrentReads());
+
+    manager->setK(K);
+    manager->setL(L);
+  }
+
+  TEST(HeightmapMosaicTest, read_layers)
+  {
+    std::filesystem::path directory = std::filesystem::temp_directory_path();
+    std::string path = (directory / "geoclipmap_layers.mosaic").string();
+    {
+      std::ofstream file(path);
+      file << "# A global base with two surveys\n"
+           << "base world.png 16\n"
+           << "\n"
+           << "inset valley.png 512 256 2\n"
+           << "inset /data/peak.png 640 320 1 32\n";
+    }
+    std::vector<MosaicLayer> layers;
+    ASSERT_TRUE(HeightmapMosaic::readLayers(path, layers));
+    ASSERT_EQ(layers.size(), 3u);
+    EXPECT_EQ(layers[0].image, (directory / "world.png").string());
+    EXPECT_EQ(layers[0].spacing, 16);
+    EXPECT_EQ(layers[1].image, (directory / "valley.png").string());
+    EXPECT_EQ(layers[1].x, 512);
+    EXPECT_EQ(layers[1].y, 256);
+    EXPECT_EQ(layers[1].spacing, 2);
+    EXPECT_EQ(layers[1].feather, 16);
+    EXPECT_EQ(layers[2].image, "/data/peak.png");
+    EXPECT_EQ(layers[2].feather, 32);
+
+    // The base has to come first
+    {
+      std::ofstream file(path);
+      file << "inset valley.png 512 256 2\n";
+    }
+    EXPECT_FALSE(HeightmapMosaic::readLayers(path, layers));
+    {
+      std::ofstream file(path);
+      file << "base world.png\n";
+    }
+    EXPECT_FALSE(HeightmapMosaic::readLayers(path, layers));
+    EXPECT_FALSE(HeightmapMosaic::readLayers("/nonexistent/layers.mosaic", layers));
+    std::filesystem::remove(path);
+  }
+} // end namespace geoclipmap
@@ -0,0 +1,234 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "HeightmapSequence.h"
+#include "Manager.h"
+#include "Terrain.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // Rolling hills with a mound at _x, _y, like a dune moving across them
+    std::vector<ngl::Real> dunes(int _width, int _depth, ngl::Real _x, ngl::Real _y)
+    {
+      std::vector<ngl::Real> heights;
+      for (int y = 0; y < _depth; y++)
+      {
+        for (int x = 0; x < _width; x++)
+        {
+          ngl::Real distance = std::hypot(x - _x, y - _y) / 10.0f;
+          ngl::Real mound = distance < 1.0f ? 0.5f * (1.0f + std::cos(distance * static_cast<ngl::Real>(M_PI))) : 0.0f;
+          heights.push_back(1.0f + 0.4f * std::sin(x * 0.1f) * std::cos(y * 0.07f) + mound);
+        }
+      }
+      return heights;
+    }
+  } // end namespace
+
+  TEST(HeightmapSequenceTest, round_trip)
+  {
+    std::string path = (std::filesystem::temp_directory_path() / "geoclipmap_round_trip.gcseq").string();
+    int width = 100;
+    int depth = 70;
+    ngl::Real step = 1.0f / 512.0f;
+    std::vector<std::vector<ngl::Real>> frames;
+    for (int f = 0; f < 6; f++)
+    {
+      frames.push_back(dunes(width, depth, 20.0f + f * 12.0f, 30.0f));
+    }
+    {
+      auto writer = HeightmapSequenceWriter::create(path, width, depth, step, 25.0f, 32);
+      ASSERT_NE(writer, nullptr);
+      for (const auto &frame : frames)
+      {
+        EXPECT_TRUE(writer->addFrame(frame.data()));
+      }
+      // The first frame stores all 4x3 tiles, later ones only the tiles the mound moved through
+      EXPECT_GT(writer->tilesWritten(), 12u);
+      EXPECT_LT(writer->tilesWritten(), 12u * 6u);
+      EXPECT_TRUE(writer->finish());
+    }
+
+    auto sequence = HeightmapSequence::open(path, 2);
+    ASSERT_NE(sequence, nullptr);
+    EXPECT_EQ(sequence->width(), width);
+    EXPECT_EQ(sequence->depth(), depth);
+    EXPECT_EQ(sequence->frameCount(), 6);
+    EXPECT_EQ(sequence->frameRate(), 25.0f);
+
+    // Every frame is within half a step of the original, however many frames came before it
+    std::vector<DirtyRect> rects;
+    for (int f = 0; f < 6; f++)
+    {
+      if (f > 0)
+      {
+        EXPECT_TRUE(sequence->step(rects));
+        EXPECT_FALSE(rects.empty());
+        for (const auto &rect : rects)
+        {
+          EXPECT_GE(rect.x1, rect.x0);
+          EXPECT_LT(rect.x1, width);
+          EXPECT_LT(rect.y1, depth);
+        }
+      }
+      EXPECT_EQ(sequence->frame(), f);
+      ngl::Real worst = 0.0f;
+      for (size_t i = 0; i < frames[f].size(); i++)
+      {
+        worst = std::max(worst, std::abs(sequence->heights()[i] - frames[f][i]));
+      }
+      EXPECT_LE(worst, step * 0.5f + 1e-5f) << "frame " << f;
+    }
+
+    // After the last frame it goes back to the first, which changes everything
+    EXPECT_TRUE(sequence->step(rects));
+    EXPECT_EQ(sequence->frame(), 0);
+    ASSERT_EQ(rects.size(), 1u);
+    EXPECT_EQ(rects[0].x1, width - 1);
+    EXPECT_EQ(rects[0].y1, depth - 1);
+    EXPECT_NEAR(sequence->heights()[5], frames[0][5], step);
+    sequence.reset();
+    std::filesystem::remove(path);
+  }
+
+  TEST(HeightmapSequenceTest, changed_tiles)
+  {
+    std::string path = (std::filesystem::temp_directory_path() / "geoclipmap_changed_tiles.gcseq").string();
+    int width = 64;
+    int depth = 64;
+    std::vector<ngl::Real> heights(static_cast<size_t>(width) * depth, 1.0f);
+    {
+      auto writer = HeightmapSequenceWriter::create(path, width, depth, 1.0f / 256.0f, 10.0f, 16);
+      ASSERT_NE(writer, nullptr);
+      writer->addFrame(heights.data());
+      EXPECT_EQ(writer->tilesWritten(), 16u);
+
+      // A change within one tile only stores that tile
+      heights[20 * width + 40] = 2.0f;
+      writer->addFrame(heights.data());
+      EXPECT_EQ(writer->tilesWritten(), 17u);
+
+      // Changes smaller than half a step aren't stored at all
+      heights[3] = 1.001f;
+      writer->addFrame(heights.data());
+      EXPECT_EQ(writer->tilesWritten(), 17u);
+
+      // Changes in neighbouring tiles along a row
+      heights[50 * width + 10] = 3.0f;
+      heights[50 * width + 20] = 3.0f;
+      writer->addFrame(heights.data());
+    }
+
+    auto sequence = HeightmapSequence::open(path, 8);
+    ASSERT_NE(sequence, nullptr);
+    // Only as many frames as there are after the current one are decoded ahead
+    EXPECT_EQ(sequence->m_pending.size(), 3u);
+    EXPECT_EQ(sequence->m_pending.front().frame, 1);
+
+    std::vector<DirtyRect> rects;
+    EXPECT_TRUE(sequence->step(rects));
+    ASSERT_EQ(rects.size(), 1u);
+    EXPECT_EQ(rects[0].x0, 32);
+    EXPECT_EQ(rects[0].y0, 16);
+    EXPECT_EQ(rects[0].x1, 47);
+    EXPECT_EQ(rects[0].y1, 31);
+    EXPECT_EQ(sequence->heights()[20 * width + 40], 2.0f);
+    EXPECT_EQ(sequence->heights()[20 * width + 41], 1.0f);
+
+    EXPECT_FALSE(sequence->step(rects));
+    EXPECT_TRUE(rects.empty());
+    EXPECT_EQ(sequence->frame(), 2);
+
+    // Neighbouring tiles are joined into one rectangle
+    EXPECT_TRUE(sequence->step(rects));
+    ASSERT_EQ(rects.size(), 1u);
+    EXPECT_EQ(rects[0].x0, 0);
+    EXPECT_EQ(rects[0].y0, 48);
+    EXPECT_EQ(rects[0].x1, 31);
+    EXPECT_EQ(rects[0].y1, 63);
+    sequence.reset();
+    std::filesystem::remove(path);
+  }
+
+  TEST(HeightmapSequenceTest, refreshes_terrain)
+  {
+    std::string path = (std::filesystem::temp_directory_path() / "geoclipmap_sequence_terrain.gcseq").string();
+    int size = 256;
+    {
+      auto writer = HeightmapSequenceWriter::create(path, size, size);
+      ASSERT_NE(writer, nullptr);
+      for (int f = 0; f < 3; f++)
+      {
+        writer->addFrame(dunes(size, size, 100.0f + f * 8.0f, 120.0f).data());
+      }
+    }
+
+    // The heightmap reads the sequence's heights in place
+    auto sequence = HeightmapSequence::open(path);
+    ASSERT_NE(sequence, nullptr);
+    Heightmap heightmap(sequence->width(), sequence->depth(), sequence->heights());
+    Terrain t(&heightmap);
+    t.moveTo(128, 128);
+
+    std::vector<DirtyRect> rects;
+    for (int f = 0; f < 2; f++)
+    {
+      ASSERT_TRUE(sequence->step(rects));
+      for (const auto &rect : rects)
+      {
+        heightmap.heightsChanged(rect.x0, rect.y0, rect.x1, rect.y1);
+        t.refreshRegion(rect.x0, rect.y0, rect.x1, rect.y1);
+      }
+    }
+
+    int D = static_cast<int>(Manager::getInstance()->D());
+    for (size_t l = 0; l < t.clipmaps().size(); l++)
+    {
+      ClipmapLevel *level = t.clipmaps()[l];
+      std::vector<ngl::Real> expected(static_cast<size_t>(D) * D);
+      heightmap.readWindow(level->originX() * level->scale(), level->originY() * level->scale(), level->scale(), D, D, expected.data());
+      EXPECT_EQ(level->heights(), expected) << "level " << l;
+    }
+    // The min/max pyramid follows the sequence too
+    const ngl::Real *heights = sequence->heights();
+    EXPECT_EQ(heightmap.heightRanges().total().max, *std::max_element(heights, heights + size * size));
+    sequence.reset();
+    std::filesystem::remove(path);
+  }
+
+  TEST(HeightmapSequenceTest, invalid)
+  {
+    EXPECT_EQ(HeightmapSequence::open("/nonexistent/sequence.gcseq"), nullptr);
+    EXPECT_EQ(HeightmapSequenceWriter::create("/nonexistent/sequence.gcseq", 16, 16), nullptr);
+    EXPECT_EQ(HeightmapSequenceWriter::create("unused.gcseq", 0, 16), nullptr);
+
+    std::string path = (std::filesystem::temp_directory_path() / "geoclipmap_invalid.gcseq").string();
+    {
+      std::ofstream file(path, std::ios::binary);
+      std::vector<char> junk(200, 'x');
+      file.write(junk.data(), static_cast<std::streamsize>(junk.size()));
+    }
+    EXPECT_EQ(HeightmapSequence::open(path), nullptr);
+
+    // A sequence cut short loses its index
+    {
+      auto writer = HeightmapSequenceWriter::create(path, 16, 16);
+      std::vector<ngl::Real> heights(256, 1.0f);
+      writer->addFrame(heights.data());
+      writer->finish();
+    }
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 8);
+    EXPECT_EQ(HeightmapSequence::open(path), nullptr);
+    std::filesystem::remove(path);
+  }
+} // end namespace geoclipmap
@@ -2,6 +2,7 @@
 #define TERRAIN_TESTING
 #endif
 
+#include <algorithm>
 #include <cmath>
 
 #include <gtest/gtest.h>
@@ -52,4 +53,332 @@ namespace geoclipmap
 
     EXPECT_EQ(h.highestPoint(), pow(15.0f, 2) * 3);
   }
-} // end namespace geoclipmap
\ No newline at end of file
+
+  TEST(HeightmapTest, layouts)
+  {
+    // Not a multiple of the tile size so the edge tiles are padded
+    int width = 70;
+    int depth = 45;
+    std::vector<ngl::Vec3> data;
+    for (int i = 0; i < width * depth; i++)
+    {
+      data.push_back(ngl::Vec3(static_cast<ngl::Real>(i % 97) / 97.0f, 0.0f, static_cast<ngl::Real>(i) / (width * depth)));
+    }
+    Heightmap h(static_cast<ngl::Real>(width), static_cast<ngl::Real>(depth), data);
+
+    EXPECT_EQ(h.layout(), HeightmapLayout::RowMajor);
+    EXPECT_EQ(h.m_data.size(), data.size());
+
+    for (auto layout : {HeightmapLayout::Tiled, HeightmapLayout::Morton, HeightmapLayout::RowMajor})
+    {
+      h.setLayout(layout);
+      EXPECT_EQ(h.layout(), layout);
+
+      for (int y = 0; y < depth; y++)
+      {
+        for (int x = 0; x < width; x++)
+        {
+          ASSERT_EQ(h.colour(x, y), data[y * width + x]);
+          ASSERT_EQ(h.value(x, y), data[y * width + x].lengthSquared());
+        }
+      }
+    }
+
+    // 3x2 tiles of 32x32
+    h.setLayout(HeightmapLayout::Tiled);
+    EXPECT_EQ(h.m_data.size(), static_cast<size_t>(3 * 2 * 32 * 32));
+    EXPECT_EQ(h.index(33, 0, HeightmapLayout::Tiled), static_cast<size_t>(32 * 32 + 1));
+    EXPECT_EQ(h.index(0, 1, HeightmapLayout::Tiled), static_cast<size_t>(32));
+
+    // Z-order inside each tile
+    EXPECT_EQ(h.index(1, 0, HeightmapLayout::Morton), static_cast<size_t>(1));
+    EXPECT_EQ(h.index(0, 1, HeightmapLayout::Morton), static_cast<size_t>(2));
+    EXPECT_EQ(h.index(1, 1, HeightmapLayout::Morton), static_cast<size_t>(3));
+    EXPECT_EQ(h.index(2, 0, HeightmapLayout::Morton), static_cast<size_t>(4));
+    EXPECT_EQ(h.index(31, 31, HeightmapLayout::Morton), static_cast<size_t>(32 * 32 - 1));
+    EXPECT_EQ(h.index(0, 32, HeightmapLayout::Morton), static_cast<size_t>(3 * 32 * 32));
+  }
+
+  TEST(HeightmapTest, readRow)
+  {
+    int width = 100;
+    int depth = 40;
+    std::vector<ngl::Vec3> data;
+    for (int i = 0; i < width * depth; i++)
+    {
+      data.push_back(ngl::Vec3(static_cast<ngl::Real>(i) / (width * depth)));
+    }
+    Heightmap h(static_cast<ngl::Real>(width), static_cast<ngl::Real>(depth), data);
+
+    for (auto layout : {HeightmapLayout::RowMajor, HeightmapLayout::Tiled, HeightmapLayout::Morton})
+    {
+      h.setLayout(layout);
+
+      // Rows inside, partly outside and completely outside the heightmap at different strides
+      for (int stride : {1, 2, 4, 16})
+      {
+        for (int y : {-1, 0, 17, depth - 1, depth})
+        {
+          for (int x : {-70, -5, 0, 3, 90, width})
+          {
+            std::vector<ngl::Real> row(20, -1.0f);
+            h.readRow(x, y, stride, static_cast<int>(row.size()), row.data());
+            for (int i = 0; i < static_cast<int>(row.size()); i++)
+            {
+              ASSERT_EQ(row[i], h.value(x + i * stride, y)) << "stride " << stride << " at " << x << ", " << y;
+            }
+          }
+        }
+      }
+    }
+
+    // Windows read tile by tile match reading each sample
+    for (auto layout : {HeightmapLayout::RowMajor, HeightmapLayout::Tiled, HeightmapLayout::Morton})
+    {
+      h.setLayout(layout);
+
+      for (int stride : {1, 3, 8})
+      {
+        for (int start : {-40, -1, 0, 30})
+        {
+          std::vector<ngl::Real> window(24 * 17, -1.0f);
+          h.readWindow(start, start / 2, stride, 24, 17, window.data());
+          for (int j = 0; j < 17; j++)
+          {
+            for (int i = 0; i < 24; i++)
+            {
+              ASSERT_EQ(window[j * 24 + i], h.value(start + i * stride, start / 2 + j * stride))
+                  << "stride " << stride << " at " << start << " sample " << i << ", " << j;
+            }
+          }
+        }
+      }
+    }
+
+    // Compressed heightmaps read the same rows from the compressed heights
+    h.compress(0.0001f, 16);
+    std::vector<ngl::Real> row(30);
+    h.readRow(-3, 5, 4, static_cast<int>(row.size()), row.data());
+    for (int i = 0; i < static_cast<int>(row.size()); i++)
+    {
+      EXPECT_EQ(row[i], h.value(-3 + i * 4, 5));
+    }
+  }
+
+  TEST(HeightmapTest, quantise)
+  {
+    // Two tiles with very different ranges of heights
+    int width = 64;
+    int depth = 40;
+    std::vector<ngl::Vec3> data;
+    for (int y = 0; y < depth; y++)
+    {
+      for (int x = 0; x < width; x++)
+      {
+        ngl::Real grey = x < 32 ? 0.5f + 0.001f * std::sin(x * 0.3f + y * 0.2f) : static_cast<ngl::Real>(x + y) / (width + depth);
+        data.push_back(ngl::Vec3(grey));
+      }
+    }
+
+    for (auto layout : {HeightmapLayout::RowMajor, HeightmapLayout::Morton})
+    {
+      Heightmap h(static_cast<ngl::Real>(width), static_cast<ngl::Real>(depth), data);
+      h.setLayout(layout);
+      EXPECT_EQ(h.quantisationStats(), nullptr);
+
+      h.quantise();
+
+      EXPECT_EQ(h.storage(), HeightmapStorage::Quantised);
+      EXPECT_TRUE(h.m_data.empty());
+      EXPECT_EQ(h.m_quantisedTiles.size(), static_cast<size_t>(2 * 2));
+      ASSERT_NE(h.quantisationStats(), nullptr);
+      auto stats = h.quantisationStats();
+      // 6 times smaller than the colours (including any padding of the layout), plus a little for each tile's scale
+      // and offset
+      EXPECT_EQ(stats->rawBytes, h.m_quantised.size() * sizeof(ngl::Vec3));
+      EXPECT_EQ(stats->quantisedBytes, h.m_quantised.size() * sizeof(uint16_t) + 4 * 2 * sizeof(ngl::Real));
+      EXPECT_LE(stats->rmsError, stats->maxError);
+
+      // Each tile's error is at most half its own quantisation step, so the flat tile is much more accurate
+      ngl::Real maxFlatError = 0.0f;
+      ngl::Real highest = 0.0f;
+      for (int y = 0; y < depth; y++)
+      {
+        for (int x = 0; x < width; x++)
+        {
+          ngl::Real height = data[y * width + x].lengthSquared();
+          ngl::Real error = std::abs(h.value(x, y) - height);
+          ASSERT_LE(error, stats->maxError);
+          ASSERT_LE(error, 3.0f / 65535.0f);
+          if (x < 32)
+          {
+            maxFlatError = std::max(maxFlatError, error);
+          }
+          highest = std::max(highest, h.value(x, y));
+          EXPECT_NEAR(h.colour(x, y).lengthSquared(), h.value(x, y), 0.00001f);
+        }
+      }
+      EXPECT_LT(maxFlatError, 0.01f / 65535.0f);
+      EXPECT_EQ(h.highestPoint(), highest);
+
+      // Rows and windows read the quantised heights directly
+      std::vector<ngl::Real> window(20 * 15);
+      h.readWindow(-5, 3, 3, 20, 15, window.data());
+      for (int j = 0; j < 15; j++)
+      {
+        for (int i = 0; i < 20; i++)
+        {
+          ASSERT_EQ(window[j * 20 + i], h.value(-5 + i * 3, 3 + j * 3));
+        }
+      }
+
+      // And changing layout keeps the same heights
+      std::vector<ngl::Real> before(width * depth);
+      h.readWindow(0, 0, 1, width, depth, before.data());
+      h.setLayout(HeightmapLayout::Tiled);
+      std::vector<ngl::Real> after(width * depth);
+      h.readWindow(0, 0, 1, width, depth, after.data());
+      EXPECT_EQ(before, after);
+    }
+  }
+
+  TEST(HeightmapTest, large_index)
+  {
+    std::vector<ngl::Vec3> data(16);
+    Heightmap h(4, 4, data);
+
+    // Indices only depend on the dimensions, so pretend this is 2^20 samples per side to check nothing overflows
+    h.m_width = static_cast<int64_t>(1) << 20;
+    h.m_depth = static_cast<int64_t>(1) << 20;
+    h.m_tilesX = h.m_width / 32;
+    int64_t x = h.m_width - 1;
+    int64_t y = h.m_depth - 1;
+
+    EXPECT_EQ(h.index(x, y, HeightmapLayout::RowMajor), static_cast<size_t>((static_cast<int64_t>(1) << 40) - 1));
+    EXPECT_EQ(h.index(x, y, HeightmapLayout::Tiled), static_cast<size_t>((static_cast<int64_t>(1) << 40) - 1));
+    EXPECT_EQ(h.index(x, y, HeightmapLayout::Morton), static_cast<size_t>((static_cast<int64_t>(1) << 40) - 1));
+  }
+
+  TEST(HeightmapTest, set_values)
+  {
+    int width = 70;
+    int depth = 50;
+    std::vector<ngl::Vec3> data;
+    for (int y = 0; y < depth; y++)
+    {
+      for (int x = 0; x < width; x++)
+      {
+        data.push_back(ngl::Vec3(0.5f + 0.1f * std::sin(x * 0.3f) * std::cos(y * 0.2f)));
+      }
+    }
+
+    for (auto storage : {HeightmapStorage::Colour, HeightmapStorage::Quantised})
+    {
+      Heightmap h(static_cast<ngl::Real>(width), static_cast<ngl::Real>(depth), data);
+      h.setLayout(HeightmapLayout::Morton);
+      if (storage == HeightmapStorage::Quantised)
+      {
+        h.quantise();
+      }
+
+      // The ranges match the samples, whatever the storage
+      auto check = [&](int64_t _x0, int64_t _y0, int64_t _x1, int64_t _y1) {
+        ngl::Real low = h.value(_x0, _y0);
+        ngl::Real high = low;
+        for (int64_t y = _y0; y <= _y1; y++)
+        {
+          for (int64_t x = _x0; x <= _x1; x++)
+          {
+            low = std::min(low, h.value(x, y));
+            high = std::max(high, h.value(x, y));
+          }
+        }
+        HeightRange range = h.exactHeightRange(_x0, _y0, _x1, _y1);
+        EXPECT_EQ(range.min, low);
+        EXPECT_EQ(range.max, high);
+        HeightRange bounds = h.heightBounds(_x0, _y0, _x1, _y1);
+        EXPECT_LE(bounds.min, low);
+        EXPECT_GE(bounds.max, high);
+      };
+      check(0, 0, width - 1, depth - 1);
+      check(3, 7, 40, 9);
+
+      // A spike well above the quantised tile's range widens the tile, keeping the rest of it close
+      std::vector<ngl::Real> before(width * depth);
+      h.readWindow(0, 0, 1, width, depth, before.data());
+      ngl::Real spike = 10.0f;
+      DirtyRect changed;
+      EXPECT_TRUE(h.setValues(10, 20, 1, 1, &spike, &changed));
+      EXPECT_NEAR(h.value(10, 20), 10.0f, 0.0001f);
+      // Re-quantising changes every height in the spike's 32 x 32 tile
+      if (storage == HeightmapStorage::Quantised)
+      {
+        EXPECT_EQ(changed.x0, 0);
+        EXPECT_EQ(changed.y0, 0);
+        EXPECT_EQ(changed.x1, 31);
+        EXPECT_EQ(changed.y1, 31);
+      }
+      else
+      {
+        EXPECT_EQ(changed.x0, 10);
+        EXPECT_EQ(changed.y1, 20);
+      }
+      EXPECT_NEAR(h.value(11, 20), before[20 * width + 11], 0.0002f);
+      EXPECT_EQ(h.value(40, 20), before[20 * width + 40]);
+      EXPECT_NEAR(h.highestPoint(), 10.0f, 0.0001f);
+      check(0, 0, width - 1, depth - 1);
+      check(5, 15, 12, 25);
+      check(12, 15, 30, 25);
+
+      // Writes hanging off the edge only change the samples inside the heightmap
+      std::vector<ngl::Real> heights(4 * 3, 0.25f);
+      EXPECT_TRUE(h.setValues(width - 2, -1, 4, 3, heights.data(), &changed));
+      EXPECT_EQ(changed.x1, width - 1);
+      EXPECT_EQ(changed.y0, 0);
+      EXPECT_NEAR(h.value(width - 1, 1), 0.25f, 0.0001f);
+      EXPECT_NEAR(h.value(width - 2, 0), 0.25f, 0.0001f);
+      EXPECT_EQ(h.value(width - 7, 0), before[width - 7]);
+      check(width - 10, 0, width - 1, 5);
+      check(0, 0, width - 1, depth - 1);
+    }
+  }
+  TEST(HeightmapTest, external)
+  {
+    int width = 70;
+    int depth = 50;
+    std::vector<ngl::Real> heights(width * depth);
+    for (int i = 0; i < width * depth; i++)
+    {
+      heights[i] = 0.5f + 0.25f * std::sin(i * 0.1f);
+    }
+    Heightmap h(width, depth, heights.data());
+    EXPECT_EQ(h.storage(), HeightmapStorage::External);
+    EXPECT_EQ(h.m_external, heights.data());
+    EXPECT_EQ(h.value(13, 17), heights[17 * width + 13]);
+    EXPECT_EQ(h.value(width, 0), 0.0f);
+
+    std::vector<ngl::Real> window(4 * 3);
+    h.readWindow(60, 44, 4, 4, 3, window.data());
+    EXPECT_EQ(window[0], heights[44 * width + 60]);
+    EXPECT_EQ(window[5], heights[48 * width + 64]);
+    EXPECT_EQ(window[3], 0.0f);
+    EXPECT_EQ(window[8], 0.0f);
+
+    // The heights belong to someone else, so they're never moved, copied or changed
+    h.setLayout(HeightmapLayout::Morton);
+    h.compress(0.001f);
+    h.quantise();
+    h.setValue(1, 1, 5.0f);
+    EXPECT_EQ(h.storage(), HeightmapStorage::External);
+    EXPECT_EQ(h.layout(), HeightmapLayout::RowMajor);
+    EXPECT_EQ(h.value(1, 1), heights[width + 1]);
+
+    // Changes made by the owner are seen straight away, and by the ranges once they're told
+    heights[20 * width + 30] = 4.0f;
+    EXPECT_EQ(h.value(30, 20), 4.0f);
+    EXPECT_LT(h.heightRanges().total().max, 4.0f);
+    h.heightsChanged(30, 20, 30, 20);
+    EXPECT_EQ(h.heightRanges().total().max, 4.0f);
+    EXPECT_EQ(h.highestPoint(), 4.0f);
+  }
+} // end namespace geoclipmap
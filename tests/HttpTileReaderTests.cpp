@@ -0,0 +1,291 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "CompressedHeightmap.h"
+#include "Heightmap.h"
+#include "HttpTileReader.h"
+
+#ifdef TILE_SERVER_PATH
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+namespace geoclipmap
+{
+  namespace
+  {
+    std::vector<ngl::Real> makeHeights(int _width, int _depth, ngl::Real _phase)
+    {
+      std::vector<ngl::Real> heights(static_cast<size_t>(_width) * _depth);
+      for (int y = 0; y < _depth; y++)
+      {
+        for (int x = 0; x < _width; x++)
+        {
+          heights[static_cast<size_t>(y) * _width + x] = 1.5f + std::sin(x * 0.02f + _phase) * std::cos(y * 0.03f);
+        }
+      }
+      return heights;
+    }
+
+    std::string tempPath(const std::string &_name)
+    {
+      return (std::filesystem::temp_directory_path() / _name).string();
+    }
+
+    /**
+     * @brief The stand-in tile server, run as its own process for as long as
+     * the object lives
+     */
+    class TileServer
+    {
+    public:
+      TileServer(const std::string &_file, const std::string &_options = "")
+      {
+#ifdef TILE_SERVER_PATH
+        int output[2];
+        if (::pipe(output) != 0)
+        {
+          return;
+        }
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, output[1], STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&actions, output[0]);
+
+        std::string program = TILE_SERVER_PATH;
+        std::string port = "0";
+        std::vector<char *> arguments = {&program[0], const_cast<char *>(_file.c_str()), &port[0]};
+        std::string options = _options;
+        if (!options.empty())
+        {
+          arguments.push_back(&options[0]);
+        }
+        arguments.push_back(nullptr);
+        if (posix_spawn(&m_pid, program.c_str(), &actions, nullptr, arguments.data(), environ) != 0)
+        {
+          m_pid = -1;
+        }
+        posix_spawn_file_actions_destroy(&actions);
+        ::close(output[1]);
+
+        // It says which port it picked once it's listening
+        FILE *stream = ::fdopen(output[0], "r");
+        if (m_pid <= 0 || std::fscanf(stream, "Listening on port %d", &m_port) != 1)
+        {
+          m_port = 0;
+        }
+        std::fclose(stream);
+#else
+        (void)_file;
+        (void)_options;
+#endif
+      }
+
+      ~TileServer()
+      {
+        stop();
+      }
+
+      void stop()
+      {
+#ifdef TILE_SERVER_PATH
+        if (m_pid > 0)
+        {
+          ::kill(m_pid, SIGTERM);
+          ::waitpid(m_pid, nullptr, 0);
+        }
+#endif
+        m_pid = -1;
+      }
+
+      bool running() const
+      {
+        return m_pid > 0 && m_port > 0;
+      }
+
+      std::string url() const
+      {
+        return "http://127.0.0.1:" + std::to_string(m_port) + "/terrain.tiles";
+      }
+
+    private:
+      int m_pid = -1;
+      int m_port = 0;
+    };
+
+    HttpStats httpStats(const CompressedHeightmap &_heightmap)
+    {
+      return dynamic_cast<const HttpTileReader *>(_heightmap.tileReader())->stats();
+    }
+
+    void expectSameHeights(CompressedHeightmap &_opened, CompressedHeightmap &_original)
+    {
+      _opened.decodeRegion(0, 0, _original.width() - 1, _original.depth() - 1, 1);
+      for (int y = 0; y < _original.depth(); y += 3)
+      {
+        for (int x = 0; x < _original.width(); x += 5)
+        {
+          ASSERT_EQ(_opened.sample(x, y), _original.sample(x, y)) << x << ", " << y;
+        }
+      }
+    }
+  } // end namespace
+
+  class HttpTileReaderTest : public ::testing::Test
+  {
+  protected:
+    static constexpr int k_width = 256;
+    static constexpr int k_depth = 192;
+
+    void SetUp() override
+    {
+#ifndef TILE_SERVER_PATH
+      GTEST_SKIP() << "The tile server isn't built on this platform";
+#endif
+      m_file = tempPath("geoclipmap_http_tiles.tiles");
+      m_cache = tempPath("geoclipmap_http_cache");
+      std::filesystem::remove_all(m_cache);
+      m_original = std::make_unique<CompressedHeightmap>(k_width, k_depth, makeHeights(k_width, k_depth, 0.0f), 0.001f, 32);
+      ASSERT_TRUE(m_original->bake(m_file));
+    }
+
+    void TearDown() override
+    {
+      std::filesystem::remove(m_file);
+      std::filesystem::remove_all(m_cache);
+    }
+
+    std::string m_file;
+    std::string m_cache;
+    std::unique_ptr<CompressedHeightmap> m_original;
+  };
+
+  TEST_F(HttpTileReaderTest, reads_tiles)
+  {
+    TileServer server(m_file);
+    ASSERT_TRUE(server.running());
+
+    auto opened = CompressedHeightmap::open(HttpTileReader::open(server.url(), "", 4, 4), 16);
+    ASSERT_NE(opened, nullptr);
+    EXPECT_EQ(opened->tileReader()->backend(), TileReaderBackend::Http);
+    EXPECT_EQ(opened->width(), k_width);
+    EXPECT_EQ(opened->depth(), k_depth);
+    expectSameHeights(*opened, *m_original);
+
+    // Every tile came down the same few kept alive connections
+    HttpStats stats = httpStats(*opened);
+    EXPECT_GT(stats.requests, 50u);
+    EXPECT_GT(stats.bytesFetched, 0u);
+    EXPECT_LE(stats.connections, 4u);
+    EXPECT_EQ(stats.failures, 0u);
+    EXPECT_EQ(opened->stats().readErrors, 0u);
+  }
+
+  TEST_F(HttpTileReaderTest, reconnects)
+  {
+    // A server that closes every connection after a few requests, partway through the pipelined ones
+    TileServer server(m_file, "--max-requests=3");
+    ASSERT_TRUE(server.running());
+
+    auto opened = CompressedHeightmap::open(HttpTileReader::open(server.url(), "", 4, 4), 16);
+    ASSERT_NE(opened, nullptr);
+    expectSameHeights(*opened, *m_original);
+    EXPECT_GT(httpStats(*opened).connections, 4u);
+    EXPECT_EQ(httpStats(*opened).failures, 0u);
+  }
+
+  TEST_F(HttpTileReaderTest, disk_cache)
+  {
+    {
+      TileServer server(m_file);
+      ASSERT_TRUE(server.running());
+      auto cold = CompressedHeightmap::open(HttpTileReader::open(server.url(), m_cache), 4096);
+      ASSERT_NE(cold, nullptr);
+      expectSameHeights(*cold, *m_original);
+      EXPECT_EQ(httpStats(*cold).cacheHits, 0u);
+
+      // A restart finds every tile on disk
+      auto warm = CompressedHeightmap::open(HttpTileReader::open(server.url(), m_cache), 4096);
+      ASSERT_NE(warm, nullptr);
+      expectSameHeights(*warm, *m_original);
+      EXPECT_GT(httpStats(*warm).cacheHits, 0u);
+      EXPECT_EQ(httpStats(*warm).bytesFetched, 0u);
+    }
+
+    // With the server gone the cache is all there is, but it's enough
+    std::string url = "http://127.0.0.1:1/terrain.tiles";
+    auto reader = HttpTileReader::open(url, m_cache);
+    ASSERT_NE(reader, nullptr);
+    EXPECT_TRUE(reader->offline());
+    auto offline = CompressedHeightmap::open(std::move(reader), 4096);
+    ASSERT_NE(offline, nullptr);
+    expectSameHeights(*offline, *m_original);
+    EXPECT_EQ(httpStats(*offline).failures, 0u);
+    EXPECT_EQ(HttpTileReader::open(url, ""), nullptr);
+    EXPECT_EQ(HttpTileReader::open(url, tempPath("geoclipmap_http_no_cache")), nullptr);
+
+    // Baking a different heightmap changes the ETag, so the old tiles aren't used
+    CompressedHeightmap changed(k_width, k_depth, makeHeights(k_width, k_depth, 1.0f), 0.001f, 32);
+    ASSERT_TRUE(changed.bake(m_file));
+    TileServer server(m_file);
+    ASSERT_TRUE(server.running());
+    auto rebaked = CompressedHeightmap::open(HttpTileReader::open(server.url(), m_cache), 4096);
+    ASSERT_NE(rebaked, nullptr);
+    expectSameHeights(*rebaked, changed);
+    EXPECT_EQ(httpStats(*rebaked).cacheHits, 0u);
+  }
+
+  TEST_F(HttpTileReaderTest, invalid)
+  {
+    EXPECT_EQ(HttpTileReader::open("https://127.0.0.1/terrain.tiles"), nullptr);
+    EXPECT_EQ(HttpTileReader::open("http://:80/terrain.tiles"), nullptr);
+    EXPECT_EQ(HttpTileReader::open("http://127.0.0.1:port/terrain.tiles"), nullptr);
+
+    // A server that isn't serving a baked heightmap
+    std::string notBaked = tempPath("geoclipmap_http_not_baked.tiles");
+    std::FILE *file = std::fopen(notBaked.c_str(), "wb");
+    std::fputs("not a baked heightmap, not a baked heightmap, not a baked heightmap", file);
+    std::fclose(file);
+    TileServer server(notBaked);
+    ASSERT_TRUE(server.running());
+    auto reader = HttpTileReader::open(server.url());
+    ASSERT_NE(reader, nullptr);
+    EXPECT_EQ(CompressedHeightmap::open(std::move(reader)), nullptr);
+    std::filesystem::remove(notBaked);
+  }
+
+  TEST_F(HttpTileReaderTest, heightmap)
+  {
+    TileServer server(m_file);
+    ASSERT_TRUE(server.running());
+
+    Heightmap heightmap(CompressedHeightmap::open(HttpTileReader::open(server.url()), 64));
+    EXPECT_EQ(heightmap.storage(), HeightmapStorage::Compressed);
+    EXPECT_EQ(heightmap.width(), k_width);
+    EXPECT_EQ(heightmap.depth(), k_depth);
+
+    ngl::Real highest = 0.0f;
+    for (int y = 0; y < k_depth; y++)
+    {
+      for (int x = 0; x < k_width; x++)
+      {
+        highest = std::max(highest, m_original->sample(x, y));
+      }
+    }
+    EXPECT_EQ(heightmap.highestPoint(), highest);
+    EXPECT_EQ(heightmap.value(101, 67), m_original->sample(101, 67));
+  }
+} // end namespace geoclipmap
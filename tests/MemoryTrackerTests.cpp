@@ -0,0 +1,212 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "Manager.h"
+#include "MemoryTracker.h"
+#include "Terrain.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    struct Settings
+    {
+      unsigned char K;
+      unsigned char L;
+      unsigned char R;
+    };
+    // Switched between in turn, ending where they started
+    const Settings k_settings[] = {{4, 4, 2}, {6, 8, 4}, {5, 6, 1}, {6, 8, 4}, {4, 5, 3}, {4, 4, 2}};
+  } // end namespace
+
+  TEST(MemoryTrackerTest, accounts)
+  {
+    MemoryTracker *tracker = MemoryTracker::getInstance();
+    EXPECT_STREQ(MemoryTracker::name(MemorySubsystem::Heightmap), "heightmap");
+    EXPECT_STREQ(MemoryTracker::name(MemorySubsystem::Footprints), "footprints");
+    MemoryUsage before = tracker->usage(MemorySubsystem::TileCache);
+    MemoryUsage totalBefore = tracker->total();
+    {
+      MemoryAccount account(MemorySubsystem::TileCache);
+      account.setCpu(100);
+      account.setGpu(50);
+      EXPECT_EQ(tracker->usage(MemorySubsystem::TileCache).cpuBytes, before.cpuBytes + 100);
+      EXPECT_EQ(tracker->usage(MemorySubsystem::TileCache).gpuBytes, before.gpuBytes + 50);
+      EXPECT_EQ(tracker->total().cpuBytes, totalBefore.cpuBytes + 100);
+
+      // Only the change is added when the bytes are set again
+      account.setCpu(40);
+      EXPECT_EQ(tracker->usage(MemorySubsystem::TileCache).cpuBytes, before.cpuBytes + 40);
+
+      // A copy holds its own memory
+      MemoryAccount copy(account);
+      EXPECT_EQ(copy.cpuBytes(), 40u);
+      EXPECT_EQ(tracker->usage(MemorySubsystem::TileCache).cpuBytes, before.cpuBytes + 80);
+      EXPECT_EQ(tracker->usage(MemorySubsystem::TileCache).gpuBytes, before.gpuBytes + 100);
+      MemoryAccount other(MemorySubsystem::Footprints);
+      other.setCpu(7);
+      copy = other;
+      EXPECT_EQ(tracker->usage(MemorySubsystem::TileCache).cpuBytes, before.cpuBytes + 40);
+      EXPECT_EQ(tracker->usage(MemorySubsystem::TileCache).gpuBytes, before.gpuBytes + 50);
+    }
+    MemoryUsage after = tracker->usage(MemorySubsystem::TileCache);
+    EXPECT_EQ(after.cpuBytes, before.cpuBytes);
+    EXPECT_EQ(after.gpuBytes, before.gpuBytes);
+    EXPECT_EQ(tracker->total().cpuBytes, totalBefore.cpuBytes);
+  }
+
+  TEST(MemoryTrackerTest, switching_terrains)
+  {
+    Manager *manager = Manager::getInstance();
+    unsigned char K = manager->K();
+    unsigned char L = manager->L();
+    unsigned char R = manager->R();
+    MemoryTracker *tracker = MemoryTracker::getInstance();
+
+    std::vector<ngl::Vec3> colours(128 * 128);
+    for (size_t i = 0; i < colours.size(); i++)
+    {
+      colours[i] = ngl::Vec3(static_cast<ngl::Real>(i % 128) / 128.0f);
+    }
+    Heightmap heightmap(128, 128, colours);
+    MemoryUsage baseline = tracker->total();
+
+    // As loading a heightmap does, throw the terrain away and make a new one each time something changes
+    for (int repeat = 0; repeat < 3; repeat++)
+    {
+      for (const Settings &setting : k_settings)
+      {
+        manager->setK(setting.K);
+        manager->setL(setting.L);
+        manager->setR(setting.R);
+        auto terrain = std::make_unique<Terrain>(&heightmap);
+        terrain->moveTo(64 + repeat, 64);
+        for (auto level : terrain->clipmaps())
+        {
+          level->pendingUpload();
+        }
+
+        // Every level's texture is on both the CPU and the GPU
+        size_t D = manager->D();
+        MemoryUsage levels = tracker->usage(MemorySubsystem::ClipmapLevels);
+        MemoryUsage total = tracker->total();
+        EXPECT_GE(levels.cpuBytes, static_cast<int64_t>(setting.L * D * D * sizeof(ngl::Vec3)));
+        EXPECT_EQ(total.gpuBytes - baseline.gpuBytes, static_cast<int64_t>(setting.L * D * D * sizeof(ngl::Vec3)));
+        EXPECT_GT(total.cpuBytes, baseline.cpuBytes);
+      }
+    }
+
+    MemoryUsage after = tracker->total();
+    EXPECT_EQ(after.cpuBytes, baseline.cpuBytes);
+    EXPECT_EQ(after.gpuBytes, baseline.gpuBytes);
+
+    manager->setK(K);
+    manager->setL(L);
+    manager->setR(R);
+  }
+
+  TEST(MemoryTrackerTest, reconfiguring_terrain)
+  {
+    Manager *manager = Manager::getInstance();
+    unsigned char K = manager->K();
+    unsigned char L = manager->L();
+    unsigned char R = manager->R();
+    MemoryTracker *tracker = MemoryTracker::getInstance();
+
+    std::vector<ngl::Vec3> colours(128 * 128);
+    for (size_t i = 0; i < colours.size(); i++)
+    {
+      colours[i] = ngl::Vec3(static_cast<ngl::Real>(i % 128) / 128.0f);
+    }
+    Heightmap heightmap(128, 128, colours);
+    MemoryUsage baseline = tracker->total();
+
+    {
+      manager->setK(k_settings[0].K);
+      manager->setL(k_settings[0].L);
+      manager->setR(k_settings[0].R);
+      Terrain terrain(&heightmap);
+      terrain.moveTo(64, 64);
+      for (auto level : terrain.clipmaps())
+      {
+        level->pendingUpload();
+      }
+      MemoryUsage first = tracker->total();
+
+      // As the K/L/R keys and the governor do, change the terrain in place each time something changes
+      for (int repeat = 0; repeat < 3; repeat++)
+      {
+        for (const Settings &setting : k_settings)
+        {
+          manager->setK(setting.K);
+          manager->setL(setting.L);
+          manager->setR(setting.R);
+          terrain.reconfigure();
+          terrain.moveTo(64 + repeat, 64);
+          for (auto level : terrain.clipmaps())
+          {
+            level->pendingUpload();
+          }
+
+          // Only the levels for the new settings are held, at the new size
+          size_t D = manager->D();
+          MemoryUsage levels = tracker->usage(MemorySubsystem::ClipmapLevels);
+          MemoryUsage total = tracker->total();
+          EXPECT_GE(levels.cpuBytes, static_cast<int64_t>(setting.L * D * D * sizeof(ngl::Vec3)));
+          EXPECT_EQ(total.gpuBytes - baseline.gpuBytes, static_cast<int64_t>(setting.L * D * D * sizeof(ngl::Vec3)));
+        }
+
+        // Back at the first settings nothing is left over from the others
+        MemoryUsage total = tracker->total();
+        EXPECT_EQ(total.cpuBytes, first.cpuBytes) << "repeat " << repeat;
+        EXPECT_EQ(total.gpuBytes, first.gpuBytes) << "repeat " << repeat;
+      }
+    }
+
+    MemoryUsage after = tracker->total();
+    EXPECT_EQ(after.cpuBytes, baseline.cpuBytes);
+    EXPECT_EQ(after.gpuBytes, baseline.gpuBytes);
+
+    manager->setK(K);
+    manager->setL(L);
+    manager->setR(R);
+  }
+
+  TEST(MemoryTrackerTest, heightmap_storage)
+  {
+    MemoryTracker *tracker = MemoryTracker::getInstance();
+    MemoryUsage heightmapBefore = tracker->usage(MemorySubsystem::Heightmap);
+    MemoryUsage cacheBefore = tracker->usage(MemorySubsystem::TileCache);
+    {
+      std::vector<ngl::Vec3> colours(256 * 256);
+      for (size_t i = 0; i < colours.size(); i++)
+      {
+        colours[i] = ngl::Vec3(0.5f + 0.25f * std::sin(static_cast<ngl::Real>(i % 256) * 0.1f));
+      }
+      Heightmap heightmap(256, 256, colours);
+      int64_t colourBytes = tracker->usage(MemorySubsystem::Heightmap).cpuBytes - heightmapBefore.cpuBytes;
+      EXPECT_GE(colourBytes, static_cast<int64_t>(colours.size() * sizeof(ngl::Vec3)));
+
+      // The compressed tiles are a fraction of the colours, and decoding some of them fills the cache
+      heightmap.compress(0.01f, 32);
+      int64_t compressedBytes = tracker->usage(MemorySubsystem::Heightmap).cpuBytes - heightmapBefore.cpuBytes;
+      EXPECT_GT(compressedBytes, 0);
+      EXPECT_LT(compressedBytes, colourBytes);
+      EXPECT_EQ(tracker->usage(MemorySubsystem::TileCache).cpuBytes, cacheBefore.cpuBytes);
+      std::vector<ngl::Real> window(64 * 64);
+      heightmap.prefetch(0, 0, 63, 63, 1);
+      heightmap.readWindow(0, 0, 1, 64, 64, window.data());
+      EXPECT_GE(tracker->usage(MemorySubsystem::TileCache).cpuBytes - cacheBefore.cpuBytes,
+                static_cast<int64_t>(window.size() * sizeof(ngl::Real)));
+    }
+    EXPECT_EQ(tracker->usage(MemorySubsystem::Heightmap).cpuBytes, heightmapBefore.cpuBytes);
+    EXPECT_EQ(tracker->usage(MemorySubsystem::TileCache).cpuBytes, cacheBefore.cpuBytes);
+  }
+} // end namespace geoclipmap
@@ -0,0 +1,171 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "ClipmapLevel.h"
+#include "Manager.h"
+#include "Metrics.h"
+#include "ThreadPool.h"
+
+namespace geoclipmap
+{
+  TEST(MetricsTest, frames)
+  {
+    Metrics *metrics = Metrics::getInstance();
+    // Start from a clean frame, whatever other tests have counted
+    metrics->frameFinished(0.0);
+    size_t frames = metrics->frameCount();
+
+    metrics->add(Counter::DrawCalls, 3);
+    metrics->add(Counter::Triangles, 300);
+    metrics->addTexels(2, 100);
+    metrics->addTexels(5, 20);
+    metrics->addTexels(40, 7);
+    metrics->addUpload(3, 1200);
+    metrics->addUpload(3, 24);
+    metrics->set(Gauge::TileCacheHitRate, 0.75);
+    metrics->frameFinished(16.0);
+    EXPECT_EQ(metrics->frameCount(), frames + 1);
+
+    const MetricsFrame &frame = metrics->lastFrame();
+    EXPECT_EQ(frame.frameMs, 16.0);
+    EXPECT_EQ(frame.counter(Counter::DrawCalls), 3u);
+    EXPECT_EQ(frame.counter(Counter::Triangles), 300u);
+    // Levels past the last counted still count towards the total
+    EXPECT_EQ(frame.counter(Counter::TexelsRegenerated), 127u);
+    EXPECT_EQ(frame.levelTexels[2], 100u);
+    EXPECT_EQ(frame.levelTexels[5], 20u);
+    EXPECT_EQ(frame.counter(Counter::BytesUploaded), 1224u);
+    EXPECT_EQ(frame.levelBytes[3], 1224u);
+    EXPECT_EQ(frame.gauge(Gauge::TileCacheHitRate), 0.75);
+
+    // Counters start again each frame, gauges keep their value until set again
+    metrics->frameFinished(8.0);
+    EXPECT_EQ(metrics->lastFrame().counter(Counter::DrawCalls), 0u);
+    EXPECT_EQ(metrics->lastFrame().levelTexels[2], 0u);
+    EXPECT_EQ(metrics->lastFrame().gauge(Gauge::TileCacheHitRate), 0.75);
+
+    // Only the recent frames count towards the percentiles
+    for (int i = 1; i <= 1000; i++)
+    {
+      metrics->frameFinished(static_cast<double>(i));
+    }
+    EXPECT_EQ(metrics->m_frameTimes.size(), 240u);
+    EXPECT_EQ(metrics->frameTimePercentile(0.0), 761.0);
+    EXPECT_EQ(metrics->frameTimePercentile(0.5), 880.0);
+    EXPECT_EQ(metrics->frameTimePercentile(1.0), 1000.0);
+
+    // Texture reads count their texels against their level
+    Manager *manager = Manager::getInstance();
+    size_t D = manager->D();
+    std::vector<ngl::Real> heights(64 * 64, 1.0f);
+    Heightmap heightmap(64, 64, heights.data());
+    ClipmapLevel level(manager->L() - 1, &heightmap, nullptr);
+    level.setPosition(ngl::Vec2{}, 0, 0, TrimLocation::All);
+    level.updateTexture();
+    level.refreshRegion(4, 4, 5, 6);
+    metrics->frameFinished(1.0);
+    EXPECT_EQ(metrics->lastFrame().levelTexels[manager->L() - 1], D * D + 6);
+
+    // And uploads count their bytes against it
+    level.pendingUpload();
+    metrics->frameFinished(1.0);
+    EXPECT_EQ(metrics->lastFrame().levelBytes[manager->L() - 1], D * D * sizeof(ngl::Vec3));
+  }
+
+  TEST(MetricsTest, log)
+  {
+    Metrics *metrics = Metrics::getInstance();
+    metrics->frameFinished(0.0);
+    std::filesystem::path directory = std::filesystem::temp_directory_path();
+    std::string csv = (directory / "geoclipmap_metrics.csv").string();
+
+    // A row every frame
+    ASSERT_TRUE(metrics->openLog(csv, 0.0));
+    metrics->add(Counter::BytesUploaded, 4096);
+    metrics->addTexels(1, 64);
+    metrics->frameFinished(10.0);
+    metrics->add(Counter::DrawCalls, 5);
+    metrics->frameFinished(20.0);
+    metrics->closeLog();
+
+    std::ifstream file(csv);
+    std::string line;
+    std::getline(file, line);
+    EXPECT_EQ(line.rfind("time_s,frames,fps,frame_ms_p50,frame_ms_p95,frame_ms_p99,frame_ms_max,texels,bytes_uploaded,"
+                         "draw_calls,triangles,inactive_level_blocks,worker_queue_depth,tile_cache_hit_rate,texels_l0,texels_l1,",
+                         0),
+              0u);
+    // The memory held by each subsystem comes after the texels
+    EXPECT_NE(line.find(",texels_l11,heightmap_cpu_bytes,heightmap_gpu_bytes,tile_cache_cpu_bytes,"), std::string::npos) << line;
+    std::getline(file, line);
+    // After the time: 1 frame, its fps, 10ms at every percentile, then the counters
+    std::string row = line.substr(line.find(',') + 1);
+    EXPECT_EQ(row.substr(0, 2), "1,");
+    row = row.substr(row.find(',', 2) + 1);
+    EXPECT_EQ(row.rfind("10,10,10,10,64,4096,0,0,0,", 0), 0u) << row;
+    EXPECT_NE(row.find(",0,64,0,"), std::string::npos) << row;
+    std::getline(file, line);
+    row = line.substr(line.find(',') + 1);
+    row = row.substr(row.find(',', 2) + 1);
+    EXPECT_EQ(row.rfind("20,20,20,20,0,0,5,", 0), 0u) << row;
+    EXPECT_FALSE(std::getline(file, line));
+    file.close();
+    std::filesystem::remove(csv);
+
+    // Frames are added up until the interval has passed, and written when the log is closed
+    std::string json = (directory / "geoclipmap_metrics.json").string();
+    ASSERT_TRUE(metrics->openLog(json, 3600.0));
+    metrics->add(Counter::Triangles, 10);
+    metrics->frameFinished(4.0);
+    metrics->add(Counter::Triangles, 32);
+    metrics->frameFinished(6.0);
+    metrics->closeLog();
+    file.open(json);
+    std::getline(file, line);
+    EXPECT_EQ(line.rfind("{\"time_s\":", 0), 0u);
+    EXPECT_NE(line.find(",\"frames\":2,"), std::string::npos) << line;
+    EXPECT_NE(line.find(",\"frame_ms_p50\":4,\"frame_ms_p95\":6,\"frame_ms_p99\":6,\"frame_ms_max\":6,"), std::string::npos) << line;
+    EXPECT_NE(line.find(",\"triangles\":42,"), std::string::npos) << line;
+    EXPECT_NE(line.find(",\"memory\":{\"heightmap\":{\"cpu_bytes\":"), std::string::npos) << line;
+    EXPECT_NE(line.find(",\"texels_per_level\":[0,0,0,0,0,0,0,0,0,0,0,0]}"), std::string::npos) << line;
+    EXPECT_FALSE(std::getline(file, line));
+    file.close();
+    std::filesystem::remove(json);
+
+    EXPECT_FALSE(metrics->openLog("/nonexistent/metrics.csv", 1.0));
+    metrics->frameFinished(1.0);
+  }
+
+  TEST(MetricsTest, queue_depth)
+  {
+    ThreadPool pool(1);
+    EXPECT_EQ(pool.takePeakQueueDepth(), 0u);
+
+    // Hold the only worker up so the tasks after it wait in the queue
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::vector<std::future<void>> tasks;
+    tasks.push_back(pool.submit([released]() { released.wait(); }));
+    for (int i = 0; i < 4; i++)
+    {
+      tasks.push_back(pool.submit([]() {}));
+    }
+    EXPECT_GE(pool.takePeakQueueDepth(), 4u);
+    release.set_value();
+    for (auto &task : tasks)
+    {
+      task.wait();
+    }
+    // Counting starts again from the tasks still queued when the peak was taken
+    EXPECT_GE(pool.takePeakQueueDepth(), 4u);
+    EXPECT_EQ(pool.takePeakQueueDepth(), 0u);
+  }
+} // end namespace geoclipmap
@@ -0,0 +1,223 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "MinMaxPyramid.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // Heights that aren't smooth so every block has a different range
+    std::vector<ngl::Real> makeHeights(int _width, int _depth)
+    {
+      std::mt19937 random(7);
+      std::uniform_real_distribution<ngl::Real> height(-2.0f, 5.0f);
+      std::vector<ngl::Real> heights(static_cast<size_t>(_width) * _depth);
+      for (auto &h : heights)
+      {
+        h = height(random);
+      }
+      return heights;
+    }
+
+    MinMaxPyramid::SampleReader reader(const std::vector<ngl::Real> &_heights, int _width, int *o_reads = nullptr)
+    {
+      return [&_heights, _width, o_reads](int64_t _x, int64_t _y, int _count, ngl::Real *_out) {
+        std::copy_n(&_heights[static_cast<size_t>(_y) * _width + _x], _count, _out);
+        if (o_reads)
+        {
+          *o_reads += _count;
+        }
+      };
+    }
+
+    HeightRange bruteForce(const std::vector<ngl::Real> &_heights, int _width, int _x0, int _y0, int _x1, int _y1)
+    {
+      HeightRange range{_heights[static_cast<size_t>(_y0) * _width + _x0], _heights[static_cast<size_t>(_y0) * _width + _x0]};
+      for (int y = _y0; y <= _y1; y++)
+      {
+        for (int x = _x0; x <= _x1; x++)
+        {
+          range.min = std::min(range.min, _heights[static_cast<size_t>(y) * _width + x]);
+          range.max = std::max(range.max, _heights[static_cast<size_t>(y) * _width + x]);
+        }
+      }
+      return range;
+    }
+  } // end namespace
+
+  TEST(MinMaxPyramidTest, levels)
+  {
+    int width = 300;
+    int depth = 100;
+    auto heights = makeHeights(width, depth);
+    MinMaxPyramid p(width, depth, reader(heights, width));
+
+    // 38x13 blocks of 8x8 -> 19x7 -> 10x4 -> 5x2 -> 3x1 -> 2x1 -> 1x1
+    EXPECT_EQ(p.levels(), 7);
+    EXPECT_EQ(p.m_levels[0].width, 38);
+    EXPECT_EQ(p.m_levels[0].depth, 13);
+    EXPECT_EQ(p.m_levels[1].width, 19);
+    EXPECT_EQ(p.m_levels[1].depth, 7);
+
+    HeightRange total = p.total();
+    HeightRange expected = bruteForce(heights, width, 0, 0, width - 1, depth - 1);
+    EXPECT_EQ(total.min, expected.min);
+    EXPECT_EQ(total.max, expected.max);
+  }
+
+  TEST(MinMaxPyramidTest, range)
+  {
+    int width = 203;
+    int depth = 157;
+    auto heights = makeHeights(width, depth);
+    MinMaxPyramid p(width, depth, reader(heights, width));
+
+    std::mt19937 random(3);
+    std::uniform_int_distribution<int> x(0, width - 1);
+    std::uniform_int_distribution<int> y(0, depth - 1);
+    for (int i = 0; i < 500; i++)
+    {
+      int x0 = x(random);
+      int x1 = x(random);
+      int y0 = y(random);
+      int y1 = y(random);
+      if (x0 > x1)
+      {
+        std::swap(x0, x1);
+      }
+      if (y0 > y1)
+      {
+        std::swap(y0, y1);
+      }
+
+      HeightRange range = p.exactRange(x0, y0, x1, y1, reader(heights, width));
+      HeightRange expected = bruteForce(heights, width, x0, y0, x1, y1);
+      ASSERT_EQ(range.min, expected.min);
+      ASSERT_EQ(range.max, expected.max);
+    }
+
+    // Clamped to the heightmap, and nothing at all outside it
+    HeightRange clamped = p.exactRange(-10, -10, 5, 5, reader(heights, width));
+    HeightRange expected = bruteForce(heights, width, 0, 0, 5, 5);
+    EXPECT_EQ(clamped.min, expected.min);
+    EXPECT_EQ(clamped.max, expected.max);
+    HeightRange outside = p.exactRange(width, 0, width + 10, 10, reader(heights, width));
+    EXPECT_EQ(outside.min, 0.0f);
+    EXPECT_EQ(outside.max, 0.0f);
+  }
+
+  TEST(MinMaxPyramidTest, bounds)
+  {
+    int width = 203;
+    int depth = 157;
+    auto heights = makeHeights(width, depth);
+    MinMaxPyramid p(width, depth, reader(heights, width));
+
+    std::mt19937 random(5);
+    std::uniform_int_distribution<int> x(0, width - 1);
+    std::uniform_int_distribution<int> y(0, depth - 1);
+    for (int i = 0; i < 500; i++)
+    {
+      int x0 = x(random);
+      int x1 = x(random);
+      int y0 = y(random);
+      int y1 = y(random);
+      if (x0 > x1)
+      {
+        std::swap(x0, x1);
+      }
+      if (y0 > y1)
+      {
+        std::swap(y0, y1);
+      }
+
+      // The bounds hold the exact range, and come from blocks no more than twice the rectangle's size past it
+      HeightRange bounds = p.bounds(x0, y0, x1, y1);
+      HeightRange exact = bruteForce(heights, width, x0, y0, x1, y1);
+      ASSERT_LE(bounds.min, exact.min);
+      ASSERT_GE(bounds.max, exact.max);
+      int pad = std::max(8, 2 * std::max(x1 - x0 + 1, y1 - y0 + 1));
+      HeightRange around = bruteForce(heights,
+                                      width,
+                                      std::max(x0 - pad, 0),
+                                      std::max(y0 - pad, 0),
+                                      std::min(x1 + pad, width - 1),
+                                      std::min(y1 + pad, depth - 1));
+      ASSERT_GE(bounds.min, around.min);
+      ASSERT_LE(bounds.max, around.max);
+    }
+
+    // A single sample is bounded by its 8x8 block, the whole heightmap by the top of the pyramid
+    HeightRange sample = p.bounds(17, 9, 17, 9);
+    HeightRange block = bruteForce(heights, width, 16, 8, 23, 15);
+    EXPECT_EQ(sample.min, block.min);
+    EXPECT_EQ(sample.max, block.max);
+    HeightRange whole = p.bounds(-10, -10, width + 10, depth + 10);
+    EXPECT_EQ(whole.min, p.total().min);
+    EXPECT_EQ(whole.max, p.total().max);
+    HeightRange outside = p.bounds(width, 0, width + 10, 10);
+    EXPECT_EQ(outside.min, 0.0f);
+    EXPECT_EQ(outside.max, 0.0f);
+  }
+
+  TEST(MinMaxPyramidTest, edges_only)
+  {
+    int width = 1024;
+    int depth = 1024;
+    auto heights = makeHeights(width, depth);
+    MinMaxPyramid p(width, depth, reader(heights, width));
+
+    // A rectangle cutting through blocks on every side only reads (at most) the samples of those blocks
+    int reads = 0;
+    HeightRange range = p.exactRange(3, 5, 1000, 1010, reader(heights, width, &reads));
+    HeightRange expected = bruteForce(heights, width, 3, 5, 1000, 1010);
+    EXPECT_EQ(range.min, expected.min);
+    EXPECT_EQ(range.max, expected.max);
+    EXPECT_LT(reads, 4 * 1024 * 8);
+
+    // Aligned to the blocks it doesn't read any
+    reads = 0;
+    p.exactRange(64, 128, 511, 767, reader(heights, width, &reads));
+    EXPECT_EQ(reads, 0);
+  }
+
+  TEST(MinMaxPyramidTest, update)
+  {
+    int width = 100;
+    int depth = 90;
+    auto heights = makeHeights(width, depth);
+    MinMaxPyramid p(width, depth, reader(heights, width));
+
+    // Raise a spike and dig a pit, only re-reading the blocks they are in
+    heights[static_cast<size_t>(40) * width + 33] = 100.0f;
+    heights[static_cast<size_t>(80) * width + 99] = -100.0f;
+    int reads = 0;
+    p.update(33, 40, 33, 40, reader(heights, width, &reads));
+    EXPECT_EQ(reads, 64);
+    p.update(99, 80, 99, 80, reader(heights, width, &reads));
+    // The last block across is only 4 samples wide
+    EXPECT_EQ(reads, 64 + 32);
+
+    EXPECT_EQ(p.total().max, 100.0f);
+    EXPECT_EQ(p.total().min, -100.0f);
+    EXPECT_EQ(p.exactRange(30, 30, 50, 50, reader(heights, width)).max, 100.0f);
+    HeightRange expected = bruteForce(heights, width, 0, 0, 50, 70);
+    HeightRange range = p.exactRange(0, 0, 50, 70, reader(heights, width));
+    EXPECT_EQ(range.min, expected.min);
+    EXPECT_EQ(range.max, expected.max);
+
+    // And back down again
+    heights[static_cast<size_t>(40) * width + 33] = 0.0f;
+    p.update(33, 40, 33, 40, reader(heights, width));
+    expected = bruteForce(heights, width, 0, 0, width - 1, depth - 1);
+    EXPECT_EQ(p.total().max, expected.max);
+  }
+} // end namespace geoclipmap
@@ -0,0 +1,145 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "Manager.h"
+#include "QualityGovernor.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    /**
+     * @brief Feed the governor the same frame until it makes a decision or
+     * _frames have gone by
+     *
+     */
+    bool feed(QualityGovernor &_governor, double _cpuMs, double _gpuMs, size_t _frames, GovernorDecision &o_decision)
+    {
+      for (size_t i = 0; i < _frames; i++)
+      {
+        if (_governor.frameFinished(_cpuMs, _gpuMs, o_decision))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+  } // end namespace
+
+  TEST(QualityGovernorTest, lower)
+  {
+    Manager *manager = Manager::getInstance();
+    unsigned char K = manager->K();
+    unsigned char R = manager->R();
+    manager->setK(8);
+    manager->setR(2);
+    manager->setUpdateBudget(0);
+    QualityGovernor governor(16.0);
+    GovernorDecision decision;
+
+    // A GPU over its target loses active levels, then level size
+    ASSERT_TRUE(feed(governor, 1.0, 20.0, 100, decision));
+    EXPECT_EQ(decision.setting, GovernorSetting::R);
+    EXPECT_EQ(decision.from, 2);
+    EXPECT_EQ(decision.to, 1);
+    EXPECT_DOUBLE_EQ(decision.gpuMs, 20.0);
+    EXPECT_EQ(manager->R(), 1);
+    ASSERT_TRUE(feed(governor, 1.0, 20.0, 100, decision));
+    EXPECT_EQ(decision.setting, GovernorSetting::K);
+    EXPECT_EQ(manager->K(), 7);
+
+    // A CPU update over its share of the target fills fewer levels a frame, then shrinks them
+    for (int budget : {4, 2, 1})
+    {
+      ASSERT_TRUE(feed(governor, 10.0, 5.0, 100, decision));
+      EXPECT_EQ(decision.setting, GovernorSetting::UpdateBudget);
+      EXPECT_EQ(decision.to, budget);
+      EXPECT_EQ(manager->updateBudget(), static_cast<size_t>(budget) * manager->D() * manager->D());
+    }
+    ASSERT_TRUE(feed(governor, 10.0, 5.0, 100, decision));
+    EXPECT_EQ(decision.setting, GovernorSetting::K);
+    EXPECT_EQ(manager->K(), 6);
+    // The budget follows the levels' size
+    EXPECT_EQ(manager->updateBudget(), manager->D() * manager->D());
+
+    manager->setK(K);
+    manager->setR(R);
+    manager->setUpdateBudget(0);
+  }
+
+  TEST(QualityGovernorTest, hysteresis)
+  {
+    Manager *manager = Manager::getInstance();
+    unsigned char K = manager->K();
+    unsigned char R = manager->R();
+    manager->setR(2);
+    manager->setUpdateBudget(2 * manager->D() * manager->D());
+    QualityGovernor governor(16.0);
+    GovernorDecision decision;
+    EXPECT_EQ(governor.budgetLevels(), 2);
+
+    // Frames between the two bands change nothing
+    EXPECT_FALSE(feed(governor, 7.0, 15.0, 1000, decision));
+
+    // Well under the target for a few windows gets the update budget back first
+    ASSERT_TRUE(feed(governor, 1.0, 5.0, 1000, decision));
+    EXPECT_EQ(decision.setting, GovernorSetting::UpdateBudget);
+    EXPECT_EQ(decision.reason, std::string("headroom"));
+    EXPECT_EQ(decision.to, 4);
+    EXPECT_GE(decision.frame, 3u * 30u);
+
+    // Going over straight away after turning the quality up makes the next one wait twice as long
+    ASSERT_TRUE(feed(governor, 10.0, 5.0, 1000, decision));
+    EXPECT_EQ(decision.to, 2);
+    EXPECT_EQ(governor.m_raiseAfter, 6u);
+    size_t before = decision.frame;
+    ASSERT_TRUE(feed(governor, 1.0, 5.0, 1000, decision));
+    EXPECT_GE(decision.frame - before, 10u + 6u * 30u);
+    EXPECT_EQ(decision.to, 4);
+
+    // Then no limit, then the active levels
+    ASSERT_TRUE(feed(governor, 1.0, 5.0, 1000, decision));
+    EXPECT_EQ(decision.setting, GovernorSetting::UpdateBudget);
+    EXPECT_EQ(decision.to, 0);
+    EXPECT_EQ(manager->updateBudget(), 0u);
+    ASSERT_TRUE(feed(governor, 1.0, 5.0, 1000, decision));
+    EXPECT_EQ(decision.setting, GovernorSetting::R);
+    EXPECT_EQ(decision.to, 3);
+
+    manager->setK(K);
+    manager->setR(R);
+    manager->setUpdateBudget(0);
+  }
+
+  TEST(QualityGovernorTest, log)
+  {
+    Manager *manager = Manager::getInstance();
+    unsigned char R = manager->R();
+    manager->setR(3);
+    std::string path = (std::filesystem::temp_directory_path() / "geoclipmap_governor.csv").string();
+    {
+      QualityGovernor governor(10.0);
+      ASSERT_TRUE(governor.openLog(path));
+      GovernorDecision decision;
+      ASSERT_TRUE(feed(governor, 0.0, 12.0, 100, decision));
+    }
+
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    EXPECT_EQ(line, "frame,cpu_update_ms,gpu_ms,target_ms,setting,from,to,reason");
+    std::getline(file, line);
+    EXPECT_EQ(line, "30,0,12,10,R,3,2,gpu over target");
+    EXPECT_FALSE(std::getline(file, line));
+    std::filesystem::remove(path);
+
+    manager->setR(R);
+  }
+} // end namespace geoclipmap
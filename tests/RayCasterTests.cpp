@@ -0,0 +1,140 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <cmath>
+#include <limits>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "RayCaster.h"
+#include "TestHeightmaps.h"
+
+namespace geoclipmap
+{
+  TEST(RayCasterTest, flat)
+  {
+    int width = 64;
+    int depth = 48;
+    std::vector<ngl::Vec3> data(static_cast<size_t>(width) * depth, grey(1.0f));
+    Heightmap h(static_cast<ngl::Real>(width), static_cast<ngl::Real>(depth), data);
+    RayCaster caster(&h);
+
+    // Straight down
+    RayHit hit = caster.cast({10.3f, 20.7f, 5.0f}, {0.0f, 0.0f, -2.0f});
+    ASSERT_TRUE(hit.hit);
+    EXPECT_NEAR(hit.position.m_x, 10.3f, 0.0001f);
+    EXPECT_NEAR(hit.position.m_y, 20.7f, 0.0001f);
+    EXPECT_NEAR(hit.position.m_z, 1.0f, 0.0001f);
+    EXPECT_NEAR(hit.distance, 4.0f, 0.0001f);
+    EXPECT_EQ(hit.sampleX, 10);
+    EXPECT_EQ(hit.sampleY, 21);
+
+    // At a slant from outside the heightmap
+    hit = caster.cast({-10.0f, 5.0f, 11.0f}, {1.0f, 0.0f, -0.5f});
+    ASSERT_TRUE(hit.hit);
+    EXPECT_NEAR(hit.position.m_x, 10.0f, 0.0001f);
+    EXPECT_NEAR(hit.position.m_z, 1.0f, 0.0001f);
+    EXPECT_NEAR(hit.distance, std::sqrt(20.0f * 20.0f + 10.0f * 10.0f), 0.001f);
+
+    // Too short, pointing up, and missing the heightmap altogether
+    EXPECT_FALSE(caster.cast({10.0f, 10.0f, 5.0f}, {0.0f, 0.0f, -1.0f}, 3.5f).hit);
+    EXPECT_FALSE(caster.cast({10.0f, 10.0f, 5.0f}, {0.3f, 0.2f, 1.0f}).hit);
+    EXPECT_FALSE(caster.cast({-10.0f, -10.0f, 5.0f}, {-1.0f, 0.0f, -0.1f}).hit);
+  }
+
+  TEST(RayCasterTest, matches_every_cell)
+  {
+    int width = 130;
+    int depth = 97;
+    Heightmap h(static_cast<ngl::Real>(width), static_cast<ngl::Real>(depth), hills(width, depth, {1.0f, 0.8f, 0.15f, 0.11f, 0.1f, 0.9f, 0.7f}));
+    RayCaster caster(&h);
+
+    // Compare against testing every cell of the heightmap for the nearest hit
+    std::mt19937 random(5);
+    std::uniform_real_distribution<ngl::Real> x(-20.0f, width + 20.0f);
+    std::uniform_real_distribution<ngl::Real> y(-20.0f, depth + 20.0f);
+    std::uniform_real_distribution<ngl::Real> z(2.0f, 6.0f);
+    std::uniform_real_distribution<ngl::Real> slope(-0.2f, -0.01f);
+    int hits = 0;
+    for (int i = 0; i < 200; i++)
+    {
+      ngl::Vec3 origin(x(random), y(random), z(random));
+      ngl::Vec3 target(x(random), y(random), 0.0f);
+      ngl::Vec3 direction(target.m_x - origin.m_x, target.m_y - origin.m_y, 0.0f);
+      direction.m_z = slope(random) * direction.length();
+
+      double nearest = std::numeric_limits<double>::max();
+      for (int64_t cy = 0; cy < depth - 1; cy++)
+      {
+        for (int64_t cx = 0; cx < width - 1; cx++)
+        {
+          double tEnter = 0.0;
+          double tExit = std::numeric_limits<double>::max();
+          // Clip the ray to the cell
+          for (int axis = 0; axis < 2; axis++)
+          {
+            double o = axis == 0 ? origin.m_x : origin.m_y;
+            double d = axis == 0 ? direction.m_x : direction.m_y;
+            double lo = static_cast<double>(axis == 0 ? cx : cy);
+            double t0 = (lo - o) / d;
+            double t1 = (lo + 1.0 - o) / d;
+            tEnter = std::max(tEnter, std::min(t0, t1));
+            tExit = std::min(tExit, std::max(t0, t1));
+          }
+          bool inside = tEnter <= tExit;
+          double t;
+          if (inside && caster.intersectCell(origin, direction, cx, cy, tEnter, tExit, t))
+          {
+            nearest = std::min(nearest, t);
+          }
+        }
+      }
+
+      RayHit hit = caster.cast(origin, direction);
+      ASSERT_EQ(hit.hit, nearest != std::numeric_limits<double>::max());
+      if (hit.hit)
+      {
+        hits++;
+        ASSERT_NEAR(hit.distance, nearest * direction.length(), 0.001f);
+        // Never above the surface (rays coming in low from the side hit the heightmap's edge under it)
+        int64_t cx = static_cast<int64_t>(std::floor(hit.position.m_x));
+        int64_t cy = static_cast<int64_t>(std::floor(hit.position.m_y));
+        ngl::Real highest = std::max(std::max(h.value(cx, cy), h.value(cx + 1, cy)), std::max(h.value(cx, cy + 1), h.value(cx + 1, cy + 1)));
+        ASSERT_LE(hit.position.m_z, highest + 0.001f);
+      }
+    }
+    // Make sure plenty of rays actually hit something
+    EXPECT_GT(hits, 50);
+  }
+
+  TEST(RayCasterTest, batch)
+  {
+    int width = 256;
+    int depth = 256;
+    Heightmap h(static_cast<ngl::Real>(width), static_cast<ngl::Real>(depth), hills(width, depth, {1.0f, 0.8f, 0.15f, 0.11f, 0.1f, 0.9f, 0.7f}));
+    RayCaster caster(&h);
+
+    std::mt19937 random(9);
+    std::uniform_real_distribution<ngl::Real> coord(0.0f, 256.0f);
+    std::vector<ngl::Vec3> origins;
+    std::vector<ngl::Vec3> directions;
+    for (int i = 0; i < 1000; i++)
+    {
+      origins.push_back(ngl::Vec3(coord(random), coord(random), 4.0f));
+      directions.push_back(ngl::Vec3(coord(random) - 128.0f, coord(random) - 128.0f, -10.0f));
+    }
+
+    std::vector<RayHit> hits(origins.size());
+    caster.castBatch(origins.data(), directions.data(), origins.size(), hits.data());
+    for (size_t i = 0; i < origins.size(); i++)
+    {
+      RayHit hit = caster.cast(origins[i], directions[i]);
+      ASSERT_EQ(hits[i].hit, hit.hit);
+      ASSERT_EQ(hits[i].distance, hit.distance);
+      ASSERT_EQ(hits[i].sampleX, hit.sampleX);
+      ASSERT_EQ(hits[i].sampleY, hit.sampleY);
+    }
+  }
+} // end namespace geoclipmap
@@ -5,6 +5,7 @@
 #include <gtest/gtest.h>
 
 #include "Manager.h"
+#include "Metrics.h"
 #include "Terrain.h"
 
 namespace geoclipmap
@@ -22,7 +23,9 @@ namespace geoclipmap
     // Check internal data
     EXPECT_EQ(t.m_heightmap, heightmap);
     EXPECT_EQ(t.m_footprints.size(), 6);
-    EXPECT_EQ(t.m_position, ngl::Vec2{});
+    EXPECT_EQ(t.positionX(), 0);
+    EXPECT_EQ(t.positionY(), 0);
+    EXPECT_EQ(t.m_positionFraction, ngl::Vec2{});
     EXPECT_EQ(t.m_clipmaps.size(), manager->L());
     EXPECT_EQ(t.m_activeFinest, manager->L() - 1);
     EXPECT_EQ(t.m_activeCoarsest, 0);
@@ -48,4 +51,302 @@ namespace geoclipmap
       EXPECT_TRUE(clipmap != nullptr);
     }
   }
+
+  TEST(TerrainTest, far_from_origin)
+  {
+    Manager *manager = Manager::getInstance();
+    std::vector<ngl::Vec3> heightmapData{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+    Heightmap *heightmap = new Heightmap(4, 4, heightmapData);
+
+    Terrain near(heightmap);
+    near.moveTo(1000, 2000);
+
+    // A world of 2^20 samples per side, offset by a multiple of the coarsest scale so every level's trims are the same
+    int64_t coarsestScale = near.m_clipmaps[0]->scale();
+    int64_t farOffset = (static_cast<int64_t>(1) << 20) / coarsestScale * coarsestScale;
+    Terrain far(heightmap);
+    far.moveTo(1000 + farOffset, 2000 + farOffset);
+
+    // The camera-relative positions are exactly the same and the origins are exactly offset
+    for (int l = 0; l < manager->L(); l++)
+    {
+      auto nearLevel = near.m_clipmaps[l];
+      auto farLevel = far.m_clipmaps[l];
+      EXPECT_EQ(farLevel->position(), nearLevel->position());
+      EXPECT_EQ(farLevel->trimLocation(), nearLevel->trimLocation());
+      EXPECT_EQ(farLevel->originX(), nearLevel->originX() + farOffset / farLevel->scale());
+      EXPECT_EQ(farLevel->originY(), nearLevel->originY() + farOffset / farLevel->scale());
+    }
+
+    // Small moves still add up far from the origin, where a float position can't represent them
+    for (int i = 0; i < 40; i++)
+    {
+      far.move(0.25f, -0.25f);
+    }
+    EXPECT_EQ(far.positionX(), 1000 + farOffset + 10);
+    EXPECT_EQ(far.positionY(), 2000 + farOffset - 10);
+    EXPECT_EQ(far.m_positionFraction, ngl::Vec2{});
+  }
+  TEST(TerrainTest, refresh_region)
+  {
+    std::vector<ngl::Real> heights(256 * 256, 1.0f);
+    Heightmap heightmap(256, 256, heights.data());
+    Terrain t(&heightmap);
+    t.moveTo(128, 128);
+
+    heights[128 * 256 + 128] = 3.0f;
+    heights[128 * 256 + 129] = 3.0f;
+    // Every level reads sample 128, 128 as it's a multiple of every scale up to 128
+    int covering = 0;
+    for (int l = t.m_activeCoarsest; l <= t.m_activeFinest; l++)
+    {
+      covering += t.m_clipmaps[l]->scale() <= 128 ? 1 : 0;
+    }
+    EXPECT_EQ(t.refreshRegion(128, 128, 129, 128), covering);
+
+    // The active levels' textures now match the heightmap everywhere
+    for (int l = t.m_activeCoarsest; l <= t.m_activeFinest; l++)
+    {
+      ClipmapLevel *level = t.m_clipmaps[l];
+      std::vector<ngl::Real> expected(level->heights().size());
+      int D = static_cast<int>(Manager::getInstance()->D());
+      heightmap.readWindow(level->originX() * level->scale(), level->originY() * level->scale(), level->scale(), D, D, expected.data());
+      EXPECT_EQ(level->heights(), expected) << "level " << l;
+    }
+  }
+
+  TEST(TerrainTest, progressive)
+  {
+    Manager *manager = Manager::getInstance();
+    manager->setProgressive(true);
+    std::vector<ngl::Real> heights(256 * 256, 1.0f);
+    Heightmap heightmap(256, 256, heights.data());
+    size_t D = manager->D();
+    // The height a level read for sample 128, 0 (a multiple of every scale up to 128)
+    auto heightAt = [D](ClipmapLevel *_level) {
+      int64_t x = 128 / _level->scale() - _level->originX();
+      int64_t y = -_level->originY();
+      return _level->heights()[static_cast<size_t>(y) * D + static_cast<size_t>(x)];
+    };
+
+    // Only the coarsest level is filled at first
+    Terrain t(&heightmap);
+    auto started = t.fillStarted();
+    EXPECT_EQ(t.readyFinest(), t.m_activeCoarsest);
+    EXPECT_TRUE(t.refining());
+    EXPECT_EQ(t.m_clipmaps[0]->heights().size(), D * D);
+    EXPECT_TRUE(t.m_clipmaps[1]->heights().empty());
+
+    // Then a finer level each refine, until every active level is ready
+    t.setActiveLevels(0.0f);
+    unsigned char coarsest = t.m_activeCoarsest;
+    EXPECT_EQ(t.readyFinest(), coarsest);
+    for (int l = coarsest + 1; l <= t.m_activeFinest; l++)
+    {
+      EXPECT_TRUE(t.m_clipmaps[l]->heights().empty());
+      EXPECT_TRUE(t.refine());
+      EXPECT_EQ(t.readyFinest(), l);
+      EXPECT_EQ(t.m_clipmaps[l]->heights().size(), D * D);
+    }
+    EXPECT_FALSE(t.refining());
+    EXPECT_FALSE(t.refine());
+    EXPECT_EQ(t.fillStarted(), started);
+
+    // Small moves keep every level ready
+    t.moveTo(10, 0);
+    EXPECT_EQ(t.readyFinest(), t.m_activeFinest);
+    EXPECT_EQ(t.fillStarted(), started);
+
+    // Jumps start again from the coarsest, with the finer levels left for refine
+    std::vector<ngl::Real> finest = t.m_clipmaps[t.m_activeFinest]->heights();
+    heights.assign(heights.size(), 2.0f);
+    t.moveTo(10 + static_cast<int64_t>(manager->D2()), 0);
+    EXPECT_EQ(t.readyFinest(), t.m_activeCoarsest);
+    EXPECT_GT(t.fillStarted(), started);
+    EXPECT_EQ(heightAt(t.m_clipmaps[t.m_activeCoarsest]), 2.0f);
+    EXPECT_EQ(t.m_clipmaps[t.m_activeFinest]->heights(), finest);
+    // Only ready levels are refreshed, the rest are read in full when refined
+    EXPECT_EQ(t.refreshRegion(0, 0, 255, 255), 1);
+    while (t.refine())
+    {
+    }
+    EXPECT_EQ(heightAt(t.m_clipmaps[t.m_activeFinest]), 2.0f);
+
+    // Without progressive refinement every level is filled straight away
+    manager->setProgressive(false);
+    t.moveTo(10, 0);
+    EXPECT_EQ(t.readyFinest(), t.m_activeFinest);
+    Terrain whole(&heightmap);
+    EXPECT_EQ(whole.readyFinest(), whole.m_activeFinest);
+    EXPECT_FALSE(whole.refining());
+  }
+
+  TEST(TerrainTest, sub_texel_moves)
+  {
+    Manager *manager = Manager::getInstance();
+    Metrics *metrics = Metrics::getInstance();
+    std::vector<ngl::Real> heights(256 * 256, 1.0f);
+    Heightmap heightmap(256, 256, heights.data());
+    size_t D = manager->D();
+    Terrain t(&heightmap);
+    t.moveTo(128, 128);
+
+    // Whole samples of the fraction are carried over
+    t.moveTo(10, 10, ngl::Vec2{1.5f, -0.25f});
+    EXPECT_EQ(t.positionX(), 11);
+    EXPECT_EQ(t.positionY(), 9);
+    EXPECT_EQ(t.positionFraction(), (ngl::Vec2{0.5f, 0.75f}));
+
+    // Moving within a sample keeps every texture, each level is offset by exactly as much as its origin is behind the
+    // camera
+    t.moveTo(128, 128);
+    metrics->frameFinished(0.0);
+    t.moveTo(128, 128, ngl::Vec2{0.5f, 0.25f});
+    metrics->frameFinished(0.0);
+    EXPECT_EQ(metrics->lastFrame().counter(Counter::TexelsRegenerated), 0u);
+    for (int l = t.m_activeCoarsest; l <= t.m_activeFinest; l++)
+    {
+      ClipmapLevel *level = t.m_clipmaps[l];
+      auto scale = static_cast<ngl::Real>(level->scale());
+      ngl::Vec2 offset = level->position() - level->subTexelOffset();
+      EXPECT_FLOAT_EQ(offset.m_x * scale + 128.5f, static_cast<ngl::Real>(level->originX()) * scale) << "level " << l;
+      EXPECT_FLOAT_EQ(offset.m_y * scale + 128.25f, static_cast<ngl::Real>(level->originY()) * scale) << "level " << l;
+    }
+    EXPECT_EQ(t.m_clipmaps[t.m_activeFinest]->subTexelOffset(), (ngl::Vec2{0.5f, 0.25f}));
+
+    // Moving a whole sample only fills the levels whose origins moved
+    std::vector<int64_t> originsX;
+    for (auto level : t.m_clipmaps)
+    {
+      originsX.push_back(level->originX());
+    }
+    t.moveTo(129, 128, ngl::Vec2{0.5f, 0.25f});
+    metrics->frameFinished(0.0);
+    int moved = 0;
+    for (int l = t.m_activeCoarsest; l <= t.m_activeFinest; l++)
+    {
+      bool levelMoved = t.m_clipmaps[l]->originX() != originsX[l];
+      moved += levelMoved ? 1 : 0;
+      EXPECT_EQ(metrics->lastFrame().levelTexels[l], levelMoved ? D * D : 0u) << "level " << l;
+    }
+    EXPECT_GT(moved, 0);
+    EXPECT_LT(moved, t.m_activeFinest - t.m_activeCoarsest + 1);
+
+    // Levels that weren't refreshed when heights changed are read again once they're needed
+    t.setActiveLevels(0.0f);
+    ASSERT_GT(t.m_activeCoarsest, 0);
+    heights.assign(heights.size(), 2.0f);
+    EXPECT_EQ(t.refreshRegion(0, 0, 255, 255), t.m_activeFinest - t.m_activeCoarsest + 1);
+    ClipmapLevel *coarsest = t.m_clipmaps[0];
+    EXPECT_TRUE(coarsest->stale());
+    EXPECT_FALSE(t.m_clipmaps[t.m_activeCoarsest]->stale());
+    t.setActiveLevels(250.0f * manager->L());
+    EXPECT_EQ(t.m_activeCoarsest, 0);
+    int64_t x = 128 / coarsest->scale() - coarsest->originX();
+    int64_t y = 128 / coarsest->scale() - coarsest->originY();
+    EXPECT_EQ(coarsest->heights()[static_cast<size_t>(y) * D + static_cast<size_t>(x)], 2.0f);
+  }
+
+  TEST(TerrainTest, reconfigure)
+  {
+    Manager *manager = Manager::getInstance();
+    unsigned char oldK = manager->K();
+    unsigned char oldL = manager->L();
+    unsigned char K = 8;
+    unsigned char L = 8;
+    manager->setK(K);
+    manager->setL(L);
+    std::vector<ngl::Real> heights(256 * 256, 1.0f);
+    Heightmap heightmap(256, 256, heights.data());
+    Terrain t(&heightmap);
+    t.moveTo(128, 128);
+    std::vector<ClipmapLevel *> levels = t.m_clipmaps;
+
+    // Nothing to do if K and L haven't changed
+    manager->setR(manager->R() + 1);
+    EXPECT_FALSE(t.reconfigure());
+    manager->setR(manager->R() - 1);
+
+    // A new K keeps the levels but resizes them, the footprints being made again for the new size
+    manager->setK(K - 1);
+    size_t D = manager->D();
+    ASSERT_TRUE(t.reconfigure());
+    EXPECT_EQ(t.m_clipmaps, levels);
+    EXPECT_EQ(t.m_locations.size(), 25u);
+    EXPECT_EQ(t.readyFinest(), t.m_activeFinest);
+    for (int l = t.m_activeCoarsest; l <= t.m_activeFinest; l++)
+    {
+      EXPECT_EQ(t.m_clipmaps[l]->heights().size(), D * D) << "level " << l;
+      EXPECT_FALSE(t.m_clipmaps[l]->stale()) << "level " << l;
+    }
+    EXPECT_EQ(t.positionX(), 128);
+
+    // A new L adds finer levels after the ones kept, every level's scale following
+    manager->setL(L + 1);
+    ASSERT_TRUE(t.reconfigure());
+    ASSERT_EQ(t.m_clipmaps.size(), static_cast<size_t>(L + 1));
+    for (int l = 0; l <= L; l++)
+    {
+      if (l < L)
+      {
+        EXPECT_EQ(t.m_clipmaps[l], levels[l]);
+      }
+      EXPECT_EQ(t.m_clipmaps[l]->scale(), 1 << (L - l)) << "level " << l;
+    }
+
+    // And removes them again
+    manager->setK(K);
+    manager->setL(L);
+    ASSERT_TRUE(t.reconfigure());
+    EXPECT_EQ(t.m_clipmaps, levels);
+    EXPECT_EQ(t.m_activeFinest, L - 1);
+    EXPECT_EQ(t.m_clipmaps[L - 1]->heights().size(), manager->D() * manager->D());
+
+    manager->setK(oldK);
+    manager->setL(oldL);
+  }
+
+  TEST(TerrainTest, update_budget)
+  {
+    Manager *manager = Manager::getInstance();
+    size_t texels = manager->D() * manager->D();
+    std::vector<ngl::Real> heights(256 * 256, 1.0f);
+    Heightmap heightmap(256, 256, heights.data());
+
+    // Only as many levels are filled as the budget allows, the rest being left for refine
+    manager->setUpdateBudget(2 * texels);
+    Terrain t(&heightmap);
+    EXPECT_EQ(t.readyFinest(), t.m_activeCoarsest + 1);
+    EXPECT_TRUE(t.refining());
+    EXPECT_FALSE(t.refine());
+    t.beginFrame();
+    EXPECT_TRUE(t.refine());
+    EXPECT_TRUE(t.refine());
+    EXPECT_FALSE(t.refine());
+    EXPECT_EQ(t.readyFinest(), t.m_activeCoarsest + 3);
+    while (t.refining())
+    {
+      t.beginFrame();
+      t.refine();
+    }
+
+    // Moves only fill what they can, but always the coarsest level and at least one level a frame while refining
+    manager->setUpdateBudget(1);
+    t.beginFrame();
+    t.moveTo(7, 0);
+    EXPECT_LT(t.readyFinest(), t.m_activeFinest);
+    for (int l = t.m_activeCoarsest; l <= t.readyFinest(); l++)
+    {
+      EXPECT_FALSE(t.m_clipmaps[l]->stale()) << "level " << l;
+    }
+    EXPECT_TRUE(t.m_clipmaps[t.readyFinest() + 1]->stale());
+    while (t.refining())
+    {
+      t.beginFrame();
+      EXPECT_TRUE(t.refine());
+      EXPECT_FALSE(t.refining() && t.m_clipmaps[t.readyFinest() + 1]->stale() && t.refine());
+    }
+
+    manager->setUpdateBudget(0);
+  }
 } // end namespace geoclipmap
\ No newline at end of file
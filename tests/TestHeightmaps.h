@@ -0,0 +1,76 @@
+/**
+ * @file TestHeightmaps.h
+ * @author Ollie Nicholls
+ * @brief Heightmap data shared by the tests and benchmarks: greys of a given
+ * height and rolling hills
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#ifndef TEST_HEIGHTMAPS_H_
+#define TEST_HEIGHTMAPS_H_
+
+#include <cmath>
+#include <vector>
+
+#include <ngl/Types.h>
+#include <ngl/Vec3.h>
+
+namespace geoclipmap
+{
+  /**
+   * @brief The shape of hills(): height = base + amplitude * sin(x *
+   * frequencyX) * cos(y * frequencyY) + detail * sin(x * detailX + y * detailY)
+   *
+   */
+  struct HillsShape
+  {
+    ngl::Real base = 1.0f;
+    ngl::Real amplitude = 0.6f;
+    ngl::Real frequencyX = 0.12f;
+    ngl::Real frequencyY = 0.09f;
+    // Finer ripples on top of the hills, none by default
+    ngl::Real detail = 0.0f;
+    ngl::Real detailX = 0.7f;
+    ngl::Real detailY = 0.5f;
+  };
+
+  // The broad, gentle hills the benchmarks and the perf gate read
+  constexpr HillsShape k_benchmarkHills{0.75f, 0.75f, 0.01f, 0.013f};
+
+  /**
+   * @brief Get the grey a heightmap image has for a height (a Heightmap reads
+   * a colour's height as the sum of its squared channels)
+   *
+   * @param _height The height
+   * @return ngl::Vec3 The colour
+   */
+  inline ngl::Vec3 grey(ngl::Real _height)
+  {
+    return ngl::Vec3(std::sqrt(_height / 3.0f));
+  }
+
+  /**
+   * @brief Make the colours of a heightmap of smooth hills
+   *
+   * @param _width The width of the heightmap
+   * @param _depth The depth of the heightmap
+   * @param _shape The shape of the hills
+   * @return std::vector<ngl::Vec3> The colours (row-major)
+   */
+  inline std::vector<ngl::Vec3> hills(int _width, int _depth, const HillsShape &_shape = HillsShape())
+  {
+    std::vector<ngl::Vec3> data;
+    data.reserve(static_cast<size_t>(_width) * _depth);
+    for (int y = 0; y < _depth; y++)
+    {
+      for (int x = 0; x < _width; x++)
+      {
+        data.push_back(grey(_shape.base + _shape.amplitude * std::sin(x * _shape.frequencyX) * std::cos(y * _shape.frequencyY) +
+                            _shape.detail * std::sin(x * _shape.detailX + y * _shape.detailY)));
+      }
+    }
+    return data;
+  }
+} // end namespace geoclipmap
+#endif // !TEST_HEIGHTMAPS_H_
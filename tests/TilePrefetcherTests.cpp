@@ -0,0 +1,85 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "Manager.h"
+#include "TestHeightmaps.h"
+#include "TilePrefetcher.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    Heightmap *makeHeightmap(int _width, int _depth)
+    {
+      Heightmap *heightmap = new Heightmap(static_cast<ngl::Real>(_width), static_cast<ngl::Real>(_depth),
+                                           hills(_width, _depth, {1.5f, 1.0f, 0.02f, 0.03f}));
+      heightmap->compress(0.001f);
+      return heightmap;
+    }
+
+    /**
+     * @brief Move a terrain across a heightmap at a steady speed, returning the
+     * number of frames that stalled
+     */
+    size_t stalledFrames(int _framesAhead)
+    {
+      Heightmap *heightmap = makeHeightmap(768, 512);
+      Terrain terrain(heightmap);
+      terrain.setActiveLevels(0.0f);
+      terrain.moveTo(200, 250);
+      TilePrefetcher prefetcher(&terrain, heightmap, _framesAhead, 64);
+
+      for (int frame = 0; frame < 60; frame++)
+      {
+        terrain.move(5.0f, 1.5f);
+        prefetcher.update(0.0f);
+      }
+      EXPECT_EQ(prefetcher.stats().frames, 60u);
+      return prefetcher.stats().stalledFrames;
+    }
+  } // end namespace
+
+  TEST(TilePrefetcherTest, predicts_movement)
+  {
+    // Other tests change the clipmap settings, use the defaults
+    Manager *manager = Manager::getInstance();
+    unsigned char K = manager->K();
+    unsigned char L = manager->L();
+    unsigned char R = manager->R();
+    manager->setK(8);
+    manager->setL(8);
+    manager->setR(4);
+
+    // Without looking ahead new tiles stall a frame every time a window reaches them
+    size_t withoutPrefetch = stalledFrames(0);
+    EXPECT_GE(withoutPrefetch, 4u);
+
+    // Looking ahead only the frames before the movement is known can stall
+    size_t withPrefetch = stalledFrames(8);
+    EXPECT_LE(withPrefetch, 1u);
+
+    manager->setK(K);
+    manager->setL(L);
+    manager->setR(R);
+  }
+
+  TEST(TilePrefetcherTest, uncompressed)
+  {
+    std::vector<ngl::Vec3> data(64 * 64, ngl::Vec3(0.5f));
+    Heightmap heightmap(64, 64, data);
+    Terrain terrain(&heightmap);
+    TilePrefetcher prefetcher(&terrain, &heightmap);
+
+    // Nothing to wait for so nothing is followed
+    terrain.move(3.0f, 0.0f);
+    prefetcher.update(0.0f);
+    EXPECT_EQ(prefetcher.stats().frames, 0u);
+    EXPECT_EQ(heightmap.warm(0, 0, 63, 63, 1, 10), 0u);
+  }
+} // end namespace geoclipmap
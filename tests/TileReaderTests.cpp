@@ -0,0 +1,124 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "TileReader.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    // The byte at each offset of the test file, so any read can be checked
+    uint8_t patternByte(uint64_t _offset)
+    {
+      return static_cast<uint8_t>((_offset * 2654435761u) >> 13);
+    }
+
+    std::string writePatternFile(size_t _size)
+    {
+      std::string path = (std::filesystem::temp_directory_path() / "geoclipmap_tile_reader.bin").string();
+      std::vector<char> bytes(_size);
+      for (size_t i = 0; i < _size; i++)
+      {
+        bytes[i] = static_cast<char>(patternByte(i));
+      }
+      std::ofstream file(path, std::ios::binary | std::ios::trunc);
+      file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+      return path;
+    }
+
+    /**
+     * @brief Read a batch of random reads (many more than io_uring queues at
+     * once) and check every one arrives once with the right bytes
+     */
+    void checkReads(TileReader &_reader, size_t _fileSize)
+    {
+      std::mt19937 random(7);
+      std::vector<TileRead> reads;
+      for (int i = 0; i < 500; i++)
+      {
+        size_t size = 1 + random() % 9000;
+        reads.push_back({random() % (_fileSize - size), size});
+      }
+      // One that ends right at the end of the file, which isn't a multiple of the alignment
+      reads.push_back({_fileSize - 100, 100});
+
+      std::mutex mutex;
+      std::vector<int> calls(reads.size(), 0);
+      std::vector<bool> correct(reads.size(), false);
+      _reader.readBatch(reads, [&](size_t _i, const uint8_t *_data, size_t _size) {
+        bool ok = _data != nullptr && _size == reads[_i].size;
+        for (size_t j = 0; ok && j < _size; j++)
+        {
+          ok = _data[j] == patternByte(reads[_i].offset + j);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        calls[_i]++;
+        correct[_i] = ok;
+      });
+
+      for (size_t i = 0; i < reads.size(); i++)
+      {
+        EXPECT_EQ(calls[i], 1) << "read " << i;
+        EXPECT_TRUE(correct[i]) << "read " << i;
+      }
+
+      // Past the end of the file fails rather than returning garbage
+      int failures = 0;
+      _reader.readBatch({{_fileSize + 8192, 10}}, [&](size_t, const uint8_t *_data, size_t) {
+        failures += _data == nullptr ? 1 : 0;
+      });
+      EXPECT_EQ(failures, 1);
+    }
+  } // end namespace
+
+  TEST(TileReaderTest, pread)
+  {
+    size_t size = 3 * 1024 * 1024 + 123;
+    std::string path = writePatternFile(size);
+    for (bool direct : {false, true})
+    {
+      auto reader = TileReader::open(path, TileReaderBackend::Pread, direct);
+      ASSERT_NE(reader, nullptr);
+      EXPECT_EQ(reader->backend(), TileReaderBackend::Pread);
+      if (!direct)
+      {
+        EXPECT_FALSE(reader->directIO());
+      }
+      checkReads(*reader, size);
+    }
+    std::filesystem::remove(path);
+  }
+
+  TEST(TileReaderTest, io_uring)
+  {
+    size_t size = 3 * 1024 * 1024 + 123;
+    std::string path = writePatternFile(size);
+    for (bool direct : {false, true})
+    {
+      auto reader = TileReader::open(path, TileReaderBackend::IoUring, direct);
+      ASSERT_NE(reader, nullptr);
+      if (reader->backend() != TileReaderBackend::IoUring)
+      {
+        std::filesystem::remove(path);
+        GTEST_SKIP() << "io_uring isn't supported by this kernel";
+      }
+      checkReads(*reader, size);
+    }
+    std::filesystem::remove(path);
+  }
+
+  TEST(TileReaderTest, missing_file)
+  {
+    EXPECT_EQ(TileReader::open("/nonexistent/tiles.bin", TileReaderBackend::IoUring, false), nullptr);
+    EXPECT_EQ(TileReader::open("/nonexistent/tiles.bin", TileReaderBackend::Pread, true), nullptr);
+  }
+} // end namespace geoclipmap
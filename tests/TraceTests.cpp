@@ -0,0 +1,126 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "Trace.h"
+
+namespace geoclipmap
+{
+  namespace
+  {
+    void traced(int _level)
+    {
+      TraceZone zone("traced", _level);
+    }
+  } // end namespace
+
+  TEST(TraceTest, zones)
+  {
+    Tracer *tracer = Tracer::getInstance();
+
+    // Nothing is recorded outside of a capture
+    EXPECT_FALSE(Tracer::capturing());
+    tracer->start(0);
+    EXPECT_FALSE(Tracer::capturing());
+    traced(1);
+    EXPECT_EQ(tracer->zoneCount(), 0u);
+
+    uint32_t captureId = tracer->captureId();
+    tracer->start(2);
+    EXPECT_TRUE(Tracer::capturing());
+    EXPECT_NE(tracer->captureId(), captureId);
+    {
+      TraceZone outer("outer");
+      traced(3);
+    }
+    std::thread worker([] { traced(4); });
+    worker.join();
+    ASSERT_EQ(tracer->zoneCount(), 3u);
+
+    // Zones are recorded as they end, each on its thread's track
+    const auto &zones = tracer->m_zones;
+    EXPECT_STREQ(zones[0].name, "traced");
+    EXPECT_EQ(zones[0].level, 3);
+    EXPECT_STREQ(zones[1].name, "outer");
+    EXPECT_EQ(zones[1].level, -1);
+    EXPECT_LE(zones[1].start, zones[0].start);
+    EXPECT_GE(zones[1].end, zones[0].end);
+    EXPECT_EQ(zones[0].track, zones[1].track);
+    EXPECT_NE(zones[2].track, zones[0].track);
+    EXPECT_NE(zones[2].track, 0u);
+
+    // The capture stops after its frames
+    EXPECT_FALSE(tracer->frameFinished());
+    EXPECT_TRUE(Tracer::capturing());
+    EXPECT_TRUE(tracer->frameFinished());
+    EXPECT_FALSE(Tracer::capturing());
+    EXPECT_FALSE(tracer->frameFinished());
+    traced(5);
+    EXPECT_EQ(tracer->zoneCount(), 3u);
+
+    // Starting again throws the last capture away
+    tracer->start(1);
+    EXPECT_EQ(tracer->zoneCount(), 0u);
+    EXPECT_TRUE(tracer->frameFinished());
+  }
+
+  TEST(TraceTest, write)
+  {
+    Tracer *tracer = Tracer::getInstance();
+    tracer->start(1);
+    int64_t now = Tracer::now();
+    tracer->addZone("updatePosition", now + 1000, now + 3500);
+    tracer->addGpuZone("upload", now + 2000, now + 2500, 7);
+    EXPECT_TRUE(tracer->frameFinished());
+
+    std::string path = (std::filesystem::temp_directory_path() / "geoclipmap_trace.json").string();
+    ASSERT_TRUE(tracer->write(path));
+    std::ifstream file(path);
+    std::stringstream json;
+    json << file.rdbuf();
+    std::string text = json.str();
+
+    // Chrome trace events in microseconds from the start of the capture, the GPU on track 0
+    EXPECT_EQ(text.rfind("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 0), 0u);
+    EXPECT_NE(text.find("\"tid\":0,\"args\":{\"name\":\"GPU\"}"), std::string::npos);
+    EXPECT_NE(text.find("{\"name\":\"upload\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":0,"), std::string::npos);
+    EXPECT_NE(text.find(",\"dur\":0.500,\"args\":{\"level\":7}}"), std::string::npos);
+    EXPECT_NE(text.find("{\"name\":\"updatePosition\",\"cat\":\"cpu\",\"ph\":\"X\""), std::string::npos);
+    EXPECT_NE(text.find(",\"dur\":2.500}"), std::string::npos);
+    EXPECT_EQ(text.substr(text.size() - 4), "\n]}\n");
+    std::filesystem::remove(path);
+
+    EXPECT_FALSE(tracer->write("/nonexistent/trace.json"));
+  }
+
+  TEST(TraceTest, gpu_zones)
+  {
+    Tracer *tracer = Tracer::getInstance();
+    GpuTrace gpu;
+
+    // Nothing is timed outside of a capture
+    gpu.begin("draw", 2);
+    gpu.end();
+    EXPECT_EQ(gpu.pending(), 0u);
+
+    tracer->start(1);
+    gpu.begin("upload", 2);
+    gpu.end();
+    gpu.begin("draw", 2);
+    gpu.end();
+    EXPECT_EQ(gpu.pending(), 2u);
+    EXPECT_TRUE(tracer->frameFinished());
+
+    // Zones still running when the capture ends are collected into it
+    gpu.collect(true);
+    EXPECT_EQ(gpu.pending(), 0u);
+    EXPECT_EQ(tracer->zoneCount(), 2u);
+  }
+} // end namespace geoclipmap
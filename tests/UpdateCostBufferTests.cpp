@@ -0,0 +1,35 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <gtest/gtest.h>
+
+#include "UpdateCostBuffer.h"
+
+namespace geoclipmap
+{
+  TEST(UpdateCostBufferTest, costs)
+  {
+    MetricsFrame frame;
+    frame.levelTexels[2] = 100;
+    frame.levelBytes[2] = 600;
+    frame.levelTexels[7] = 400;
+    frame.levelBytes[7] = 4800;
+
+    // Each level's texels and bytes, and both as fractions of a whole texture's
+    auto costs = UpdateCostBuffer::computeCosts(frame, 400);
+    EXPECT_EQ(costs[2].m_x, 100.0f);
+    EXPECT_EQ(costs[2].m_y, 600.0f);
+    EXPECT_FLOAT_EQ(costs[2].m_z, 0.25f);
+    EXPECT_FLOAT_EQ(costs[2].m_w, 600.0f / (400.0f * sizeof(ngl::Vec3)));
+    EXPECT_FLOAT_EQ(costs[7].m_z, 1.0f);
+    EXPECT_FLOAT_EQ(costs[7].m_w, 1.0f);
+    EXPECT_EQ(costs[0].m_x, 0.0f);
+    EXPECT_EQ(costs[0].m_w, 0.0f);
+
+    // An empty frame costs nothing, and a texture with no texels doesn't divide by 0
+    costs = UpdateCostBuffer::computeCosts(MetricsFrame(), 0);
+    EXPECT_EQ(costs[7].m_y, 0.0f);
+    EXPECT_EQ(costs[7].m_w, 0.0f);
+  }
+} // end namespace geoclipmap
@@ -0,0 +1,152 @@
+#ifndef TERRAIN_TESTING
+#define TERRAIN_TESTING
+#endif
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "TestHeightmaps.h"
+#include "Viewshed.h"
+
+namespace geoclipmap
+{
+  TEST(ViewshedTest, flat)
+  {
+    int width = 40;
+    int depth = 30;
+    std::vector<ngl::Vec3> data(static_cast<size_t>(width) * depth, grey(1.0f));
+    Heightmap h(static_cast<ngl::Real>(width), static_cast<ngl::Real>(depth), data);
+    Viewshed viewshed(&h);
+
+    // Everything can be seen on flat ground
+    viewshed.compute(7, 11, 0.1f);
+    EXPECT_EQ(viewshed.visibleCount(), static_cast<size_t>(width) * depth);
+    EXPECT_TRUE(viewshed.visible(0, 0));
+    EXPECT_TRUE(viewshed.visible(width - 1, depth - 1));
+    EXPECT_FALSE(viewshed.visible(-1, 0));
+    EXPECT_FALSE(viewshed.visible(width, 0));
+
+    // Apart from what is outside the radius
+    viewshed.compute(20, 15, 0.1f, 0.0f, 5);
+    EXPECT_TRUE(viewshed.visible(25, 15));
+    EXPECT_TRUE(viewshed.visible(23, 19));
+    EXPECT_FALSE(viewshed.visible(24, 19));
+    EXPECT_FALSE(viewshed.visible(14, 15));
+
+    // And the mask reads into rows
+    std::vector<ngl::Real> row(6);
+    viewshed.readRow(13, 15, 2, 6, row.data());
+    EXPECT_EQ(row, (std::vector<ngl::Real>{0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f}));
+
+    // An observer off the heightmap sees nothing
+    viewshed.compute(-1, 3, 0.1f);
+    EXPECT_EQ(viewshed.visibleCount(), 0u);
+  }
+
+  TEST(ViewshedTest, wall)
+  {
+    int width = 50;
+    int depth = 50;
+    std::vector<ngl::Vec3> data(static_cast<size_t>(width) * depth, grey(1.0f));
+    // A wall along x = 30 from y = 20 to 30
+    for (int y = 20; y <= 30; y++)
+    {
+      data[static_cast<size_t>(y) * width + 30] = grey(2.0f);
+    }
+    Heightmap h(static_cast<ngl::Real>(width), static_cast<ngl::Real>(depth), data);
+    Viewshed viewshed(&h);
+
+    viewshed.compute(10, 25, 0.1f);
+    EXPECT_TRUE(viewshed.visible(30, 25));
+    EXPECT_TRUE(viewshed.visible(29, 25));
+    EXPECT_FALSE(viewshed.visible(31, 25));
+    EXPECT_FALSE(viewshed.visible(49, 25));
+    EXPECT_TRUE(viewshed.visible(49, 5));
+
+    // Targets tall enough to see over it
+    viewshed.compute(10, 25, 0.1f, 5.0f);
+    EXPECT_TRUE(viewshed.visible(49, 25));
+
+    EXPECT_FALSE(viewshed.lineOfSight({10.0f, 25.0f, 1.1f}, {49.0f, 25.0f, 1.0f}));
+    EXPECT_TRUE(viewshed.lineOfSight({10.0f, 25.0f, 1.1f}, {49.0f, 5.0f, 1.0f}));
+    EXPECT_TRUE(viewshed.lineOfSight({10.0f, 25.0f, 4.0f}, {49.0f, 25.0f, 1.0f}));
+  }
+
+  TEST(ViewshedTest, matches_lines_of_sight)
+  {
+    int width = 120;
+    int depth = 90;
+    Heightmap h(static_cast<ngl::Real>(width), static_cast<ngl::Real>(depth), hills(width, depth, {1.0f, 0.6f, 0.12f, 0.09f, 0.1f}));
+    Viewshed viewshed(&h);
+
+    // The sweep interpolates horizons so it can disagree with exact lines of sight near the edges of what can be
+    // seen, more so further from the observer, but should agree nearly everywhere
+    for (auto observer : {std::make_pair(60, 45), std::make_pair(20, 10), std::make_pair(119, 0)})
+    {
+      ngl::Real targetHeight = 0.05f;
+      viewshed.compute(observer.first, observer.second, 0.2f, targetHeight);
+      ngl::Vec3 eye(static_cast<ngl::Real>(observer.first),
+                    static_cast<ngl::Real>(observer.second),
+                    h.value(observer.first, observer.second) + 0.2f);
+      int agree = 0;
+      for (int y = 0; y < depth; y++)
+      {
+        for (int x = 0; x < width; x++)
+        {
+          ngl::Vec3 target(static_cast<ngl::Real>(x), static_cast<ngl::Real>(y), h.value(x, y) + targetHeight);
+          agree += viewshed.visible(x, y) == viewshed.lineOfSight(eye, target);
+        }
+      }
+      EXPECT_GT(agree, width * depth * 93 / 100);
+      // Make sure it isn't trivially all or nothing
+      EXPECT_GT(viewshed.visibleCount(), static_cast<size_t>(width * depth / 20));
+      EXPECT_LT(viewshed.visibleCount(), static_cast<size_t>(width * depth * 19 / 20));
+    }
+  }
+
+  TEST(ViewshedTest, deterministic)
+  {
+    int width = 200;
+    int depth = 150;
+    Heightmap h(static_cast<ngl::Real>(width), static_cast<ngl::Real>(depth), hills(width, depth, {1.0f, 0.6f, 0.12f, 0.09f, 0.1f}));
+    Viewshed viewshed(&h);
+
+    viewshed.compute(80, 60, 0.1f, 0.0f, 70);
+    std::vector<uint8_t> parallel = viewshed.m_mask;
+
+    // Sweeping the octants one at a time in another order gives exactly the same mask
+    std::fill(viewshed.m_mask.begin(), viewshed.m_mask.end(), 0);
+    viewshed.m_mask[static_cast<size_t>((60 - viewshed.m_y0) * viewshed.m_width + (80 - viewshed.m_x0))] = 1;
+    ngl::Real eye = h.value(80, 60) + 0.1f;
+    for (int octant = 7; octant >= 0; octant--)
+    {
+      viewshed.sweepOctant(octant, 80, 60, eye, 0.0f, 70);
+    }
+    EXPECT_EQ(viewshed.m_mask, parallel);
+
+    // Every sample in the radius is written by one of the octants
+    std::fill(viewshed.m_mask.begin(), viewshed.m_mask.end(), 2);
+    for (int octant = 0; octant < 8; octant++)
+    {
+      viewshed.sweepOctant(octant, 80, 60, eye, 0.0f, 70);
+    }
+    for (int64_t y = viewshed.m_y0; y < viewshed.m_y0 + viewshed.m_depth; y++)
+    {
+      for (int64_t x = viewshed.m_x0; x < viewshed.m_x0 + viewshed.m_width; x++)
+      {
+        int64_t distance2 = (x - 80) * (x - 80) + (y - 60) * (y - 60);
+        uint8_t value = viewshed.m_mask[static_cast<size_t>((y - viewshed.m_y0) * viewshed.m_width + (x - viewshed.m_x0))];
+        if (distance2 > 0 && distance2 <= 70 * 70)
+        {
+          ASSERT_NE(value, 2) << x << ", " << y;
+        }
+        else if (distance2 > 0)
+        {
+          ASSERT_EQ(value, 2) << x << ", " << y;
+        }
+      }
+    }
+  }
+} // end namespace geoclipmap
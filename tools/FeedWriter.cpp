@@ -0,0 +1,124 @@
+/**
+ * @file FeedWriter.cpp
+ * @author Ollie Nicholls
+ * @brief A stand-in for an external simulation, driving a HeightmapFeed so
+ * the live terrain can be tried out without the real thing
+ *
+ * It creates the feed, fills it with rolling hills and then moves a mound
+ * around a circle over them, publishing the rectangle it changed each step.
+ *
+ * Usage: FeedWriter <name> [size] [--rate=N]
+ *
+ * Then run the demo with shm://<name> as the heightmap. The size defaults to
+ * 1024 samples square and the rate to 60 updates a second. It runs until
+ * killed, removing the feed when it exits.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include "HeightmapFeed.h"
+
+namespace
+{
+  volatile std::sig_atomic_t g_running = 1;
+
+  void stop(int)
+  {
+    g_running = 0;
+  }
+
+  float hills(int64_t _x, int64_t _y)
+  {
+    return 1.0f + 0.5f * std::sin(_x * 0.013f) * std::cos(_y * 0.017f);
+  }
+} // end namespace
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    std::fprintf(stderr, "Usage: FeedWriter <name> [size] [--rate=N]\n");
+    return EXIT_FAILURE;
+  }
+
+  // Shared memory names start with a slash
+  std::string name = argv[1][0] == '/' ? argv[1] : "/" + std::string(argv[1]);
+  int64_t size = 1024;
+  double rate = 60.0;
+  for (int i = 2; i < argc; i++)
+  {
+    std::string option(argv[i]);
+    if (option.compare(0, 7, "--rate=") == 0)
+    {
+      rate = std::max(std::atof(option.c_str() + 7), 1.0);
+    }
+    else
+    {
+      size = std::max<int64_t>(std::atoll(option.c_str()), 64);
+    }
+  }
+
+  auto writer = geoclipmap::HeightmapFeedWriter::create(name, size, size);
+  if (!writer)
+  {
+    std::fprintf(stderr, "Couldn't create %s\n", name.c_str());
+    return EXIT_FAILURE;
+  }
+  ngl::Real *heights = writer->heights();
+  for (int64_t y = 0; y < size; y++)
+  {
+    for (int64_t x = 0; x < size; x++)
+    {
+      heights[y * size + x] = hills(x, y);
+    }
+  }
+  writer->publish(0, 0, size - 1, size - 1);
+  std::printf("Writing %s (%lldx%lld)\n", name.c_str(), static_cast<long long>(size), static_cast<long long>(size));
+  std::fflush(stdout);
+
+  std::signal(SIGINT, stop);
+  std::signal(SIGTERM, stop);
+
+  // The mound covers the samples within its radius of its centre
+  const int64_t radius = size / 16;
+  int64_t previousX = -1;
+  int64_t previousY = -1;
+  auto period = std::chrono::duration<double>(1.0 / rate);
+  auto next = std::chrono::steady_clock::now();
+  for (long step = 0; g_running; step++)
+  {
+    double angle = step * 0.01;
+    int64_t centreX = size / 2 + static_cast<int64_t>(std::cos(angle) * size / 4);
+    int64_t centreY = size / 2 + static_cast<int64_t>(std::sin(angle) * size / 4);
+
+    // Rewrite the bounds of where the mound was and where it is now, so the old one is flattened back to hills
+    int64_t x0 = std::max<int64_t>(std::min(centreX, previousX < 0 ? centreX : previousX) - radius, 0);
+    int64_t y0 = std::max<int64_t>(std::min(centreY, previousY < 0 ? centreY : previousY) - radius, 0);
+    int64_t x1 = std::min<int64_t>(std::max(centreX, previousX) + radius, size - 1);
+    int64_t y1 = std::min<int64_t>(std::max(centreY, previousY) + radius, size - 1);
+    for (int64_t y = y0; y <= y1; y++)
+    {
+      for (int64_t x = x0; x <= x1; x++)
+      {
+        double distance = std::hypot(static_cast<double>(x - centreX), static_cast<double>(y - centreY)) / radius;
+        heights[y * size + x] = hills(x, y) + (distance < 1.0 ? static_cast<float>(0.5 * (1.0 + std::cos(distance * M_PI))) : 0.0f);
+      }
+    }
+    writer->publish(x0, y0, x1, y1);
+    previousX = centreX;
+    previousY = centreY;
+
+    next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+    std::this_thread::sleep_until(next);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,307 @@
+/**
+ * @file TileServer.cpp
+ * @author Ollie Nicholls
+ * @brief A small stand-in for a tile service, serving a baked heightmap (see
+ * CompressedHeightmap::bake) over HTTP so HttpTileReader can be run and tested
+ * without the real thing
+ *
+ * It serves the baked file at every path with HTTP/1.1 keep-alive, pipelining
+ * and single Range requests, from one thread polling every connection. GET
+ * /stats returns the number of connections and requests it has seen. Only
+ * listens on the loopback address.
+ *
+ * Usage: TileServer <baked_file> [port] [--max-requests=N]
+ *
+ * With port 0 (the default) it picks a free port. Either way it prints
+ * "Listening on port N" once it's ready. --max-requests closes each connection
+ * after N responses, like a server tuned to recycle connections.
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+  struct Client
+  {
+    int socket = -1;
+    // Bytes received but not yet handled
+    std::string in;
+    // Responses waiting to be sent
+    std::string out;
+    // The number of responses queued
+    long responses = 0;
+    // Whether to close once everything queued has been sent
+    bool closing = false;
+  };
+
+  struct Server
+  {
+    int file = -1;
+    uint64_t size = 0;
+    std::string etag;
+    long maxRequests = 0;
+    long connections = 0;
+    long requests = 0;
+  };
+
+  std::string header(const std::string &_headers, const std::string &_name)
+  {
+    size_t start = _headers.find("\n" + _name + ":");
+    if (start == std::string::npos)
+    {
+      return "";
+    }
+    start += _name.size() + 2;
+    std::string value = _headers.substr(start, _headers.find('\r', start) - start);
+    value.erase(0, value.find_first_not_of(' '));
+    return value;
+  }
+
+  /**
+   * @brief Queue the response to one request
+   */
+  void respond(Server &io_server, Client &io_client, const std::string &_method, const std::string &_path, const std::string &_headers)
+  {
+    io_server.requests++;
+    io_client.responses++;
+    bool head = _method == "HEAD";
+    std::string status = "200 OK";
+    std::string extra;
+    std::string body;
+
+    if (_method != "GET" && !head)
+    {
+      status = "405 Method Not Allowed";
+    }
+    else if (_path == "/stats")
+    {
+      body = "connections " + std::to_string(io_server.connections) + "\nrequests " + std::to_string(io_server.requests) + "\n";
+    }
+    else
+    {
+      uint64_t first = 0;
+      uint64_t last = io_server.size - 1;
+      std::string range = header(_headers, "range");
+      bool partial = range.compare(0, 6, "bytes=") == 0 && range.find(',') == std::string::npos;
+      if (partial)
+      {
+        size_t dash = range.find('-');
+        first = std::strtoull(range.c_str() + 6, nullptr, 10);
+        if (dash != std::string::npos && dash + 1 < range.size())
+        {
+          last = std::min<uint64_t>(last, std::strtoull(range.c_str() + dash + 1, nullptr, 10));
+        }
+      }
+
+      extra = "ETag: " + io_server.etag + "\r\nAccept-Ranges: bytes\r\n";
+      if (partial && (first >= io_server.size || first > last))
+      {
+        status = "416 Range Not Satisfiable";
+        extra += "Content-Range: bytes */" + std::to_string(io_server.size) + "\r\n";
+      }
+      else
+      {
+        if (partial)
+        {
+          status = "206 Partial Content";
+          extra += "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(io_server.size) + "\r\n";
+        }
+        body.resize(io_server.size == 0 ? 0 : last - first + 1);
+        if (!head && !body.empty() && ::pread(io_server.file, &body[0], body.size(), static_cast<off_t>(first)) != static_cast<ssize_t>(body.size()))
+        {
+          status = "500 Internal Server Error";
+          extra.clear();
+          body.clear();
+        }
+      }
+    }
+
+    if (header(_headers, "connection") == "close" || (io_server.maxRequests > 0 && io_client.responses >= io_server.maxRequests))
+    {
+      io_client.closing = true;
+      extra += "Connection: close\r\n";
+    }
+    io_client.out += "HTTP/1.1 " + status + "\r\n" + extra + "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    if (!head)
+    {
+      io_client.out += body;
+    }
+  }
+
+  /**
+   * @brief Handle every whole request a client has sent
+   */
+  void handleRequests(Server &io_server, Client &io_client)
+  {
+    size_t end;
+    while (!io_client.closing && (end = io_client.in.find("\r\n\r\n")) != std::string::npos)
+    {
+      std::string request = io_client.in.substr(0, end + 2);
+      io_client.in.erase(0, end + 4);
+
+      size_t lineEnd = request.find("\r\n");
+      std::string line = request.substr(0, lineEnd);
+      std::string headers = request.substr(lineEnd + 1);
+      std::transform(headers.begin(), headers.end(), headers.begin(), [](unsigned char _c) {
+        return static_cast<char>(std::tolower(_c));
+      });
+
+      size_t space = line.find(' ');
+      size_t space2 = line.find(' ', space + 1);
+      std::string method = line.substr(0, space);
+      std::string path = space == std::string::npos ? "/" : line.substr(space + 1, space2 - space - 1);
+      respond(io_server, io_client, method, path, headers);
+      if (space2 != std::string::npos && line.compare(space2 + 1, std::string::npos, "HTTP/1.0") == 0)
+      {
+        io_client.closing = true;
+      }
+    }
+  }
+} // end namespace
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    std::fprintf(stderr, "Usage: TileServer <baked_file> [port] [--max-requests=N]\n");
+    return EXIT_FAILURE;
+  }
+
+  Server server;
+  int port = 0;
+  for (int i = 2; i < argc; i++)
+  {
+    std::string option(argv[i]);
+    if (option.compare(0, 15, "--max-requests=") == 0)
+    {
+      server.maxRequests = std::atol(option.c_str() + 15);
+    }
+    else
+    {
+      port = std::atoi(option.c_str());
+    }
+  }
+
+  server.file = ::open(argv[1], O_RDONLY);
+  struct stat info;
+  if (server.file < 0 || ::fstat(server.file, &info) != 0)
+  {
+    std::fprintf(stderr, "Couldn't open %s\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  server.size = static_cast<uint64_t>(info.st_size);
+  // Rebaking the file changes its modification time, to the nanosecond where the platform has it
+#ifdef __linux__
+  long nanoseconds = info.st_mtim.tv_nsec;
+#else
+  long nanoseconds = 0;
+#endif
+  server.etag = "\"" + std::to_string(info.st_size) + "-" + std::to_string(info.st_mtime) + "." + std::to_string(nanoseconds) + "\"";
+
+  // Clients that hang up shouldn't kill the server
+  std::signal(SIGPIPE, SIG_IGN);
+
+  int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  ::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(static_cast<uint16_t>(port));
+  socklen_t length = sizeof(address);
+  if (::bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || ::listen(listener, 128) != 0 ||
+      ::getsockname(listener, reinterpret_cast<sockaddr *>(&address), &length) != 0)
+  {
+    std::fprintf(stderr, "Couldn't listen on port %d\n", port);
+    return EXIT_FAILURE;
+  }
+  std::printf("Listening on port %d\n", ntohs(address.sin_port));
+  std::fflush(stdout);
+
+  std::vector<Client> clients;
+  std::vector<pollfd> polls;
+  char buffer[64 * 1024];
+  while (true)
+  {
+    polls.assign(1, pollfd{listener, POLLIN, 0});
+    for (const auto &client : clients)
+    {
+      polls.push_back(pollfd{client.socket, static_cast<short>(client.out.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+    }
+    if (::poll(polls.data(), polls.size(), -1) < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return EXIT_FAILURE;
+    }
+
+    // Go backwards through the clients so closing one doesn't move the ones still to do
+    for (size_t i = clients.size(); i-- > 0;)
+    {
+      Client &client = clients[i];
+      short events = polls[i + 1].revents;
+      bool open = true;
+      if (events & (POLLIN | POLLHUP | POLLERR))
+      {
+        ssize_t received = ::recv(client.socket, buffer, sizeof(buffer), 0);
+        if (received > 0)
+        {
+          client.in.append(buffer, static_cast<size_t>(received));
+          handleRequests(server, client);
+        }
+        else if (received == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+          open = false;
+        }
+      }
+      if (open && !client.out.empty() && (events & POLLOUT))
+      {
+        ssize_t sent = ::send(client.socket, client.out.data(), client.out.size(), 0);
+        if (sent > 0)
+        {
+          client.out.erase(0, static_cast<size_t>(sent));
+        }
+        else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+          open = false;
+        }
+      }
+      if (!open || (client.closing && client.out.empty()))
+      {
+        ::close(client.socket);
+        clients.erase(clients.begin() + static_cast<std::ptrdiff_t>(i));
+      }
+    }
+
+    if (polls[0].revents & POLLIN)
+    {
+      int socket = ::accept(listener, nullptr, nullptr);
+      if (socket >= 0)
+      {
+        ::fcntl(socket, F_SETFL, ::fcntl(socket, F_GETFL) | O_NONBLOCK);
+        clients.emplace_back();
+        clients.back().socket = socket;
+        server.connections++;
+      }
+    }
+  }
+}